@@ -0,0 +1,623 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "fakempd.h"
+#include "bench.h"
+
+
+
+
+#define BAR_BINARY_DEFAULT      "../src/mpd-fnscroller"
+#define BAR_BLOCKS_DIR_DEFAULT  "../sparse/usr/share/i3blocks"
+#define BAR_RUNTIME_DIR         "/tmp/" PROGNAME "_bar_XXXXXX"
+#define BAR_BIN_DIR_NAME        "bin"
+#define BAR_DURATION_DEFAULT    60
+#define BAR_SONG_PERIOD_DEFAULT 60
+#define BAR_CLICKS_DEFAULT      60
+#define BAR_HOUR_MS             3600000ULL
+#define BAR_SIGNAL              12
+#define BAR_INSTANCE            "16"
+#define BAR_STARTUP_TIMEOUT     5000
+#define BAR_STARTUP_POLL        10
+#define BAR_IDLE_PLAYER         (1 << 3)
+#define BAR_LINE_SIZE           256
+#define BAR_NEVER               ULLONG_MAX
+
+
+bool debug = false;
+
+// Ways the frames get to the bar: the mpd block polled every second, the same
+// asking for JSON, or run once and then on the signal of the server (-i)
+enum bar_mode
+{
+    BAR_MODE_INTERVAL,
+    BAR_MODE_JSON,
+    BAR_MODE_SIGNAL,
+    BAR_MODE_COUNT
+};
+
+// Block of the i3blocks config in the README. Interval is in seconds, 0 is
+// "once"; refresh is the signal the block script sends to i3blocks
+struct bar_block
+{
+    const char         *name;
+    unsigned int       interval;
+    unsigned int       signal;
+    unsigned int       refresh;
+    bool               clickable;
+
+    pid_t              pid;
+    unsigned long long next_time;
+};
+
+// Figures of the whole setup over the run: the blocks with everything they
+// spawn and the server, CPU in seconds
+struct bar_usage
+{
+    double             cpu;
+    double             server_cpu;
+    unsigned long long switches;
+    unsigned long long wakeups;
+    unsigned long long forks;
+};
+
+struct bar
+{
+    struct fakempd     mpd;
+    char               binary[PATH_MAX];
+    const char         *blocks_dir;
+    char               runtime_dir[sizeof(BAR_RUNTIME_DIR)];
+    char               bin_dir[sizeof(BAR_RUNTIME_DIR) +
+                               sizeof(BAR_BIN_DIR_NAME)];
+    char               link_path[sizeof(BAR_RUNTIME_DIR) +
+                                 sizeof(BAR_BIN_DIR_NAME) + sizeof(PROGNAME)];
+    char               sockfile_path[SUN_PATH_STRING_SIZE];
+    pid_t              server_pid;
+    struct rusage      server_usage;
+    sigset_t           signals;
+
+    struct bar_block   blocks[8];
+    unsigned int       blocks_count;
+    unsigned int       clicks;
+    unsigned int       songs;
+};
+
+static const char *const bar_mode_names[BAR_MODE_COUNT] =
+{
+    "interval", "json", "signal"
+};
+
+static const struct bar_block bar_blocks[] =
+{
+    {"mpd-shuffle", 4, 0, 0, true, 0, 0},
+    {"mpd-repeat", 4, 0, 0, true, 0, 0},
+    {"mpd-playpause", 1, 0, 0, true, 0, 0},
+    {"mpd", 1, BAR_SIGNAL, 0, false, 0, 0},
+    {"mpd-prevbutton", 0, 0, BAR_SIGNAL, true, 0, 0},
+    {"mpd-nextbutton", 0, 0, BAR_SIGNAL, true, 0, 0}
+};
+
+
+static enum mpd_fnscroller_result bar_setup(struct bar *bar,
+                                            const char *binary);
+static void bar_teardown(struct bar *bar);
+static enum mpd_fnscroller_result bar_server_start(struct bar *bar,
+                                                   enum bar_mode mode);
+static void bar_server_stop(struct bar *bar);
+static void bar_run(struct bar *bar, enum bar_mode mode,
+                    unsigned long long duration_ms,
+                    unsigned long long song_period_ms,
+                    unsigned long long click_period_ms);
+static void bar_block_run(struct bar *bar, struct bar_block *block,
+                          enum bar_mode mode, bool click);
+static void bar_blocks_reap(struct bar *bar, int options);
+static void bar_signal_deliver(struct bar *bar, unsigned int signal,
+                               unsigned long long now);
+static unsigned long long bar_forks_get(void);
+static unsigned long long bar_time_get(void);
+static double bar_cpu_get(const struct rusage *usage);
+
+
+// Emulates i3blocks running the shipped blocks against a stand-in MPD for
+// each way of delivering the frames, and reports what the whole setup costs
+// per hour: the block scripts, mpc, awk and the clients they spawn, and the
+// server
+int main(int argc, char **argv)
+{
+    struct bar         bar;
+    const char         *binary = BAR_BINARY_DEFAULT;
+    unsigned long long duration = BAR_DURATION_DEFAULT;
+    unsigned long long song_period = BAR_SONG_PERIOD_DEFAULT;
+    unsigned long long clicks = BAR_CLICKS_DEFAULT;
+    int                option = 0;
+    unsigned int       mode = 0;
+
+    memset(&bar, 0, sizeof(bar));
+    bar.blocks_dir = BAR_BLOCKS_DIR_DEFAULT;
+
+    while ((option = getopt(argc, argv, "b:B:t:s:k:")) != -1)
+    {
+        switch (option)
+        {
+            case 'b':
+                binary = optarg;
+                break;
+
+            case 'B':
+                bar.blocks_dir = optarg;
+                break;
+
+            case 't':
+                duration = strtoull(optarg, NULL, DEC);
+                break;
+
+            case 's':
+                song_period = strtoull(optarg, NULL, DEC);
+                break;
+
+            case 'k':
+                clicks = strtoull(optarg, NULL, DEC);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-b <binary>] [-B <blocks dir>] "
+                        "[-t <seconds>] [-s <song seconds>] "
+                        "[-k <clicks per hour>]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if ((duration == 0) || (song_period == 0))
+    {
+        fprintf(stderr, "Duration and song period must not be 0\n");
+        return EXIT_FAILURE;
+    }
+
+// Refresh signal and the exits of the blocks are taken synchronously, the
+// children get them unblocked
+    sigemptyset(&bar.signals);
+    sigaddset(&bar.signals, SIGRTMIN + BAR_SIGNAL);
+    sigaddset(&bar.signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &bar.signals, NULL);
+
+    if (!fakempd_start(&bar.mpd))
+    {
+        fprintf(stderr, "Could not start stand-in MPD\n");
+        return EXIT_FAILURE;
+    }
+    fakempd_song_set(&bar.mpd, FAKEMPD_STATE_PLAY, bench_corpus[0].string);
+
+    if (!bar_setup(&bar, binary))
+    {
+        bar_teardown(&bar);
+        fakempd_stop(&bar.mpd);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s%10s%10s%12s%12s%10s\n", "mode", "CPU s/h", "server",
+           "switches/h", "wakeups/h", "forks/h");
+    for (mode = 0; mode < BAR_MODE_COUNT; ++mode)
+    {
+        bar_run(&bar, mode, duration * 1000, song_period * 1000,
+                (clicks) ? BAR_HOUR_MS / clicks : BAR_NEVER);
+    }
+
+    bar_teardown(&bar);
+    fakempd_stop(&bar.mpd);
+
+    return EXIT_SUCCESS;
+};
+
+
+// Scripts find mpd-fnscroller on the PATH, as installed, and mpc is pointed
+// to the stand-in MPD
+static enum mpd_fnscroller_result bar_setup(struct bar *bar,
+                                            const char *binary)
+{
+    char path[PATH_MAX + PATH_STRING_SIZE];
+    char port[PID_STRING_SIZE];
+
+    if (realpath(binary, bar->binary) == NULL)
+    {
+        perror(binary);
+        return RESULT_ERROR;
+    }
+    strcpy(bar->runtime_dir, BAR_RUNTIME_DIR);
+    if (mkdtemp(bar->runtime_dir) == NULL)
+    {
+        perror("Could not create runtime directory");
+        return RESULT_ERROR;
+    }
+    snprintf(bar->bin_dir, sizeof(bar->bin_dir), "%s/" BAR_BIN_DIR_NAME,
+             bar->runtime_dir);
+    snprintf(bar->link_path, sizeof(bar->link_path), "%s/" PROGNAME,
+             bar->bin_dir);
+    snprintf(bar->sockfile_path, SUN_PATH_STRING_SIZE, "%s/" PROGNAME
+             "/" SOCKFILE_NAME, bar->runtime_dir);
+    if ((mkdir(bar->bin_dir, 0700) == -1) ||
+        (symlink(bar->binary, bar->link_path) == -1))
+    {
+        perror("Could not link the binary");
+        return RESULT_ERROR;
+    }
+
+    snprintf(path, sizeof(path), "%s:%s", bar->bin_dir,
+             (getenv("PATH")) ? getenv("PATH") : "/usr/bin:/bin");
+    snprintf(port, PID_STRING_SIZE, "%hu", bar->mpd.port);
+    setenv("PATH", path, 1);
+    setenv("XDG_RUNTIME_DIR", bar->runtime_dir, 1);
+    setenv("MPD_HOST", "127.0.0.1", 1);
+    setenv("MPD_PORT", port, 1);
+
+    return RESULT_SUCCESS;
+};
+
+// Server leaves the snapshot in the runtime directory, the clients may leave
+// the PID of the bar
+static void bar_teardown(struct bar *bar)
+{
+    char path[sizeof(BAR_RUNTIME_DIR) + sizeof(PROGNAME) +
+              sizeof(SNAPSHOTFILE_NAME)];
+
+    if (bar->runtime_dir[0] == '\0')
+    {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/" PROGNAME "/" SNAPSHOTFILE_NAME,
+             bar->runtime_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/" PROGNAME "/" BAR_PIDFILE_NAME,
+             bar->runtime_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/" PROGNAME, bar->runtime_dir);
+    rmdir(path);
+    unlink(bar->link_path);
+    rmdir(bar->bin_dir);
+    rmdir(bar->runtime_dir);
+
+    return;
+};
+
+static enum mpd_fnscroller_result bar_server_start(struct bar *bar,
+                                                   enum bar_mode mode)
+{
+    struct stat  sockfile_stat;
+    char         mpd_address[HOSTNAME_STRING_SIZE + 8];
+    char         signal_string[PID_STRING_SIZE];
+    char         pid_string[PID_STRING_SIZE];
+    unsigned int waited = 0;
+
+    snprintf(mpd_address, sizeof(mpd_address), "127.0.0.1:%hu",
+             bar->mpd.port);
+    snprintf(signal_string, PID_STRING_SIZE, "%d", BAR_SIGNAL);
+    snprintf(pid_string, PID_STRING_SIZE, "%d", getpid());
+
+    bar->server_pid = fork();
+    if (bar->server_pid == -1)
+    {
+        perror("Could not fork");
+        return RESULT_ERROR;
+    }
+    if (bar->server_pid == 0)
+    {
+        sigprocmask(SIG_UNBLOCK, &bar->signals, NULL);
+        if (mode == BAR_MODE_SIGNAL)
+        {
+            execl(bar->binary, bar->binary, "-n", "-s", mpd_address, "-i",
+                  signal_string, "-I", pid_string, (char *)NULL);
+        }
+        else
+        {
+            execl(bar->binary, bar->binary, "-n", "-s", mpd_address,
+                  (char *)NULL);
+        }
+        perror(bar->binary);
+        _exit(EXIT_FAILURE);
+    }
+
+    while (stat(bar->sockfile_path, &sockfile_stat) == -1)
+    {
+        if ((waited >= BAR_STARTUP_TIMEOUT) ||
+            (waitpid(bar->server_pid, NULL, WNOHANG) != 0))
+        {
+            fprintf(stderr, "Server did not start\n");
+            bar_server_stop(bar);
+            return RESULT_ERROR;
+        }
+        usleep(BAR_STARTUP_POLL * 1000);
+        waited += BAR_STARTUP_POLL;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Usage of the server on its own is taken when it is reaped
+static void bar_server_stop(struct bar *bar)
+{
+    memset(&bar->server_usage, 0, sizeof(bar->server_usage));
+    if (bar->server_pid > 0)
+    {
+        kill(bar->server_pid, SIGUSR1);
+        wait4(bar->server_pid, NULL, 0, &bar->server_usage);
+        bar->server_pid = 0;
+    }
+
+    return;
+};
+
+// One run of the bar: the blocks are run on their intervals, on the refresh
+// signal and on the clicks (spread over the clickable blocks in turn), the
+// song is changed every song period. The usage of the children is taken once
+// all of them are reaped.
+static void bar_run(struct bar *bar, enum bar_mode mode,
+                    unsigned long long duration_ms,
+                    unsigned long long song_period_ms,
+                    unsigned long long click_period_ms)
+{
+    struct bar_block   *block;
+    struct bar_usage   usage;
+    struct rusage      before;
+    struct rusage      after;
+    struct timespec    timeout;
+    unsigned long long forks = bar_forks_get();
+    unsigned long long start = 0;
+    unsigned long long now = 0;
+    unsigned long long next = 0;
+    unsigned long long song_time = 0;
+    unsigned long long click_time = 0;
+    double             scale = (double)BAR_HOUR_MS / duration_ms;
+    unsigned int       i = 0;
+    int                received = 0;
+
+    getrusage(RUSAGE_CHILDREN, &before);
+    if (!bar_server_start(bar, mode))
+    {
+        return;
+    }
+
+    bar->blocks_count = sizeof(bar_blocks) / sizeof(bar_blocks[0]);
+    memcpy(bar->blocks, bar_blocks, sizeof(bar_blocks));
+    if (mode == BAR_MODE_SIGNAL)
+    {
+        for (i = 0; i < bar->blocks_count; ++i)
+        {
+            if (bar->blocks[i].signal == BAR_SIGNAL)
+            {
+                bar->blocks[i].interval = 0;
+            }
+        }
+    }
+
+    start = bar_time_get();
+    song_time = start + song_period_ms;
+    click_time = (click_period_ms == BAR_NEVER) ? BAR_NEVER :
+                 start + click_period_ms;
+    for (i = 0; i < bar->blocks_count; ++i)
+    {
+        bar->blocks[i].next_time = start;
+    }
+
+    for (now = start; now < start + duration_ms; now = bar_time_get())
+    {
+        bar_blocks_reap(bar, WNOHANG);
+
+        if (now >= song_time)
+        {
+            fakempd_song_set(&bar->mpd, FAKEMPD_STATE_PLAY,
+                             bench_corpus[++bar->songs %
+                                          bench_corpus_size].string);
+            fakempd_idle_emit(&bar->mpd, BAR_IDLE_PLAYER);
+            song_time += song_period_ms;
+        }
+        if (now >= click_time)
+        {
+            do
+            {
+                block = &bar->blocks[bar->clicks++ % bar->blocks_count];
+            }
+            while (!block->clickable);
+            if (!block->pid)
+            {
+                bar_block_run(bar, block, mode, true);
+            }
+            if (block->refresh)
+            {
+                bar_signal_deliver(bar, block->refresh, now);
+            }
+            click_time += click_period_ms;
+        }
+
+        next = start + duration_ms;
+        next = (song_time < next) ? song_time : next;
+        next = (click_time < next) ? click_time : next;
+        for (i = 0; i < bar->blocks_count; ++i)
+        {
+            block = &bar->blocks[i];
+            if ((!block->pid) && (block->next_time <= now))
+            {
+                bar_block_run(bar, block, mode, false);
+                block->next_time = (block->interval) ?
+                                   now + block->interval * 1000 : BAR_NEVER;
+            }
+            next = (block->next_time < next) ? block->next_time : next;
+        }
+
+        now = bar_time_get();
+        next = (next > now) ? next - now : 0;
+        timeout.tv_sec = next / 1000;
+        timeout.tv_nsec = (next % 1000) * 1000000;
+        received = sigtimedwait(&bar->signals, NULL, &timeout);
+        if (received == SIGRTMIN + BAR_SIGNAL)
+        {
+            bar_signal_deliver(bar, BAR_SIGNAL, bar_time_get());
+        }
+    }
+
+    bar_server_stop(bar);
+    bar_blocks_reap(bar, 0);
+    getrusage(RUSAGE_CHILDREN, &after);
+
+    usage.cpu = (bar_cpu_get(&after) - bar_cpu_get(&before)) * scale;
+    usage.server_cpu = bar_cpu_get(&bar->server_usage) * scale;
+    usage.wakeups = (after.ru_nvcsw - before.ru_nvcsw) * scale;
+    usage.switches = usage.wakeups +
+                     (after.ru_nivcsw - before.ru_nivcsw) * scale;
+    usage.forks = (bar_forks_get() - forks) * scale;
+
+    printf("%-10s%10.2f%10.2f%12llu%12llu%10llu\n", bar_mode_names[mode],
+           usage.cpu, usage.server_cpu, usage.switches, usage.wakeups,
+           usage.forks);
+    fflush(stdout);
+
+    return;
+};
+
+// Blocks are run the way i3blocks runs them: through "sh -c", with the block
+// properties in the environment; the output is discarded
+static void bar_block_run(struct bar *bar, struct bar_block *block,
+                          enum bar_mode mode, bool click)
+{
+    char path[PATH_STRING_SIZE];
+    int  null_fd = 0;
+
+    snprintf(path, PATH_STRING_SIZE, "%s/%s", bar->blocks_dir, block->name);
+
+    block->pid = fork();
+    if (block->pid == -1)
+    {
+        block->pid = 0;
+        return;
+    }
+    if (block->pid)
+    {
+        return;
+    }
+
+    sigprocmask(SIG_UNBLOCK, &bar->signals, NULL);
+    null_fd = open("/dev/null", O_RDWR);
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    setenv("BLOCK_NAME", block->name, 1);
+    if (block->signal == BAR_SIGNAL)
+    {
+        setenv("BLOCK_INSTANCE", BAR_INSTANCE, 1);
+        if (mode == BAR_MODE_JSON)
+        {
+            setenv("format", "json", 1);
+        }
+    }
+    if (click)
+    {
+        setenv("BLOCK_BUTTON", "1", 1);
+    }
+    execl("/bin/sh", "sh", "-c", path, (char *)NULL);
+    _exit(EXIT_FAILURE);
+};
+
+static void bar_blocks_reap(struct bar *bar, int options)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < bar->blocks_count; ++i)
+    {
+        if ((bar->blocks[i].pid) &&
+            (waitpid(bar->blocks[i].pid, NULL, options) != 0))
+        {
+            bar->blocks[i].pid = 0;
+        }
+    }
+
+    return;
+};
+
+// Blocks listening to the signal are run on the next pass
+static void bar_signal_deliver(struct bar *bar, unsigned int signal,
+                               unsigned long long now)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < bar->blocks_count; ++i)
+    {
+        if (bar->blocks[i].signal == signal)
+        {
+            bar->blocks[i].next_time = now;
+        }
+    }
+
+    return;
+};
+
+// Processes created system-wide: the benchmark is meant for a quiet machine
+static unsigned long long bar_forks_get(void)
+{
+    FILE               *file = NULL;
+    char               line[BAR_LINE_SIZE];
+    unsigned long long forks = 0;
+
+    file = fopen("/proc/stat", "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    while (fgets(line, BAR_LINE_SIZE, file))
+    {
+        if (strncmp(line, "processes ", strlen("processes ")) == 0)
+        {
+            forks = strtoull(line + strlen("processes "), NULL, DEC);
+            break;
+        }
+    }
+    fclose(file);
+
+    return forks;
+};
+
+static unsigned long long bar_time_get(void)
+{
+    return bench_time_get() / 1000000;
+};
+
+static double bar_cpu_get(const struct rusage *usage)
+{
+    return usage->ru_utime.tv_sec + usage->ru_stime.tv_sec +
+           (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1000000.0;
+};
@@ -0,0 +1,104 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+
+
+
+// Allocations are counted by wrapping the allocator at link time
+// (-Wl,--wrap=malloc,...), so the code under test is left untouched
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+static atomic_ullong allocations_count = 0;
+static atomic_ullong allocations_bytes = 0;
+
+const struct bench_title bench_corpus[] =
+{
+    {"ascii", "Pink Floyd - Shine On You Crazy Diamond (Parts I-V).flac"},
+    {"short", "intro.mp3"},
+    {"cyrillic", "Кино - Звезда по имени Солнце (Ремастер 2019, "
+                 "Концертная версия).flac"},
+    {"cjk", "坂本龍一 - 戦場のメリークリスマス (ライブ録音 東京 1996).flac"},
+    {"emoji", "🎸🔥 Rock Anthems Megamix 🎤🎶 Vol. 3 🚀✨.ogg"},
+    {"long", "Various Artists - The Complete Collection of Extremely Long "
+             "Track Names Which Never Fit Into Any Status Bar Block No "
+             "Matter How Wide It Is Configured, Remastered Deluxe Edition "
+             "With Bonus Tracks And Alternate Takes (Disc 1 of 12) - "
+             "Track 01.flac"}
+};
+const unsigned int       bench_corpus_size = sizeof(bench_corpus) /
+                                             sizeof(bench_corpus[0]);
+
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&allocations_bytes, size, memory_order_relaxed);
+
+    return __real_malloc(size);
+};
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&allocations_bytes, count * size,
+                              memory_order_relaxed);
+
+    return __real_calloc(count, size);
+};
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&allocations_bytes, size, memory_order_relaxed);
+
+    return __real_realloc(pointer, size);
+};
+
+
+// Nanoseconds of CLOCK_MONOTONIC
+unsigned long long bench_time_get(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+};
+
+void bench_allocations_get(struct bench_allocations *allocations)
+{
+    allocations->count = atomic_load(&allocations_count);
+    allocations->bytes = atomic_load(&allocations_bytes);
+
+    return;
+};
@@ -0,0 +1,61 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef BENCH_H
+#define BENCH_H
+
+
+#include <stddef.h>
+
+
+
+
+#define BENCH_TITLE_STRING_SIZE 32
+
+
+// Title corpus shared by the benchmarks: ASCII, Cyrillic, CJK, emoji and
+// very long names
+struct bench_title
+{
+    const char *name;
+    const char *string;
+};
+
+struct bench_allocations
+{
+    unsigned long long count;
+    unsigned long long bytes;
+};
+
+
+extern const struct bench_title bench_corpus[];
+extern const unsigned int       bench_corpus_size;
+
+
+unsigned long long bench_time_get(void);
+void bench_allocations_get(struct bench_allocations *allocations);
+
+
+#endif /* BENCH_H */
@@ -0,0 +1,545 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "fakempd.h"
+
+
+
+
+static const char *const fakempd_idle_names[] =
+{
+    "database", "stored_playlist", "playlist", "player", "mixer", "output",
+    "options", NULL
+};
+
+
+static void *fakempd_serve(void *arg);
+static void fakempd_accept(struct fakempd *mpd);
+static void fakempd_client_read(struct fakempd *mpd,
+                                struct fakempd_client *client);
+static void fakempd_line_handle(struct fakempd *mpd,
+                                struct fakempd_client *client, char *line);
+static size_t fakempd_command_execute(struct fakempd *mpd, const char *command,
+                                      char *output, size_t size);
+static void fakempd_events_deliver(struct fakempd *mpd);
+static void fakempd_client_send(struct fakempd_client *client,
+                                const char *output, size_t length);
+static void fakempd_client_close(struct fakempd_client *client);
+static unsigned int fakempd_idle_mask_parse(const char *names);
+static void fakempd_wakeup(struct fakempd *mpd);
+
+
+enum mpd_fnscroller_result fakempd_start(struct fakempd *mpd)
+{
+    struct sockaddr_in address;
+    socklen_t          address_length = sizeof(address);
+    unsigned int       i = 0;
+
+    memset(mpd, 0, sizeof(*mpd));
+    mpd->state = FAKEMPD_STATE_STOP;
+    for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+    {
+        mpd->clients[i].sock = -1;
+    }
+
+    mpd->sock_listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (mpd->sock_listener == -1)
+    {
+        return RESULT_ERROR;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    if ((bind(mpd->sock_listener, (struct sockaddr *)&address,
+              sizeof(address)) == -1) ||
+        (listen(mpd->sock_listener, FAKEMPD_CLIENTS_MAX) == -1) ||
+        (getsockname(mpd->sock_listener, (struct sockaddr *)&address,
+                     &address_length) == -1) ||
+        (pipe(mpd->wakeup) == -1))
+    {
+        close(mpd->sock_listener);
+        return RESULT_ERROR;
+    }
+    mpd->port = ntohs(address.sin_port);
+
+    pthread_mutex_init(&mpd->lock, NULL);
+    mpd->running = true;
+    if (pthread_create(&mpd->thread_id, NULL, fakempd_serve, mpd))
+    {
+        close(mpd->sock_listener);
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+void fakempd_stop(struct fakempd *mpd)
+{
+    unsigned int i = 0;
+
+    mpd->running = false;
+    fakempd_wakeup(mpd);
+    pthread_join(mpd->thread_id, NULL);
+
+    for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+    {
+        fakempd_client_close(&mpd->clients[i]);
+    }
+    close(mpd->sock_listener);
+    close(mpd->wakeup[0]);
+    close(mpd->wakeup[1]);
+    pthread_mutex_destroy(&mpd->lock);
+
+    return;
+};
+
+void fakempd_song_set(struct fakempd *mpd, unsigned int state,
+                      const char *uri)
+{
+    pthread_mutex_lock(&mpd->lock);
+    mpd->state = state;
+    if ((uri) && (strcmp(uri, mpd->uri)))
+    {
+        snprintf(mpd->uri, FILENAME_STRING_SIZE, "%s", uri);
+        ++mpd->song_id;
+        mpd->elapsed_ms = 0;
+    }
+    pthread_mutex_unlock(&mpd->lock);
+
+    return;
+};
+
+// Event is queued for every connected client, as MPD does it, and delivered
+// to the ones which are idle and interested in it
+void fakempd_idle_emit(struct fakempd *mpd, unsigned int idle_mask)
+{
+    unsigned int i = 0;
+
+    pthread_mutex_lock(&mpd->lock);
+    for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+    {
+        if (mpd->clients[i].sock != -1)
+        {
+            mpd->clients[i].pending_events |= idle_mask;
+        }
+    }
+    pthread_mutex_unlock(&mpd->lock);
+
+    fakempd_wakeup(mpd);
+
+    return;
+};
+
+
+static void *fakempd_serve(void *arg)
+{
+    struct fakempd *mpd = arg;
+    struct pollfd  pollfds[FAKEMPD_CLIENTS_MAX + 2];
+    char           buffer[FAKEMPD_LINE_SIZE];
+    unsigned int   i = 0;
+
+    while (mpd->running)
+    {
+        pollfds[0].fd = mpd->sock_listener;
+        pollfds[0].events = POLLIN;
+        pollfds[1].fd = mpd->wakeup[0];
+        pollfds[1].events = POLLIN;
+        for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+        {
+            pollfds[i + 2].fd = mpd->clients[i].sock;
+            pollfds[i + 2].events = POLLIN;
+        }
+
+        if (poll(pollfds, FAKEMPD_CLIENTS_MAX + 2, -1) == -1)
+        {
+            continue;
+        }
+
+        if ((pollfds[1].revents & POLLIN) &&
+            (read(mpd->wakeup[0], buffer, FAKEMPD_LINE_SIZE) <= 0))
+        {
+            break;
+        }
+        if (pollfds[0].revents & POLLIN)
+        {
+            fakempd_accept(mpd);
+        }
+        for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+        {
+            if ((mpd->clients[i].sock != -1) &&
+                (pollfds[i + 2].fd == mpd->clients[i].sock) &&
+                (pollfds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                fakempd_client_read(mpd, &mpd->clients[i]);
+            }
+        }
+
+        fakempd_events_deliver(mpd);
+    }
+
+    return NULL;
+};
+
+static void fakempd_accept(struct fakempd *mpd)
+{
+    struct fakempd_client *client = NULL;
+    unsigned int          i = 0;
+    int                   sock = 0;
+
+    sock = accept(mpd->sock_listener, NULL, NULL);
+    if (sock == -1)
+    {
+        return;
+    }
+
+    for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+    {
+        if (mpd->clients[i].sock == -1)
+        {
+            client = &mpd->clients[i];
+            break;
+        }
+    }
+    if (client == NULL)
+    {
+        close(sock);
+        return;
+    }
+
+    pthread_mutex_lock(&mpd->lock);
+    memset(client, 0, sizeof(*client));
+    client->sock = sock;
+    pthread_mutex_unlock(&mpd->lock);
+
+    fakempd_client_send(client, FAKEMPD_GREETING, strlen(FAKEMPD_GREETING));
+
+    return;
+};
+
+static void fakempd_client_read(struct fakempd *mpd,
+                                struct fakempd_client *client)
+{
+    ssize_t bytes_received = 0;
+    char    *newline = NULL;
+
+    bytes_received = recv(client->sock, client->line + client->line_length,
+                          FAKEMPD_LINE_SIZE - 1 - client->line_length, 0);
+    if (bytes_received <= 0)
+    {
+        pthread_mutex_lock(&mpd->lock);
+        fakempd_client_close(client);
+        pthread_mutex_unlock(&mpd->lock);
+        return;
+    }
+    client->line_length += bytes_received;
+    client->line[client->line_length] = '\0';
+
+    while ((client->sock != -1) &&
+           ((newline = strchr(client->line, '\n')) != NULL))
+    {
+        *newline = '\0';
+
+        pthread_mutex_lock(&mpd->lock);
+        fakempd_line_handle(mpd, client, client->line);
+        pthread_mutex_unlock(&mpd->lock);
+
+        if (client->sock == -1)
+        {
+            return;
+        }
+        client->line_length -= newline + 1 - client->line;
+        memmove(client->line, newline + 1, client->line_length + 1);
+    }
+
+    if (client->line_length == FAKEMPD_LINE_SIZE - 1)
+    {
+        fakempd_client_close(client);
+    }
+
+    return;
+};
+
+// Called with the lock held
+static void fakempd_line_handle(struct fakempd *mpd,
+                                struct fakempd_client *client, char *line)
+{
+    char         output[FAKEMPD_OUTPUT_SIZE];
+    size_t       length = 0;
+    unsigned int i = 0;
+
+    if (client->command_list)
+    {
+        if (strcmp(line, "command_list_end"))
+        {
+            if (client->commands_count < FAKEMPD_COMMANDS_MAX)
+            {
+                snprintf(client->commands[client->commands_count++],
+                         FAKEMPD_LINE_SIZE, "%s", line);
+            }
+            return;
+        }
+
+        for (i = 0; i < client->commands_count; ++i)
+        {
+            length += fakempd_command_execute(mpd, client->commands[i],
+                                              output + length,
+                                              FAKEMPD_OUTPUT_SIZE - length);
+            if ((client->command_list_ok) &&
+                (FAKEMPD_OUTPUT_SIZE - length > sizeof("list_OK\n")))
+            {
+                length += sprintf(output + length, "list_OK\n");
+            }
+        }
+        client->command_list = false;
+        length += snprintf(output + length, FAKEMPD_OUTPUT_SIZE - length,
+                           "OK\n");
+        fakempd_client_send(client, output, length);
+
+        return;
+    }
+
+    if ((!strcmp(line, "command_list_begin")) ||
+        (!strcmp(line, "command_list_ok_begin")))
+    {
+        client->command_list = true;
+        client->command_list_ok = (strcmp(line, "command_list_ok_begin") == 0);
+        client->commands_count = 0;
+    }
+    else if (!strncmp(line, "idle", strlen("idle")))
+    {
+        client->idle = true;
+        client->idle_mask = fakempd_idle_mask_parse(line + strlen("idle"));
+    }
+    else if (!strcmp(line, "noidle"))
+    {
+        if (client->idle)
+        {
+            client->idle = false;
+            fakempd_client_send(client, "OK\n", strlen("OK\n"));
+        }
+    }
+    else if (!strcmp(line, "close"))
+    {
+        fakempd_client_close(client);
+    }
+    else
+    {
+        length = fakempd_command_execute(mpd, line, output,
+                                         FAKEMPD_OUTPUT_SIZE);
+        length += snprintf(output + length, FAKEMPD_OUTPUT_SIZE - length,
+                           "OK\n");
+        fakempd_client_send(client, output, length);
+    }
+
+    return;
+};
+
+// Called with the lock held. Playback commands of mpc are emulated just as
+// far as the events they cause go.
+static size_t fakempd_command_execute(struct fakempd *mpd, const char *command,
+                                      char *output, size_t size)
+{
+    static const char *const states[] = {"unknown", "stop", "play", "pause"};
+    unsigned int             i = 0;
+    int                      length = 0;
+
+    ++mpd->commands_served;
+
+    if (!strcmp(command, "status"))
+    {
+        length = snprintf(output, size, "volume: 50\nrepeat: %d\nrandom: %d\n"
+                          "single: 0\nconsume: 0\nplaylist: 2\n"
+                          "playlistlength: 1\nstate: %s\n", mpd->repeat,
+                          mpd->random, states[mpd->state & 3]);
+        if (mpd->state != FAKEMPD_STATE_STOP)
+        {
+            length += snprintf(output + length, size - length, "song: 0\n"
+                               "songid: %u\nelapsed: %u.%03u\n"
+                               "duration: %u.%03u\n", mpd->song_id,
+                               mpd->elapsed_ms / 1000, mpd->elapsed_ms % 1000,
+                               mpd->duration_ms / 1000,
+                               mpd->duration_ms % 1000);
+        }
+    }
+    else if (!strcmp(command, "currentsong"))
+    {
+        if (mpd->state != FAKEMPD_STATE_STOP)
+        {
+            length = snprintf(output, size, "file: %s\nPos: 0\nId: %u\n",
+                              mpd->uri, mpd->song_id);
+        }
+    }
+    else if ((!strcmp(command, "next")) || (!strcmp(command, "previous")))
+    {
+        ++mpd->song_id;
+        for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+        {
+            mpd->clients[i].pending_events |= 1 << 3;
+        }
+    }
+    else if ((!strncmp(command, "pause", strlen("pause"))) ||
+             (!strncmp(command, "play", strlen("play"))) ||
+             (!strcmp(command, "stop")))
+    {
+        mpd->state = (!strcmp(command, "stop")) ? FAKEMPD_STATE_STOP :
+                     (mpd->state == FAKEMPD_STATE_PLAY) ?
+                     FAKEMPD_STATE_PAUSE : FAKEMPD_STATE_PLAY;
+        for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+        {
+            mpd->clients[i].pending_events |= 1 << 3;
+        }
+    }
+    else if ((!strncmp(command, "repeat", strlen("repeat"))) ||
+             (!strncmp(command, "random", strlen("random"))))
+    {
+        if (!strncmp(command, "repeat", strlen("repeat")))
+        {
+            mpd->repeat = !mpd->repeat;
+        }
+        else
+        {
+            mpd->random = !mpd->random;
+        }
+        for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+        {
+            mpd->clients[i].pending_events |= 1 << 6;
+        }
+    }
+
+    return ((length > 0) && ((size_t)length < size)) ? length : 0;
+};
+
+static void fakempd_events_deliver(struct fakempd *mpd)
+{
+    struct fakempd_client *client;
+    char                  output[FAKEMPD_OUTPUT_SIZE];
+    unsigned int          events = 0;
+    unsigned int          i = 0;
+    unsigned int          j = 0;
+    size_t                length = 0;
+
+    pthread_mutex_lock(&mpd->lock);
+    for (i = 0; i < FAKEMPD_CLIENTS_MAX; ++i)
+    {
+        client = &mpd->clients[i];
+        events = client->pending_events & client->idle_mask;
+        if ((client->sock == -1) || (!client->idle) || (!events))
+        {
+            continue;
+        }
+
+        length = 0;
+        for (j = 0; fakempd_idle_names[j]; ++j)
+        {
+            if (events & (1 << j))
+            {
+                length += sprintf(output + length, "changed: %s\n",
+                                  fakempd_idle_names[j]);
+            }
+        }
+        length += sprintf(output + length, "OK\n");
+
+        client->pending_events &= ~events;
+        client->idle = false;
+        fakempd_client_send(client, output, length);
+    }
+    pthread_mutex_unlock(&mpd->lock);
+
+    return;
+};
+
+static void fakempd_client_send(struct fakempd_client *client,
+                                const char *output, size_t length)
+{
+    ssize_t bytes_sent = 0;
+    size_t  offset = 0;
+
+    while (offset < length)
+    {
+        bytes_sent = send(client->sock, output + offset, length - offset,
+                          MSG_NOSIGNAL);
+        if (bytes_sent <= 0)
+        {
+            fakempd_client_close(client);
+            return;
+        }
+        offset += bytes_sent;
+    }
+
+    return;
+};
+
+static void fakempd_client_close(struct fakempd_client *client)
+{
+    if (client->sock != -1)
+    {
+        close(client->sock);
+        client->sock = -1;
+    }
+
+    return;
+};
+
+static unsigned int fakempd_idle_mask_parse(const char *names)
+{
+    unsigned int mask = 0;
+    unsigned int i = 0;
+
+    for (i = 0; fakempd_idle_names[i]; ++i)
+    {
+        if (strstr(names, fakempd_idle_names[i]))
+        {
+            mask |= 1 << i;
+        }
+    }
+
+// Idle with no subsystems listed waits for any of them
+    return mask ? mask : ~0U;
+};
+
+static void fakempd_wakeup(struct fakempd *mpd)
+{
+    ssize_t bytes_written = 0;
+
+// A full pipe already guarantees the serving thread wakes up
+    bytes_written = write(mpd->wakeup[1], "", 1);
+    (void)bytes_written;
+
+    return;
+};
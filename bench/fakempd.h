@@ -0,0 +1,97 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef FAKEMPD_H
+#define FAKEMPD_H
+
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "mpd-fnscroller.h"
+
+
+
+
+#define FAKEMPD_CLIENTS_MAX  16
+#define FAKEMPD_LINE_SIZE    1024
+#define FAKEMPD_OUTPUT_SIZE  8192
+#define FAKEMPD_COMMANDS_MAX 16
+#define FAKEMPD_GREETING     "OK MPD 0.23.5\n"
+
+// Values of enum mpd_state and enum mpd_idle of libmpdclient
+#define FAKEMPD_STATE_STOP  1
+#define FAKEMPD_STATE_PLAY  2
+#define FAKEMPD_STATE_PAUSE 3
+
+
+struct fakempd_client
+{
+    int          sock;
+    char         line[FAKEMPD_LINE_SIZE];
+    size_t       line_length;
+
+    bool         idle;
+    unsigned int idle_mask;
+    unsigned int pending_events;
+
+    bool         command_list;
+    bool         command_list_ok;
+    char         commands[FAKEMPD_COMMANDS_MAX][FAKEMPD_LINE_SIZE];
+    unsigned int commands_count;
+};
+
+// Stand-in MPD: speaks just enough of the protocol for mpd-fnscroller and
+// mpc, the player state is set by the benchmark
+struct fakempd
+{
+    int                   sock_listener;
+    unsigned short        port;
+    int                   wakeup[2];
+    pthread_t             thread_id;
+    pthread_mutex_t       lock;
+    volatile bool         running;
+
+    unsigned int          state;
+    char                  uri[FILENAME_STRING_SIZE];
+    unsigned int          song_id;
+    unsigned int          elapsed_ms;
+    unsigned int          duration_ms;
+    bool                  repeat;
+    bool                  random;
+
+    struct fakempd_client clients[FAKEMPD_CLIENTS_MAX];
+    unsigned long long    commands_served;
+};
+
+
+enum mpd_fnscroller_result fakempd_start(struct fakempd *mpd);
+void fakempd_stop(struct fakempd *mpd);
+void fakempd_song_set(struct fakempd *mpd, unsigned int state,
+                      const char *uri);
+void fakempd_idle_emit(struct fakempd *mpd, unsigned int idle_mask);
+
+
+#endif /* FAKEMPD_H */
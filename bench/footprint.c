@@ -0,0 +1,353 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "fakempd.h"
+#include "bench.h"
+
+
+
+
+#define FOOTPRINT_BINARY_DEFAULT   "../src/mpd-fnscroller"
+#define FOOTPRINT_RUNTIME_DIR      "/tmp/" PROGNAME "_footprint_XXXXXX"
+#define FOOTPRINT_REQUESTS_DEFAULT 10000
+#define FOOTPRINT_SONG_PERIOD      100
+#define FOOTPRINT_STARTUP_TIMEOUT  5000
+#define FOOTPRINT_STARTUP_POLL     10
+#define FOOTPRINT_IDLE_PLAYER      (1 << 3)
+#define FOOTPRINT_LINE_SIZE        256
+
+
+bool debug = false;
+
+// Figures of the server process, in kB but the thread count
+struct footprint_usage
+{
+    unsigned long vm_size;
+    unsigned long vm_hwm;
+    unsigned long vm_rss;
+    unsigned long private_dirty;
+    unsigned long threads;
+};
+
+struct footprint
+{
+    struct fakempd mpd;
+    char           runtime_dir[PATH_STRING_SIZE];
+    char           sockfile_path[SUN_PATH_STRING_SIZE];
+    pid_t          server_pid;
+    unsigned int   failures;
+};
+
+// Widths and kinds of frames asked for in turn: a few blocks of the usual
+// sizes, with and without the progress and the JSON
+static const uint32_t footprint_frames[] =
+{
+    REQUEST_FRAME_ARG(16, PROGRESS_NONE),
+    REQUEST_FRAME_ARG(25, PROGRESS_TIME),
+    REQUEST_FRAME_ARG(40, PROGRESS_BAR),
+    REQUEST_FRAME_ARG(25, PROGRESS_NONE) | REQUEST_FRAME_JSON,
+    REQUEST_FRAME_ARG(120, PROGRESS_TIME) | REQUEST_FRAME_JSON
+};
+
+
+static enum mpd_fnscroller_result
+footprint_server_start(struct footprint *footprint, const char *binary);
+static void footprint_server_stop(struct footprint *footprint);
+static void footprint_run(struct footprint *footprint, unsigned int requests);
+static void footprint_request_send(struct footprint *footprint,
+                                   uint32_t request);
+static enum mpd_fnscroller_result
+footprint_usage_get(pid_t pid, struct footprint_usage *usage);
+static unsigned long footprint_field_get(const char *path, const char *name);
+
+
+// Memory footprint of a server scrolling titles for a while: the song is
+// changed every FOOTPRINT_SONG_PERIOD frame requests, the figures are taken
+// from /proc once the requests are served
+int main(int argc, char **argv)
+{
+    struct footprint       footprint;
+    struct footprint_usage usage;
+    const char             *binary = FOOTPRINT_BINARY_DEFAULT;
+    unsigned int           requests = FOOTPRINT_REQUESTS_DEFAULT;
+    int                    option = 0;
+
+    memset(&footprint, 0, sizeof(footprint));
+
+    while ((option = getopt(argc, argv, "b:n:")) != -1)
+    {
+        switch (option)
+        {
+            case 'b':
+                binary = optarg;
+                break;
+
+            case 'n':
+                requests = strtoul(optarg, NULL, DEC);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-b <binary>] [-n <requests>]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (!fakempd_start(&footprint.mpd))
+    {
+        fprintf(stderr, "Could not start stand-in MPD\n");
+        return EXIT_FAILURE;
+    }
+    fakempd_song_set(&footprint.mpd, FAKEMPD_STATE_PLAY,
+                     bench_corpus[0].string);
+
+    if (!footprint_server_start(&footprint, binary))
+    {
+        fakempd_stop(&footprint.mpd);
+        return EXIT_FAILURE;
+    }
+
+    footprint_run(&footprint, requests);
+
+    if (!footprint_usage_get(footprint.server_pid, &usage))
+    {
+        footprint_server_stop(&footprint);
+        fakempd_stop(&footprint.mpd);
+        return EXIT_FAILURE;
+    }
+
+    footprint_server_stop(&footprint);
+    fakempd_stop(&footprint.mpd);
+
+    printf("%-16s%u (%u failed)\n", "requests", requests, footprint.failures);
+    printf("%-16s%lu kB\n", "peak RSS", usage.vm_hwm);
+    printf("%-16s%lu kB\n", "RSS", usage.vm_rss);
+    printf("%-16s%lu kB\n", "private dirty", usage.private_dirty);
+    printf("%-16s%lu kB\n", "virtual", usage.vm_size);
+    printf("%-16s%lu\n", "threads", usage.threads);
+
+    return EXIT_SUCCESS;
+};
+
+
+static enum mpd_fnscroller_result
+footprint_server_start(struct footprint *footprint, const char *binary)
+{
+    struct stat  sockfile_stat;
+    char         mpd_address[HOSTNAME_STRING_SIZE + 8];
+    unsigned int waited = 0;
+
+    strcpy(footprint->runtime_dir, FOOTPRINT_RUNTIME_DIR);
+    if (mkdtemp(footprint->runtime_dir) == NULL)
+    {
+        perror("Could not create runtime directory");
+        return RESULT_ERROR;
+    }
+    snprintf(footprint->sockfile_path, SUN_PATH_STRING_SIZE, "%s/" PROGNAME
+             "/" SOCKFILE_NAME, footprint->runtime_dir);
+    snprintf(mpd_address, sizeof(mpd_address), "127.0.0.1:%hu",
+             footprint->mpd.port);
+
+    footprint->server_pid = fork();
+    if (footprint->server_pid == -1)
+    {
+        perror("Could not fork");
+        return RESULT_ERROR;
+    }
+    if (footprint->server_pid == 0)
+    {
+        setenv("XDG_RUNTIME_DIR", footprint->runtime_dir, 1);
+        execl(binary, binary, "-n", "-s", mpd_address, (char *)NULL);
+        perror(binary);
+        _exit(EXIT_FAILURE);
+    }
+
+    while (stat(footprint->sockfile_path, &sockfile_stat) == -1)
+    {
+        if ((waited >= FOOTPRINT_STARTUP_TIMEOUT) ||
+            (waitpid(footprint->server_pid, NULL, WNOHANG) != 0))
+        {
+            fprintf(stderr, "Server did not start\n");
+            footprint_server_stop(footprint);
+            return RESULT_ERROR;
+        }
+        usleep(FOOTPRINT_STARTUP_POLL * 1000);
+        waited += FOOTPRINT_STARTUP_POLL;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// The snapshot is left in the runtime directory by the server on shutdown
+static void footprint_server_stop(struct footprint *footprint)
+{
+    char path[PATH_STRING_SIZE + sizeof(PROGNAME) + sizeof(SNAPSHOTFILE_NAME)];
+
+    if (footprint->server_pid > 0)
+    {
+        kill(footprint->server_pid, SIGUSR1);
+        waitpid(footprint->server_pid, NULL, 0);
+        footprint->server_pid = 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/" PROGNAME "/" SNAPSHOTFILE_NAME,
+             footprint->runtime_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/" PROGNAME, footprint->runtime_dir);
+    rmdir(path);
+    rmdir(footprint->runtime_dir);
+
+    return;
+};
+
+static void footprint_run(struct footprint *footprint, unsigned int requests)
+{
+    unsigned int frames_count = sizeof(footprint_frames) /
+                                sizeof(footprint_frames[0]);
+    unsigned int i = 0;
+
+    for (i = 0; i < requests; ++i)
+    {
+        if ((i) && (i % FOOTPRINT_SONG_PERIOD == 0))
+        {
+            fakempd_song_set(&footprint->mpd, FAKEMPD_STATE_PLAY,
+                             bench_corpus[(i / FOOTPRINT_SONG_PERIOD) %
+                                          bench_corpus_size].string);
+            fakempd_idle_emit(&footprint->mpd, FOOTPRINT_IDLE_PLAYER);
+        }
+        footprint_request_send(footprint,
+                               REQUEST_MAKE(REQUEST_FRAME,
+                                            footprint_frames[i %
+                                                             frames_count]));
+    }
+
+    return;
+};
+
+static void footprint_request_send(struct footprint *footprint,
+                                   uint32_t request)
+{
+    struct sockaddr_un address;
+    char               buffer[BUFSIZ];
+    ssize_t            bytes_received = 0;
+    size_t             total = 0;
+    int                sock = 0;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1)
+    {
+        ++footprint->failures;
+        return;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, footprint->sockfile_path);
+
+    if ((connect(sock, (struct sockaddr *)&address, sizeof(address)) == -1) ||
+        (send(sock, &request, sizeof(request), MSG_NOSIGNAL) !=
+         sizeof(request)))
+    {
+        ++footprint->failures;
+        close(sock);
+        return;
+    }
+    while ((bytes_received = recv(sock, buffer, BUFSIZ, 0)) > 0)
+    {
+        total += bytes_received;
+    }
+    close(sock);
+
+    if ((bytes_received == -1) || (total == 0))
+    {
+        ++footprint->failures;
+    }
+
+    return;
+};
+
+static enum mpd_fnscroller_result
+footprint_usage_get(pid_t pid, struct footprint_usage *usage)
+{
+    char status_path[FOOTPRINT_LINE_SIZE];
+    char smaps_path[FOOTPRINT_LINE_SIZE];
+
+    snprintf(status_path, FOOTPRINT_LINE_SIZE, "/proc/%d/status", pid);
+    snprintf(smaps_path, FOOTPRINT_LINE_SIZE, "/proc/%d/smaps_rollup", pid);
+
+    usage->vm_size = footprint_field_get(status_path, "VmSize:");
+    usage->vm_hwm = footprint_field_get(status_path, "VmHWM:");
+    usage->vm_rss = footprint_field_get(status_path, "VmRSS:");
+    usage->threads = footprint_field_get(status_path, "Threads:");
+    usage->private_dirty = footprint_field_get(smaps_path, "Private_Dirty:");
+
+    if ((!usage->vm_hwm) || (!usage->threads))
+    {
+        fprintf(stderr, "Could not read the usage of the server\n");
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Value of the line starting with the name, smaps_rollup has the totals of
+// all the mappings
+static unsigned long footprint_field_get(const char *path, const char *name)
+{
+    FILE          *file = NULL;
+    char          line[FOOTPRINT_LINE_SIZE];
+    size_t        name_length = strlen(name);
+    unsigned long value = 0;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    while (fgets(line, FOOTPRINT_LINE_SIZE, file))
+    {
+        if (strncmp(line, name, name_length) == 0)
+        {
+            value = strtoul(line + name_length, NULL, DEC);
+            break;
+        }
+    }
+    fclose(file);
+
+    return value;
+};
@@ -0,0 +1,611 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "record.h"
+#include "fakempd.h"
+#include "bench.h"
+
+
+
+
+#define REPLAY_BINARY_DEFAULT  "../src/mpd-fnscroller"
+#define REPLAY_RUNTIME_DIR     "/tmp/" PROGNAME "_replay_XXXXXX"
+#define REPLAY_STARTUP_TIMEOUT 5000
+#define REPLAY_STARTUP_POLL    10
+#define REPLAY_IDLE_PLAYER     (1 << 3)
+#define REPLAY_CLIENTS_MAX     256
+
+
+bool debug = false;
+
+struct replay_record
+{
+    unsigned long long timestamp;
+    enum record_type   type;
+    uint16_t           length;
+    const char         *payload;
+};
+
+struct replay;
+
+// Each client sends all the recorded requests on its own, like one more bar
+// running the block: its latencies go to a part of the array of its own
+struct replay_client
+{
+    struct replay      *replay;
+    pthread_t          thread_id;
+    unsigned long long *latencies;
+    unsigned int       latencies_count;
+    unsigned int       failures;
+};
+
+struct replay
+{
+    char                 *data;
+    struct replay_record *records;
+    unsigned int         count;
+    unsigned int         requests;
+
+    struct replay_client *clients;
+    unsigned int         clients_count;
+    double               speed;
+    unsigned long long   start;
+    unsigned long long   *latencies;
+    unsigned int         latencies_count;
+    unsigned int         failures;
+
+    struct fakempd       mpd;
+    char                 runtime_dir[PATH_STRING_SIZE];
+    char                 sockfile_path[SUN_PATH_STRING_SIZE];
+    pid_t                server_pid;
+};
+
+
+static enum mpd_fnscroller_result replay_load(struct replay *replay,
+                                              const char *path);
+static enum mpd_fnscroller_result replay_server_start(struct replay *replay,
+                                                      const char *binary);
+static void replay_server_stop(struct replay *replay);
+static enum mpd_fnscroller_result replay_run(struct replay *replay);
+static void *replay_client_run(void *arg);
+static void replay_record_wait(struct replay *replay,
+                               const struct replay_record *record);
+static void replay_mpd_apply(struct replay *replay, unsigned int index);
+static void replay_request_send(struct replay_client *client,
+                                uint32_t request);
+static void replay_report(struct replay *replay);
+static int replay_latency_compare(const void *a, const void *b);
+static uint32_t replay_uint32_get(const struct replay_record *record);
+
+
+// Replays a workload captured with "mpd-fnscroller -r": the recorded MPD
+// events are played by a stand-in MPD, the recorded requests are sent to a
+// real server with the original timing (scaled by -x, 0 is flat out) by as
+// many concurrent clients as given by -c
+int main(int argc, char **argv)
+{
+    struct replay replay;
+    const char    *binary = REPLAY_BINARY_DEFAULT;
+    int           option = 0;
+
+    memset(&replay, 0, sizeof(replay));
+    replay.speed = 1.0;
+    replay.clients_count = 1;
+
+    while ((option = getopt(argc, argv, "b:x:c:")) != -1)
+    {
+        switch (option)
+        {
+            case 'b':
+                binary = optarg;
+                break;
+
+            case 'x':
+                replay.speed = strtod(optarg, NULL);
+                break;
+
+            case 'c':
+                replay.clients_count = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-b <binary>] [-x <speed>] "
+                        "[-c <clients>] <workload>\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if ((optind != argc - 1) || (replay.speed < 0) ||
+        (replay.clients_count == 0) ||
+        (replay.clients_count > REPLAY_CLIENTS_MAX))
+    {
+        fprintf(stderr, "Usage: %s [-b <binary>] [-x <speed>] "
+                "[-c <clients>] <workload>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!replay_load(&replay, argv[optind]))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!fakempd_start(&replay.mpd))
+    {
+        fprintf(stderr, "Could not start stand-in MPD\n");
+        return EXIT_FAILURE;
+    }
+// State the server finds at startup is the one recorded before the first
+// idle event
+    replay_mpd_apply(&replay, 0);
+
+    if (!replay_server_start(&replay, binary))
+    {
+        fakempd_stop(&replay.mpd);
+        return EXIT_FAILURE;
+    }
+
+    if (!replay_run(&replay))
+    {
+        replay_server_stop(&replay);
+        fakempd_stop(&replay.mpd);
+        return EXIT_FAILURE;
+    }
+
+    replay_server_stop(&replay);
+    fakempd_stop(&replay.mpd);
+
+    replay_report(&replay);
+
+    free(replay.clients);
+    free(replay.latencies);
+    free(replay.records);
+    free(replay.data);
+
+    return EXIT_SUCCESS;
+};
+
+
+static enum mpd_fnscroller_result replay_load(struct replay *replay,
+                                              const char *path)
+{
+    struct record_file_header file_header;
+    struct record_header      header;
+    FILE                      *file = NULL;
+    long                      size = 0;
+    size_t                    offset = 0;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return RESULT_ERROR;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+
+    replay->data = malloc(size);
+    if ((replay->data == NULL) ||
+        (fread(replay->data, 1, size, file) != (size_t)size))
+    {
+        fprintf(stderr, "Could not read %s\n", path);
+        fclose(file);
+        return RESULT_ERROR;
+    }
+    fclose(file);
+
+    if ((size_t)size >= sizeof(file_header))
+    {
+        memcpy(&file_header, replay->data, sizeof(file_header));
+    }
+    if (((size_t)size < sizeof(file_header)) ||
+        (memcmp(file_header.magic, RECORD_MAGIC, RECORD_MAGIC_SIZE)) ||
+        (file_header.version != RECORD_FORMAT_VERSION))
+    {
+        fprintf(stderr, "%s is not a workload file of version %d\n", path,
+                RECORD_FORMAT_VERSION);
+        return RESULT_ERROR;
+    }
+
+// Records are fixed size headers followed by the payloads: the first pass
+// counts them, the second one indexes them in place
+    for (offset = sizeof(file_header);
+         offset + sizeof(header) <= (size_t)size;
+         offset += sizeof(header) + header.length)
+    {
+        memcpy(&header, replay->data + offset, sizeof(header));
+        ++replay->count;
+    }
+
+    replay->records = calloc(replay->count, sizeof(struct replay_record));
+    if (replay->records == NULL)
+    {
+        fprintf(stderr, "Could not allocate %u records\n", replay->count);
+        return RESULT_ERROR;
+    }
+
+    replay->count = 0;
+    for (offset = sizeof(file_header);
+         offset + sizeof(header) <= (size_t)size;
+         offset += sizeof(header) + header.length)
+    {
+        memcpy(&header, replay->data + offset, sizeof(header));
+// Capture cut short by a crash leaves a partial last record
+        if ((offset + sizeof(header) + header.length > (size_t)size) ||
+            (header.type >= RECORD_TYPE_COUNT))
+        {
+            break;
+        }
+        replay->records[replay->count].timestamp = header.timestamp;
+        replay->records[replay->count].type = header.type;
+        replay->records[replay->count].length = header.length;
+        replay->records[replay->count].payload = replay->data + offset +
+                                                 sizeof(header);
+        if (header.type == RECORD_REQUEST)
+        {
+            ++replay->requests;
+        }
+        ++replay->count;
+    }
+
+    replay->latencies = malloc(sizeof(unsigned long long) *
+                               (replay->requests * replay->clients_count +
+                                1));
+    if (replay->latencies == NULL)
+    {
+        fprintf(stderr, "Could not allocate %u latencies\n",
+                replay->requests * replay->clients_count);
+        return RESULT_ERROR;
+    }
+
+    printf("%s: %u records, %u requests, %.3f s\n", path, replay->count,
+           replay->requests, replay->count ?
+           replay->records[replay->count - 1].timestamp / 1e6 : 0.0);
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result replay_server_start(struct replay *replay,
+                                                      const char *binary)
+{
+    struct stat  sockfile_stat;
+    char         mpd_address[HOSTNAME_STRING_SIZE + 8];
+    unsigned int waited = 0;
+
+    strcpy(replay->runtime_dir, REPLAY_RUNTIME_DIR);
+    if (mkdtemp(replay->runtime_dir) == NULL)
+    {
+        perror("Could not create runtime directory");
+        return RESULT_ERROR;
+    }
+    snprintf(replay->sockfile_path, SUN_PATH_STRING_SIZE, "%s/" PROGNAME
+             "/" SOCKFILE_NAME, replay->runtime_dir);
+    snprintf(mpd_address, sizeof(mpd_address), "127.0.0.1:%hu",
+             replay->mpd.port);
+
+    replay->server_pid = fork();
+    if (replay->server_pid == -1)
+    {
+        perror("Could not fork");
+        return RESULT_ERROR;
+    }
+    if (replay->server_pid == 0)
+    {
+        setenv("XDG_RUNTIME_DIR", replay->runtime_dir, 1);
+        execl(binary, binary, "-n", "-s", mpd_address, (char *)NULL);
+        perror(binary);
+        _exit(EXIT_FAILURE);
+    }
+
+    while (stat(replay->sockfile_path, &sockfile_stat) == -1)
+    {
+        if ((waited >= REPLAY_STARTUP_TIMEOUT) ||
+            (waitpid(replay->server_pid, NULL, WNOHANG) != 0))
+        {
+            fprintf(stderr, "Server did not start\n");
+            replay_server_stop(replay);
+            return RESULT_ERROR;
+        }
+        usleep(REPLAY_STARTUP_POLL * 1000);
+        waited += REPLAY_STARTUP_POLL;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Server leaves the snapshot in the runtime directory
+static void replay_server_stop(struct replay *replay)
+{
+    char path[PATH_STRING_SIZE + sizeof(PROGNAME) +
+              sizeof(SNAPSHOTFILE_NAME)];
+
+    if (replay->server_pid > 0)
+    {
+        kill(replay->server_pid, SIGUSR1);
+        waitpid(replay->server_pid, NULL, 0);
+        replay->server_pid = 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/" PROGNAME "/" SNAPSHOTFILE_NAME,
+             replay->runtime_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/" PROGNAME, replay->runtime_dir);
+    rmdir(path);
+    rmdir(replay->runtime_dir);
+
+    return;
+};
+
+// MPD events are played here, the requests by the client threads along the
+// same timeline; their latencies are gathered once they are all done
+static enum mpd_fnscroller_result replay_run(struct replay *replay)
+{
+    const struct replay_record *record;
+    struct replay_client       *client;
+    unsigned int               started = 0;
+    unsigned int               i = 0;
+
+    replay->clients = calloc(replay->clients_count,
+                             sizeof(struct replay_client));
+    if (replay->clients == NULL)
+    {
+        fprintf(stderr, "Could not allocate %u clients\n",
+                replay->clients_count);
+        return RESULT_ERROR;
+    }
+
+    replay->start = bench_time_get();
+    for (started = 0; started < replay->clients_count; ++started)
+    {
+        client = &replay->clients[started];
+        client->replay = replay;
+        client->latencies = replay->latencies + started * replay->requests;
+        if (pthread_create(&client->thread_id, NULL, replay_client_run,
+                           client))
+        {
+            fprintf(stderr, "Could not start client %u\n", started);
+            break;
+        }
+    }
+
+    for (i = 0; i < replay->count; ++i)
+    {
+        record = &replay->records[i];
+        if (record->type != RECORD_IDLE)
+        {
+            continue;
+        }
+        replay_record_wait(replay, record);
+// Player state is applied ahead of its idle event
+        replay_mpd_apply(replay, i + 1);
+        fakempd_idle_emit(&replay->mpd, replay_uint32_get(record));
+    }
+
+    for (i = 0; i < started; ++i)
+    {
+        client = &replay->clients[i];
+        pthread_join(client->thread_id, NULL);
+        memmove(replay->latencies + replay->latencies_count,
+                client->latencies,
+                client->latencies_count * sizeof(unsigned long long));
+        replay->latencies_count += client->latencies_count;
+        replay->failures += client->failures;
+    }
+
+    return (started == replay->clients_count) ? RESULT_SUCCESS :
+                                                RESULT_ERROR;
+};
+
+static void *replay_client_run(void *arg)
+{
+    struct replay_client       *client = arg;
+    struct replay              *replay = client->replay;
+    const struct replay_record *record;
+    unsigned int               i = 0;
+
+    for (i = 0; i < replay->count; ++i)
+    {
+        record = &replay->records[i];
+        if (record->type != RECORD_REQUEST)
+        {
+            continue;
+        }
+        replay_record_wait(replay, record);
+        replay_request_send(client, replay_uint32_get(record));
+    }
+
+    return NULL;
+};
+
+static void replay_record_wait(struct replay *replay,
+                               const struct replay_record *record)
+{
+    unsigned long long due = 0;
+    unsigned long long now = 0;
+
+    if (replay->speed > 0)
+    {
+        due = replay->start + (unsigned long long)(record->timestamp * 1000 /
+                                                   replay->speed);
+        now = bench_time_get();
+        if (due > now)
+        {
+            usleep((due - now) / 1000);
+        }
+    }
+
+    return;
+};
+
+// Server fetches the status and the song after an idle event: those are
+// recorded after it and have to be in place before it is emitted
+static void replay_mpd_apply(struct replay *replay, unsigned int index)
+{
+    const struct replay_record *record;
+    char                       uri[FILENAME_STRING_SIZE];
+    unsigned int               state = 0;
+    bool                       song = false;
+
+    for (; (index < replay->count) &&
+           (replay->records[index].type != RECORD_IDLE); ++index)
+    {
+        record = &replay->records[index];
+        if (record->type == RECORD_STATUS)
+        {
+            state = replay_uint32_get(record);
+        }
+        else if (record->type == RECORD_SONG)
+        {
+            snprintf(uri, FILENAME_STRING_SIZE, "%.*s", record->length,
+                     record->payload);
+            song = true;
+        }
+    }
+
+    if (state)
+    {
+        fakempd_song_set(&replay->mpd, state, song ? uri : NULL);
+    }
+
+    return;
+};
+
+// Every request is a connection of its own, like the one of the client run by
+// i3blocks: the latency is from connect() to the server closing it
+static void replay_request_send(struct replay_client *client,
+                                uint32_t request)
+{
+    struct replay      *replay = client->replay;
+    struct sockaddr_un address;
+    unsigned long long start = 0;
+    char               buffer[BUFSIZ];
+    ssize_t            bytes_received = 0;
+    size_t             total = 0;
+    int                sock = 0;
+
+    start = bench_time_get();
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1)
+    {
+        ++client->failures;
+        return;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, replay->sockfile_path);
+
+    if ((connect(sock, (struct sockaddr *)&address, sizeof(address)) == -1) ||
+        (send(sock, &request, sizeof(request), MSG_NOSIGNAL) !=
+         sizeof(request)))
+    {
+        ++client->failures;
+        close(sock);
+        return;
+    }
+    while ((bytes_received = recv(sock, buffer, BUFSIZ, 0)) > 0)
+    {
+        total += bytes_received;
+    }
+    close(sock);
+
+    if ((bytes_received == -1) || (total == 0))
+    {
+        ++client->failures;
+        return;
+    }
+
+    client->latencies[client->latencies_count++] = bench_time_get() - start;
+
+    return;
+};
+
+static void replay_report(struct replay *replay)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    unsigned long long  sum = 0;
+    unsigned int        count = replay->latencies_count;
+    unsigned int        i = 0;
+
+    printf("requests: %u served, %u failed by %u clients, %llu MPD "
+           "commands\n", count, replay->failures, replay->clients_count,
+           replay->mpd.commands_served);
+    if (count == 0)
+    {
+        return;
+    }
+
+    qsort(replay->latencies, count, sizeof(unsigned long long),
+          replay_latency_compare);
+    for (i = 0; i < count; ++i)
+    {
+        sum += replay->latencies[i];
+    }
+
+    printf("latency, us: mean %.1f", sum / 1e3 / count);
+    for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i)
+    {
+        printf(" p%g %.1f", quantiles[i] * 100,
+               replay->latencies[(unsigned int)(quantiles[i] * (count - 1))] /
+               1e3);
+    }
+    printf(" max %.1f\n", replay->latencies[count - 1] / 1e3);
+
+    return;
+};
+
+static int replay_latency_compare(const void *a, const void *b)
+{
+    unsigned long long latency_a = *(const unsigned long long *)a;
+    unsigned long long latency_b = *(const unsigned long long *)b;
+
+    return (latency_a > latency_b) - (latency_a < latency_b);
+};
+
+static uint32_t replay_uint32_get(const struct replay_record *record)
+{
+    uint32_t value = 0;
+
+    memcpy(&value, record->payload,
+           record->length < sizeof(value) ? record->length : sizeof(value));
+
+    return value;
+};
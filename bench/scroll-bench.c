@@ -0,0 +1,142 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <locale.h>
+#include <wchar.h>
+
+#include "mpd-fnscroller.h"
+#include "scroll.h"
+#include "bench.h"
+
+
+
+
+#define SCROLL_BENCH_FRAMES        200000
+#define SCROLL_BENCH_WARMUP_FRAMES 1000
+
+
+bool debug = false;
+
+static const unsigned int scroll_bench_widths[] = {8, 16, 25, 64};
+
+// Elaborate animations only make the schedule longer, not the frames slower
+static const char *scroll_bench_modes[] = {"wrap", "bounce,dwell=4,accel=4"};
+
+
+static void scroll_bench_run(const struct bench_title *title,
+                             unsigned int width, const char *mode);
+
+
+int main(int argc, char **argv)
+{
+    unsigned int i = 0;
+    unsigned int j = 0;
+    unsigned int k = 0;
+
+    if (!setlocale(LC_ALL, "C.UTF-8"))
+    {
+        fprintf(stderr, "C.UTF-8 locale is not available\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-*s %5s %-24s %12s %14s %14s\n", BENCH_TITLE_STRING_SIZE / 2,
+           "title", "width", "mode", "ns/frame", "frames/s", "bytes/frame");
+    for (i = 0; i < bench_corpus_size; ++i)
+    {
+        for (j = 0; j < sizeof(scroll_bench_widths) /
+                        sizeof(scroll_bench_widths[0]); ++j)
+        {
+            for (k = 0; k < sizeof(scroll_bench_modes) /
+                            sizeof(scroll_bench_modes[0]); ++k)
+            {
+                scroll_bench_run(&bench_corpus[i],
+                                 scroll_bench_widths[j],
+                                 scroll_bench_modes[k]);
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+};
+
+
+// Runs the scroll engine the same way the server does for a single client:
+// the width is stable, every request produces the next frame
+static void scroll_bench_run(const struct bench_title *title,
+                             unsigned int width, const char *mode)
+{
+    struct mpd_fnscroller_scroll scroll;
+    struct mpdfnscroller_options options;
+    char                         spec[BENCH_TITLE_STRING_SIZE];
+    struct bench_allocations     allocations_before;
+    struct bench_allocations     allocations_after;
+    wchar_t                      frame[FILENAME_WCHAR_STRING_SIZE];
+    unsigned long long           time_start = 0;
+    unsigned long long           time_elapsed = 0;
+    unsigned int                 i = 0;
+    unsigned int                 wcbufsize = width + 1;
+
+    scroll_init(&scroll);
+    snprintf(spec, sizeof(spec), "%s", mode);
+    if ((!scroll_options_parse(&options, spec)) ||
+        (!scroll_options_set(&scroll, &options)))
+    {
+        fprintf(stderr, "Invalid mode %s\n", mode);
+        return;
+    }
+    if (!scroll_string_set(&scroll, title->string))
+    {
+        fprintf(stderr, "Could not set title %s\n", title->name);
+        return;
+    }
+
+    for (i = 0; i < SCROLL_BENCH_WARMUP_FRAMES; ++i)
+    {
+        scroll_frame_get(&scroll, frame, wcbufsize);
+    }
+
+    bench_allocations_get(&allocations_before);
+    time_start = bench_time_get();
+    for (i = 0; i < SCROLL_BENCH_FRAMES; ++i)
+    {
+        scroll_frame_get(&scroll, frame, wcbufsize);
+        __asm__ __volatile__("" : : "r"(frame) : "memory");
+    }
+    time_elapsed = bench_time_get() - time_start;
+    bench_allocations_get(&allocations_after);
+
+    printf("%-*s %5u %-24s %12.1f %14.0f %14.2f\n",
+           BENCH_TITLE_STRING_SIZE / 2, title->name, width, mode,
+           (double)time_elapsed / SCROLL_BENCH_FRAMES,
+           SCROLL_BENCH_FRAMES * 1e9 / time_elapsed,
+           (double)(allocations_after.bytes - allocations_before.bytes) /
+           SCROLL_BENCH_FRAMES);
+
+    return;
+};
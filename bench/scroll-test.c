@@ -0,0 +1,125 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <locale.h>
+
+#include "libmpdfnscroller.h"
+
+
+
+
+#define SCROLL_TEST_POSITIONS 64
+#define SCROLL_TEST_FRAME_SIZE (MPDFNSCROLLER_TITLE_SIZE * 4 + 1)
+
+
+struct scroll_test_case
+{
+    const char   *title;
+    unsigned int width;
+    const char   *frame;
+};
+
+// Titles which do not move in bounce mode: they are shown as they are, a
+// single cluster wider than the frame too
+static const struct scroll_test_case scroll_test_bounce_still[] =
+{
+    {"Artist - Title", 14, "Artist - Title"},
+    {"Artist - Title", 20, "Artist - Title"},
+    {"\xe5\xa3\xb0", 2, "\xe5\xa3\xb0"},
+    {"\xe5\xa3\xb0", 1, "\xe5\xa3\xb0"},
+    {"", 8, ""}
+};
+
+
+static int scroll_test_bounce_still_run(const struct scroll_test_case *test);
+
+
+int main(void)
+{
+    unsigned int i = 0;
+    int          failures = 0;
+
+    if (!setlocale(LC_ALL, "C.UTF-8"))
+    {
+        fprintf(stderr, "C.UTF-8 locale is not available\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < sizeof(scroll_test_bounce_still) /
+                    sizeof(scroll_test_bounce_still[0]); ++i)
+    {
+        failures += scroll_test_bounce_still_run(&scroll_test_bounce_still[i]);
+    }
+    printf("%d failed\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+};
+
+
+static int scroll_test_bounce_still_run(const struct scroll_test_case *test)
+{
+    struct mpdfnscroller_options options = {MPDFNSCROLLER_MODE_BOUNCE, 2, 2,
+                                            NULL};
+    struct mpdfnscroller         scroller;
+    char                         frame[SCROLL_TEST_FRAME_SIZE];
+    unsigned long long           period = 0;
+    unsigned long long           position = 0;
+
+    mpdfnscroller_init(&scroller, 0);
+    if ((mpdfnscroller_options_set(&scroller, &options) == -1) ||
+        (mpdfnscroller_title_set(&scroller, test->title, 0) == -1))
+    {
+        printf("FAIL \"%s\" at width %u: not set\n", test->title,
+               test->width);
+        return 1;
+    }
+
+    period = mpdfnscroller_period_get(&scroller, test->width);
+    if (period != 1)
+    {
+        printf("FAIL \"%s\" at width %u: period %llu\n", test->title,
+               test->width, period);
+        return 1;
+    }
+    for (position = 0; position < SCROLL_TEST_POSITIONS; ++position)
+    {
+        mpdfnscroller_frame_get(&scroller, test->width,
+                                position * MPDFNSCROLLER_STEP_MS, frame,
+                                SCROLL_TEST_FRAME_SIZE);
+        if ((mpdfnscroller_offset_at(&scroller, test->width, position)) ||
+            (strcmp(frame, test->frame)))
+        {
+            printf("FAIL \"%s\" at width %u: \"%s\" at position %llu\n",
+                   test->title, test->width, frame, position);
+            return 1;
+        }
+    }
+    printf("ok   \"%s\" at width %u\n", test->title, test->width);
+
+    return 0;
+};
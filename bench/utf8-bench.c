@@ -0,0 +1,141 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <locale.h>
+#include <wchar.h>
+
+#include "libmpdfnscroller.h"
+#include "utf8.h"
+#include "bench.h"
+
+
+
+
+#define UTF8_BENCH_TITLES        1000000
+#define UTF8_BENCH_WARMUP_TITLES 10000
+
+
+static bool utf8_bench_check(const struct bench_title *title);
+static void utf8_bench_run(const struct bench_title *title);
+
+
+int main(int argc, char **argv)
+{
+    unsigned int i = 0;
+
+// Locale is only needed by mbstowcs(), the decoder does without it
+    if (!setlocale(LC_ALL, "C.UTF-8"))
+    {
+        fprintf(stderr, "C.UTF-8 locale is not available\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-*s %6s %14s %14s %9s\n", BENCH_TITLE_STRING_SIZE / 2, "title",
+           "bytes", "mbstowcs ns", "utf8 ns", "speedup");
+    for (i = 0; i < bench_corpus_size; ++i)
+    {
+        if (!utf8_bench_check(&bench_corpus[i]))
+        {
+            fprintf(stderr, "Decoders disagree on %s\n",
+                    bench_corpus[i].name);
+            return EXIT_FAILURE;
+        }
+        utf8_bench_run(&bench_corpus[i]);
+    }
+
+    return EXIT_SUCCESS;
+};
+
+
+static bool utf8_bench_check(const struct bench_title *title)
+{
+    wchar_t        expected[MPDFNSCROLLER_TITLE_SIZE];
+    wchar_t        codepoints[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned short columns[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned char  boundaries[MPDFNSCROLLER_TITLE_SIZE];
+    size_t         length = mbstowcs(expected, title->string,
+                                     MPDFNSCROLLER_TITLE_SIZE);
+
+    return (mpdfnscroller_utf8_decode(title->string, codepoints, columns,
+                                      boundaries, MPDFNSCROLLER_TITLE_SIZE) ==
+            (int)length) &&
+           (wmemcmp(expected, codepoints, length + 1) == 0);
+};
+
+// Song change as it used to be, sizing and converting with mbstowcs(), next
+// to the decoder building the index as well
+static void utf8_bench_run(const struct bench_title *title)
+{
+    wchar_t            codepoints[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned short     columns[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned char      boundaries[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned long long time_start = 0;
+    unsigned long long mbstowcs_elapsed = 0;
+    unsigned long long utf8_elapsed = 0;
+    unsigned int       i = 0;
+
+    for (i = 0; i < UTF8_BENCH_WARMUP_TITLES; ++i)
+    {
+        if (mbstowcs(NULL, title->string, 0) != (size_t)-1)
+        {
+            mbstowcs(codepoints, title->string, MPDFNSCROLLER_TITLE_SIZE);
+        }
+        mpdfnscroller_utf8_decode(title->string, codepoints, columns,
+                                  boundaries, MPDFNSCROLLER_TITLE_SIZE);
+    }
+
+    time_start = bench_time_get();
+    for (i = 0; i < UTF8_BENCH_TITLES; ++i)
+    {
+        if (mbstowcs(NULL, title->string, 0) != (size_t)-1)
+        {
+            mbstowcs(codepoints, title->string, MPDFNSCROLLER_TITLE_SIZE);
+        }
+        __asm__ __volatile__("" : : "r"(codepoints) : "memory");
+    }
+    mbstowcs_elapsed = bench_time_get() - time_start;
+
+    time_start = bench_time_get();
+    for (i = 0; i < UTF8_BENCH_TITLES; ++i)
+    {
+        mpdfnscroller_utf8_decode(title->string, codepoints, columns,
+                                  boundaries, MPDFNSCROLLER_TITLE_SIZE);
+        __asm__ __volatile__("" : : "r"(codepoints), "r"(columns),
+                             "r"(boundaries) : "memory");
+    }
+    utf8_elapsed = bench_time_get() - time_start;
+
+    printf("%-*s %6zu %14.1f %14.1f %8.2fx\n", BENCH_TITLE_STRING_SIZE / 2,
+           title->name, strlen(title->string),
+           (double)mbstowcs_elapsed / UTF8_BENCH_TITLES,
+           (double)utf8_elapsed / UTF8_BENCH_TITLES,
+           (double)mbstowcs_elapsed / utf8_elapsed);
+
+    return;
+};
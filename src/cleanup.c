@@ -0,0 +1,432 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <regex.h>
+#ifdef MPD_FNSCROLLER_ICU
+#include <unicode/unorm2.h>
+#include <unicode/ustring.h>
+#endif /* MPD_FNSCROLLER_ICU */
+
+#include "mpd-fnscroller.h"
+#include "format.h"
+#include "cleanup.h"
+
+
+
+
+extern bool debug;
+
+
+static enum mpd_fnscroller_result
+cleanup_regex_compile(struct cleanup_rule *rule, const char *rule_string);
+static void cleanup_extension_strip(char *buf);
+static void cleanup_track_strip(char *buf);
+static void cleanup_underscore_replace(char *buf);
+static size_t cleanup_regex_substitute(const struct cleanup_rule *rule,
+                                       const char *input, char *buf,
+                                       size_t size);
+#ifdef MPD_FNSCROLLER_ICU
+static void cleanup_nfc_normalize(const struct mpd_fnscroller_cleanup *cleanup,
+                                  char *buf, size_t size);
+#endif /* MPD_FNSCROLLER_ICU */
+
+
+void cleanup_init(struct mpd_fnscroller_cleanup *cleanup)
+{
+    memset(cleanup, 0, sizeof(*cleanup));
+
+    return;
+};
+
+void cleanup_free(struct mpd_fnscroller_cleanup *cleanup)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < cleanup->rules_count; ++i)
+    {
+        if (cleanup->rules[i].type == CLEANUP_RULE_TYPE_REGEX)
+        {
+            regfree(&cleanup->rules[i].regex);
+        }
+    }
+    cleanup->rules_count = 0;
+
+    return;
+};
+
+enum mpd_fnscroller_result
+cleanup_rule_add(struct mpd_fnscroller_cleanup *cleanup, const char *rule)
+{
+    struct cleanup_rule *new_rule = NULL;
+
+    if (cleanup->rules_count == CLEANUP_RULES_MAX)
+    {
+        ERR_("Too many cleanup rules, at most %d are allowed",
+             CLEANUP_RULES_MAX)
+        return RESULT_ERROR;
+    }
+    new_rule = &cleanup->rules[cleanup->rules_count];
+
+    if (strcmp(rule, CLEANUP_RULE_EXTENSION) == 0)
+    {
+        new_rule->type = CLEANUP_RULE_TYPE_EXTENSION;
+    }
+    else if (strcmp(rule, CLEANUP_RULE_TRACK) == 0)
+    {
+        new_rule->type = CLEANUP_RULE_TYPE_TRACK;
+    }
+    else if (strcmp(rule, CLEANUP_RULE_UNDERSCORE) == 0)
+    {
+        new_rule->type = CLEANUP_RULE_TYPE_UNDERSCORE;
+    }
+    else if (strcmp(rule, CLEANUP_RULE_NFC) == 0)
+    {
+#ifdef MPD_FNSCROLLER_ICU
+        UErrorCode status = U_ZERO_ERROR;
+
+        cleanup->nfc = unorm2_getNFCInstance(&status);
+        if (U_FAILURE(status))
+        {
+            ERR_("Could not get the NFC normalizer: %s", u_errorName(status))
+            return RESULT_ERROR;
+        }
+        new_rule->type = CLEANUP_RULE_TYPE_NFC;
+#else
+        ERR_("NFC normalization needs " PROGNAME " built with ICU=1")
+        return RESULT_ERROR;
+#endif /* MPD_FNSCROLLER_ICU */
+    }
+    else if (rule[0] == 's')
+    {
+        if (!cleanup_regex_compile(new_rule, rule))
+        {
+            return RESULT_ERROR;
+        }
+        new_rule->type = CLEANUP_RULE_TYPE_REGEX;
+    }
+    else
+    {
+        ERR_("Unknown cleanup rule: %s", rule)
+        return RESULT_ERROR;
+    }
+    ++cleanup->rules_count;
+
+    return RESULT_SUCCESS;
+};
+
+// Every rule is a single pass over the string; they are only run when the
+// song is changed
+void cleanup_apply(const struct mpd_fnscroller_cleanup *cleanup, char *buf,
+                   size_t size)
+{
+    char         input[FILENAME_STRING_SIZE];
+    unsigned int i = 0;
+
+    for (i = 0; i < cleanup->rules_count; ++i)
+    {
+        switch (cleanup->rules[i].type)
+        {
+            case CLEANUP_RULE_TYPE_EXTENSION:
+                cleanup_extension_strip(buf);
+                break;
+
+            case CLEANUP_RULE_TYPE_TRACK:
+                cleanup_track_strip(buf);
+                break;
+
+            case CLEANUP_RULE_TYPE_UNDERSCORE:
+                cleanup_underscore_replace(buf);
+                break;
+
+            case CLEANUP_RULE_TYPE_REGEX:
+                snprintf(input, FILENAME_STRING_SIZE, "%s", buf);
+                cleanup_regex_substitute(&cleanup->rules[i], input, buf,
+                                         size);
+                break;
+
+#ifdef MPD_FNSCROLLER_ICU
+            case CLEANUP_RULE_TYPE_NFC:
+                cleanup_nfc_normalize(cleanup, buf, size);
+                break;
+#endif /* MPD_FNSCROLLER_ICU */
+
+            default:
+                break;
+        }
+    }
+
+    return;
+};
+
+
+// Rule is "s/regex/replacement/" with any delimiter following "s", "i" after
+// the last delimiter makes the match case insensitive
+static enum mpd_fnscroller_result
+cleanup_regex_compile(struct cleanup_rule *rule, const char *rule_string)
+{
+    char         pattern[CLEANUP_REPLACEMENT_SIZE];
+    char         *parts[2] = {pattern, rule->replacement};
+    char         delimiter = rule_string[1];
+    const char   *c = rule_string + 2;
+    unsigned int part = 0;
+    size_t       length = 0;
+    int          cflags = REG_EXTENDED;
+    int          error = 0;
+
+    if ((delimiter == '\0') || (delimiter == '\\'))
+    {
+        ERR_("Invalid cleanup rule: %s", rule_string)
+        return RESULT_ERROR;
+    }
+
+    for (part = 0; part < 2; ++part)
+    {
+        length = 0;
+        while ((*c != delimiter) && (*c != '\0'))
+        {
+// Escaped delimiter is taken as it is, other escapes are left to regcomp
+            if ((*c == '\\') && (c[1] == delimiter))
+            {
+                ++c;
+            }
+            if (length == CLEANUP_REPLACEMENT_SIZE - 1)
+            {
+                ERR_("Cleanup rule is too long: %s", rule_string)
+                return RESULT_ERROR;
+            }
+            parts[part][length++] = *c++;
+        }
+        parts[part][length] = '\0';
+        if (*c != delimiter)
+        {
+            ERR_("Invalid cleanup rule: %s", rule_string)
+            return RESULT_ERROR;
+        }
+        ++c;
+    }
+
+    if (strcmp(c, "i") == 0)
+    {
+        cflags |= REG_ICASE;
+    }
+    else if (*c != '\0')
+    {
+        ERR_("Invalid cleanup rule flags: %s", rule_string)
+        return RESULT_ERROR;
+    }
+
+    error = regcomp(&rule->regex, pattern, cflags);
+    if (error)
+    {
+        regerror(error, &rule->regex, pattern, CLEANUP_REPLACEMENT_SIZE);
+        ERR_("Invalid cleanup rule %s: %s", rule_string, pattern)
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// "song.flac" loses ".flac", "Mr. Jones" is left as it is
+static void cleanup_extension_strip(char *buf)
+{
+    char   *dot = strrchr(buf, '.');
+    size_t length = 0;
+
+    if ((dot == NULL) || (dot == buf))
+    {
+        return;
+    }
+    for (length = 1; dot[length] != '\0'; ++length)
+    {
+        if (!isalnum((unsigned char)dot[length]))
+        {
+            return;
+        }
+    }
+    if ((length > 1) && (length <= CLEANUP_EXTENSION_SIZE_MAX + 1))
+    {
+        *dot = '\0';
+    }
+
+    return;
+};
+
+// "01 - Song", "01. Song", "1-02 Song" all become "Song"
+static void cleanup_track_strip(char *buf)
+{
+    char   *c = buf;
+    size_t digits = strspn(c, "0123456789");
+
+    if ((digits == 0) || (digits > CLEANUP_TRACK_DIGITS_MAX))
+    {
+        return;
+    }
+    c += digits;
+// Disc number is followed by the track number
+    if ((*c == '-') && (isdigit((unsigned char)c[1])))
+    {
+        digits = strspn(c + 1, "0123456789");
+        if (digits > CLEANUP_TRACK_DIGITS_MAX)
+        {
+            return;
+        }
+        c += digits + 1;
+    }
+    digits = strspn(c, CLEANUP_TRACK_SEPARATORS);
+    if ((digits == 0) || (c[digits] == '\0'))
+    {
+        return;
+    }
+    c += digits;
+    memmove(buf, c, strlen(c) + 1);
+
+    return;
+};
+
+static void cleanup_underscore_replace(char *buf)
+{
+    char *c = buf;
+
+    while ((c = strchr(c, '_')) != NULL)
+    {
+        *c++ = ' ';
+    }
+
+    return;
+};
+
+// Every match is replaced, like "s/regex/replacement/g" of sed
+static size_t cleanup_regex_substitute(const struct cleanup_rule *rule,
+                                       const char *input, char *buf,
+                                       size_t size)
+{
+    regmatch_t   matches[CLEANUP_MATCHES_MAX];
+    const char   *c = NULL;
+    const char   *next = NULL;
+    size_t       length = 0;
+    size_t       offset = 0;
+    size_t       span = 0;
+    unsigned int group = 0;
+    int          eflags = 0;
+
+    buf[0] = '\0';
+    while ((input[offset] != '\0') &&
+           (regexec(&rule->regex, input + offset, CLEANUP_MATCHES_MAX,
+                    matches, eflags) == 0))
+    {
+        length = format_string_append(buf, size, length, input + offset,
+                                      matches[0].rm_so);
+        for (c = rule->replacement; *c != '\0'; c = next)
+        {
+            span = strcspn(c, "\\&");
+            if (span)
+            {
+                length = format_string_append(buf, size, length, c, span);
+                next = c + span;
+                continue;
+            }
+            if (*c == '&')
+            {
+                group = 0;
+                next = c + 1;
+            }
+            else if ((c[1] >= '0') && (c[1] <= '9'))
+            {
+                group = c[1] - '0';
+                next = c + 2;
+            }
+            else
+            {
+                next = (c[1] != '\0') ? c + 2 : c + 1;
+                length = format_string_append(buf, size, length, next - 1,
+                                              1);
+                continue;
+            }
+            if (matches[group].rm_so != -1)
+            {
+                length = format_string_append(buf, size, length,
+                                              input + offset +
+                                              matches[group].rm_so,
+                                              matches[group].rm_eo -
+                                              matches[group].rm_so);
+            }
+        }
+
+// Empty match moves on by a whole character
+        if (matches[0].rm_eo == 0)
+        {
+            next = input + offset + 1;
+            while ((*next & 0xc0) == 0x80)
+            {
+                ++next;
+            }
+            length = format_string_append(buf, size, length, input + offset,
+                                          next - (input + offset));
+            offset = next - input;
+        }
+        else
+        {
+            offset += matches[0].rm_eo;
+        }
+        eflags = REG_NOTBOL;
+    }
+    length = format_string_append(buf, size, length, input + offset,
+                                  strlen(input + offset));
+
+    return length;
+};
+
+#ifdef MPD_FNSCROLLER_ICU
+// Decomposed "é" from the file names of some systems becomes a single
+// character: it takes a single column in the frame
+static void cleanup_nfc_normalize(const struct mpd_fnscroller_cleanup *cleanup,
+                                  char *buf, size_t size)
+{
+    UChar      input[FILENAME_STRING_SIZE];
+    UChar      output[FILENAME_STRING_SIZE];
+    char       result[FILENAME_STRING_SIZE];
+    int32_t    length = 0;
+    UErrorCode status = U_ZERO_ERROR;
+
+    u_strFromUTF8(input, FILENAME_STRING_SIZE, &length, buf, -1, &status);
+    length = unorm2_normalize(cleanup->nfc, input, length, output,
+                              FILENAME_STRING_SIZE, &status);
+    u_strToUTF8(result, FILENAME_STRING_SIZE, NULL, output, length, &status);
+    if ((U_FAILURE(status)) || (status == U_STRING_NOT_TERMINATED_WARNING))
+    {
+        DEBUG_("NFC normalization failed: %s", u_errorName(status))
+        return;
+    }
+    snprintf(buf, size, "%s", result);
+
+    return;
+};
+#endif /* MPD_FNSCROLLER_ICU */
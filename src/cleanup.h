@@ -0,0 +1,92 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef CLEANUP_H
+#define CLEANUP_H
+
+
+#include <stddef.h>
+#include <regex.h>
+#ifdef MPD_FNSCROLLER_ICU
+#include <unicode/unorm2.h>
+#endif /* MPD_FNSCROLLER_ICU */
+
+#include "mpd-fnscroller.h"
+
+
+
+
+#define CLEANUP_RULES_MAX          16
+#define CLEANUP_REPLACEMENT_SIZE   128
+#define CLEANUP_MATCHES_MAX        10
+#define CLEANUP_EXTENSION_SIZE_MAX 5
+#define CLEANUP_TRACK_DIGITS_MAX   3
+#define CLEANUP_TRACK_SEPARATORS   " ._-"
+#define CLEANUP_RULE_EXTENSION     "ext"
+#define CLEANUP_RULE_TRACK         "track"
+#define CLEANUP_RULE_UNDERSCORE    "underscore"
+#define CLEANUP_RULE_NFC           "nfc"
+
+
+enum cleanup_rule_type
+{
+    CLEANUP_RULE_TYPE_EXTENSION = 0,
+    CLEANUP_RULE_TYPE_TRACK,
+    CLEANUP_RULE_TYPE_UNDERSCORE,
+    CLEANUP_RULE_TYPE_REGEX,
+    CLEANUP_RULE_TYPE_NFC,
+    CLEANUP_RULE_TYPE_COUNT
+};
+
+// Substitution "s/regex/replacement/" is compiled by regcomp once, the
+// replacement may refer to the subexpressions as \1..\9 and to the match as &
+struct cleanup_rule
+{
+    enum cleanup_rule_type type;
+    regex_t                regex;
+    char                   replacement[CLEANUP_REPLACEMENT_SIZE];
+};
+
+// Rules to tidy up the titles, compiled at startup and applied in order once
+// per song change: the requests only get the result.
+struct mpd_fnscroller_cleanup
+{
+    struct cleanup_rule rules[CLEANUP_RULES_MAX];
+    unsigned int        rules_count;
+#ifdef MPD_FNSCROLLER_ICU
+    const UNormalizer2  *nfc;
+#endif /* MPD_FNSCROLLER_ICU */
+};
+
+
+void cleanup_init(struct mpd_fnscroller_cleanup *cleanup);
+void cleanup_free(struct mpd_fnscroller_cleanup *cleanup);
+enum mpd_fnscroller_result
+cleanup_rule_add(struct mpd_fnscroller_cleanup *cleanup, const char *rule);
+void cleanup_apply(const struct mpd_fnscroller_cleanup *cleanup, char *buf,
+                   size_t size);
+
+
+#endif /* CLEANUP_H */
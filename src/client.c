@@ -26,21 +26,34 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/time.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <syslog.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "mpd-fnscroller.h"
+#include "progress.h"
+#include "refresh.h"
+#include "runtime.h"
+#include "utf8.h"
 #include "client.h"
 
 
 
 
 extern bool debug;
-extern char pidfile_path[];
-extern char sockfile_path[];
+extern char *pidfile_path;
+extern char *sockfile_path;
+
+
+static enum mpd_fnscroller_result
+client_frame_get(struct mpd_fnscroller_client *client);
+static enum mpd_fnscroller_result
+client_response_print(struct mpd_fnscroller_client *client);
 
 
 enum mpd_fnscroller_result client_init(struct mpd_fnscroller_client *client)
@@ -53,6 +66,10 @@ enum mpd_fnscroller_result client_init(struct mpd_fnscroller_client *client)
         return RESULT_ERROR;
     }
 
+    client->request = REQUEST_FRAME;
+    client->request_arg = 0;
+    client->progress = PROGRESS_NONE;
+    client->json = false;
     client->buffer = NULL;
     client->bufsize = DEFAULT_OUTPUT_STRING_SIZE;
 
@@ -62,42 +79,175 @@ enum mpd_fnscroller_result client_init(struct mpd_fnscroller_client *client)
 
 enum mpd_fnscroller_result client_run(struct mpd_fnscroller_client *client)
 {
-    ssize_t send_recv_bytes;
+    struct timeval             timeout = {CLIENT_TIMEOUT_MS / 1000,
+                                          (CLIENT_TIMEOUT_MS % 1000) * 1000};
+    enum mpd_fnscroller_result result = RESULT_ERROR;
 
     TRACE_()
 
-    client->buffer = (wchar_t *)malloc(sizeof(wchar_t) * client->bufsize);
+// Wait is held open by the server for up to its own timeout
+    if (client->request == REQUEST_WAIT)
+    {
+        timeout.tv_sec += REQUEST_WAIT_TIMEOUT_MS / 1000;
+    }
 
     strcpy(client->server_sockaddr.sun_path, sockfile_path);
     if (connect(client->sock, (struct sockaddr *)&client->server_sockaddr,
                 sizeof(client->server_sockaddr)) == -1)
     {
-        ERR_("Issue connecting with server")
+// Users with no server of their own get the frames from the system daemon
+        if ((client->request != REQUEST_FRAME) ||
+            ((errno != ENOENT) && (errno != ECONNREFUSED)))
+        {
+            ERR_("Issue connecting with server")
+            return RESULT_ERROR;
+        }
+// Socket is left in an unspecified state by the failed connect
+        close(client->sock);
+        client->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (client->sock == -1)
+        {
+            ERR_("Could not create socket")
+            return RESULT_ERROR;
+        }
+        strcpy(client->server_sockaddr.sun_path, SYSTEM_SOCKFILE_PATH);
+        if (connect(client->sock,
+                    (struct sockaddr *)&client->server_sockaddr,
+                    sizeof(client->server_sockaddr)) == -1)
+        {
+            ERR_("Issue connecting with server")
+            return RESULT_ERROR;
+        }
+    }
+// Stuck server must not make i3blocks pile up hanging clients
+    setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+               sizeof(timeout));
+    setsockopt(client->sock, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+               sizeof(timeout));
+
+    switch (client->request)
+    {
+        case REQUEST_FRAME:
+
+        case REQUEST_UP_NEXT:
+// Bar running the block is left for the server to signal
+            refresh_bar_register();
+// JSON frame is plain text, of no fixed size
+            if (client->json)
+            {
+                client->request_arg = REQUEST_FRAME_ARG(client->bufsize,
+                                                        client->progress) |
+                                      REQUEST_FRAME_JSON;
+                result = client_response_print(client);
+                break;
+            }
+            result = client_frame_get(client);
+            break;
+
+        default:
+            result = client_response_print(client);
+            break;
+    }
+
+    close(client->sock);
+    return result;
+};
+
+
+static enum mpd_fnscroller_result
+client_frame_get(struct mpd_fnscroller_client *client)
+{
+    unsigned int client_msg = REQUEST_MAKE(client->request,
+                                           REQUEST_FRAME_ARG(client->bufsize,
+                                                             client->progress));
+    unsigned int wcbufsize = client->bufsize + PROGRESS_STRING_SIZE;
+    unsigned int i = 0;
+    char         character[MPDFNSCROLLER_UTF8_CHARACTER_MAX + 1];
+    size_t       received_bytes = 0;
+    size_t       character_length = 0;
+    ssize_t      send_recv_bytes;
+
+    client->buffer = (wchar_t *)calloc(wcbufsize, sizeof(wchar_t));
+    if (client->buffer == NULL)
+    {
+        ERR_("Could not allocate buffer")
         return RESULT_ERROR;
     }
 
-    send_recv_bytes = send(client->sock, &client->bufsize, sizeof(unsigned int),
-                           0);
+    send_recv_bytes = send(client->sock, &client_msg, sizeof(unsigned int),
+                           MSG_NOSIGNAL);
     if (send_recv_bytes == -1)
     {
         ERR_("Could not send buffer size to server")
-        close(client->sock);
         free(client->buffer);
         return RESULT_ERROR;
     }
-    send_recv_bytes = recv(client->sock, client->buffer, sizeof(wchar_t) *
-                           client->bufsize, 0);
+// Frame with the progress appended has no fixed size: it is read until the
+// server closes the connection
+    while ((send_recv_bytes = recv(client->sock,
+                                   (char *)client->buffer + received_bytes,
+                                   sizeof(wchar_t) * (wcbufsize - 1) -
+                                   received_bytes, 0)) > 0)
+    {
+        received_bytes += send_recv_bytes;
+    }
     if (send_recv_bytes == -1)
     {
         ERR_("Could not receive buffer from server")
-        close(client->sock);
         free(client->buffer);
         return RESULT_ERROR;
     }
 
-    printf("%ls", client->buffer);
+// Printed in UTF-8 whatever the locale of the bar is
+    for (i = 0; client->buffer[i] != L'\0'; ++i)
+    {
+        character_length = mpdfnscroller_utf8_encode(client->buffer + i, 1,
+                                                     character,
+                                                     sizeof(character));
+        fwrite(character, 1, character_length, stdout);
+    }
 
-    close(client->sock);
     free(client->buffer);
     return RESULT_SUCCESS;
 };
+
+// Responses other than frames are plain text of arbitrary length, ended by
+// the server closing the connection
+static enum mpd_fnscroller_result
+client_response_print(struct mpd_fnscroller_client *client)
+{
+    unsigned int client_msg = REQUEST_MAKE(client->request,
+                                           client->request_arg);
+    char         buffer[BUFSIZ];
+    size_t       received_bytes = 0;
+    ssize_t      send_recv_bytes;
+
+    send_recv_bytes = send(client->sock, &client_msg, sizeof(unsigned int),
+                           MSG_NOSIGNAL);
+    if (send_recv_bytes == -1)
+    {
+        ERR_("Could not send request to server")
+        return RESULT_ERROR;
+    }
+
+    while ((send_recv_bytes = recv(client->sock, buffer, BUFSIZ, 0)) > 0)
+    {
+// Busy answer is the whole response, sent at once
+        if ((client->request == REQUEST_WAIT) && (!received_bytes) &&
+            (send_recv_bytes == sizeof(REQUEST_WAIT_BUSY) - 1) &&
+            (!memcmp(buffer, REQUEST_WAIT_BUSY, send_recv_bytes)))
+        {
+            ERR_("Server has too many waiters")
+            return RESULT_ERROR;
+        }
+        fwrite(buffer, 1, send_recv_bytes, stdout);
+        received_bytes += send_recv_bytes;
+    }
+    if (send_recv_bytes == -1)
+    {
+        ERR_("Could not receive response from server")
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
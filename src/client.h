@@ -34,13 +34,20 @@
 
 
 
+#define CLIENT_TIMEOUT_MS 1000
+
+
 struct mpd_fnscroller_client
 {
-    struct sockaddr_un server_sockaddr;
-    int                sock;
-
-    wchar_t            *buffer;
-    unsigned int       bufsize;
+    struct sockaddr_un           server_sockaddr;
+    int                          sock;
+
+    enum mpd_fnscroller_request  request;
+    unsigned int                 request_arg;
+    enum mpd_fnscroller_progress progress;
+    bool                         json;
+    wchar_t                      *buffer;
+    unsigned int                 bufsize;
 };
 
 
@@ -0,0 +1,520 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <poll.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "connection.h"
+
+
+
+
+extern bool debug;
+
+
+static struct mpd_fnscroller_connection *
+connection_slot_get(struct connection_pool *pool,
+                    const struct ucred *credentials);
+static unsigned int connection_warning_due(struct connection_warning *warning);
+
+
+void connection_pool_init(struct connection_pool *pool)
+{
+    unsigned int i = 0;
+
+    memset(pool->connections, 0, sizeof(pool->connections));
+    memset(pool->pollfds, 0, sizeof(pool->pollfds));
+    for (i = 0; i < CONNECTION_SLOTS; ++i)
+    {
+        pool->connections[i].sock = -1;
+        pool->connections[i].state = CONNECTION_FREE;
+        pool->connections[i].output_buffer = pool->output_buffers[i];
+        pool->connections[i].output = pool->connections[i].output_buffer;
+    }
+    for (i = 0; i < CONNECTION_WAITERS_MAX; ++i)
+    {
+        pool->waiters[i].sock = -1;
+    }
+    pool->active = 0;
+    pool->waiting = 0;
+    pool->uid_connections_max = 0;
+    memset(&pool->eviction_warning, 0, sizeof(pool->eviction_warning));
+    memset(&pool->busy_warning, 0, sizeof(pool->busy_warning));
+    memset(&pool->refusal_warning, 0, sizeof(pool->refusal_warning));
+
+    return;
+};
+
+void connection_pool_close(struct connection_pool *pool)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < CONNECTION_SLOTS; ++i)
+    {
+        if (pool->connections[i].state != CONNECTION_FREE)
+        {
+            connection_close(pool, &pool->connections[i]);
+        }
+    }
+    for (i = 0; i < CONNECTION_WAITERS_MAX; ++i)
+    {
+        if (pool->waiters[i].sock != -1)
+        {
+            connection_waiter_release(pool, &pool->waiters[i], NULL, 0);
+        }
+    }
+
+    return;
+};
+
+// Accepts everything pending on the listening socket. Only the errors of the
+// listening socket itself are reported: running out of descriptors or memory
+// is transient and must not stop the serving.
+enum mpd_fnscroller_result connection_accept(struct connection_pool *pool,
+                                             int sock_listener)
+{
+    struct mpd_fnscroller_connection *connection;
+    struct ucred                     credentials;
+    socklen_t                        length = 0;
+    unsigned int                     accepted = 0;
+    int                              sock = 0;
+
+    for (accepted = 0; accepted < CONNECTIONS_MAX; ++accepted)
+    {
+        sock = accept4(sock_listener, NULL, NULL, SOCK_NONBLOCK |
+                       SOCK_CLOEXEC);
+        if (sock == -1)
+        {
+            switch (errno)
+            {
+                case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+                case EWOULDBLOCK:
+#endif /* EAGAIN != EWOULDBLOCK */
+                    return RESULT_SUCCESS;
+
+                case EINTR:
+
+                case ECONNABORTED:
+
+                case EPROTO:
+                    continue;
+
+                case EMFILE:
+
+                case ENFILE:
+
+                case ENOBUFS:
+
+                case ENOMEM:
+                    syslog(LOG_WARNING, "Could not accept connection: %s",
+                           strerror(errno));
+                    return RESULT_SUCCESS;
+
+                default:
+                    ERR_("Issue accepting incoming connection: %s",
+                         strerror(errno))
+                    return RESULT_ERROR;
+            }
+        }
+
+        length = sizeof(credentials);
+        if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &credentials,
+                       &length) == -1)
+        {
+            ERR_("Could not get the credentials of the peer")
+            close(sock);
+            continue;
+        }
+        connection = connection_slot_get(pool, &credentials);
+        if (connection == NULL)
+        {
+            close(sock);
+            continue;
+        }
+        connection->sock = sock;
+        connection->uid = credentials.uid;
+        connection->gid = credentials.gid;
+        connection->state = CONNECTION_READING;
+        connection->deadline = monotonic_time_get() + CONNECTION_TIMEOUT_MS;
+        connection->request_length = 0;
+        connection->output = connection->output_buffer;
+        connection->output_length = 0;
+        connection->output_offset = 0;
+        ++pool->active;
+
+// Request is usually there already, so it is worth trying to read it at once
+        pool->pollfds[connection - pool->connections + 1].revents = POLLIN;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Listening socket goes first, then the slots, the wakeup descriptor of the
+// waiters and the waiters themselves
+int connection_pool_poll(struct connection_pool *pool, int sock_listener,
+                         int wakeup_fd)
+{
+    struct mpd_fnscroller_connection *connection;
+    struct mpd_fnscroller_waiter     *waiter;
+    unsigned long long               now = monotonic_time_get();
+    unsigned long long               nearest_deadline = 0;
+    unsigned int                     i = 0;
+    int                              timeout = -1;
+
+    pool->pollfds[0].fd = sock_listener;
+    pool->pollfds[0].events = POLLIN;
+    pool->pollfds[0].revents = 0;
+    pool->pollfds[CONNECTION_POLLFD_WAKEUP].fd = wakeup_fd;
+    pool->pollfds[CONNECTION_POLLFD_WAKEUP].events = POLLIN;
+    pool->pollfds[CONNECTION_POLLFD_WAKEUP].revents = 0;
+
+    for (i = 0; i < CONNECTION_SLOTS; ++i)
+    {
+        connection = &pool->connections[i];
+
+        pool->pollfds[i + 1].fd = connection->sock;
+        pool->pollfds[i + 1].revents = 0;
+        switch (connection->state)
+        {
+            case CONNECTION_READING:
+                pool->pollfds[i + 1].events = POLLIN;
+                break;
+
+            case CONNECTION_WRITING:
+                pool->pollfds[i + 1].events = POLLOUT;
+                break;
+
+            default:
+                pool->pollfds[i + 1].fd = -1;
+                pool->pollfds[i + 1].events = 0;
+                continue;
+        }
+
+        if ((!nearest_deadline) || (connection->deadline < nearest_deadline))
+        {
+            nearest_deadline = connection->deadline;
+        }
+    }
+// Waiter has sent its request: anything readable is its hangup
+    for (i = 0; i < CONNECTION_WAITERS_MAX; ++i)
+    {
+        waiter = &pool->waiters[i];
+
+        pool->pollfds[CONNECTION_POLLFD_WAITERS + i].fd = waiter->sock;
+        pool->pollfds[CONNECTION_POLLFD_WAITERS + i].events = POLLIN;
+        pool->pollfds[CONNECTION_POLLFD_WAITERS + i].revents = 0;
+        if ((waiter->sock != -1) &&
+            ((!nearest_deadline) || (waiter->deadline < nearest_deadline)))
+        {
+            nearest_deadline = waiter->deadline;
+        }
+    }
+
+    if (nearest_deadline)
+    {
+        timeout = (nearest_deadline > now) ? nearest_deadline - now : 0;
+    }
+
+    return poll(pool->pollfds, CONNECTION_POLLFDS, timeout);
+};
+
+void connection_pool_expire(struct connection_pool *pool)
+{
+    unsigned long long now = monotonic_time_get();
+    unsigned int       i = 0;
+
+    for (i = 0; i < CONNECTION_SLOTS; ++i)
+    {
+        if ((pool->connections[i].state != CONNECTION_FREE) &&
+            (pool->connections[i].deadline <= now))
+        {
+            TRACEPOINT_("Connection %lld missed its deadline",
+                        pool->connections[i].sock, 0)
+            connection_close(pool, &pool->connections[i]);
+        }
+    }
+
+    return;
+};
+
+char *connection_output_reserve(struct mpd_fnscroller_connection *connection,
+                                size_t size)
+{
+    if (size <= CONNECTION_OUTPUT_SIZE)
+    {
+        return connection->output_buffer;
+    }
+    if (size > CONNECTION_OUTPUT_MAX)
+    {
+        ERR_("Response of %zu bytes exceeds the output limit", size)
+        return NULL;
+    }
+
+    connection->output = malloc(size);
+    if (connection->output == NULL)
+    {
+        ERR_("Could not allocate output buffer")
+        connection->output = connection->output_buffer;
+        return NULL;
+    }
+
+    return connection->output;
+};
+
+enum connection_io_result
+connection_read(struct mpd_fnscroller_connection *connection)
+{
+    ssize_t bytes_received = 0;
+
+    bytes_received = recv(connection->sock,
+                          connection->request + connection->request_length,
+                          CONNECTION_REQUEST_SIZE - connection->request_length,
+                          0);
+    if (bytes_received > 0)
+    {
+        connection->request_length += bytes_received;
+
+        return (connection->request_length == CONNECTION_REQUEST_SIZE) ?
+               CONNECTION_IO_DONE : CONNECTION_IO_PENDING;
+    }
+    if ((bytes_received == -1) && ((errno == EAGAIN) ||
+                                   (errno == EWOULDBLOCK) || (errno == EINTR)))
+    {
+        return CONNECTION_IO_PENDING;
+    }
+
+    return CONNECTION_IO_ERROR;
+};
+
+enum connection_io_result
+connection_write(struct mpd_fnscroller_connection *connection)
+{
+    ssize_t bytes_sent = 0;
+
+    bytes_sent = send(connection->sock,
+                      connection->output + connection->output_offset,
+                      connection->output_length - connection->output_offset,
+                      MSG_NOSIGNAL);
+    if (bytes_sent >= 0)
+    {
+// Deadline is for making progress: large responses take several writes
+        connection->output_offset += bytes_sent;
+        connection->deadline = monotonic_time_get() + CONNECTION_TIMEOUT_MS;
+
+        return (connection->output_offset == connection->output_length) ?
+               CONNECTION_IO_DONE : CONNECTION_IO_PENDING;
+    }
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+    {
+        return CONNECTION_IO_PENDING;
+    }
+
+    return CONNECTION_IO_ERROR;
+};
+
+void connection_close(struct connection_pool *pool,
+                      struct mpd_fnscroller_connection *connection)
+{
+    close(connection->sock);
+    if (connection->output != connection->output_buffer)
+    {
+        free(connection->output);
+        connection->output = connection->output_buffer;
+    }
+    connection->sock = -1;
+    connection->state = CONNECTION_FREE;
+    --pool->active;
+
+    return;
+};
+
+// Socket of the connection is moved to the waiters and its slot is freed at
+// once. No waiter is dropped for a new one: when they are all taken, the
+// connection is left to be answered as busy.
+enum mpd_fnscroller_result
+connection_park(struct connection_pool *pool,
+                struct mpd_fnscroller_connection *connection,
+                unsigned int version, unsigned long long deadline)
+{
+    unsigned int count = 0;
+    unsigned int i = 0;
+
+    for (i = 0; i < CONNECTION_WAITERS_MAX; ++i)
+    {
+        if (pool->waiters[i].sock == -1)
+        {
+            break;
+        }
+    }
+    if (i == CONNECTION_WAITERS_MAX)
+    {
+        count = connection_warning_due(&pool->busy_warning);
+        if (count)
+        {
+            syslog(LOG_WARNING, "Too many waiters; answering busy (%u since "
+                   "the last warning)", count);
+        }
+        return RESULT_ERROR;
+    }
+
+    pool->waiters[i].sock = connection->sock;
+    pool->waiters[i].version = version;
+    pool->waiters[i].deadline = deadline;
+    ++pool->waiting;
+
+    connection->sock = -1;
+    connection->state = CONNECTION_FREE;
+    --pool->active;
+
+    return RESULT_SUCCESS;
+};
+
+// Response of a waiter is a few kilobytes at most, which the empty
+// socket buffer always takes at once: it is sent without waiting for the peer
+void connection_waiter_release(struct connection_pool *pool,
+                               struct mpd_fnscroller_waiter *waiter,
+                               const char *response, size_t length)
+{
+    if ((length) &&
+        (send(waiter->sock, response, length, MSG_NOSIGNAL | MSG_DONTWAIT) !=
+         (ssize_t)length))
+    {
+        TRACEPOINT_("Waiter %lld missed its response", waiter->sock, 0)
+    }
+    close(waiter->sock);
+    waiter->sock = -1;
+    --pool->waiting;
+
+    return;
+};
+
+
+// When all the slots are busy, the connection of the same user closest to
+// its deadline is the one to be dropped: it is the slowest peer most
+// probably. Connections of the other users are never dropped, the new one is
+// refused instead. Probe of the server itself only ever takes the reserved
+// slot.
+static struct mpd_fnscroller_connection *
+connection_slot_get(struct connection_pool *pool,
+                    const struct ucred *credentials)
+{
+    struct mpd_fnscroller_connection *connection;
+    struct mpd_fnscroller_connection *free_slot = NULL;
+    struct mpd_fnscroller_connection *oldest = NULL;
+    unsigned int                     uid_connections = 0;
+    unsigned int                     count = 0;
+    unsigned int                     i = 0;
+
+    if (credentials->pid == getpid())
+    {
+        connection = &pool->connections[CONNECTIONS_MAX];
+        return (connection->state == CONNECTION_FREE) ? connection : NULL;
+    }
+
+    for (i = 0; i < CONNECTIONS_MAX; ++i)
+    {
+        connection = &pool->connections[i];
+        if (connection->state == CONNECTION_FREE)
+        {
+            if (free_slot == NULL)
+            {
+                free_slot = connection;
+            }
+            continue;
+        }
+        if (connection->uid != credentials->uid)
+        {
+            continue;
+        }
+        ++uid_connections;
+        if ((oldest == NULL) || (connection->deadline < oldest->deadline))
+        {
+            oldest = connection;
+        }
+    }
+
+    if ((pool->uid_connections_max) &&
+        (uid_connections >= pool->uid_connections_max))
+    {
+        TRACEPOINT_("uid %lld is over its connection limit",
+                    credentials->uid, 0)
+        return NULL;
+    }
+    if (free_slot)
+    {
+        return free_slot;
+    }
+// One user refused over and over must not flood the journal of all
+    if (oldest == NULL)
+    {
+        count = connection_warning_due(&pool->refusal_warning);
+        if (count)
+        {
+            syslog(LOG_WARNING, "Too many connections; refusing uid %u (%u "
+                   "refused since the last warning)", credentials->uid,
+                   count);
+        }
+        return NULL;
+    }
+
+    count = connection_warning_due(&pool->eviction_warning);
+    if (count)
+    {
+        syslog(LOG_WARNING, "Too many connections; dropping the slowest "
+               "ones (%u since the last warning)", count);
+    }
+    connection_close(pool, oldest);
+
+    return oldest;
+};
+
+// Returns the number of times to be logged now, 0 while the warning is held
+// back
+static unsigned int connection_warning_due(struct connection_warning *warning)
+{
+    unsigned long long now = monotonic_time_get();
+    unsigned int       count = ++warning->count;
+
+    if ((warning->time) && (now - warning->time < CONNECTION_WARNING_MS))
+    {
+        return 0;
+    }
+    warning->time = now;
+    warning->count = 0;
+
+    return count;
+};
@@ -0,0 +1,163 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+
+#include <sys/types.h>
+#include <poll.h>
+#include <stddef.h>
+#include <wchar.h>
+
+#include "mpd-fnscroller.h"
+#include "progress.h"
+
+
+
+
+#define CONNECTIONS_MAX           32
+#define CONNECTION_SLOTS          (CONNECTIONS_MAX + 1)
+#define CONNECTION_BACKLOG        16
+#define CONNECTION_TIMEOUT_MS     500
+#define CONNECTION_REQUEST_SIZE   sizeof(unsigned int)
+#define CONNECTION_OUTPUT_SIZE    ((FILENAME_WCHAR_STRING_SIZE +               \
+                                    PROGRESS_STRING_SIZE) * sizeof(wchar_t))
+#define CONNECTION_OUTPUT_MAX     (1024 * 1024)
+#define CONNECTION_WAITERS_MAX    64
+#define CONNECTION_POLLFD_WAKEUP  (CONNECTION_SLOTS + 1)
+#define CONNECTION_POLLFD_WAITERS (CONNECTION_SLOTS + 2)
+#define CONNECTION_POLLFDS        (CONNECTION_POLLFD_WAITERS +                 \
+                                   CONNECTION_WAITERS_MAX)
+#define CONNECTION_WARNING_MS     (60 * 1000)
+
+
+enum connection_state
+{
+    CONNECTION_FREE = 0,
+    CONNECTION_READING,
+    CONNECTION_WRITING,
+    CONNECTION_STATE_COUNT
+};
+
+enum connection_io_result
+{
+    CONNECTION_IO_ERROR = 0,
+    CONNECTION_IO_PENDING,
+    CONNECTION_IO_DONE,
+    CONNECTION_IO_COUNT
+};
+
+// Every connection has its own deadline and a bounded output buffer: a peer
+// which is too slow to send its request or to read the response is dropped
+// without affecting the others. Frames fit into the buffer of the slot in the
+// pool; larger responses get a heap one of at most CONNECTION_OUTPUT_MAX
+// bytes.
+struct mpd_fnscroller_connection
+{
+    int                   sock;
+    uid_t                 uid;
+    gid_t                 gid;
+    enum connection_state state;
+    unsigned long long    deadline;
+
+    unsigned char         request[CONNECTION_REQUEST_SIZE];
+    size_t                request_length;
+
+    char                  *output;
+    char                  *output_buffer;
+    size_t                output_length;
+    size_t                output_offset;
+};
+
+// Waiter holds nothing but its socket until it is answered, so that it is
+// parked apart from the slots: long waits never take a slot from a frame, nor
+// are they dropped to make room for one.
+struct mpd_fnscroller_waiter
+{
+    int                sock;
+    unsigned int       version;
+    unsigned long long deadline;
+};
+
+// Warning repeated under overload is logged once per CONNECTION_WARNING_MS
+// with the number of times it has come up since
+struct connection_warning
+{
+    unsigned long long time;
+    unsigned int       count;
+};
+
+// Last slot is kept for the server probing its own socket (the watchdog),
+// which is never dropped for a client nor drops one. Peers are told apart by
+// their credentials taken on accept: one is only ever dropped for another
+// connection of the same user, who may hold uid_connections_max of them at
+// most (0 for no limit). Output buffers are kept
+// apart from the slots, so that the pages of the ones never used (the pool
+// is taken from the first slot on) stay untouched. They go first to be
+// aligned for the wide strings of the frames.
+struct connection_pool
+{
+    char                             output_buffers[CONNECTION_SLOTS]
+                                                   [CONNECTION_OUTPUT_SIZE];
+    struct mpd_fnscroller_connection connections[CONNECTION_SLOTS];
+    struct mpd_fnscroller_waiter     waiters[CONNECTION_WAITERS_MAX];
+    struct pollfd                    pollfds[CONNECTION_POLLFDS];
+    unsigned int                     active;
+    unsigned int                     waiting;
+    unsigned int                     uid_connections_max;
+    struct connection_warning        eviction_warning;
+    struct connection_warning        busy_warning;
+    struct connection_warning        refusal_warning;
+};
+
+
+void connection_pool_init(struct connection_pool *pool);
+void connection_pool_close(struct connection_pool *pool);
+enum mpd_fnscroller_result connection_accept(struct connection_pool *pool,
+                                             int sock_listener);
+int connection_pool_poll(struct connection_pool *pool, int sock_listener,
+                         int wakeup_fd);
+void connection_pool_expire(struct connection_pool *pool);
+
+char *connection_output_reserve(struct mpd_fnscroller_connection *connection,
+                                size_t size);
+enum connection_io_result
+connection_read(struct mpd_fnscroller_connection *connection);
+enum connection_io_result
+connection_write(struct mpd_fnscroller_connection *connection);
+void connection_close(struct connection_pool *pool,
+                      struct mpd_fnscroller_connection *connection);
+
+enum mpd_fnscroller_result
+connection_park(struct connection_pool *pool,
+                struct mpd_fnscroller_connection *connection,
+                unsigned int version, unsigned long long deadline);
+void connection_waiter_release(struct connection_pool *pool,
+                               struct mpd_fnscroller_waiter *waiter,
+                               const char *response, size_t length);
+
+
+#endif /* CONNECTION_H */
@@ -0,0 +1,383 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "format.h"
+
+
+
+
+extern bool debug;
+
+struct format_frame
+{
+    size_t start;
+    bool   missing;
+};
+
+
+static enum mpd_fnscroller_result
+format_op_add(struct mpd_fnscroller_format *format, enum format_op_type type,
+              enum mpd_tag_type tag);
+static enum mpd_fnscroller_result
+format_literal_add(struct mpd_fnscroller_format *format, char c);
+static void format_group_close(struct mpd_fnscroller_format *format,
+                               unsigned int begin);
+static const char *format_file_get(const struct source_song *song);
+
+
+enum mpd_fnscroller_result format_compile(struct mpd_fnscroller_format *format,
+                                          const char *template)
+{
+    unsigned int      groups[FORMAT_DEPTH_MAX + 1];
+    unsigned int      depth = 0;
+    char              tag_name[FORMAT_LITERALS_SIZE];
+    const char        *tag_end = NULL;
+    enum mpd_tag_type tag = MPD_TAG_UNKNOWN;
+
+    memset(format, 0, sizeof(*format));
+
+// Whole template is the outermost group: alternatives work on its top level
+    groups[depth] = format->ops_count;
+    if (!format_op_add(format, FORMAT_OP_GROUP_BEGIN, MPD_TAG_UNKNOWN))
+    {
+        return RESULT_ERROR;
+    }
+
+    for (; *template; ++template)
+    {
+        switch (*template)
+        {
+            case '%':
+                tag_end = strchr(template + 1, '%');
+                if ((tag_end == NULL) ||
+                    (tag_end - template - 1 >= FORMAT_LITERALS_SIZE))
+                {
+                    ERR_("Unterminated tag in format: %s", template)
+                    return RESULT_ERROR;
+                }
+// "%%" is the percent sign itself
+                if (tag_end == template + 1)
+                {
+                    if (!format_literal_add(format, '%'))
+                    {
+                        return RESULT_ERROR;
+                    }
+                    template = tag_end;
+                    break;
+                }
+
+                snprintf(tag_name, FORMAT_LITERALS_SIZE, "%.*s",
+                         (int)(tag_end - template - 1), template + 1);
+                template = tag_end;
+
+                if (strcmp(tag_name, FORMAT_FILE_TAG_NAME) == 0)
+                {
+                    if (!format_op_add(format, FORMAT_OP_FILE,
+                                       MPD_TAG_UNKNOWN))
+                    {
+                        return RESULT_ERROR;
+                    }
+                    break;
+                }
+                tag = mpd_tag_name_iparse(tag_name);
+                if (tag == MPD_TAG_UNKNOWN)
+                {
+                    ERR_("Unknown tag in format: %s", tag_name)
+                    return RESULT_ERROR;
+                }
+                if (!format_op_add(format, FORMAT_OP_TAG, tag))
+                {
+                    return RESULT_ERROR;
+                }
+                break;
+
+            case '[':
+                if (depth == FORMAT_DEPTH_MAX)
+                {
+                    ERR_("Format groups are nested too deep")
+                    return RESULT_ERROR;
+                }
+                groups[++depth] = format->ops_count;
+                if (!format_op_add(format, FORMAT_OP_GROUP_BEGIN,
+                                   MPD_TAG_UNKNOWN))
+                {
+                    return RESULT_ERROR;
+                }
+                break;
+
+            case ']':
+                if (depth == 0)
+                {
+                    ERR_("Unbalanced ']' in format")
+                    return RESULT_ERROR;
+                }
+                if (!format_op_add(format, FORMAT_OP_GROUP_END,
+                                   MPD_TAG_UNKNOWN))
+                {
+                    return RESULT_ERROR;
+                }
+                format_group_close(format, groups[depth--]);
+                break;
+
+            case '|':
+                if (!format_op_add(format, FORMAT_OP_ALTERNATIVE,
+                                   MPD_TAG_UNKNOWN))
+                {
+                    return RESULT_ERROR;
+                }
+                break;
+
+            case '\\':
+                if (template[1])
+                {
+                    ++template;
+                }
+// Fall through: escaped character is a literal
+
+            default:
+                if (!format_literal_add(format, *template))
+                {
+                    return RESULT_ERROR;
+                }
+                break;
+        }
+    }
+
+    if (depth != 0)
+    {
+        ERR_("Unbalanced '[' in format")
+        return RESULT_ERROR;
+    }
+    if (!format_op_add(format, FORMAT_OP_GROUP_END, MPD_TAG_UNKNOWN))
+    {
+        return RESULT_ERROR;
+    }
+    format_group_close(format, groups[0]);
+
+    return RESULT_SUCCESS;
+};
+
+// Called on song changes only: rendering is a single pass over the ops, with
+// no template parsing
+size_t format_render(const struct mpd_fnscroller_format *format,
+                     const struct source_song *song, char *buf, size_t size)
+{
+    struct format_frame    frames[FORMAT_DEPTH_MAX + 1];
+    const struct format_op *op;
+    const char             *value = NULL;
+    unsigned int           depth = 0;
+    unsigned int           i = 0;
+    size_t                 length = 0;
+
+    buf[0] = '\0';
+
+    for (i = 0; i < format->ops_count; ++i)
+    {
+        op = &format->ops[i];
+        switch (op->type)
+        {
+            case FORMAT_OP_LITERAL:
+                length = format_string_append(buf, size, length,
+                                       format->literals + op->offset,
+                                       op->length);
+                break;
+
+            case FORMAT_OP_TAG:
+                value = source_song_tag_get(song, op->tag);
+                if ((value == NULL) || (value[0] == '\0'))
+                {
+                    frames[depth].missing = true;
+                    break;
+                }
+                length = format_string_append(buf, size, length, value,
+                                       strlen(value));
+                break;
+
+            case FORMAT_OP_FILE:
+                value = format_file_get(song);
+                length = format_string_append(buf, size, length, value,
+                                       strlen(value));
+                break;
+
+            case FORMAT_OP_GROUP_BEGIN:
+// Outermost group takes the frame 0
+                if (i > 0)
+                {
+                    ++depth;
+                }
+                frames[depth].start = length;
+                frames[depth].missing = false;
+                break;
+
+            case FORMAT_OP_ALTERNATIVE:
+                if ((!frames[depth].missing) && (length > frames[depth].start))
+                {
+                    i = op->jump - 1;
+                    break;
+                }
+                length = frames[depth].start;
+                frames[depth].missing = false;
+                break;
+
+            case FORMAT_OP_GROUP_END:
+                if (frames[depth].missing)
+                {
+                    length = frames[depth].start;
+                }
+                if (depth > 0)
+                {
+                    --depth;
+                }
+                break;
+
+            default:
+                break;
+        }
+        buf[length] = '\0';
+    }
+
+    if (length == 0)
+    {
+        value = format_file_get(song);
+        length = format_string_append(buf, size, 0, value, strlen(value));
+    }
+
+    return length;
+};
+
+// Cut string never ends in the middle of a UTF-8 sequence: the scroller
+// could not decode it otherwise
+size_t format_string_append(char *buf, size_t size, size_t length,
+                            const char *string, size_t string_length)
+{
+    if (length + string_length >= size)
+    {
+        string_length = size - 1 - length;
+        while ((string_length > 0) &&
+               ((string[string_length] & 0xc0) == 0x80))
+        {
+            --string_length;
+        }
+    }
+    memcpy(buf + length, string, string_length);
+    buf[length + string_length] = '\0';
+
+    return length + string_length;
+};
+
+
+static enum mpd_fnscroller_result
+format_op_add(struct mpd_fnscroller_format *format, enum format_op_type type,
+              enum mpd_tag_type tag)
+{
+    if (format->ops_count == FORMAT_OPS_MAX)
+    {
+        ERR_("Format is too long")
+        return RESULT_ERROR;
+    }
+
+    format->ops[format->ops_count].type = type;
+    format->ops[format->ops_count].tag = tag;
+    format->ops[format->ops_count].offset = format->literals_length;
+    format->ops[format->ops_count].length = 0;
+    format->ops[format->ops_count].jump = 0;
+    ++format->ops_count;
+
+    return RESULT_SUCCESS;
+};
+
+// Adjacent literal characters make up a single op
+static enum mpd_fnscroller_result
+format_literal_add(struct mpd_fnscroller_format *format, char c)
+{
+    if (format->literals_length == FORMAT_LITERALS_SIZE)
+    {
+        ERR_("Format is too long")
+        return RESULT_ERROR;
+    }
+
+    if ((format->ops_count == 0) ||
+        (format->ops[format->ops_count - 1].type != FORMAT_OP_LITERAL))
+    {
+        if (!format_op_add(format, FORMAT_OP_LITERAL, MPD_TAG_UNKNOWN))
+        {
+            return RESULT_ERROR;
+        }
+    }
+    format->literals[format->literals_length++] = c;
+    ++format->ops[format->ops_count - 1].length;
+
+    return RESULT_SUCCESS;
+};
+
+// Points the alternatives of the group which has just been closed to its end
+static void format_group_close(struct mpd_fnscroller_format *format,
+                               unsigned int begin)
+{
+    unsigned int end = format->ops_count - 1;
+    unsigned int nesting = 0;
+    unsigned int i = 0;
+
+    for (i = begin + 1; i < end; ++i)
+    {
+        switch (format->ops[i].type)
+        {
+            case FORMAT_OP_GROUP_BEGIN:
+                ++nesting;
+                break;
+
+            case FORMAT_OP_GROUP_END:
+                --nesting;
+                break;
+
+            case FORMAT_OP_ALTERNATIVE:
+                if (nesting == 0)
+                {
+                    format->ops[i].jump = end;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return;
+};
+
+static const char *format_file_get(const struct source_song *song)
+{
+    const char *uri = song->uri;
+    const char *slash = strrchr(uri, '/');
+
+    return slash ? slash + 1 : uri;
+};
@@ -0,0 +1,89 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+
+#include <stddef.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "source.h"
+
+
+
+
+#define FORMAT_DEFAULT_STRING "%file%"
+#define FORMAT_FILE_TAG_NAME  "file"
+#define FORMAT_OPS_MAX        64
+#define FORMAT_LITERALS_SIZE  256
+#define FORMAT_DEPTH_MAX      8
+
+
+enum format_op_type
+{
+    FORMAT_OP_LITERAL = 0,
+    FORMAT_OP_TAG,
+    FORMAT_OP_FILE,
+    FORMAT_OP_GROUP_BEGIN,
+    FORMAT_OP_ALTERNATIVE,
+    FORMAT_OP_GROUP_END,
+    FORMAT_OP_COUNT
+};
+
+// Literal is a slice of the literal pool, alternative jumps to the end of its
+// group once one of the alternatives has been rendered
+struct format_op
+{
+    enum format_op_type type;
+    enum mpd_tag_type   tag;
+    unsigned short      offset;
+    unsigned short      length;
+    unsigned short      jump;
+};
+
+// Template like "[%artist% - ]%title%[ (%album%)]|%file%" compiled into a flat
+// list of ops. A group in brackets is dropped when any of its tags is
+// missing, "|" separates the alternatives tried one after another. The file
+// name is the last resort when nothing is left.
+struct mpd_fnscroller_format
+{
+    struct format_op ops[FORMAT_OPS_MAX];
+    unsigned int     ops_count;
+    char             literals[FORMAT_LITERALS_SIZE];
+    unsigned int     literals_length;
+};
+
+
+enum mpd_fnscroller_result format_compile(struct mpd_fnscroller_format *format,
+                                          const char *template);
+size_t format_render(const struct mpd_fnscroller_format *format,
+                     const struct source_song *song, char *buf, size_t size);
+size_t format_string_append(char *buf, size_t size, size_t length,
+                            const char *string, size_t string_length);
+
+
+#endif /* FORMAT_H */
@@ -0,0 +1,247 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "handover.h"
+
+
+
+
+extern bool debug;
+extern char *handoverfile_path;
+
+
+enum mpd_fnscroller_result
+handover_receive(struct mpd_fnscroller_snapshot *snapshot, int *sock_listener)
+{
+    struct sockaddr_un handover_sockaddr;
+    struct pollfd      pollfd;
+    struct ucred       peer_credentials;
+    struct msghdr      msg;
+    struct iovec       iov;
+    struct cmsghdr     *cmsg;
+    union
+    {
+        char           buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    socklen_t          socklen = sizeof(struct ucred);
+    pid_t              server_pid = 0;
+    int                sock_handover = 0;
+    int                sock_connection = 0;
+    ssize_t            bytes_received = 0;
+
+    TRACE_()
+
+    if (!server_pid_get(&server_pid))
+    {
+        ERR_("There is no running server instance to take over")
+        return RESULT_ERROR;
+    }
+
+    unlink(handoverfile_path);
+    sock_handover = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock_handover == -1)
+    {
+        ERR_("Issue creating handover socket")
+        return RESULT_ERROR;
+    }
+
+    memset(&handover_sockaddr, 0, sizeof(handover_sockaddr));
+    handover_sockaddr.sun_family = AF_UNIX;
+    strncpy(handover_sockaddr.sun_path, handoverfile_path,
+            SUN_PATH_STRING_SIZE);
+    if ((bind(sock_handover, (struct sockaddr *)&handover_sockaddr,
+              sizeof(handover_sockaddr)) == -1) ||
+        (listen(sock_handover, 1) == -1))
+    {
+        ERR_("Issue binding handover socket")
+        close(sock_handover);
+        return RESULT_ERROR;
+    }
+
+    if (kill(server_pid, SIGUSR2) == -1)
+    {
+        ERR_("Could not send SIGUSR2 to server process")
+        close(sock_handover);
+        unlink(handoverfile_path);
+        return RESULT_ERROR;
+    }
+
+    pollfd.fd = sock_handover;
+    pollfd.events = POLLIN;
+    if (poll(&pollfd, 1, HANDOVER_TIMEOUT * 1000) != 1)
+    {
+        ERR_("Server instance did not respond to the handover request")
+        close(sock_handover);
+        unlink(handoverfile_path);
+        return RESULT_ERROR;
+    }
+    sock_connection = accept(sock_handover, NULL, NULL);
+    close(sock_handover);
+    unlink(handoverfile_path);
+    if (sock_connection == -1)
+    {
+        ERR_("Issue accepting handover connection")
+        return RESULT_ERROR;
+    }
+
+// Only the same user is allowed to pass its listening socket
+    if ((getsockopt(sock_connection, SOL_SOCKET, SO_PEERCRED,
+                    &peer_credentials, &socklen) == -1) ||
+        (peer_credentials.uid != getuid()))
+    {
+        ERR_("Handover peer credentials check failed")
+        close(sock_connection);
+        return RESULT_ERROR;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = snapshot;
+    iov.iov_len = sizeof(*snapshot);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    pollfd.fd = sock_connection;
+    if (poll(&pollfd, 1, HANDOVER_TIMEOUT * 1000) != 1)
+    {
+        ERR_("Timed out waiting for the handover message")
+        close(sock_connection);
+        return RESULT_ERROR;
+    }
+    bytes_received = recvmsg(sock_connection, &msg, MSG_WAITALL |
+                             MSG_CMSG_CLOEXEC);
+    close(sock_connection);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if ((cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) ||
+        (cmsg->cmsg_type != SCM_RIGHTS) ||
+        (cmsg->cmsg_len != CMSG_LEN(sizeof(int))))
+    {
+        ERR_("Handover message does not carry the listening socket")
+        return RESULT_ERROR;
+    }
+    memcpy(sock_listener, CMSG_DATA(cmsg), sizeof(int));
+
+// The socket is ours from now on, even if the state is not usable
+    if ((bytes_received != sizeof(*snapshot)) ||
+        (snapshot->layout_version != SNAPSHOT_LAYOUT_VERSION))
+    {
+        syslog(LOG_WARNING, "Handover snapshot is not compatible; starting "
+               "with an empty state");
+        memset(snapshot, 0, sizeof(*snapshot));
+        snapshot->layout_version = SNAPSHOT_LAYOUT_VERSION;
+    }
+    snapshot->fn_string[FILENAME_STRING_SIZE - 1] = '\0';
+
+    DEBUG_("Took over socket %d; fn_string: %s", *sock_listener,
+           snapshot->fn_string)
+
+    return RESULT_SUCCESS;
+};
+
+int handover_connect(void)
+{
+    struct sockaddr_un handover_sockaddr;
+    int                sock_handover = 0;
+
+    sock_handover = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock_handover == -1)
+    {
+        ERR_("Issue creating handover socket")
+        return -1;
+    }
+
+    memset(&handover_sockaddr, 0, sizeof(handover_sockaddr));
+    handover_sockaddr.sun_family = AF_UNIX;
+    strncpy(handover_sockaddr.sun_path, handoverfile_path,
+            SUN_PATH_STRING_SIZE);
+    if (connect(sock_handover, (struct sockaddr *)&handover_sockaddr,
+                sizeof(handover_sockaddr)) == -1)
+    {
+        ERR_("Issue connecting to the new server instance")
+        close(sock_handover);
+        return -1;
+    }
+
+    return sock_handover;
+};
+
+enum mpd_fnscroller_result
+handover_send(int sock_handover,
+              const struct mpd_fnscroller_snapshot *snapshot,
+              int sock_listener)
+{
+    struct msghdr  msg;
+    struct iovec   iov;
+    struct cmsghdr *cmsg;
+    union
+    {
+        char           buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    ssize_t        bytes_sent = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = (void *)snapshot;
+    iov.iov_len = sizeof(*snapshot);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sock_listener, sizeof(int));
+
+    bytes_sent = sendmsg(sock_handover, &msg, MSG_NOSIGNAL);
+    close(sock_handover);
+    if (bytes_sent != sizeof(*snapshot))
+    {
+        ERR_("Could not send handover message; bytes_sent: %ld", bytes_sent)
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
@@ -0,0 +1,449 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "format.h"
+#include "history.h"
+
+
+
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x100000001b3ULL
+
+
+extern bool debug;
+
+struct history_top_entry
+{
+    uint64_t     hash;
+    unsigned int plays;
+    uint64_t     index;
+};
+
+
+static enum mpd_fnscroller_result
+history_map(struct mpd_fnscroller_history *history, size_t size);
+static enum mpd_fnscroller_result
+history_grow(struct mpd_fnscroller_history *history);
+static void history_append(struct mpd_fnscroller_history *history,
+                           const struct history_record *record);
+static void history_sync(struct mpd_fnscroller_history *history);
+static size_t history_line_print(const struct history_record *record,
+                                 unsigned int plays, char *buf, size_t size);
+static uint64_t history_hash_get(const char *string);
+
+
+enum mpd_fnscroller_result
+history_open(struct mpd_fnscroller_history *history, const char *path)
+{
+    struct stat stat_buffer;
+    size_t      size = 0;
+    bool        created = false;
+
+    memset(history, 0, sizeof(*history));
+    pthread_mutex_init(&history->lock, NULL);
+
+    history->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if ((history->fd == -1) || (fstat(history->fd, &stat_buffer) == -1))
+    {
+        ERR_("Could not open history file %s", path)
+        return RESULT_ERROR;
+    }
+
+    size = stat_buffer.st_size;
+    if (size == 0)
+    {
+        size = sizeof(struct history_file_header) +
+               HISTORY_GROW_RECORDS * sizeof(struct history_record);
+        if (ftruncate(history->fd, size) == -1)
+        {
+            ERR_("Could not allocate history file %s", path)
+            close(history->fd);
+            return RESULT_ERROR;
+        }
+        created = true;
+    }
+    else if (size < sizeof(struct history_file_header))
+    {
+        ERR_("History file %s is truncated", path)
+        close(history->fd);
+        return RESULT_ERROR;
+    }
+
+    if (!history_map(history, size))
+    {
+        close(history->fd);
+        return RESULT_ERROR;
+    }
+
+    if (created)
+    {
+        memcpy(history->header->magic, HISTORY_MAGIC, HISTORY_MAGIC_SIZE);
+        history->header->version = HISTORY_FORMAT_VERSION;
+        history->header->record_size = sizeof(struct history_record);
+        history->header->count = 0;
+    }
+    else if ((memcmp(history->header->magic, HISTORY_MAGIC,
+                     HISTORY_MAGIC_SIZE)) ||
+             (history->header->version != HISTORY_FORMAT_VERSION) ||
+             (history->header->record_size != sizeof(struct history_record)))
+    {
+        ERR_("%s is not a history file of version %d", path,
+             HISTORY_FORMAT_VERSION)
+        history_close(history);
+        return RESULT_ERROR;
+    }
+
+// Count is written after the record: a crash could only lose the last one
+    if (history->header->count > history->capacity)
+    {
+        history->header->count = history->capacity;
+    }
+    history->synced_count = history->header->count;
+    history->synced_time = monotonic_time_get();
+
+    syslog(LOG_INFO, "History of %llu plays in %s",
+           (unsigned long long)history->header->count, path);
+
+    return RESULT_SUCCESS;
+};
+
+void history_close(struct mpd_fnscroller_history *history)
+{
+    if (history->header == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&history->lock);
+    msync(history->header, history->map_size, MS_SYNC);
+    munmap(history->header, history->map_size);
+    history->header = NULL;
+    history->records = NULL;
+    close(history->fd);
+    pthread_mutex_unlock(&history->lock);
+
+    return;
+};
+
+// Called on every status received from MPD. Play of the previous song is
+// appended once another song (or nothing) is played: only then its played
+// duration is known.
+void history_player_update(struct mpd_fnscroller_history *history,
+                           bool playing, const char *uri,
+                           unsigned int song_id, unsigned int duration_ms,
+                           const char *title)
+{
+    struct history_play *play = &history->play;
+    unsigned long long  now = monotonic_time_get();
+    uint64_t            hash = 0;
+
+    if (history->header == NULL)
+    {
+        return;
+    }
+    if (uri)
+    {
+        hash = history_hash_get(uri);
+    }
+
+    pthread_mutex_lock(&history->lock);
+    if ((play->active) && (play->playing))
+    {
+        play->record.played_ms += now - play->updated;
+    }
+    if ((play->active) &&
+        ((uri == NULL) || (hash != play->record.hash) ||
+         (song_id != play->record.song_id)))
+    {
+        if (play->record.played_ms >= HISTORY_PLAYED_MIN_MS)
+        {
+            history_append(history, &play->record);
+        }
+        play->active = false;
+    }
+    if ((uri) && (!play->active))
+    {
+        memset(&play->record, 0, sizeof(play->record));
+        play->record.timestamp = time(NULL);
+        play->record.hash = hash;
+        play->record.song_id = song_id;
+        play->record.duration_ms = duration_ms;
+        format_string_append(play->record.title, HISTORY_TITLE_SIZE, 0,
+                             title, strlen(title));
+        play->active = true;
+    }
+    play->playing = playing;
+    play->updated = now;
+    pthread_mutex_unlock(&history->lock);
+
+    return;
+};
+
+// Last plays, the most recent first
+size_t history_last_get(struct mpd_fnscroller_history *history,
+                        unsigned int count, char *buf, size_t size)
+{
+    uint64_t index = 0;
+    size_t   length = 0;
+
+    buf[0] = '\0';
+    if (history->header == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&history->lock);
+    for (index = history->header->count; (index > 0) && (count > 0);
+         --index, --count)
+    {
+        length += history_line_print(&history->records[index - 1], 0,
+                                     buf + length, size - length);
+    }
+    pthread_mutex_unlock(&history->lock);
+
+    return length;
+};
+
+// Songs played the most during the last week. Records are walked back from
+// the end while they are recent enough and counted in a small open addressing
+// table keyed by the song hash.
+size_t history_top_get(struct mpd_fnscroller_history *history,
+                       unsigned int count, char *buf, size_t size)
+{
+    static struct history_top_entry table[HISTORY_TOP_TABLE_SIZE];
+    struct history_top_entry        *top = NULL;
+    time_t                          since = time(NULL) - HISTORY_TOP_PERIOD;
+    uint64_t                        index = 0;
+    unsigned int                    slot = 0;
+    unsigned int                    used = 0;
+    unsigned int                    i = 0;
+    size_t                          length = 0;
+
+    buf[0] = '\0';
+    if (history->header == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&history->lock);
+    memset(table, 0, sizeof(table));
+    for (index = history->header->count;
+         (index > 0) && (history->records[index - 1].timestamp >= since) &&
+         (used < HISTORY_TOP_TABLE_SIZE / 2); --index)
+    {
+        slot = history->records[index - 1].hash % HISTORY_TOP_TABLE_SIZE;
+        while ((table[slot].plays) &&
+               (table[slot].hash != history->records[index - 1].hash))
+        {
+            slot = (slot + 1) % HISTORY_TOP_TABLE_SIZE;
+        }
+        if (table[slot].plays == 0)
+        {
+            table[slot].hash = history->records[index - 1].hash;
+            table[slot].index = index - 1;
+            ++used;
+        }
+        ++table[slot].plays;
+    }
+
+// Selection of the top entries: the count is small, the table is sparse
+    for (; count > 0; --count)
+    {
+        top = NULL;
+        for (i = 0; i < HISTORY_TOP_TABLE_SIZE; ++i)
+        {
+            if ((table[i].plays) && ((top == NULL) ||
+                                     (table[i].plays > top->plays) ||
+                                     ((table[i].plays == top->plays) &&
+                                      (table[i].index > top->index))))
+            {
+                top = &table[i];
+            }
+        }
+        if (top == NULL)
+        {
+            break;
+        }
+        length += history_line_print(&history->records[top->index],
+                                     top->plays, buf + length, size - length);
+        top->plays = 0;
+    }
+    pthread_mutex_unlock(&history->lock);
+
+    return length;
+};
+
+
+static enum mpd_fnscroller_result
+history_map(struct mpd_fnscroller_history *history, size_t size)
+{
+    void *map = NULL;
+
+    if (history->header)
+    {
+        map = mremap(history->header, history->map_size, size, MREMAP_MAYMOVE);
+    }
+    else
+    {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   history->fd, 0);
+    }
+    if (map == MAP_FAILED)
+    {
+        ERR_("Could not map history file")
+        return RESULT_ERROR;
+    }
+
+    history->header = map;
+    history->records = (struct history_record *)(history->header + 1);
+    history->map_size = size;
+    history->capacity = (size - sizeof(struct history_file_header)) /
+                        sizeof(struct history_record);
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result
+history_grow(struct mpd_fnscroller_history *history)
+{
+    size_t size = history->map_size +
+                  HISTORY_GROW_RECORDS * sizeof(struct history_record);
+
+    if (ftruncate(history->fd, size) == -1)
+    {
+        ERR_("Could not grow history file")
+        return RESULT_ERROR;
+    }
+
+    return history_map(history, size);
+};
+
+// Called with the lock held
+static void history_append(struct mpd_fnscroller_history *history,
+                           const struct history_record *record)
+{
+    if ((history->header->count == history->capacity) &&
+        (!history_grow(history)))
+    {
+        return;
+    }
+
+    history->records[history->header->count] = *record;
+    ++history->header->count;
+
+    TRACEPOINT_("history count: %lld; played_ms: %lld",
+                history->header->count, record->played_ms)
+
+// Dirty pages are written back by the kernel anyway: msync only bounds the
+// loss on a system crash, so it is done in batches
+    if ((history->header->count - history->synced_count >=
+         HISTORY_SYNC_RECORDS) ||
+        (monotonic_time_get() - history->synced_time >=
+         HISTORY_SYNC_INTERVAL_MS))
+    {
+        history_sync(history);
+    }
+
+    return;
+};
+
+// Only the pages of the records appended since the last sync and the header
+static void history_sync(struct mpd_fnscroller_history *history)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t start = sizeof(struct history_file_header) +
+                   history->synced_count * sizeof(struct history_record);
+    size_t end = sizeof(struct history_file_header) +
+                 history->header->count * sizeof(struct history_record);
+
+    start -= start % page_size;
+    msync((char *)history->header + start, end - start, MS_SYNC);
+    if (start > 0)
+    {
+        msync(history->header, page_size, MS_SYNC);
+    }
+
+    history->synced_count = history->header->count;
+    history->synced_time = monotonic_time_get();
+
+    return;
+};
+
+static size_t history_line_print(const struct history_record *record,
+                                 unsigned int plays, char *buf, size_t size)
+{
+    struct tm tm_buffer;
+    time_t    timestamp = record->timestamp;
+    char      time_string[sizeof("YYYY-MM-DD HH:MM")];
+    int       length = 0;
+
+    if (plays)
+    {
+        length = snprintf(buf, size, "%u %.*s\n", plays, HISTORY_TITLE_SIZE,
+                          record->title);
+    }
+    else
+    {
+        localtime_r(&timestamp, &tm_buffer);
+        strftime(time_string, sizeof(time_string), "%Y-%m-%d %H:%M",
+                 &tm_buffer);
+        length = snprintf(buf, size, "%s %.*s\n", time_string,
+                          HISTORY_TITLE_SIZE, record->title);
+    }
+
+    return ((length > 0) && ((size_t)length < size)) ? length : 0;
+};
+
+// FNV-1a: songs are told apart by their URI
+static uint64_t history_hash_get(const char *string)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (; *string; ++string)
+    {
+        hash ^= (unsigned char)*string;
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+};
@@ -0,0 +1,117 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mpd-fnscroller.h"
+
+
+
+
+#define HISTORY_MAGIC            "MFSH"
+#define HISTORY_MAGIC_SIZE       4
+#define HISTORY_FORMAT_VERSION   1
+#define HISTORY_RECORD_SIZE      128
+#define HISTORY_TITLE_SIZE       (HISTORY_RECORD_SIZE - 28)
+#define HISTORY_GROW_RECORDS     4096
+#define HISTORY_SYNC_RECORDS     16
+#define HISTORY_SYNC_INTERVAL_MS (15 * 60 * 1000)
+#define HISTORY_PLAYED_MIN_MS    1000
+#define HISTORY_QUERY_MAX        100
+#define HISTORY_TOP_PERIOD       (7 * 24 * 60 * 60)
+#define HISTORY_TOP_TABLE_SIZE   4096
+#define HISTORY_LINE_SIZE        (HISTORY_TITLE_SIZE + 32)
+
+
+// Play of a single song, written when it is over. Fixed size records are
+// answered from the mapping as they are: no parsing at all.
+struct history_record
+{
+    uint64_t timestamp;
+    uint64_t hash;
+    uint32_t song_id;
+    uint32_t duration_ms;
+    uint32_t played_ms;
+    char     title[HISTORY_TITLE_SIZE];
+} __attribute__((packed));
+
+// Header takes the place of the first record: the records stay aligned
+struct history_file_header
+{
+    char     magic[HISTORY_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t count;
+    char     padding[HISTORY_RECORD_SIZE - 24];
+} __attribute__((packed));
+
+// Song which is being played now: it becomes a record once it is changed
+struct history_play
+{
+    bool                  active;
+    bool                  playing;
+    struct history_record record;
+    unsigned long long    updated;
+};
+
+// Append-only play history in a shared file mapping, synced in batches
+struct mpd_fnscroller_history
+{
+    int                        fd;
+    struct history_file_header *header;
+    struct history_record      *records;
+    size_t                     map_size;
+    uint64_t                   capacity;
+
+    uint64_t                   synced_count;
+    unsigned long long         synced_time;
+
+    struct history_play        play;
+    pthread_mutex_t            lock;
+};
+
+
+enum mpd_fnscroller_result
+history_open(struct mpd_fnscroller_history *history, const char *path);
+void history_close(struct mpd_fnscroller_history *history);
+void history_player_update(struct mpd_fnscroller_history *history,
+                           bool playing, const char *uri,
+                           unsigned int song_id, unsigned int duration_ms,
+                           const char *title);
+size_t history_last_get(struct mpd_fnscroller_history *history,
+                        unsigned int count, char *buf, size_t size);
+size_t history_top_get(struct mpd_fnscroller_history *history,
+                       unsigned int count, char *buf, size_t size);
+
+
+#endif /* HISTORY_H */
@@ -0,0 +1,385 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <spawn.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "hook.h"
+
+
+
+
+extern bool debug;
+extern char **environ;
+
+
+static void hook_helper_run(struct mpd_fnscroller_hook *hook);
+static unsigned int hook_spawn(struct mpd_fnscroller_hook *hook, char **envp,
+                               size_t env_count, char *message,
+                               size_t length);
+static size_t hook_variable_append(char *message, size_t length,
+                                   const char *name, const char *value);
+
+
+void hook_init(struct mpd_fnscroller_hook *hook)
+{
+    memset(hook, 0, sizeof(*hook));
+    hook->helper_pid = -1;
+    hook->sock = -1;
+    hook->state = MPD_STATE_UNKNOWN;
+
+    return;
+};
+
+enum mpd_fnscroller_result
+hook_command_add(struct mpd_fnscroller_hook *hook, char *command)
+{
+    if (hook->command_count == HOOK_COMMAND_MAX)
+    {
+        ERR_("Too many hook commands, at most %d are allowed",
+             HOOK_COMMAND_MAX)
+        return RESULT_ERROR;
+    }
+    hook->commands[hook->command_count++] = command;
+
+    return RESULT_SUCCESS;
+};
+
+// Must be called before any thread is started
+enum mpd_fnscroller_result hook_start(struct mpd_fnscroller_hook *hook)
+{
+    int sv[2];
+
+    if (hook->command_count == 0)
+    {
+        return RESULT_SUCCESS;
+    }
+
+// Datagrams keep the events apart: one event is one message
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+        ERR_("Could not create the hook helper socket")
+        return RESULT_ERROR;
+    }
+
+    hook->helper_pid = fork();
+    if (hook->helper_pid == -1)
+    {
+        ERR_("Could not fork the hook helper")
+        close(sv[0]);
+        close(sv[1]);
+        return RESULT_ERROR;
+    }
+    if (hook->helper_pid == 0)
+    {
+        close(sv[0]);
+        hook->sock = sv[1];
+        hook_helper_run(hook);
+    }
+
+    close(sv[1]);
+    hook->sock = sv[0];
+    DEBUG_("Hook helper pid: %d", hook->helper_pid)
+
+    return RESULT_SUCCESS;
+};
+
+// Helper exits once the hooks pending are started
+void hook_stop(struct mpd_fnscroller_hook *hook)
+{
+    if (hook->sock == -1)
+    {
+        return;
+    }
+    close(hook->sock);
+    hook->sock = -1;
+
+    return;
+};
+
+void hook_player_update(struct mpd_fnscroller_hook *hook,
+                        enum mpd_state state,
+                        const struct source_song *song,
+                        unsigned int duration_ms)
+{
+    char        message[HOOK_MESSAGE_SIZE];
+    char        number[16];
+    const char  *event = NULL;
+    const char  *state_name = "stop";
+    size_t      length = 0;
+    bool        song_changed = false;
+
+    if (hook->sock == -1)
+    {
+        return;
+    }
+
+    song_changed = (song) && ((song->id != hook->song_id) ||
+                              (strcmp(song->uri, hook->uri)));
+    if (song_changed)
+    {
+        event = "song";
+        snprintf(hook->uri, PATH_STRING_SIZE, "%s", song->uri);
+        hook->song_id = song->id;
+    }
+    else if (state != hook->state)
+    {
+        event = "state";
+    }
+    else
+    {
+        return;
+    }
+    hook->state = state;
+    if (song == NULL)
+    {
+        hook->uri[0] = '\0';
+    }
+
+    if (state == MPD_STATE_PLAY)
+    {
+        state_name = "play";
+    }
+    else if (state == MPD_STATE_PAUSE)
+    {
+        state_name = "pause";
+    }
+
+    length = hook_variable_append(message, length, "EVENT", event);
+    length = hook_variable_append(message, length, "STATE", state_name);
+    if (song)
+    {
+        length = hook_variable_append(message, length, "URI", song->uri);
+        length = hook_variable_append(message, length, "ARTIST",
+                                      source_song_tag_get(song,
+                                                          MPD_TAG_ARTIST));
+        length = hook_variable_append(message, length, "ALBUM",
+                                      source_song_tag_get(song,
+                                                          MPD_TAG_ALBUM));
+        length = hook_variable_append(message, length, "TITLE",
+                                      source_song_tag_get(song,
+                                                          MPD_TAG_TITLE));
+        snprintf(number, sizeof(number), "%u", duration_ms / 1000);
+        length = hook_variable_append(message, length, "DURATION", number);
+        snprintf(number, sizeof(number), "%u", song->id);
+        length = hook_variable_append(message, length, "SONG_ID", number);
+    }
+
+// Never blocks the event loop: when the helper is behind, the event would
+// be coalesced with the next ones anyway
+    if (send(hook->sock, message, length, MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        {
+            DEBUG_("Hook helper is busy, event dropped")
+            return;
+        }
+        ERR_("Hook helper is gone, hooks are disabled")
+        hook_stop(hook);
+    }
+
+    return;
+};
+
+
+// The latest event is kept pending until no other one is received for
+// HOOK_COALESCE_MS: skipping through the queue runs the hooks only once, for
+// the song which is eventually played
+static void hook_helper_run(struct mpd_fnscroller_hook *hook)
+{
+    struct pollfd      pfd = {.fd = hook->sock, .events = POLLIN};
+    char               message[HOOK_MESSAGE_SIZE];
+    ssize_t            length = 0;
+    ssize_t            received_length = 0;
+    bool               pending = false;
+    unsigned long long received = 0;
+    unsigned long long now = 0;
+    unsigned int       running = 0;
+    int                timeout = 0;
+    char               **envp = NULL;
+    size_t             env_count = 0;
+
+// Nothing of the daemon is needed: the listener, the pidfile and the rest
+// must not leak into the hooks
+    if (((hook->sock > STDERR_FILENO + 1) &&
+         (close_range(STDERR_FILENO + 1, hook->sock - 1, 0) == -1)) ||
+        (close_range(hook->sock + 1, ~0U, 0) == -1))
+    {
+        ERR_("Could not close the descriptors of the daemon")
+    }
+    signal(SIGUSR1, SIG_DFL);
+    signal(SIGUSR2, SIG_DFL);
+
+    while (environ[env_count])
+    {
+        ++env_count;
+    }
+    envp = malloc((env_count + HOOK_VARIABLE_MAX + 1) * sizeof(char *));
+    if (envp == NULL)
+    {
+        _exit(EXIT_FAILURE);
+    }
+    memcpy(envp, environ, env_count * sizeof(char *));
+
+    while ((pfd.fd != -1) || (pending))
+    {
+        timeout = -1;
+        if (pending)
+        {
+            now = monotonic_time_get();
+            timeout = (now - received >= HOOK_COALESCE_MS) ?
+                      0 : HOOK_COALESCE_MS - (now - received);
+// Event held back by the cap waits for the running hooks to be reaped
+            if ((timeout == 0) &&
+                (running + hook->command_count > HOOK_RUNNING_MAX))
+            {
+                timeout = HOOK_REAP_INTERVAL_MS;
+            }
+        }
+        if ((running) && ((timeout == -1) || (timeout > HOOK_REAP_INTERVAL_MS)))
+        {
+            timeout = HOOK_REAP_INTERVAL_MS;
+        }
+
+        if ((poll(&pfd, 1, timeout) == -1) && (errno != EINTR))
+        {
+            break;
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            received_length = recv(pfd.fd, message, HOOK_MESSAGE_SIZE, 0);
+            if (received_length > 0)
+            {
+                length = received_length;
+                pending = true;
+                received = monotonic_time_get();
+            }
+            else
+            {
+// Daemon is gone: the last event pending is still delivered
+                close(pfd.fd);
+                pfd.fd = -1;
+            }
+        }
+        pfd.revents = 0;
+
+        while ((running) && (waitpid(-1, NULL, WNOHANG) > 0))
+        {
+            --running;
+        }
+
+        if ((pending) &&
+            (monotonic_time_get() - received >= HOOK_COALESCE_MS) &&
+            (running + hook->command_count <= HOOK_RUNNING_MAX))
+        {
+            running += hook_spawn(hook, envp, env_count, message, length);
+            pending = false;
+        }
+    }
+
+    _exit(EXIT_SUCCESS);
+};
+
+// Commands are run by the shell with the event appended to the environment
+static unsigned int hook_spawn(struct mpd_fnscroller_hook *hook, char **envp,
+                               size_t env_count, char *message,
+                               size_t length)
+{
+    posix_spawnattr_t attr;
+    sigset_t          signals;
+    char              *argv[] = {"sh", "-c", NULL, NULL};
+    size_t            count = env_count;
+    size_t            offset = 0;
+    unsigned int      spawned = 0;
+    unsigned int      i = 0;
+    pid_t             pid = 0;
+
+    while ((offset < length) && (count < env_count + HOOK_VARIABLE_MAX))
+    {
+        envp[count++] = message + offset;
+        offset += strlen(message + offset) + 1;
+    }
+    envp[count] = NULL;
+
+    posix_spawnattr_init(&attr);
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                             POSIX_SPAWN_SETSIGMASK);
+
+    for (i = 0; i < hook->command_count; ++i)
+    {
+        argv[2] = hook->commands[i];
+        if (posix_spawn(&pid, "/bin/sh", NULL, &attr, argv, envp) == 0)
+        {
+            ++spawned;
+        }
+        else
+        {
+            ERR_("Could not run hook: %s", hook->commands[i])
+        }
+    }
+    posix_spawnattr_destroy(&attr);
+
+    return spawned;
+};
+
+// Variables which do not fit are left out, the message stays well-formed
+static size_t hook_variable_append(char *message, size_t length,
+                                   const char *name, const char *value)
+{
+    int written = 0;
+
+    if (value == NULL)
+    {
+        return length;
+    }
+    written = snprintf(message + length, HOOK_MESSAGE_SIZE - length,
+                       HOOK_ENV_PREFIX "%s=%s", name, value);
+    if ((written < 0) || ((size_t)written >= HOOK_MESSAGE_SIZE - length))
+    {
+        return length;
+    }
+
+    return length + written + 1;
+};
@@ -0,0 +1,78 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef HOOK_H
+#define HOOK_H
+
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "source.h"
+
+
+
+
+#define HOOK_COMMAND_MAX      4
+#define HOOK_RUNNING_MAX      8
+#define HOOK_COALESCE_MS      500
+#define HOOK_REAP_INTERVAL_MS 100
+#define HOOK_VARIABLE_MAX     8
+#define HOOK_MESSAGE_SIZE     (PATH_STRING_SIZE + 4096)
+#define HOOK_ENV_PREFIX       "MPD_FNSCROLLER_"
+
+
+// Commands run on song and state changes with the metadata in the
+// environment. They are spawned by a helper process forked at the start,
+// while the daemon is still small and single-threaded: the daemon itself only
+// sends the events to it.
+struct mpd_fnscroller_hook
+{
+    char           *commands[HOOK_COMMAND_MAX];
+    unsigned int   command_count;
+
+    pid_t          helper_pid;
+    int            sock;
+
+    enum mpd_state state;
+    char           uri[PATH_STRING_SIZE];
+    unsigned int   song_id;
+};
+
+
+void hook_init(struct mpd_fnscroller_hook *hook);
+enum mpd_fnscroller_result
+hook_command_add(struct mpd_fnscroller_hook *hook, char *command);
+enum mpd_fnscroller_result hook_start(struct mpd_fnscroller_hook *hook);
+void hook_stop(struct mpd_fnscroller_hook *hook);
+void hook_player_update(struct mpd_fnscroller_hook *hook,
+                        enum mpd_state state,
+                        const struct source_song *song,
+                        unsigned int duration_ms);
+
+
+#endif /* HOOK_H */
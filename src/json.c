@@ -0,0 +1,171 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "mpd-fnscroller.h"
+#include "libmpdfnscroller.h"
+#include "utf8.h"
+#include "json.h"
+
+
+
+
+extern bool debug;
+
+
+static size_t json_character_escape(wchar_t character, char *buf,
+                                    size_t size);
+
+
+void json_title_set(struct mpd_fnscroller_json *json,
+                    const struct mpdfnscroller *scroller)
+{
+    wchar_t      character = L'\0';
+    unsigned int length = 0;
+    unsigned int i = 0;
+    unsigned int j = 0;
+
+    json->length = scroller->length;
+    json->period = scroller->length + scroller->delimiter_length;
+
+    for (i = 0; i < 2 * json->period; ++i)
+    {
+        j = i % json->period;
+        character = (j < scroller->length) ?
+                    scroller->title[j] :
+                    scroller->delimiter[j - scroller->length];
+        json->offsets[i] = length;
+        length += json_character_escape(character, json->escaped + length,
+                                        JSON_ESCAPED_SIZE - length);
+    }
+    json->offsets[2 * json->period] = length;
+
+    return;
+};
+
+// Full text is the frame of the marquee followed by the progress, short
+// text is the beginning of the title for the bars running out of space. The
+// scroller measures both, the title it has been set from.
+size_t json_frame_render(const struct mpd_fnscroller_json *json,
+                         const struct mpdfnscroller *scroller,
+                         unsigned int offset, unsigned int width,
+                         const char *progress, const char *color, char *buf,
+                         size_t size)
+{
+    unsigned int full_end = offset + mpdfnscroller_frame_length(scroller,
+                                                                width,
+                                                                offset);
+    unsigned int short_width = width / 2;
+    unsigned int short_end = mpdfnscroller_frame_length(scroller, short_width,
+                                                        0);
+    const char   *ellipsis = "";
+    int          length = 0;
+
+    if (short_end < json->length)
+    {
+        short_end = (short_width > 1) ?
+                    mpdfnscroller_frame_length(scroller, short_width - 1, 0) :
+                    0;
+        ellipsis = short_width ? JSON_ELLIPSIS : "";
+    }
+
+    length = snprintf(buf, size, "{\"full_text\":\"%.*s%s\","
+                      "\"short_text\":\"%.*s%s\",%s%s%s"
+                      "\"markup\":\"pango\"}\n",
+                      json->offsets[full_end] - json->offsets[offset],
+                      json->escaped + json->offsets[offset],
+                      progress ? progress : "",
+                      json->offsets[short_end], json->escaped, ellipsis,
+                      color ? "\"color\":\"" : "", color ? color : "",
+                      color ? "\"," : "");
+    if (length < 0)
+    {
+        return 0;
+    }
+
+    return ((size_t)length < size) ? (size_t)length : size - 1;
+};
+
+
+// Pango markup goes first: its entities need no JSON escaping
+static size_t json_character_escape(wchar_t character, char *buf,
+                                    size_t size)
+{
+    char   multibyte[MB_LEN_MAX];
+    size_t length = 0;
+
+    switch (character)
+    {
+        case L'&':
+            length = snprintf(multibyte, MB_LEN_MAX, "&amp;");
+            break;
+
+        case L'<':
+            length = snprintf(multibyte, MB_LEN_MAX, "&lt;");
+            break;
+
+        case L'>':
+            length = snprintf(multibyte, MB_LEN_MAX, "&gt;");
+            break;
+
+        case L'\'':
+            length = snprintf(multibyte, MB_LEN_MAX, "&#39;");
+            break;
+
+        case L'"':
+            length = snprintf(multibyte, MB_LEN_MAX, "&#34;");
+            break;
+
+        case L'\\':
+            length = snprintf(multibyte, MB_LEN_MAX, "\\\\");
+            break;
+
+        default:
+            if (character < L' ')
+            {
+                length = snprintf(multibyte, MB_LEN_MAX, "\\u%04x",
+                                  (unsigned int)character);
+                break;
+            }
+            length = mpdfnscroller_utf8_encode(&character, 1, multibyte,
+                                               MB_LEN_MAX);
+            break;
+    }
+
+    if (length >= size)
+    {
+        return 0;
+    }
+    memcpy(buf, multibyte, length);
+
+    return length;
+};
@@ -0,0 +1,69 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef JSON_H
+#define JSON_H
+
+
+#include <stddef.h>
+
+#include "mpd-fnscroller.h"
+#include "libmpdfnscroller.h"
+
+
+
+
+#define JSON_ESCAPED_CHARACTER_MAX 6
+#define JSON_LOOP_SIZE             (2 * (MPDFNSCROLLER_TITLE_SIZE +            \
+                                         MPDFNSCROLLER_DELIMITER_SIZE))
+#define JSON_ESCAPED_SIZE          (JSON_LOOP_SIZE * JSON_ESCAPED_CHARACTER_MAX)
+#define JSON_OUTPUT_SIZE           (2 * JSON_ESCAPED_SIZE)
+#define JSON_ELLIPSIS              "…"
+#define JSON_COLOR_PAUSE           "#a0a0a0"
+#define JSON_COLOR_STOP            "#606060"
+
+
+// Title looped with the delimiter twice over, escaped for Pango markup and
+// then for JSON once per song change. Offsets of the characters in it turn
+// any window of the marquee into a single slice: the frames need no escaping.
+struct mpd_fnscroller_json
+{
+    char           escaped[JSON_ESCAPED_SIZE];
+    unsigned short offsets[JSON_LOOP_SIZE + 1];
+    unsigned int   length;
+    unsigned int   period;
+};
+
+
+void json_title_set(struct mpd_fnscroller_json *json,
+                    const struct mpdfnscroller *scroller);
+size_t json_frame_render(const struct mpd_fnscroller_json *json,
+                         const struct mpdfnscroller *scroller,
+                         unsigned int offset, unsigned int width,
+                         const char *progress, const char *color, char *buf,
+                         size_t size);
+
+
+#endif /* JSON_H */
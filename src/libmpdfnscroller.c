@@ -0,0 +1,396 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <wchar.h>
+
+#include "libmpdfnscroller.h"
+#include "utf8.h"
+
+
+
+
+#define MPDFNSCROLLER_SCHEDULE_STALE UINT_MAX
+
+
+static void mpdfnscroller_schedule_compile(struct mpdfnscroller *scroller,
+                                           unsigned int width);
+static unsigned int
+mpdfnscroller_end_get(const struct mpdfnscroller *scroller,
+                      unsigned int width);
+static int mpdfnscroller_fits(const struct mpdfnscroller *scroller,
+                              unsigned int width);
+static unsigned int
+mpdfnscroller_columns_at(const struct mpdfnscroller *scroller,
+                         unsigned int offset);
+static int mpdfnscroller_boundary_at(const struct mpdfnscroller *scroller,
+                                     unsigned int offset);
+static void mpdfnscroller_segment_append(struct mpdfnscroller *scroller,
+                                         unsigned int from, unsigned int steps,
+                                         unsigned int period);
+
+
+void mpdfnscroller_init(struct mpdfnscroller *scroller, unsigned int step_ms)
+{
+    memset(scroller, 0, sizeof(*scroller));
+    scroller->step_ms = step_ms ? step_ms : MPDFNSCROLLER_STEP_MS;
+    scroller->delimiter_length =
+        mpdfnscroller_utf8_decode(MPDFNSCROLLER_DELIMITER_DEFAULT,
+                                  scroller->delimiter,
+                                  scroller->delimiter_columns,
+                                  scroller->delimiter_boundaries,
+                                  MPDFNSCROLLER_DELIMITER_SIZE);
+    scroller->schedule_width = MPDFNSCROLLER_SCHEDULE_STALE;
+
+    return;
+};
+
+int mpdfnscroller_options_set(struct mpdfnscroller *scroller,
+                              const struct mpdfnscroller_options *options)
+{
+    const char     *delimiter = options->delimiter ?
+                                options->delimiter :
+                                MPDFNSCROLLER_DELIMITER_DEFAULT;
+    wchar_t        codepoints[MPDFNSCROLLER_DELIMITER_SIZE];
+    unsigned short columns[MPDFNSCROLLER_DELIMITER_SIZE];
+    unsigned char  boundaries[MPDFNSCROLLER_DELIMITER_SIZE];
+    int            length = mpdfnscroller_utf8_decode(delimiter, codepoints,
+                                                      columns, boundaries,
+                                                      MPDFNSCROLLER_DELIMITER_SIZE);
+
+    if ((options->mode >= MPDFNSCROLLER_MODE_COUNT) ||
+        (options->dwell > MPDFNSCROLLER_DWELL_MAX) ||
+        (options->acceleration > MPDFNSCROLLER_ACCELERATION_MAX) ||
+        (length == -1))
+    {
+        return -1;
+    }
+
+    scroller->mode = options->mode;
+    scroller->dwell = options->dwell;
+    scroller->acceleration = options->acceleration;
+    memcpy(scroller->delimiter, codepoints, sizeof(codepoints));
+    memcpy(scroller->delimiter_columns, columns, sizeof(columns));
+    memcpy(scroller->delimiter_boundaries, boundaries, sizeof(boundaries));
+    scroller->delimiter_length = length;
+    scroller->schedule_width = MPDFNSCROLLER_SCHEDULE_STALE;
+
+    return 0;
+};
+
+int mpdfnscroller_title_set(struct mpdfnscroller *scroller, const char *title,
+                            unsigned long long now_ms)
+{
+    int length = mpdfnscroller_utf8_decode(title, scroller->title,
+                                           scroller->columns,
+                                           scroller->boundaries,
+                                           MPDFNSCROLLER_TITLE_SIZE);
+
+    scroller->epoch_ms = now_ms;
+    scroller->schedule_width = MPDFNSCROLLER_SCHEDULE_STALE;
+    if (length == -1)
+    {
+        scroller->title[0] = L'\0';
+        scroller->columns[0] = 0;
+        scroller->length = 0;
+        return -1;
+    }
+    scroller->length = length;
+
+    return 0;
+};
+
+unsigned long long mpdfnscroller_period_get(struct mpdfnscroller *scroller,
+                                            unsigned int width)
+{
+    if (width != scroller->schedule_width)
+    {
+        mpdfnscroller_schedule_compile(scroller, width);
+    }
+
+    return scroller->schedule_length;
+};
+
+unsigned int mpdfnscroller_offset_at(struct mpdfnscroller *scroller,
+                                     unsigned int width,
+                                     unsigned long long position)
+{
+    return scroller->schedule[position %
+                              mpdfnscroller_period_get(scroller, width)];
+};
+
+// Frame is taken cluster by cluster: a cluster too wide for the rest of the
+// frame ends it. Bounce frames never get past the end of the title.
+unsigned int mpdfnscroller_frame_length(const struct mpdfnscroller *scroller,
+                                        unsigned int width,
+                                        unsigned int offset)
+{
+    unsigned int limit = 0;
+    unsigned int length = 0;
+    unsigned int columns = 0;
+    unsigned int cluster_length = 0;
+    unsigned int cluster_columns = 0;
+
+    if (mpdfnscroller_fits(scroller, width))
+    {
+        return scroller->length;
+    }
+
+    limit = (scroller->mode == MPDFNSCROLLER_MODE_BOUNCE) ?
+            scroller->length - offset :
+            scroller->length + scroller->delimiter_length;
+    while (length < limit)
+    {
+        cluster_length = 1;
+        cluster_columns = mpdfnscroller_columns_at(scroller, offset + length);
+        while ((length + cluster_length < limit) &&
+               (!mpdfnscroller_boundary_at(scroller,
+                                           offset + length + cluster_length)))
+        {
+            cluster_columns += mpdfnscroller_columns_at(scroller, offset +
+                                                        length +
+                                                        cluster_length);
+            ++cluster_length;
+        }
+        if ((length + cluster_length > width) ||
+            (columns + cluster_columns > width))
+        {
+            break;
+        }
+        length += cluster_length;
+        columns += cluster_columns;
+    }
+
+// Single character wider than the whole frame is shown anyway
+    if ((length == 0) && (width > 0))
+    {
+        length = 1;
+    }
+
+    return length;
+};
+
+size_t mpdfnscroller_frame_at(struct mpdfnscroller *scroller,
+                              unsigned int width, unsigned long long position,
+                              wchar_t *buf)
+{
+    unsigned int period = scroller->length + scroller->delimiter_length;
+    unsigned int offset = 0;
+    unsigned int length = 0;
+    unsigned int i = 0;
+
+    if (mpdfnscroller_fits(scroller, width))
+    {
+        wmemcpy(buf, scroller->title, scroller->length + 1);
+        return scroller->length;
+    }
+
+    offset = mpdfnscroller_offset_at(scroller, width, position);
+    length = mpdfnscroller_frame_length(scroller, width, offset);
+    for (i = 0; i < length; ++i)
+    {
+        buf[i] = (offset < scroller->length) ? scroller->title[offset] :
+                 scroller->delimiter[offset - scroller->length];
+        if (++offset == period)
+        {
+            offset = 0;
+        }
+    }
+    buf[length] = L'\0';
+
+    return length;
+};
+
+size_t mpdfnscroller_frame_get(struct mpdfnscroller *scroller,
+                               unsigned int width, unsigned long long now_ms,
+                               char *buf, size_t size)
+{
+    wchar_t            frame[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned long long position = 0;
+    size_t             length = 0;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+// Frame is never wider than the title itself
+    if (width >= MPDFNSCROLLER_TITLE_SIZE)
+    {
+        width = MPDFNSCROLLER_TITLE_SIZE - 1;
+    }
+    if (now_ms > scroller->epoch_ms)
+    {
+        position = (now_ms - scroller->epoch_ms) / scroller->step_ms;
+    }
+    length = mpdfnscroller_frame_at(scroller, width, position, frame);
+
+    return mpdfnscroller_utf8_encode(frame, length, buf, size);
+};
+
+
+// Animation is made of the moves between the stops: the beginning and the
+// end of the title. Wrap mode moves on from the end through the delimiter to
+// the beginning, bounce mode moves back.
+static void mpdfnscroller_schedule_compile(struct mpdfnscroller *scroller,
+                                           unsigned int width)
+{
+    unsigned int end = 0;
+    unsigned int period = 0;
+
+    scroller->schedule_width = width;
+    scroller->schedule_length = 0;
+
+    if (mpdfnscroller_fits(scroller, width))
+    {
+        scroller->schedule[scroller->schedule_length++] = 0;
+        return;
+    }
+
+    end = mpdfnscroller_end_get(scroller, width);
+    period = scroller->length + scroller->delimiter_length;
+    mpdfnscroller_segment_append(scroller, 0, end, period);
+    if (scroller->mode == MPDFNSCROLLER_MODE_BOUNCE)
+    {
+        mpdfnscroller_segment_append(scroller, end, end, 0);
+    }
+    else
+    {
+        mpdfnscroller_segment_append(scroller, end, period - end, period);
+    }
+// A single cluster wider than the frame has no moves: it stays at the start
+    if (!scroller->schedule_length)
+    {
+        scroller->schedule[scroller->schedule_length++] = 0;
+    }
+
+    return;
+};
+
+// End stop is the first cluster from which the rest of the title fits
+static unsigned int
+mpdfnscroller_end_get(const struct mpdfnscroller *scroller,
+                      unsigned int width)
+{
+    unsigned int end = 0;
+
+    for (end = 0; end < scroller->length; ++end)
+    {
+        if ((scroller->boundaries[end]) &&
+            (scroller->length - end <= width) &&
+            (scroller->columns[scroller->length] - scroller->columns[end] <=
+             width))
+        {
+            return end;
+        }
+    }
+
+// Last cluster alone is wider than the frame
+    for (end = scroller->length - 1; end > 0; --end)
+    {
+        if (scroller->boundaries[end])
+        {
+            break;
+        }
+    }
+
+    return end;
+};
+
+static int mpdfnscroller_fits(const struct mpdfnscroller *scroller,
+                              unsigned int width)
+{
+    return (scroller->length <= width) &&
+           (scroller->columns[scroller->length] <= width);
+};
+
+// Columns taken by the code point at the offset within the looped title
+static unsigned int
+mpdfnscroller_columns_at(const struct mpdfnscroller *scroller,
+                         unsigned int offset)
+{
+    offset %= scroller->length + scroller->delimiter_length;
+    if (offset < scroller->length)
+    {
+        return scroller->columns[offset + 1] - scroller->columns[offset];
+    }
+    offset -= scroller->length;
+
+    return scroller->delimiter_columns[offset + 1] -
+           scroller->delimiter_columns[offset];
+};
+
+static int mpdfnscroller_boundary_at(const struct mpdfnscroller *scroller,
+                                     unsigned int offset)
+{
+    offset %= scroller->length + scroller->delimiter_length;
+    if (offset < scroller->length)
+    {
+        return scroller->boundaries[offset];
+    }
+
+    return scroller->delimiter_boundaries[offset - scroller->length];
+};
+
+// Move of the given number of steps from the offset, forward within the
+// period or backward when there is none. Every offset is shown for a number
+// of frames: the stop adds the dwell, the ramp at both ends of the move slows
+// it down. Offsets within a grapheme cluster are stepped over.
+static void mpdfnscroller_segment_append(struct mpdfnscroller *scroller,
+                                         unsigned int from, unsigned int steps,
+                                         unsigned int period)
+{
+    unsigned int step = 0;
+    unsigned int distance = 0;
+    unsigned int frames = 0;
+    unsigned int offset = 0;
+
+    for (step = 0; step < steps; ++step)
+    {
+        offset = period ? (from + step) % period : from - step;
+        if (!mpdfnscroller_boundary_at(scroller, offset))
+        {
+            continue;
+        }
+        distance = (step < steps - step) ? step : steps - step;
+        frames = 1;
+        if (step == 0)
+        {
+            frames += scroller->dwell;
+        }
+        if (distance < scroller->acceleration)
+        {
+            frames += scroller->acceleration - distance;
+        }
+        while ((frames--) &&
+               (scroller->schedule_length < MPDFNSCROLLER_SCHEDULE_SIZE))
+        {
+            scroller->schedule[scroller->schedule_length++] = offset;
+        }
+    }
+
+    return;
+};
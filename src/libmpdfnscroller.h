@@ -0,0 +1,153 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef LIBMPDFNSCROLLER_H
+#define LIBMPDFNSCROLLER_H
+
+
+#include <stddef.h>
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+
+#define MPDFNSCROLLER_VERSION           4
+#define MPDFNSCROLLER_TITLE_SIZE        256
+#define MPDFNSCROLLER_DELIMITER_DEFAULT " | "
+#define MPDFNSCROLLER_DELIMITER_SIZE    16
+#define MPDFNSCROLLER_STEP_MS           1000
+#define MPDFNSCROLLER_DWELL_MAX         32
+#define MPDFNSCROLLER_ACCELERATION_MAX  8
+#define MPDFNSCROLLER_SCHEDULE_SIZE     1024
+
+
+enum mpdfnscroller_mode
+{
+    MPDFNSCROLLER_MODE_WRAP = 0,
+    MPDFNSCROLLER_MODE_BOUNCE,
+    MPDFNSCROLLER_MODE_COUNT
+};
+
+// Wrap mode scrolls the title in a loop with the delimiter in between its
+// ending and its beginning, bounce mode scrolls it back and forth. Dwell is
+// the number of extra frames the title stays still at its beginning and its
+// end, acceleration is the length of the ramp over which the scrolling speeds
+// up after a stop and slows down before the next one.
+struct mpdfnscroller_options
+{
+    enum mpdfnscroller_mode mode;
+    unsigned int            dwell;
+    unsigned int            acceleration;
+    const char              *delimiter;
+};
+
+// Marquee of a single title. The state is owned by the caller and nothing
+// is allocated: the animation is compiled for the title and the width into a
+// table of offsets, a frame is a lookup in it at the position, which is taken
+// from the time elapsed since the title was set. Titles are UTF-8 whatever
+// the locale is. Their code points are indexed by the column and by the
+// grapheme cluster: frames are measured in columns and never split a
+// cluster.
+struct mpdfnscroller
+{
+    wchar_t                 title[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned short          columns[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned char           boundaries[MPDFNSCROLLER_TITLE_SIZE];
+    unsigned int            length;
+    unsigned int            step_ms;
+    unsigned long long      epoch_ms;
+
+    enum mpdfnscroller_mode mode;
+    unsigned int            dwell;
+    unsigned int            acceleration;
+    wchar_t                 delimiter[MPDFNSCROLLER_DELIMITER_SIZE];
+    unsigned short          delimiter_columns[MPDFNSCROLLER_DELIMITER_SIZE];
+    unsigned char           delimiter_boundaries[MPDFNSCROLLER_DELIMITER_SIZE];
+    unsigned int            delimiter_length;
+
+    unsigned short          schedule[MPDFNSCROLLER_SCHEDULE_SIZE];
+    unsigned int            schedule_length;
+    unsigned int            schedule_width;
+};
+
+
+// step_ms is the time a frame is shown, MPDFNSCROLLER_STEP_MS when 0. The
+// animation is the wrap-around with the default delimiter.
+void mpdfnscroller_init(struct mpdfnscroller *scroller, unsigned int step_ms);
+
+// Returns 0, or -1 when the options are out of range or the delimiter is not
+// valid UTF-8 or is longer than MPDFNSCROLLER_DELIMITER_SIZE - 1 code points.
+// NULL delimiter is the default one.
+int mpdfnscroller_options_set(struct mpdfnscroller *scroller,
+                              const struct mpdfnscroller_options *options);
+
+// Restarts the scrolling at now_ms. Returns 0, or -1 when the title is not
+// valid UTF-8 or is longer than MPDFNSCROLLER_TITLE_SIZE - 1 code points:
+// the title is left empty then.
+int mpdfnscroller_title_set(struct mpdfnscroller *scroller, const char *title,
+                            unsigned long long now_ms);
+
+// Number of frames before the animation starts over, never 0: 1 when the
+// title does not move
+unsigned long long mpdfnscroller_period_get(struct mpdfnscroller *scroller,
+                                            unsigned int width);
+
+// Offset of the frame at the given position within the title looped with the
+// delimiter, the frame is mpdfnscroller_frame_length() code points from
+// there. Meant for the callers keeping their own renditions of the title.
+unsigned int mpdfnscroller_offset_at(struct mpdfnscroller *scroller,
+                                     unsigned int width,
+                                     unsigned long long position);
+
+// Number of code points of the frame at the offset: the whole grapheme
+// clusters fitting into width columns, never more than width code points.
+// It is the whole title when the title fits.
+unsigned int mpdfnscroller_frame_length(const struct mpdfnscroller *scroller,
+                                        unsigned int width,
+                                        unsigned int offset);
+
+// Frame at the given position as a wide string of at most width code points,
+// buf must hold width + 1 of them. Returns the length of the frame.
+size_t mpdfnscroller_frame_at(struct mpdfnscroller *scroller,
+                              unsigned int width, unsigned long long position,
+                              wchar_t *buf);
+
+// Frame shown at now_ms in UTF-8. It is cut at a character boundary when size
+// is too small, width * 4 + 1 always fits.
+// Returns the length of the frame in bytes.
+size_t mpdfnscroller_frame_get(struct mpdfnscroller *scroller,
+                               unsigned int width, unsigned long long now_ms,
+                               char *buf, size_t size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBMPDFNSCROLLER_H */
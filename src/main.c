@@ -34,6 +34,7 @@
 #include <stdio.h>
 #include <signal.h>
 #include <locale.h>
+#include <malloc.h>
 
 #include "mpd-fnscroller.h"
 #include "runtime.h"
@@ -45,8 +46,11 @@
 
 bool daemonize_service = true;
 bool debug = false;
-char pidfile_path[PATH_STRING_SIZE];
-char sockfile_path[SUN_PATH_STRING_SIZE];
+char *pidfile_path = NULL;
+char *sockfile_path = NULL;
+char *handoverfile_path = NULL;
+char *snapshotfile_path = NULL;
+char *bar_pidfile_path = NULL;
 
 struct mpd_fnscroller_master
 {
@@ -90,6 +94,11 @@ mpd_fnscroller_start(struct mpd_fnscroller_master *master, int argc,
                      char **argv)
 {
     setlocale(LC_ALL, "");
+#ifdef MPD_FNSCROLLER_FOOTPRINT
+// Threads allocate little: the main arena is enough for all of them, instead
+// of an arena of its own (up to 64 MiB of address space) for each
+    mallopt(M_ARENA_MAX, 1);
+#endif /* MPD_FNSCROLLER_FOOTPRINT */
 
     if ((runtime_paths_init() != RESULT_SUCCESS) ||
         (mpd_fnscroller_master_init(master, argc, argv) != RESULT_SUCCESS))
@@ -133,16 +142,12 @@ opt_string_parse(struct mpd_fnscroller_master *master, int argc, char **argv)
 {
     struct mpd_fnscroller_server *server = &master->server;
     struct mpd_fnscroller_client *client = &master->client;
-    int                          pidfile_fd = 0;
-    int                          server_pid = 0;
+    struct mpdfnscroller_options scroll_options;
+    pid_t                        server_pid = 0;
     int                          opt = 0;
-    ssize_t                      bytes_read = 0;
     char                         *invalid_numchar = NULL;
-    char                         pid_str[PID_STRING_SIZE];
 
-    memset(pid_str, '\0', PID_STRING_SIZE);
-
-    while ((opt = getopt(argc, argv, "hds:nt:c:qv")) != -1)
+    while ((opt = getopt(argc, argv, "hds:nuU:f:m:C:r:H:S:e:i:I:ML:t:c:p:jNl:w:W:Tqv")) != -1)
     {
         switch (opt)
         {
@@ -157,62 +162,141 @@ opt_string_parse(struct mpd_fnscroller_master *master, int argc, char **argv)
 
             case 's':
                 master->mode = SERVER_MODE;
-                memset(server->mpd_host, '\0', HOSTNAME_STRING_SIZE);
+                if (!source_address_parse(&server->source, optarg))
+                {
+                    return RESULT_ERROR;
+                }
 
-                char *colon = strchr(optarg, ':');
-                if (colon)
+                break;
+
+            case 'n':
+                daemonize_service = false;
+                break;
+
+            case 'u':
+                server->handover = true;
+                break;
+
+            case 'U':
+                master->mode = SERVER_MODE;
+                if (!tenants_template_set(&server->tenants, optarg))
                 {
-                    unsigned int colon_pos = colon - optarg;
+                    return RESULT_ERROR;
+                }
 
-                    if ((colon_pos < HOSTNAME_STRING_SIZE - 2) &&
-                        (colon_pos > 0))
-                    {
-                        strncpy(server->mpd_host, optarg, colon_pos);
-                    }
-                    else
-                    {
-                        ERR_("Wrong <host>:<port> argument")
-                        return RESULT_ERROR;
-                    }
-                    server->mpd_port = strtol(colon + 1, &invalid_numchar, DEC);
-                    if ((*invalid_numchar) || (!strlen(colon + 1)))
-                    {
-                        ERR_("Invalid port")
-                        return RESULT_ERROR;
-                    }
+                break;
+
+            case 'f':
+                if (!format_compile(&server->format, optarg))
+                {
+                    ERR_("Invalid -f optarg")
+                    return RESULT_ERROR;
                 }
-                else
+
+                break;
+
+            case 'm':
+                if ((!scroll_options_parse(&scroll_options, optarg)) ||
+                    (!scroll_options_set(&server->scroll, &scroll_options)) ||
+                    (!scroll_options_set(&server->up_next_scroll,
+                                         &scroll_options)))
                 {
-                    if (strcmp(optarg, MPD_FNSCROLLER_DEFAULT_OPTARG) == 0)
-                    {
-                        if (!mpd_server_defaults_get(server->mpd_host,
-                                                     &server->mpd_port))
-                        {
-                            ERR_("Unable to get default mpd host and port")
-                            return RESULT_ERROR;
-                        }
-                    }
-                    else
-                    {
-                        ERR_("Invalid -s optarg")
-                        return RESULT_ERROR;
-                    }
+                    ERR_("Invalid -m optarg")
+                    return RESULT_ERROR;
                 }
 
                 break;
 
-            case 'n':
-                daemonize_service = false;
+            case 'C':
+                if (!cleanup_rule_add(&server->cleanup, optarg))
+                {
+                    ERR_("Invalid -C optarg")
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'r':
+                server->record_path = absolute_path_get(optarg);
+                if (server->record_path == NULL)
+                {
+                    ERR_("Invalid -r optarg")
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'H':
+                server->history_path = absolute_path_get(optarg);
+                if (server->history_path == NULL)
+                {
+                    ERR_("Invalid -H optarg")
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'S':
+                server->scrobble_path = absolute_path_get(optarg);
+                if (server->scrobble_path == NULL)
+                {
+                    ERR_("Invalid -S optarg")
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'e':
+                if (!hook_command_add(&server->hook, optarg))
+                {
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'i':
+                server->refresh.signal = strtol(optarg, &invalid_numchar, DEC);
+                if ((*invalid_numchar) || (server->refresh.signal <= 0) ||
+                    (SIGRTMIN + server->refresh.signal > SIGRTMAX))
+                {
+                    ERR_("Invalid -i optarg")
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'I':
+                server->refresh.pid = strtol(optarg, &invalid_numchar, DEC);
+                if ((*invalid_numchar) || (server->refresh.pid <= 0))
+                {
+                    ERR_("Invalid -I optarg")
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'L':
+                if (!watchdog_thresholds_parse(&server->watchdog, optarg))
+                {
+                    ERR_("Invalid -L optarg")
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'M':
+                server->mpris.enabled = true;
                 break;
 
             case 't':
                 if (strcmp(optarg, MPD_FNSCROLLER_DEFAULT_OPTARG) == 0)
                 {
-                    server->mpd_timeout =  MPD_DEFAULT_TIMEOUT;
+                    server->source.timeout = MPD_DEFAULT_TIMEOUT;
                 }
                 else
                 {
-                    server->mpd_timeout = strtol(optarg, &invalid_numchar, DEC);
+                    server->source.timeout = strtol(optarg, &invalid_numchar,
+                                                    DEC);
                     if (*invalid_numchar)
                     {
                         ERR_("Invalid -t optarg")
@@ -246,35 +330,80 @@ opt_string_parse(struct mpd_fnscroller_master *master, int argc, char **argv)
 
                 break;
 
-            case 'q':
-                syslog(LOG_WARNING, "Sending normal shutdown signal to server");
-                pidfile_fd = open(pidfile_path, O_RDONLY);
-                if (pidfile_fd == -1)
+            case 'p':
+                if (strcmp(optarg, PROGRESS_OPTARG_TIME) == 0)
                 {
-                    ERR_("Could not open pidfile: %s", pidfile_path)
+                    client->progress = PROGRESS_TIME;
+                }
+                else if (strcmp(optarg, PROGRESS_OPTARG_BAR) == 0)
+                {
+                    client->progress = PROGRESS_BAR;
+                }
+                else
+                {
+                    ERR_("Invalid -p optarg")
                     return RESULT_ERROR;
                 }
-                bytes_read = read(pidfile_fd, pid_str, PID_STRING_SIZE);
-                if (bytes_read == -1)
+
+                break;
+
+            case 'j':
+                client->json = true;
+                break;
+
+// Same option for both sides: the server keeps the queue mirror, the client
+// gets the "up next" frames
+            case 'N':
+                server->up_next = true;
+                client->request = REQUEST_UP_NEXT;
+                break;
+
+            case 'l':
+
+            case 'w':
+                master->mode = CLIENT_MODE;
+                client->request = (opt == 'l') ? REQUEST_HISTORY_LAST :
+                                                 REQUEST_HISTORY_TOP;
+                client->request_arg = strtol(optarg, &invalid_numchar, DEC);
+                if ((*invalid_numchar) || (client->request_arg == 0) ||
+                    (client->request_arg > HISTORY_QUERY_MAX))
                 {
-                    ERR_("Could not read server PID")
-                    close(pidfile_fd);
+                    ERR_("Invalid -%c optarg", opt)
                     return RESULT_ERROR;
                 }
-                server_pid = strtol(pid_str, &invalid_numchar, DEC);
-                if (*invalid_numchar)
+
+                break;
+
+            case 'W':
+                master->mode = CLIENT_MODE;
+                client->request = REQUEST_WAIT;
+                client->request_arg = strtoul(optarg, &invalid_numchar, DEC);
+                if ((*invalid_numchar) ||
+                    (client->request_arg > REQUEST_ARG_MASK))
+                {
+                    ERR_("Invalid -W optarg")
+                    return RESULT_ERROR;
+                }
+
+                break;
+
+            case 'T':
+                master->mode = CLIENT_MODE;
+                client->request = REQUEST_TRACE_DUMP;
+                break;
+
+            case 'q':
+                syslog(LOG_WARNING, "Sending normal shutdown signal to server");
+                if (!server_pid_get(&server_pid))
                 {
-                    ERR_("Invalid pidfile data")
-                    close(pidfile_fd);
+                    ERR_("Could not get server PID")
                     return RESULT_ERROR;
                 }
                 if (kill(server_pid, SIGUSR1) == -1)
                 {
                     ERR_("Could not send SIGUSR1 to server process")
-                    close(pidfile_fd);
                     return RESULT_ERROR;
                 }
-                close(pidfile_fd);
 
                 closelog();
                 exit(EXIT_SUCCESS);
@@ -33,6 +33,8 @@
 #endif /* __linux__ */
 #include <syslog.h>
 
+#include "trace.h"
+
 
 #define PROGNAME                     "mpd-fnscroller"
 #define MPD_FNSCROLLER_VERSION_MAJOR 1
@@ -40,26 +42,110 @@
 #define MPD_FNSCROLLER_VERSION_PATCH 0
 
 #define MPD_FNSCROLLER_HELP_STR       "Get filename of the song currently "    \
-                                      "played by mpd. Meant to be used with"   \
-                                      "i3blocks\n" MPD_FNSCROLLER_USAGE_STR " "\
-                                      "   -h Show this message\n    -d Enable "\
-                                      "debug\n    -s Launch in server mode\n  "\
-                                      "  -n Do not daemonize server\n    -c "  \
-                                      "Launch in client mode and get current " \
-                                      "piece of the filename\n    -t Set "     \
-                                      "MPD server connection timeout (for the "\
-                                      "mpd-fnscroller server routine)\n    -q "\
-                                      "Shutdown server instance\n    -v Show " \
-                                      "program version\n"
+                                      "played by mpd. Meant to be used with "  \
+                                      "i3blocks\n" MPD_FNSCROLLER_USAGE_STR    \
+                                      "    -h Show this message\n"             \
+                                      "    -d Enable debug\n"                  \
+                                      "    -s Launch in server mode, "         \
+                                      "following MPD, an MPRIS player "        \
+                                      "(mpris:<name>) or a file or FIFO "      \
+                                      "(file:<path>)\n"                        \
+                                      "    -n Do not daemonize server\n"       \
+                                      "    -u Take over the socket and the "   \
+                                      "state of the running server instance\n" \
+                                      "    -U Launch the system daemon "       \
+                                      "serving every user with their own MPD " \
+                                      "at the address <template> (%%u is the " \
+                                      "user ID, %%n the name; default "        \
+                                      "/run/user/%%u/mpd/socket)\n"            \
+                                      "    -f Set the format of the "          \
+                                      "displayed title, e.g. \"[%%artist%% - " \
+                                      "]%%title%%|%%file%%\" (file name by "   \
+                                      "default)\n"                             \
+                                      "    -m Set the scrolling: wrap or "     \
+                                      "bounce, dwell=<frames> at the ends, "   \
+                                      "accel=<frames> of the speed ramp, "     \
+                                      "delimiter=<string> last, e.g. "         \
+                                      "bounce,dwell=2,accel=3\n"               \
+                                      "    -C Add a title cleanup rule: ext, " \
+                                      "track, underscore, nfc or "             \
+                                      "s/regex/replacement/ (applied in "      \
+                                      "order)\n"                               \
+                                      "    -r Record the workload (MPD "       \
+                                      "events and client requests) into the "  \
+                                      "file\n"                                 \
+                                      "    -H Keep the play history in the "   \
+                                      "file\n"                                 \
+                                      "    -S Queue the scrobbles for upload " \
+                                      "in the .scrobbler.log file\n"           \
+                                      "    -e Run the shell command on song "  \
+                                      "and state changes, with the song in "   \
+                                      "MPD_FNSCROLLER_* variables (up to 4 "   \
+                                      "times)\n"                               \
+                                      "    -i Signal i3blocks with "           \
+                                      "SIGRTMIN+<n> when the frame changes "   \
+                                      "(for blocks with signal=<n> and "       \
+                                      "interval=once)\n"                       \
+                                      "    -I Signal this i3blocks <pid> "     \
+                                      "instead of the ones running the "       \
+                                      "client (with -i)\n"                     \
+                                      "    -M Expose the player on the "       \
+                                      "session bus over MPRIS (the same MPD "  \
+                                      "connection serves it)\n"                \
+                                      "    -L Set the latency thresholds of "  \
+                                      "the watchdog run under systemd "        \
+                                      "(WatchdogSec=), e.g. "                  \
+                                      "\"probe=500,source=2000\": the "        \
+                                      "longest the socket and the player may " \
+                                      "take to answer, in ms\n"                \
+                                      "    -c Launch in client mode and get "  \
+                                      "current piece of the filename\n"        \
+                                      "    -p Append playback progress to "    \
+                                      "the filename piece: time or bar (with " \
+                                      "-c)\n"                                  \
+                                      "    -j Print the filename piece as "    \
+                                      "i3blocks JSON (format=json) with "      \
+                                      "Pango markup, colored by the player "   \
+                                      "state (with -c)\n"                      \
+                                      "    -N Scroll the next songs of the "   \
+                                      "queue instead (server: keep the queue " \
+                                      "mirror, client: get its piece)\n"       \
+                                      "    -l Show the last <n> songs played " \
+                                      "(with -H)\n"                            \
+                                      "    -w Show the top <n> songs of the "  \
+                                      "week (with -H)\n"                       \
+                                      "    -W Wait for a change past the "     \
+                                      "<version> (0 for none) and print "      \
+                                      "\"<version> <state>\" and the title, "  \
+                                      "or the same version after 30 seconds\n" \
+                                      "    -t Set MPD server or MPRIS player " \
+                                      "timeout (for the mpd-fnscroller "       \
+                                      "server routine)\n"                      \
+                                      "    -T Dump the trace ring of the "     \
+                                      "running server (enabled with -d)\n"     \
+                                      "    -q Shutdown server instance\n"      \
+                                      "    -v Show program version\n"
 #define MPD_FNSCROLLER_USAGE_STR      "Usage:\n" PROGNAME" [-h] [-d] [-s "     \
-                                      "<host>:<port> | "                       \
+                                      "<host>:<port> | mpris:<name> | "        \
+                                      "file:<path> | "                         \
                                       MPD_FNSCROLLER_DEFAULT_OPTARG " [-n] "   \
-                                      "[-t <timeout> | "                       \
+                                      "[-u] [-U <template> | "                 \
+                                      MPD_FNSCROLLER_DEFAULT_OPTARG "] "       \
+                                      "[-f <format>] [-m <marquee>] "          \
+                                      "[-C <rule>] [-r <file>] [-H "           \
+                                      "<file>] [-S <file>] [-e <command>] "    \
+                                      "[-i <n>] [-I <pid>] [-M] "              \
+                                      "[-L <thresholds>] [-t "                 \
+                                      "<timeout> | "                           \
                                       MPD_FNSCROLLER_DEFAULT_OPTARG "] [-c "   \
                                       "<strlen> | "                            \
-                                      MPD_FNSCROLLER_DEFAULT_OPTARG "] [-q] [" \
-                                      "-v]\n"
+                                      MPD_FNSCROLLER_DEFAULT_OPTARG "] [-p "   \
+                                      "time | bar] [-j] [-N] [-l <n>] "        \
+                                      "[-w <n>] [-W <version>] [-T] [-q] "     \
+                                      "[-v]\n"
 #define MPD_FNSCROLLER_DEFAULT_OPTARG "default"
+#define PROGRESS_OPTARG_TIME          "time"
+#define PROGRESS_OPTARG_BAR           "bar"
 
 #define MPD_ENV_VARIABLE_HOST "MPD_HOST"
 #define MPD_ENV_VARIABLE_PORT "MPD_PORT"
@@ -67,18 +153,15 @@
 #define DEFAULT_OUTPUT_STRING_SIZE 25
 #ifdef __linux__
 #define PATH_STRING_SIZE           PATH_MAX
-#define FILENAME_STRING_SIZE       NAME_MAX + 1
+#define FILENAME_STRING_SIZE       (NAME_MAX + 1)
 #else
 #define PATH_STRING_SIZE           256
-#define FILENAME_STRING_SIZE       PATH_STRING_SIZE - 1
+#define FILENAME_STRING_SIZE       (PATH_STRING_SIZE - 1)
 #endif /* __linux__ */
-#ifdef __SIZEOF_WCHAR_T__
-#define FILENAME_WCHAR_STRING_SIZE FILENAME_STRING_SIZE / __SIZEOF_WCHAR_T__
-#else
-#define FILENAME_WCHAR_STRING_SIZE FILENAME_STRING_SIZE / 4
-#endif /* __SIZEOF_WCHAR_T__ */
+// UTF-8 string never decodes into more wide characters than it has bytes
+#define FILENAME_WCHAR_STRING_SIZE FILENAME_STRING_SIZE
 #ifdef MAXHOSTNAMELEN
-#define HOSTNAME_STRING_SIZE       MAXHOSTNAMELEN + 1
+#define HOSTNAME_STRING_SIZE       (MAXHOSTNAMELEN + 1)
 #else
 #define HOSTNAME_STRING_SIZE       256
 #endif /* MAXHOSTNAMELEN */
@@ -86,6 +169,33 @@
 
 #define DEC 10
 
+#define REQUEST_TYPE_SHIFT 24
+#define REQUEST_ARG_MASK   0x00ffffff
+#define REQUEST_MAKE(type, arg) (((unsigned int)(type) << REQUEST_TYPE_SHIFT) |\
+                                 ((arg) & REQUEST_ARG_MASK))
+#define REQUEST_TYPE(request)   ((request) >> REQUEST_TYPE_SHIFT)
+#define REQUEST_ARG(request)    ((request) & REQUEST_ARG_MASK)
+
+// Argument of the frame requests: the width in the lower half, the kind of
+// the playback progress appended to the frame above it, the top bit asks for
+// the i3blocks JSON instead of the wide string
+#define REQUEST_FRAME_WIDTH_MASK     0x0000ffff
+#define REQUEST_FRAME_PROGRESS_SHIFT 16
+#define REQUEST_FRAME_PROGRESS_MASK  0x7
+#define REQUEST_FRAME_JSON           0x00800000
+#define REQUEST_FRAME_ARG(width, progress)                                     \
+    (((progress) << REQUEST_FRAME_PROGRESS_SHIFT) |                            \
+     ((width) & REQUEST_FRAME_WIDTH_MASK))
+#define REQUEST_FRAME_WIDTH(arg)    ((arg) & REQUEST_FRAME_WIDTH_MASK)
+#define REQUEST_FRAME_PROGRESS(arg)                                            \
+    (((arg) >> REQUEST_FRAME_PROGRESS_SHIFT) & REQUEST_FRAME_PROGRESS_MASK)
+
+// Argument of the wait request is the last version seen, 0 for none. It is
+// answered once the version differs, or with the same one on the timeout.
+// Server with all its waiters taken answers busy right away.
+#define REQUEST_WAIT_TIMEOUT_MS 30000
+#define REQUEST_WAIT_BUSY       "busy\n"
+
 
 #define DEBUG_(fmt, ...)                       \
     if (debug)                                 \
@@ -97,7 +207,20 @@
     syslog(LOG_DEBUG, "%s:%s():%d", __FILE__, __func__, __LINE__); \
     syslog(LOG_ERR, fmt, ##__VA_ARGS__);
 
-#define TRACE_() DEBUG_("%s:%s():%d", __FILE__, __func__, __LINE__)
+// Tracepoints are meant for the hot path: they only put the static format
+// string and two integer arguments into the in-memory ring of the thread
+#ifdef MPD_FNSCROLLER_NO_TRACE
+#define TRACEPOINT_(fmt, arg0, arg1)
+#else
+#define TRACEPOINT_(fmt, arg0, arg1)                                          \
+    if (debug)                                                                \
+    {                                                                         \
+        trace_record(__func__, __LINE__, fmt, (long long)(arg0),              \
+                     (long long)(arg1));                                      \
+    }
+#endif /* MPD_FNSCROLLER_NO_TRACE */
+
+#define TRACE_() TRACEPOINT_(NULL, 0, 0)
 
 
 
@@ -109,6 +232,27 @@ enum mpd_fnscroller_mode
     MODE_COUNT
 };
 
+// Client request is a single unsigned int. Its upper byte is the type of the
+// request, so the plain frame width sent by older clients is still valid.
+enum mpd_fnscroller_request
+{
+    REQUEST_FRAME = 0,
+    REQUEST_TRACE_DUMP,
+    REQUEST_UP_NEXT,
+    REQUEST_HISTORY_LAST,
+    REQUEST_HISTORY_TOP,
+    REQUEST_WAIT,
+    REQUEST_COUNT
+};
+
+enum mpd_fnscroller_progress
+{
+    PROGRESS_NONE = 0,
+    PROGRESS_TIME,
+    PROGRESS_BAR,
+    PROGRESS_COUNT
+};
+
 enum mpd_fnscroller_result
 {
     RESULT_ERROR = 0,
@@ -0,0 +1,1166 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <pthread.h>
+#include <mpd/client.h>
+#ifdef MPD_FNSCROLLER_MPRIS
+#include <dbus/dbus.h>
+#endif /* MPD_FNSCROLLER_MPRIS */
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "mpris.h"
+
+
+
+
+extern bool debug;
+
+
+static void mpris_string_copy(char *dst, const char *src, size_t size);
+static unsigned int mpris_changes_get(const struct mpris_player *current,
+                                      const struct mpris_player *player);
+#ifdef MPD_FNSCROLLER_MPRIS
+static void *mpris_thread(void *arg);
+static DBusHandlerResult mpris_message_handle(DBusConnection *bus,
+                                              DBusMessage *message,
+                                              void *arg);
+static DBusMessage *mpris_player_call(struct mpd_fnscroller_mpris *mpris,
+                                      DBusMessage *message,
+                                      const struct mpris_player *player);
+static DBusMessage *mpris_properties_call(struct mpd_fnscroller_mpris *mpris,
+                                          DBusMessage *message,
+                                          const struct mpris_player *player);
+static DBusMessage *mpris_property_set(struct mpd_fnscroller_mpris *mpris,
+                                       DBusMessage *message,
+                                       const char *name,
+                                       DBusMessageIter *value);
+static void mpris_command_queue(struct mpd_fnscroller_mpris *mpris,
+                                enum source_command command, long long arg,
+                                unsigned int song_id);
+static void mpris_changes_send(DBusConnection *bus, unsigned int changes,
+                               const struct mpris_player *player);
+static bool mpris_property_append(DBusMessageIter *iter,
+                                  const char *interface, const char *name,
+                                  const struct mpris_player *player);
+static void mpris_entry_append(DBusMessageIter *dict, const char *interface,
+                               const char *name,
+                               const struct mpris_player *player);
+static void mpris_metadata_append(DBusMessageIter *iter,
+                                  const struct mpris_player *player);
+static void mpris_variant_append(DBusMessageIter *iter, int type,
+                                 const void *value);
+static void mpris_tag_append(DBusMessageIter *dict, const char *key, int type,
+                             const void *value);
+static long long mpris_position_get(const struct mpris_player *player);
+static void mpris_track_path_get(const struct mpris_player *player,
+                                 char *path, size_t size);
+
+
+static const char *mpris_root_properties[] =
+{
+    "CanQuit", "CanRaise", "HasTrackList", "Identity", "SupportedUriSchemes",
+    "SupportedMimeTypes", NULL
+};
+
+static const char *mpris_player_properties[] =
+{
+    "PlaybackStatus", "LoopStatus", "Rate", "Shuffle", "Metadata", "Volume",
+    "Position", "MinimumRate", "MaximumRate", "CanGoNext", "CanGoPrevious",
+    "CanPlay", "CanPause", "CanSeek", "CanControl", NULL
+};
+
+// Methods with no arguments, in the order of their commands
+static const char *mpris_player_methods[] =
+{
+    "Play", "Pause", "PlayPause", "Stop", "Next", "Previous", NULL
+};
+
+static const char *mpris_loop_names[SOURCE_LOOP_COUNT] =
+{
+    "None", "Track", "Playlist"
+};
+
+static const char mpris_introspection[] =
+    DBUS_INTROSPECT_1_0_XML_DOCTYPE_DECL_NODE
+    "<node>\n"
+    " <interface name=\"" DBUS_INTERFACE_INTROSPECTABLE "\">\n"
+    "  <method name=\"Introspect\">"
+    "<arg direction=\"out\" type=\"s\"/></method>\n"
+    " </interface>\n"
+    " <interface name=\"" DBUS_INTERFACE_PROPERTIES "\">\n"
+    "  <method name=\"Get\"><arg direction=\"in\" type=\"s\"/>"
+    "<arg direction=\"in\" type=\"s\"/>"
+    "<arg direction=\"out\" type=\"v\"/></method>\n"
+    "  <method name=\"GetAll\"><arg direction=\"in\" type=\"s\"/>"
+    "<arg direction=\"out\" type=\"a{sv}\"/></method>\n"
+    "  <method name=\"Set\"><arg direction=\"in\" type=\"s\"/>"
+    "<arg direction=\"in\" type=\"s\"/>"
+    "<arg direction=\"in\" type=\"v\"/></method>\n"
+    "  <signal name=\"PropertiesChanged\"><arg type=\"s\"/>"
+    "<arg type=\"a{sv}\"/><arg type=\"as\"/></signal>\n"
+    " </interface>\n"
+    " <interface name=\"" MPRIS_INTERFACE_ROOT "\">\n"
+    "  <method name=\"Raise\"/>\n"
+    "  <method name=\"Quit\"/>\n"
+    "  <property name=\"CanQuit\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanRaise\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"HasTrackList\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"Identity\" type=\"s\" access=\"read\"/>\n"
+    "  <property name=\"SupportedUriSchemes\" type=\"as\" "
+    "access=\"read\"/>\n"
+    "  <property name=\"SupportedMimeTypes\" type=\"as\" access=\"read\"/>\n"
+    " </interface>\n"
+    " <interface name=\"" MPRIS_INTERFACE_PLAYER "\">\n"
+    "  <method name=\"Next\"/>\n"
+    "  <method name=\"Previous\"/>\n"
+    "  <method name=\"Pause\"/>\n"
+    "  <method name=\"PlayPause\"/>\n"
+    "  <method name=\"Stop\"/>\n"
+    "  <method name=\"Play\"/>\n"
+    "  <method name=\"Seek\"><arg direction=\"in\" type=\"x\"/></method>\n"
+    "  <method name=\"SetPosition\"><arg direction=\"in\" type=\"o\"/>"
+    "<arg direction=\"in\" type=\"x\"/></method>\n"
+    "  <method name=\"OpenUri\"><arg direction=\"in\" type=\"s\"/>"
+    "</method>\n"
+    "  <signal name=\"Seeked\"><arg type=\"x\"/></signal>\n"
+    "  <property name=\"PlaybackStatus\" type=\"s\" access=\"read\"/>\n"
+    "  <property name=\"LoopStatus\" type=\"s\" access=\"readwrite\"/>\n"
+    "  <property name=\"Rate\" type=\"d\" access=\"read\"/>\n"
+    "  <property name=\"Shuffle\" type=\"b\" access=\"readwrite\"/>\n"
+    "  <property name=\"Metadata\" type=\"a{sv}\" access=\"read\"/>\n"
+    "  <property name=\"Volume\" type=\"d\" access=\"readwrite\"/>\n"
+    "  <property name=\"Position\" type=\"x\" access=\"read\"/>\n"
+    "  <property name=\"MinimumRate\" type=\"d\" access=\"read\"/>\n"
+    "  <property name=\"MaximumRate\" type=\"d\" access=\"read\"/>\n"
+    "  <property name=\"CanGoNext\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanGoPrevious\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanPlay\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanPause\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanSeek\" type=\"b\" access=\"read\"/>\n"
+    "  <property name=\"CanControl\" type=\"b\" access=\"read\"/>\n"
+    " </interface>\n"
+    "</node>\n";
+#endif /* MPD_FNSCROLLER_MPRIS */
+
+
+void mpris_init(struct mpd_fnscroller_mpris *mpris)
+{
+    memset(mpris, 0, sizeof(*mpris));
+    mpris->player.state = MPD_STATE_UNKNOWN;
+    mpris->player.volume = -1;
+    mpris->wakeup_fd = -1;
+    mpris->command_fd = -1;
+    pthread_mutex_init(&mpris->lock, NULL);
+
+    return;
+};
+
+// Bus is connected and the name is taken before the thread is started, so
+// that a missing session bus is reported at the start
+enum mpd_fnscroller_result mpris_start(struct mpd_fnscroller_mpris *mpris)
+{
+#ifdef MPD_FNSCROLLER_MPRIS
+    static const DBusObjectPathVTable vtable =
+    {
+        .message_function = mpris_message_handle
+    };
+    DBusConnection                    *bus = NULL;
+    DBusError                         error;
+    int                               reply = 0;
+#endif /* MPD_FNSCROLLER_MPRIS */
+
+    if (!mpris->enabled)
+    {
+        return RESULT_SUCCESS;
+    }
+
+#ifdef MPD_FNSCROLLER_MPRIS
+    mpris->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mpris->wakeup_fd == -1)
+    {
+        ERR_("Could not create the MPRIS event descriptor")
+        return RESULT_ERROR;
+    }
+
+    dbus_error_init(&error);
+    bus = dbus_bus_get_private(DBUS_BUS_SESSION, &error);
+    if (bus == NULL)
+    {
+        ERR_("Could not connect to the session bus: %s", error.message)
+        dbus_error_free(&error);
+        return RESULT_ERROR;
+    }
+    dbus_connection_set_exit_on_disconnect(bus, FALSE);
+
+// Instance taking over on upgrade takes the name over as well
+    reply = dbus_bus_request_name(bus, MPRIS_BUS_NAME,
+                                  DBUS_NAME_FLAG_ALLOW_REPLACEMENT |
+                                  DBUS_NAME_FLAG_REPLACE_EXISTING |
+                                  DBUS_NAME_FLAG_DO_NOT_QUEUE, &error);
+    if (reply != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
+    {
+        ERR_("Could not take the " MPRIS_BUS_NAME " name: %s",
+             dbus_error_is_set(&error) ? error.message : "it is in use")
+        dbus_error_free(&error);
+        dbus_connection_close(bus);
+        dbus_connection_unref(bus);
+        return RESULT_ERROR;
+    }
+    if (!dbus_connection_register_object_path(bus, MPRIS_OBJECT_PATH, &vtable,
+                                              mpris))
+    {
+        ERR_("Could not register the MPRIS object")
+        dbus_connection_close(bus);
+        dbus_connection_unref(bus);
+        return RESULT_ERROR;
+    }
+    mpris->bus = bus;
+
+    if (thread_create(&mpris->thread_id, mpris_thread, mpris))
+    {
+        ERR_("Could not start MPRIS thread")
+        mpris->bus = NULL;
+        dbus_connection_close(bus);
+        dbus_connection_unref(bus);
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+#else
+    ERR_("MPRIS bridge needs " PROGNAME " built with MPRIS=1")
+    return RESULT_ERROR;
+#endif /* MPD_FNSCROLLER_MPRIS */
+};
+
+// Connection goes away with the process, the bus drops the name then
+void mpris_stop(struct mpd_fnscroller_mpris *mpris)
+{
+    if (!mpris->enabled)
+    {
+        return;
+    }
+    if (mpris->bus != NULL)
+    {
+        pthread_cancel(mpris->thread_id);
+    }
+    if (mpris->wakeup_fd != -1)
+    {
+        close(mpris->wakeup_fd);
+    }
+
+    return;
+};
+
+// Called by the event handler loop on every status taken: the bus thread is
+// only woken up when some of the properties are changed indeed
+void mpris_player_update(struct mpd_fnscroller_mpris *mpris,
+                         const struct source_status *status,
+                         const struct source_song *song, const char *title,
+                         unsigned long long status_time)
+{
+    struct mpris_player player;
+    const char          *tag = NULL;
+    unsigned int        changes = 0;
+    uint64_t            wakeup = 1;
+
+    if ((!mpris->enabled) || (mpris->wakeup_fd == -1))
+    {
+        return;
+    }
+
+    memset(&player, 0, sizeof(player));
+    player.state = status->state;
+    player.elapsed_ms = status->elapsed_ms;
+    player.duration_ms = status->duration_ms;
+    player.status_time = status_time;
+    player.volume = status->volume;
+    player.shuffle = status->random;
+// Single mode without repeat stops after the song, it is no loop
+    if (status->repeat)
+    {
+        player.loop = status->single ? SOURCE_LOOP_TRACK :
+                                       SOURCE_LOOP_PLAYLIST;
+    }
+    if (song != NULL)
+    {
+        player.song_id = song->id;
+        tag = source_song_tag_get(song, MPD_TAG_TITLE);
+        mpris_string_copy(player.title, (tag != NULL) ? tag : title,
+                          sizeof(player.title));
+        mpris_string_copy(player.artist, song->tags[MPD_TAG_ARTIST],
+                          sizeof(player.artist));
+        mpris_string_copy(player.album, song->tags[MPD_TAG_ALBUM],
+                          sizeof(player.album));
+    }
+
+    pthread_mutex_lock(&mpris->lock);
+    changes = mpris_changes_get(&mpris->player, &player);
+    memcpy(&mpris->player, &player, sizeof(player));
+    mpris->changes |= changes;
+    pthread_mutex_unlock(&mpris->lock);
+
+    if ((changes) &&
+        (write(mpris->wakeup_fd, &wakeup, sizeof(wakeup)) == -1))
+    {
+        TRACEPOINT_("Could not write wakeup_fd: %lld", errno, 0)
+    }
+
+    return;
+};
+
+// Called by the event handler loop when it is woken up by command_fd, with
+// the source out of its wait (the loop has drained the descriptor)
+enum mpd_fnscroller_result
+mpris_commands_run(struct mpd_fnscroller_mpris *mpris,
+                   struct mpd_fnscroller_source *source)
+{
+    struct mpris_command_entry entry;
+    enum mpd_state             state = MPD_STATE_UNKNOWN;
+    unsigned int               song_id = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&mpris->lock);
+        if (mpris->command_count == 0)
+        {
+            pthread_mutex_unlock(&mpris->lock);
+            break;
+        }
+        entry = mpris->commands[mpris->command_head];
+        mpris->command_head = (mpris->command_head + 1) % MPRIS_COMMANDS_MAX;
+        --mpris->command_count;
+        state = mpris->player.state;
+        song_id = mpris->player.song_id;
+        pthread_mutex_unlock(&mpris->lock);
+
+        TRACEPOINT_("MPRIS command: %lld; arg: %lld", entry.command, entry.arg)
+// Toggle does not start a stopped player
+        if ((entry.command == SOURCE_COMMAND_PLAY_PAUSE) &&
+            (state != MPD_STATE_PLAY) && (state != MPD_STATE_PAUSE))
+        {
+            entry.command = SOURCE_COMMAND_PLAY;
+        }
+// Song could have been changed since the call
+        if ((entry.command == SOURCE_COMMAND_POSITION_SET) &&
+            (entry.song_id != song_id))
+        {
+            continue;
+        }
+        if (!source_command_run(source, entry.command, entry.arg, song_id))
+        {
+            return RESULT_ERROR;
+        }
+    }
+
+    return RESULT_SUCCESS;
+};
+
+
+// D-Bus takes valid UTF-8 only: a sequence cut by the truncation is dropped
+static void mpris_string_copy(char *dst, const char *src, size_t size)
+{
+    size_t length = 0;
+    size_t lead = 0;
+    size_t sequence_length = 1;
+
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+    length = strlen(dst);
+    if ((length == 0) || (!((unsigned char)dst[length - 1] & 0x80)))
+    {
+        return;
+    }
+
+    lead = length - 1;
+    while ((lead > 0) && (((unsigned char)dst[lead] & 0xc0) == 0x80))
+    {
+        --lead;
+    }
+    if (((unsigned char)dst[lead] & 0xe0) == 0xc0)
+    {
+        sequence_length = 2;
+    }
+    else if (((unsigned char)dst[lead] & 0xf0) == 0xe0)
+    {
+        sequence_length = 3;
+    }
+    else if (((unsigned char)dst[lead] & 0xf8) == 0xf0)
+    {
+        sequence_length = 4;
+    }
+    if (length - lead < sequence_length)
+    {
+        dst[lead] = '\0';
+    }
+
+    return;
+};
+
+// Position is expected to move on while playing: only a jump is a seek
+static unsigned int mpris_changes_get(const struct mpris_player *current,
+                                      const struct mpris_player *player)
+{
+    unsigned long long expected_ms = current->elapsed_ms;
+    unsigned int       changes = 0;
+
+    if (current->state != player->state)
+    {
+        changes |= MPRIS_CHANGE_STATUS;
+    }
+    if ((current->song_id != player->song_id) ||
+        (current->duration_ms != player->duration_ms) ||
+        (strcmp(current->title, player->title)) ||
+        (strcmp(current->artist, player->artist)) ||
+        (strcmp(current->album, player->album)))
+    {
+        changes |= MPRIS_CHANGE_METADATA;
+    }
+    if (current->volume != player->volume)
+    {
+        changes |= MPRIS_CHANGE_VOLUME;
+    }
+    if (current->loop != player->loop)
+    {
+        changes |= MPRIS_CHANGE_LOOP;
+    }
+    if (current->shuffle != player->shuffle)
+    {
+        changes |= MPRIS_CHANGE_SHUFFLE;
+    }
+
+    if ((changes & MPRIS_CHANGE_METADATA) ||
+        (current->state == MPD_STATE_STOP) ||
+        (player->state == MPD_STATE_STOP))
+    {
+        return changes;
+    }
+    if (current->state == MPD_STATE_PLAY)
+    {
+        expected_ms += player->status_time - current->status_time;
+    }
+    if ((player->elapsed_ms + MPRIS_SEEK_TOLERANCE_MS < expected_ms) ||
+        (player->elapsed_ms > expected_ms + MPRIS_SEEK_TOLERANCE_MS))
+    {
+        changes |= MPRIS_CHANGE_SEEKED;
+    }
+
+    return changes;
+};
+
+
+#ifdef MPD_FNSCROLLER_MPRIS
+static void *mpris_thread(void *arg)
+{
+    struct mpd_fnscroller_mpris *mpris = arg;
+    DBusConnection              *bus = mpris->bus;
+    struct mpris_player         player;
+    struct pollfd               pollfds[2];
+    unsigned int                changes = 0;
+    uint64_t                    wakeups = 0;
+    int                         bus_fd = -1;
+
+    if (!dbus_connection_get_unix_fd(bus, &bus_fd))
+    {
+        ERR_("Could not get the session bus descriptor")
+        pthread_exit(NULL);
+    }
+    pollfds[0].fd = bus_fd;
+    pollfds[0].events = POLLIN;
+    pollfds[1].fd = mpris->wakeup_fd;
+    pollfds[1].events = POLLIN;
+
+    for (;;)
+    {
+        while (dbus_connection_dispatch(bus) == DBUS_DISPATCH_DATA_REMAINS)
+        {
+        }
+        dbus_connection_flush(bus);
+
+        if (poll(pollfds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ERR_("Issue polling the session bus")
+            break;
+        }
+
+        if ((pollfds[0].revents) && (!dbus_connection_read_write(bus, 0)))
+        {
+            ERR_("Session bus connection is lost")
+            break;
+        }
+        if (pollfds[1].revents & POLLIN)
+        {
+            if (read(mpris->wakeup_fd, &wakeups, sizeof(wakeups)) == -1)
+            {
+                TRACEPOINT_("Could not read wakeup_fd: %lld", errno, 0)
+            }
+            pthread_mutex_lock(&mpris->lock);
+            changes = mpris->changes;
+            mpris->changes = 0;
+            memcpy(&player, &mpris->player, sizeof(player));
+            pthread_mutex_unlock(&mpris->lock);
+
+            mpris_changes_send(bus, changes, &player);
+        }
+    }
+
+    pthread_exit(NULL);
+};
+
+static DBusHandlerResult mpris_message_handle(DBusConnection *bus,
+                                              DBusMessage *message,
+                                              void *arg)
+{
+    struct mpd_fnscroller_mpris *mpris = arg;
+    struct mpris_player         player;
+    DBusMessage                 *reply = NULL;
+    DBusMessageIter             iter;
+    const char                  *interface = dbus_message_get_interface(message);
+    const char                  *member = dbus_message_get_member(message);
+    const char                  *xml = mpris_introspection;
+
+    if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+    {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    pthread_mutex_lock(&mpris->lock);
+    memcpy(&player, &mpris->player, sizeof(player));
+    pthread_mutex_unlock(&mpris->lock);
+
+// Interface is optional in a method call
+    if (interface == NULL)
+    {
+        interface = (strcmp(member, "Introspect") == 0) ?
+                    DBUS_INTERFACE_INTROSPECTABLE : MPRIS_INTERFACE_PLAYER;
+    }
+
+    if (strcmp(interface, DBUS_INTERFACE_INTROSPECTABLE) == 0)
+    {
+        reply = dbus_message_new_method_return(message);
+        if (reply != NULL)
+        {
+            dbus_message_iter_init_append(reply, &iter);
+            dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &xml);
+        }
+    }
+    else if (strcmp(interface, DBUS_INTERFACE_PROPERTIES) == 0)
+    {
+        reply = mpris_properties_call(mpris, message, &player);
+    }
+    else if (strcmp(interface, MPRIS_INTERFACE_ROOT) == 0)
+    {
+// Nothing to raise and the daemon is not quit by the desktop
+        reply = dbus_message_new_method_return(message);
+    }
+    else if (strcmp(interface, MPRIS_INTERFACE_PLAYER) == 0)
+    {
+        reply = mpris_player_call(mpris, message, &player);
+    }
+    else
+    {
+        reply = dbus_message_new_error(message, DBUS_ERROR_UNKNOWN_INTERFACE,
+                                       interface);
+    }
+
+    if (reply == NULL)
+    {
+        return DBUS_HANDLER_RESULT_NEED_MEMORY;
+    }
+    dbus_connection_send(bus, reply, NULL);
+    dbus_message_unref(reply);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+};
+
+// Commands are queued for the event handler loop and answered right away,
+// their effect is announced by the properties on the following MPD event
+static DBusMessage *mpris_player_call(struct mpd_fnscroller_mpris *mpris,
+                                      DBusMessage *message,
+                                      const struct mpris_player *player)
+{
+    DBusError    error;
+    DBusMessage  *reply = NULL;
+    const char   *member = dbus_message_get_member(message);
+    const char   *track = NULL;
+    char         track_path[sizeof(MPRIS_TRACK_PATH_PREFIX) + 16];
+    dbus_int64_t offset = 0;
+    unsigned int i = 0;
+
+    for (i = 0; mpris_player_methods[i] != NULL; ++i)
+    {
+        if (strcmp(member, mpris_player_methods[i]) == 0)
+        {
+            mpris_command_queue(mpris, i, 0, 0);
+            return dbus_message_new_method_return(message);
+        }
+    }
+
+    dbus_error_init(&error);
+    if (strcmp(member, "Seek") == 0)
+    {
+        if (dbus_message_get_args(message, &error, DBUS_TYPE_INT64, &offset,
+                                  DBUS_TYPE_INVALID))
+        {
+            mpris_command_queue(mpris, SOURCE_COMMAND_SEEK, offset / 1000, 0);
+            return dbus_message_new_method_return(message);
+        }
+    }
+    else if (strcmp(member, "SetPosition") == 0)
+    {
+        if (dbus_message_get_args(message, &error, DBUS_TYPE_OBJECT_PATH,
+                                  &track, DBUS_TYPE_INT64, &offset,
+                                  DBUS_TYPE_INVALID))
+        {
+// Stale track and position out of the song are ignored as the spec says
+            mpris_track_path_get(player, track_path, sizeof(track_path));
+            if ((strcmp(track, track_path) == 0) && (offset >= 0) &&
+                (offset / 1000 <= player->duration_ms))
+            {
+                mpris_command_queue(mpris, SOURCE_COMMAND_POSITION_SET,
+                                    offset / 1000, player->song_id);
+            }
+            return dbus_message_new_method_return(message);
+        }
+    }
+    else if (strcmp(member, "OpenUri") == 0)
+    {
+        return dbus_message_new_error(message, DBUS_ERROR_NOT_SUPPORTED,
+                                      "Opening URIs is not supported");
+    }
+    else
+    {
+        return dbus_message_new_error(message, DBUS_ERROR_UNKNOWN_METHOD,
+                                      member);
+    }
+
+    reply = dbus_message_new_error(message, error.name, error.message);
+    dbus_error_free(&error);
+
+    return reply;
+};
+
+static DBusMessage *mpris_properties_call(struct mpd_fnscroller_mpris *mpris,
+                                          DBusMessage *message,
+                                          const struct mpris_player *player)
+{
+    DBusMessage     *reply = NULL;
+    DBusMessageIter iter;
+    DBusMessageIter dict;
+    const char      *member = dbus_message_get_member(message);
+    const char      *interface = NULL;
+    const char      *name = NULL;
+    const char      **names = NULL;
+    unsigned int    i = 0;
+
+    if (!dbus_message_iter_init(message, &iter) ||
+        (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING))
+    {
+        return dbus_message_new_error(message, DBUS_ERROR_INVALID_ARGS,
+                                      "Interface name is expected");
+    }
+    dbus_message_iter_get_basic(&iter, &interface);
+    if (strcmp(interface, MPRIS_INTERFACE_ROOT) == 0)
+    {
+        names = mpris_root_properties;
+    }
+    else if (strcmp(interface, MPRIS_INTERFACE_PLAYER) == 0)
+    {
+        names = mpris_player_properties;
+    }
+    else
+    {
+        return dbus_message_new_error(message, DBUS_ERROR_UNKNOWN_INTERFACE,
+                                      interface);
+    }
+
+    if (strcmp(member, "GetAll") == 0)
+    {
+        reply = dbus_message_new_method_return(message);
+        if (reply == NULL)
+        {
+            return NULL;
+        }
+        dbus_message_iter_init_append(reply, &iter);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}",
+                                         &dict);
+        for (i = 0; names[i] != NULL; ++i)
+        {
+            mpris_entry_append(&dict, interface, names[i], player);
+        }
+        dbus_message_iter_close_container(&iter, &dict);
+        return reply;
+    }
+
+    if ((!dbus_message_iter_next(&iter)) ||
+        (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING))
+    {
+        return dbus_message_new_error(message, DBUS_ERROR_INVALID_ARGS,
+                                      "Property name is expected");
+    }
+    dbus_message_iter_get_basic(&iter, &name);
+
+    if (strcmp(member, "Set") == 0)
+    {
+        if ((!dbus_message_iter_next(&iter)) ||
+            (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_VARIANT))
+        {
+            return dbus_message_new_error(message, DBUS_ERROR_INVALID_ARGS,
+                                          "Property value is expected");
+        }
+        return mpris_property_set(mpris, message, name, &iter);
+    }
+    if (strcmp(member, "Get") != 0)
+    {
+        return dbus_message_new_error(message, DBUS_ERROR_UNKNOWN_METHOD,
+                                      member);
+    }
+
+    reply = dbus_message_new_method_return(message);
+    if (reply == NULL)
+    {
+        return NULL;
+    }
+    dbus_message_iter_init_append(reply, &iter);
+    if (!mpris_property_append(&iter, interface, name, player))
+    {
+        dbus_message_unref(reply);
+        return dbus_message_new_error(message, DBUS_ERROR_UNKNOWN_PROPERTY,
+                                      name);
+    }
+
+    return reply;
+};
+
+// Volume, Shuffle and LoopStatus are the writable ones
+static DBusMessage *mpris_property_set(struct mpd_fnscroller_mpris *mpris,
+                                       DBusMessage *message,
+                                       const char *name,
+                                       DBusMessageIter *value)
+{
+    DBusMessageIter variant;
+    double          volume = 0;
+    dbus_bool_t     shuffle = FALSE;
+    const char      *loop = NULL;
+    unsigned int    i = 0;
+
+    dbus_message_iter_recurse(value, &variant);
+    if ((strcmp(name, "Volume") == 0) &&
+        (dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_DOUBLE))
+    {
+        dbus_message_iter_get_basic(&variant, &volume);
+        volume = (volume < 0) ? 0 : ((volume > 1) ? 1 : volume);
+        mpris_command_queue(mpris, SOURCE_COMMAND_VOLUME_SET,
+                            (long long)(volume * 100 + 0.5), 0);
+    }
+    else if ((strcmp(name, "Shuffle") == 0) &&
+             (dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_BOOLEAN))
+    {
+        dbus_message_iter_get_basic(&variant, &shuffle);
+        mpris_command_queue(mpris, SOURCE_COMMAND_SHUFFLE_SET, shuffle, 0);
+    }
+    else if ((strcmp(name, "LoopStatus") == 0) &&
+             (dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_STRING))
+    {
+        dbus_message_iter_get_basic(&variant, &loop);
+        for (i = 0; i < SOURCE_LOOP_COUNT; ++i)
+        {
+            if (strcmp(loop, mpris_loop_names[i]) == 0)
+            {
+                break;
+            }
+        }
+        if (i == SOURCE_LOOP_COUNT)
+        {
+            return dbus_message_new_error(message, DBUS_ERROR_INVALID_ARGS,
+                                          loop);
+        }
+        mpris_command_queue(mpris, SOURCE_COMMAND_LOOP_SET, i, 0);
+    }
+    else
+    {
+        return dbus_message_new_error(message, DBUS_ERROR_PROPERTY_READ_ONLY,
+                                      name);
+    }
+
+    return dbus_message_new_method_return(message);
+};
+
+// Full queue means the MPD connection is stuck, the command is dropped then
+static void mpris_command_queue(struct mpd_fnscroller_mpris *mpris,
+                                enum source_command command, long long arg,
+                                unsigned int song_id)
+{
+    struct mpris_command_entry *entry = NULL;
+    uint64_t                   wakeup = 1;
+
+    pthread_mutex_lock(&mpris->lock);
+    if (mpris->command_count == MPRIS_COMMANDS_MAX)
+    {
+        pthread_mutex_unlock(&mpris->lock);
+        ERR_("MPRIS command %d is dropped: the queue is full", command)
+        return;
+    }
+    entry = &mpris->commands[(mpris->command_head + mpris->command_count) %
+                             MPRIS_COMMANDS_MAX];
+    entry->command = command;
+    entry->arg = arg;
+    entry->song_id = song_id;
+    ++mpris->command_count;
+    pthread_mutex_unlock(&mpris->lock);
+
+    if (write(mpris->command_fd, &wakeup, sizeof(wakeup)) == -1)
+    {
+        TRACEPOINT_("Could not write command_fd: %lld", errno, 0)
+    }
+
+    return;
+};
+
+// One PropertiesChanged with all the properties changed by an MPD event
+static void mpris_changes_send(DBusConnection *bus, unsigned int changes,
+                               const struct mpris_player *player)
+{
+    static const struct
+    {
+        unsigned int change;
+        const char   *name;
+    }               properties[] =
+    {
+        {MPRIS_CHANGE_STATUS,   "PlaybackStatus"},
+        {MPRIS_CHANGE_METADATA, "Metadata"},
+        {MPRIS_CHANGE_VOLUME,   "Volume"},
+        {MPRIS_CHANGE_LOOP,     "LoopStatus"},
+        {MPRIS_CHANGE_SHUFFLE,  "Shuffle"},
+        {MPRIS_CHANGE_STATUS,   "CanSeek"}
+    };
+    DBusMessage     *signal = NULL;
+    DBusMessageIter iter;
+    DBusMessageIter dict;
+    DBusMessageIter invalidated;
+    const char      *interface = MPRIS_INTERFACE_PLAYER;
+    dbus_int64_t    position = 0;
+    unsigned int    i = 0;
+
+    DEBUG_("MPRIS changes: 0x%x", changes)
+    if (changes & ~MPRIS_CHANGE_SEEKED)
+    {
+        signal = dbus_message_new_signal(MPRIS_OBJECT_PATH,
+                                         DBUS_INTERFACE_PROPERTIES,
+                                         "PropertiesChanged");
+        if (signal == NULL)
+        {
+            return;
+        }
+        dbus_message_iter_init_append(signal, &iter);
+        dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &interface);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}",
+                                         &dict);
+        for (i = 0; i < sizeof(properties) / sizeof(properties[0]); ++i)
+        {
+            if (changes & properties[i].change)
+            {
+                mpris_entry_append(&dict, interface, properties[i].name,
+                                   player);
+            }
+        }
+        dbus_message_iter_close_container(&iter, &dict);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s",
+                                         &invalidated);
+        dbus_message_iter_close_container(&iter, &invalidated);
+        dbus_connection_send(bus, signal, NULL);
+        dbus_message_unref(signal);
+    }
+
+    if (changes & MPRIS_CHANGE_SEEKED)
+    {
+        signal = dbus_message_new_signal(MPRIS_OBJECT_PATH,
+                                         MPRIS_INTERFACE_PLAYER, "Seeked");
+        if (signal == NULL)
+        {
+            return;
+        }
+        position = mpris_position_get(player);
+        dbus_message_append_args(signal, DBUS_TYPE_INT64, &position,
+                                 DBUS_TYPE_INVALID);
+        dbus_connection_send(bus, signal, NULL);
+        dbus_message_unref(signal);
+    }
+
+    return;
+};
+
+static bool mpris_property_append(DBusMessageIter *iter,
+                                  const char *interface, const char *name,
+                                  const struct mpris_player *player)
+{
+    DBusMessageIter variant;
+    DBusMessageIter array;
+    const char      *string = NULL;
+    dbus_bool_t     flag = FALSE;
+    double          number = 1.0;
+    dbus_int64_t    position = 0;
+
+    if (strcmp(interface, MPRIS_INTERFACE_ROOT) == 0)
+    {
+        if ((strcmp(name, "CanQuit") == 0) ||
+            (strcmp(name, "CanRaise") == 0) ||
+            (strcmp(name, "HasTrackList") == 0))
+        {
+            mpris_variant_append(iter, DBUS_TYPE_BOOLEAN, &flag);
+        }
+        else if (strcmp(name, "Identity") == 0)
+        {
+            string = MPRIS_IDENTITY;
+            mpris_variant_append(iter, DBUS_TYPE_STRING, &string);
+        }
+        else if ((strcmp(name, "SupportedUriSchemes") == 0) ||
+                 (strcmp(name, "SupportedMimeTypes") == 0))
+        {
+            dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "as",
+                                             &variant);
+            dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "s",
+                                             &array);
+            dbus_message_iter_close_container(&variant, &array);
+            dbus_message_iter_close_container(iter, &variant);
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    if (strcmp(name, "PlaybackStatus") == 0)
+    {
+        string = "Stopped";
+        if (player->state == MPD_STATE_PLAY)
+        {
+            string = "Playing";
+        }
+        else if (player->state == MPD_STATE_PAUSE)
+        {
+            string = "Paused";
+        }
+        mpris_variant_append(iter, DBUS_TYPE_STRING, &string);
+    }
+    else if (strcmp(name, "LoopStatus") == 0)
+    {
+        string = mpris_loop_names[player->loop];
+        mpris_variant_append(iter, DBUS_TYPE_STRING, &string);
+    }
+    else if ((strcmp(name, "Rate") == 0) ||
+             (strcmp(name, "MinimumRate") == 0) ||
+             (strcmp(name, "MaximumRate") == 0))
+    {
+        mpris_variant_append(iter, DBUS_TYPE_DOUBLE, &number);
+    }
+    else if (strcmp(name, "Shuffle") == 0)
+    {
+        flag = player->shuffle;
+        mpris_variant_append(iter, DBUS_TYPE_BOOLEAN, &flag);
+    }
+    else if (strcmp(name, "Metadata") == 0)
+    {
+        mpris_metadata_append(iter, player);
+    }
+// Volume is -1 with no mixer
+    else if (strcmp(name, "Volume") == 0)
+    {
+        number = (player->volume > 0) ? player->volume / 100.0 : 0;
+        mpris_variant_append(iter, DBUS_TYPE_DOUBLE, &number);
+    }
+    else if (strcmp(name, "Position") == 0)
+    {
+        position = mpris_position_get(player);
+        mpris_variant_append(iter, DBUS_TYPE_INT64, &position);
+    }
+    else if (strcmp(name, "CanSeek") == 0)
+    {
+        flag = (player->state != MPD_STATE_STOP) && (player->duration_ms);
+        mpris_variant_append(iter, DBUS_TYPE_BOOLEAN, &flag);
+    }
+    else if ((strcmp(name, "CanGoNext") == 0) ||
+             (strcmp(name, "CanGoPrevious") == 0) ||
+             (strcmp(name, "CanPlay") == 0) ||
+             (strcmp(name, "CanPause") == 0) ||
+             (strcmp(name, "CanControl") == 0))
+    {
+        flag = TRUE;
+        mpris_variant_append(iter, DBUS_TYPE_BOOLEAN, &flag);
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+};
+
+static void mpris_entry_append(DBusMessageIter *dict, const char *interface,
+                               const char *name,
+                               const struct mpris_player *player)
+{
+    DBusMessageIter entry;
+
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name);
+    mpris_property_append(&entry, interface, name, player);
+    dbus_message_iter_close_container(dict, &entry);
+
+    return;
+};
+
+static void mpris_metadata_append(DBusMessageIter *iter,
+                                  const struct mpris_player *player)
+{
+    DBusMessageIter variant;
+    DBusMessageIter dict;
+    DBusMessageIter entry;
+    DBusMessageIter artist_variant;
+    DBusMessageIter artists;
+    char            track_path[sizeof(MPRIS_TRACK_PATH_PREFIX) + 16];
+    const char      *string = track_path;
+    const char      *key = "xesam:artist";
+    dbus_int64_t    length = player->duration_ms * 1000LL;
+
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "a{sv}",
+                                     &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "{sv}",
+                                     &dict);
+
+    mpris_track_path_get(player, track_path, sizeof(track_path));
+    mpris_tag_append(&dict, "mpris:trackid", DBUS_TYPE_OBJECT_PATH, &string);
+    if (player->state != MPD_STATE_STOP)
+    {
+        mpris_tag_append(&dict, "mpris:length", DBUS_TYPE_INT64, &length);
+        string = player->title;
+        mpris_tag_append(&dict, "xesam:title", DBUS_TYPE_STRING, &string);
+        if (player->album[0] != '\0')
+        {
+            string = player->album;
+            mpris_tag_append(&dict, "xesam:album", DBUS_TYPE_STRING, &string);
+        }
+    }
+// Artist is a list of one
+    if ((player->state != MPD_STATE_STOP) && (player->artist[0] != '\0'))
+    {
+        string = player->artist;
+        dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL,
+                                         &entry);
+        dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+        dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "as",
+                                         &artist_variant);
+        dbus_message_iter_open_container(&artist_variant, DBUS_TYPE_ARRAY,
+                                         "s", &artists);
+        dbus_message_iter_append_basic(&artists, DBUS_TYPE_STRING, &string);
+        dbus_message_iter_close_container(&artist_variant, &artists);
+        dbus_message_iter_close_container(&entry, &artist_variant);
+        dbus_message_iter_close_container(&dict, &entry);
+    }
+
+    dbus_message_iter_close_container(&variant, &dict);
+    dbus_message_iter_close_container(iter, &variant);
+
+    return;
+};
+
+static void mpris_variant_append(DBusMessageIter *iter, int type,
+                                 const void *value)
+{
+    DBusMessageIter variant;
+    char            signature[2] = {type, '\0'};
+
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, signature,
+                                     &variant);
+    dbus_message_iter_append_basic(&variant, type, value);
+    dbus_message_iter_close_container(iter, &variant);
+
+    return;
+};
+
+static void mpris_tag_append(DBusMessageIter *dict, const char *key, int type,
+                             const void *value)
+{
+    DBusMessageIter entry;
+
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    mpris_variant_append(&entry, type, value);
+    dbus_message_iter_close_container(dict, &entry);
+
+    return;
+};
+
+// Interpolated like the progress of the block, in microseconds
+static long long mpris_position_get(const struct mpris_player *player)
+{
+    unsigned long long position_ms = player->elapsed_ms;
+
+    if (player->state == MPD_STATE_STOP)
+    {
+        return 0;
+    }
+    if (player->state == MPD_STATE_PLAY)
+    {
+        position_ms += monotonic_time_get() - player->status_time;
+    }
+    if ((player->duration_ms) && (position_ms > player->duration_ms))
+    {
+        position_ms = player->duration_ms;
+    }
+
+    return position_ms * 1000;
+};
+
+static void mpris_track_path_get(const struct mpris_player *player,
+                                 char *path, size_t size)
+{
+    if (player->state == MPD_STATE_STOP)
+    {
+        snprintf(path, size, "%s", MPRIS_NO_TRACK_PATH);
+        return;
+    }
+    snprintf(path, size, MPRIS_TRACK_PATH_PREFIX "%u", player->song_id);
+
+    return;
+};
+#endif /* MPD_FNSCROLLER_MPRIS */
@@ -0,0 +1,123 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MPRIS_H
+#define MPRIS_H
+
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "source.h"
+
+
+
+
+#define MPRIS_BUS_NAME          "org.mpris.MediaPlayer2.mpd_fnscroller"
+#define MPRIS_INTERFACE_ROOT    "org.mpris.MediaPlayer2"
+#define MPRIS_INTERFACE_PLAYER  "org.mpris.MediaPlayer2.Player"
+#define MPRIS_OBJECT_PATH       "/org/mpris/MediaPlayer2"
+#define MPRIS_TRACK_PATH_PREFIX "/org/mpd_fnscroller/track/"
+#define MPRIS_NO_TRACK_PATH     "/org/mpris/MediaPlayer2/TrackList/NoTrack"
+#define MPRIS_IDENTITY          PROGNAME
+#define MPRIS_COMMANDS_MAX      16
+#define MPRIS_TAG_SIZE          256
+#define MPRIS_SEEK_TOLERANCE_MS 1000
+
+
+// Properties which are announced with PropertiesChanged, the position is not
+// one of them: it only gets the Seeked signal when it jumps
+enum mpris_change
+{
+    MPRIS_CHANGE_STATUS   = 0x01,
+    MPRIS_CHANGE_METADATA = 0x02,
+    MPRIS_CHANGE_VOLUME   = 0x04,
+    MPRIS_CHANGE_LOOP     = 0x08,
+    MPRIS_CHANGE_SHUFFLE  = 0x10,
+    MPRIS_CHANGE_SEEKED   = 0x20
+};
+
+struct mpris_player
+{
+    enum mpd_state     state;
+    unsigned int       song_id;
+    unsigned int       elapsed_ms;
+    unsigned int       duration_ms;
+    unsigned long long status_time;
+    int                volume;
+    enum source_loop   loop;
+    bool               shuffle;
+    char               title[FILENAME_STRING_SIZE];
+    char               artist[MPRIS_TAG_SIZE];
+    char               album[MPRIS_TAG_SIZE];
+};
+
+// Position is set for the song it was asked for only
+struct mpris_command_entry
+{
+    enum source_command command;
+    long long           arg;
+    unsigned int        song_id;
+};
+
+// org.mpris.MediaPlayer2.Player object on the session bus. It is served from
+// the player state taken on the source events by the event handler loop, and its
+// methods are queued back to that loop, so that the daemon keeps a single
+// connection to the player. The bus is served by a thread of its own.
+struct mpd_fnscroller_mpris
+{
+    bool                       enabled;
+
+    struct mpris_player        player;
+    unsigned int               changes;
+    int                        wakeup_fd;
+
+    struct mpris_command_entry commands[MPRIS_COMMANDS_MAX];
+    unsigned int               command_head;
+    unsigned int               command_count;
+// Wakes the event handler loop up, it is the server's
+    int                        command_fd;
+
+    pthread_t                  thread_id;
+    pthread_mutex_t            lock;
+    void                       *bus;
+};
+
+
+void mpris_init(struct mpd_fnscroller_mpris *mpris);
+enum mpd_fnscroller_result mpris_start(struct mpd_fnscroller_mpris *mpris);
+void mpris_stop(struct mpd_fnscroller_mpris *mpris);
+void mpris_player_update(struct mpd_fnscroller_mpris *mpris,
+                         const struct source_status *status,
+                         const struct source_song *song, const char *title,
+                         unsigned long long status_time);
+enum mpd_fnscroller_result
+mpris_commands_run(struct mpd_fnscroller_mpris *mpris,
+                   struct mpd_fnscroller_source *source);
+
+
+#endif /* MPRIS_H */
@@ -0,0 +1,160 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "mpd-fnscroller.h"
+#include "progress.h"
+
+
+
+
+extern bool debug;
+
+// Left one eighth block to left seven eighths block
+static const wchar_t progress_bar_partial[PROGRESS_BAR_STEPS] =
+{
+    L' ', L'\x258f', L'\x258e', L'\x258d', L'\x258c', L'\x258b', L'\x258a',
+    L'\x2589'
+};
+
+
+static size_t progress_time_render(wchar_t *buf, size_t size,
+                                   unsigned int ms);
+
+
+void playtime_set(struct mpd_fnscroller_playtime *playtime, bool playing,
+                  unsigned int elapsed_ms, unsigned int duration_ms,
+                  unsigned long long now)
+{
+    playtime->playing = playing;
+    playtime->elapsed_ms = elapsed_ms;
+    playtime->duration_ms = duration_ms;
+    playtime->timestamp = now;
+
+    return;
+};
+
+unsigned int playtime_elapsed_get(const struct mpd_fnscroller_playtime
+                                  *playtime, unsigned long long now)
+{
+    unsigned long long elapsed_ms = playtime->elapsed_ms;
+
+    if ((playtime->playing) && (now > playtime->timestamp))
+    {
+        elapsed_ms += now - playtime->timestamp;
+    }
+// Next player event (the song change) may come a little late
+    if ((playtime->duration_ms) && (elapsed_ms > playtime->duration_ms))
+    {
+        elapsed_ms = playtime->duration_ms;
+    }
+
+    return elapsed_ms;
+};
+
+// Renders " [1:23/4:05]" or " [████▌   ]" into buf, returns its length
+size_t progress_render(const struct mpd_fnscroller_playtime *playtime,
+                       enum mpd_fnscroller_progress progress,
+                       unsigned long long now, wchar_t *buf, size_t size)
+{
+    unsigned long long eighths = 0;
+    unsigned int       elapsed_ms = 0;
+    unsigned int       i = 0;
+    size_t             length = 0;
+
+    if ((progress == PROGRESS_NONE) || (size < PROGRESS_STRING_SIZE))
+    {
+        return 0;
+    }
+    elapsed_ms = playtime_elapsed_get(playtime, now);
+
+    buf[length++] = L' ';
+    buf[length++] = L'[';
+    switch (progress)
+    {
+        case PROGRESS_TIME:
+            length += progress_time_render(buf + length, size - length,
+                                           elapsed_ms);
+// Streams have no duration
+            if (playtime->duration_ms)
+            {
+                buf[length++] = L'/';
+                length += progress_time_render(buf + length, size - length,
+                                               playtime->duration_ms);
+            }
+            break;
+
+        case PROGRESS_BAR:
+            if (playtime->duration_ms)
+            {
+                eighths = (unsigned long long)elapsed_ms * PROGRESS_BAR_WIDTH *
+                          PROGRESS_BAR_STEPS / playtime->duration_ms;
+            }
+            for (i = 0; i < PROGRESS_BAR_WIDTH; ++i)
+            {
+                if (eighths >= PROGRESS_BAR_STEPS)
+                {
+                    buf[length++] = L'\x2588';
+                    eighths -= PROGRESS_BAR_STEPS;
+                }
+                else
+                {
+                    buf[length++] = progress_bar_partial[eighths];
+                    eighths = 0;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+    buf[length++] = L']';
+    buf[length] = L'\0';
+
+    return length;
+};
+
+
+static size_t progress_time_render(wchar_t *buf, size_t size,
+                                   unsigned int ms)
+{
+    unsigned int seconds = ms / 1000;
+    int          length = 0;
+
+    if (seconds >= 3600)
+    {
+        length = swprintf(buf, size, L"%u:%02u:%02u", seconds / 3600,
+                          seconds / 60 % 60, seconds % 60);
+    }
+    else
+    {
+        length = swprintf(buf, size, L"%u:%02u", seconds / 60, seconds % 60);
+    }
+
+    return (length > 0) ? length : 0;
+};
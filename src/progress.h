@@ -0,0 +1,65 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <wchar.h>
+
+#include "mpd-fnscroller.h"
+
+
+
+
+#define PROGRESS_BAR_WIDTH   8
+#define PROGRESS_BAR_STEPS   8
+#define PROGRESS_STRING_SIZE 32
+
+
+// Playback position as of the last player event: between the events it is
+// interpolated from the monotonic clock instead of asking MPD again
+struct mpd_fnscroller_playtime
+{
+    bool               playing;
+    unsigned int       elapsed_ms;
+    unsigned int       duration_ms;
+    unsigned long long timestamp;
+};
+
+
+void playtime_set(struct mpd_fnscroller_playtime *playtime, bool playing,
+                  unsigned int elapsed_ms, unsigned int duration_ms,
+                  unsigned long long now);
+unsigned int playtime_elapsed_get(const struct mpd_fnscroller_playtime
+                                  *playtime, unsigned long long now);
+size_t progress_render(const struct mpd_fnscroller_playtime *playtime,
+                       enum mpd_fnscroller_progress progress,
+                       unsigned long long now, wchar_t *buf, size_t size);
+
+
+#endif /* PROGRESS_H */
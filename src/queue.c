@@ -0,0 +1,188 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "format.h"
+#include "cleanup.h"
+#include "queue.h"
+
+
+
+
+extern bool debug;
+
+
+static enum mpd_fnscroller_result
+queue_resize(struct mpd_fnscroller_queue *queue, unsigned int length);
+
+
+void queue_init(struct mpd_fnscroller_queue *queue)
+{
+    queue->entries = NULL;
+    queue->length = 0;
+    queue->capacity = 0;
+// Changes since the version 0 are the whole queue
+    queue->version = 0;
+
+    return;
+};
+
+void queue_free(struct mpd_fnscroller_queue *queue)
+{
+    queue_resize(queue, 0);
+    free(queue->entries);
+    queue_init(queue);
+
+    return;
+};
+
+// Source lists the songs at the positions changed since the given version
+// ("plchanges"): those are the only entries replaced. Removed songs at the
+// tail are cut by the new queue length from the status.
+enum mpd_fnscroller_result queue_update(struct mpd_fnscroller_queue *queue,
+                                        struct mpd_fnscroller_source
+                                        *source,
+                                        const struct mpd_fnscroller_format
+                                        *format,
+                                        const struct mpd_fnscroller_cleanup
+                                        *cleanup, unsigned int version,
+                                        unsigned int length)
+{
+    struct source_song song;
+    struct queue_entry *entry;
+    char               title[FILENAME_STRING_SIZE];
+    unsigned int       changes = 0;
+
+    if (version == queue->version)
+    {
+        return RESULT_SUCCESS;
+    }
+
+    if (!queue_resize(queue, length))
+    {
+        return RESULT_ERROR;
+    }
+
+    if (!source_queue_begin(source, queue->version))
+    {
+        return RESULT_ERROR;
+    }
+    while (source_queue_song_next(source, &song))
+    {
+        if (song.pos < queue->length)
+        {
+            entry = &queue->entries[song.pos];
+            format_render(format, &song, title, FILENAME_STRING_SIZE);
+            cleanup_apply(cleanup, title, FILENAME_STRING_SIZE);
+            free(entry->title);
+            entry->title = strdup(title);
+            entry->id = song.id;
+            ++changes;
+        }
+    }
+    if (!source_queue_end(source))
+    {
+        return RESULT_ERROR;
+    }
+
+    DEBUG_("Queue version %u -> %u: %u changes, length %u", queue->version,
+           version, changes, queue->length)
+    queue->version = version;
+
+    return RESULT_SUCCESS;
+};
+
+// Titles of the songs after the current one, joined into a single string for
+// the scroller
+size_t queue_up_next_get(const struct mpd_fnscroller_queue *queue,
+                         int song_pos, char *buf, size_t size)
+{
+    unsigned int pos = (song_pos < 0) ? 0 : song_pos + 1;
+    unsigned int count = 0;
+    size_t       length = 0;
+
+    buf[0] = '\0';
+    for (; (pos < queue->length) && (count < QUEUE_UP_NEXT_COUNT); ++pos)
+    {
+        if (queue->entries[pos].title == NULL)
+        {
+            continue;
+        }
+        if (count++)
+        {
+            length = format_string_append(buf, size, length,
+                                          QUEUE_UP_NEXT_SEPARATOR,
+                                          strlen(QUEUE_UP_NEXT_SEPARATOR));
+        }
+        length = format_string_append(buf, size, length,
+                                      queue->entries[pos].title,
+                                      strlen(queue->entries[pos].title));
+    }
+
+    return length;
+};
+
+
+static enum mpd_fnscroller_result
+queue_resize(struct mpd_fnscroller_queue *queue, unsigned int length)
+{
+    struct queue_entry *entries = NULL;
+    unsigned int       capacity = 0;
+    unsigned int       i = 0;
+
+    for (i = length; i < queue->length; ++i)
+    {
+        free(queue->entries[i].title);
+        queue->entries[i].title = NULL;
+    }
+
+    if (length > queue->capacity)
+    {
+        capacity = queue->capacity ? queue->capacity : QUEUE_CAPACITY_MIN;
+        while (capacity < length)
+        {
+            capacity *= 2;
+        }
+        entries = realloc(queue->entries, capacity * sizeof(*entries));
+        if (entries == NULL)
+        {
+            ERR_("Could not allocate queue mirror of %u entries", capacity)
+            return RESULT_ERROR;
+        }
+        memset(entries + queue->capacity, 0,
+               (capacity - queue->capacity) * sizeof(*entries));
+        queue->entries = entries;
+        queue->capacity = capacity;
+    }
+    queue->length = length;
+
+    return RESULT_SUCCESS;
+};
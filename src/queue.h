@@ -0,0 +1,78 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+
+#include <stddef.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "format.h"
+#include "cleanup.h"
+#include "source.h"
+
+
+
+
+#define QUEUE_UP_NEXT_COUNT     3
+#define QUEUE_UP_NEXT_SEPARATOR " / "
+#define QUEUE_CAPACITY_MIN      64
+
+
+struct queue_entry
+{
+    unsigned int id;
+    char         *title;
+};
+
+// Local mirror of the MPD queue. It is brought up to date with the changes
+// since the mirrored queue version only, so keeping it costs O(changes)
+// rather than O(queue length).
+struct mpd_fnscroller_queue
+{
+    struct queue_entry *entries;
+    unsigned int       length;
+    unsigned int       capacity;
+    unsigned int       version;
+};
+
+
+void queue_init(struct mpd_fnscroller_queue *queue);
+void queue_free(struct mpd_fnscroller_queue *queue);
+enum mpd_fnscroller_result queue_update(struct mpd_fnscroller_queue *queue,
+                                        struct mpd_fnscroller_source
+                                        *source,
+                                        const struct mpd_fnscroller_format
+                                        *format,
+                                        const struct mpd_fnscroller_cleanup
+                                        *cleanup, unsigned int version,
+                                        unsigned int length);
+size_t queue_up_next_get(const struct mpd_fnscroller_queue *queue,
+                         int song_pos, char *buf, size_t size);
+
+
+#endif /* QUEUE_H */
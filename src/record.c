@@ -0,0 +1,140 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "mpd-fnscroller.h"
+#include "record.h"
+
+
+
+
+extern bool debug;
+
+static FILE               *record_file = NULL;
+static unsigned long long record_start = 0;
+
+
+static unsigned long long record_time_get(void);
+
+
+// Workload capture: MPD events and client requests with their timestamps (in
+// microseconds since the start of the capture) to be replayed later
+enum mpd_fnscroller_result record_open(const char *path)
+{
+    struct record_file_header header;
+
+    record_file = fopen(path, "w");
+    if (record_file == NULL)
+    {
+        ERR_("Could not open workload file %s", path)
+        return RESULT_ERROR;
+    }
+    setvbuf(record_file, NULL, _IOFBF, RECORD_BUFFER_SIZE);
+
+    memcpy(header.magic, RECORD_MAGIC, RECORD_MAGIC_SIZE);
+    header.version = RECORD_FORMAT_VERSION;
+    if (fwrite(&header, sizeof(header), 1, record_file) != 1)
+    {
+        ERR_("Could not write workload file header")
+        fclose(record_file);
+        record_file = NULL;
+        return RESULT_ERROR;
+    }
+    record_start = record_time_get();
+
+    syslog(LOG_INFO, "Recording workload into %s", path);
+
+    return RESULT_SUCCESS;
+};
+
+void record_close(void)
+{
+    if (record_file)
+    {
+        fclose(record_file);
+        record_file = NULL;
+    }
+
+    return;
+};
+
+void record_write(enum record_type type, const void *payload,
+                  uint16_t length)
+{
+    struct
+    {
+        struct record_header header;
+        char                 payload[RECORD_PAYLOAD_SIZE];
+    } __attribute__((packed)) record;
+
+    if (record_file == NULL)
+    {
+        return;
+    }
+    if (length > RECORD_PAYLOAD_SIZE)
+    {
+        length = RECORD_PAYLOAD_SIZE;
+    }
+
+    record.header.timestamp = record_time_get() - record_start;
+    record.header.type = type;
+    record.header.length = length;
+    memcpy(record.payload, payload, length);
+
+// Single fwrite keeps the records of different threads apart
+    fwrite(&record, sizeof(record.header) + length, 1, record_file);
+
+// Events from MPD are rare and the interesting ones: those are not kept in
+// the buffer, while the requests are written out in batches
+    if (type != RECORD_REQUEST)
+    {
+        fflush(record_file);
+    }
+
+    return;
+};
+
+void record_uint32_write(enum record_type type, uint32_t value)
+{
+    record_write(type, &value, sizeof(value));
+
+    return;
+};
+
+
+static unsigned long long record_time_get(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+};
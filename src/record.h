@@ -0,0 +1,77 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef RECORD_H
+#define RECORD_H
+
+
+#include <stdint.h>
+
+#include "mpd-fnscroller.h"
+
+
+
+
+#define RECORD_MAGIC          "MFSR"
+#define RECORD_MAGIC_SIZE     4
+#define RECORD_FORMAT_VERSION 1
+#define RECORD_PAYLOAD_SIZE   FILENAME_STRING_SIZE
+#define RECORD_BUFFER_SIZE    (64 * 1024)
+
+
+enum record_type
+{
+    RECORD_IDLE = 0,
+    RECORD_STATUS,
+    RECORD_SONG,
+    RECORD_REQUEST,
+    RECORD_TYPE_COUNT
+};
+
+// Workload file is the header followed by the records. Every record is the
+// fixed size record header and the payload of the given length: the idle mask,
+// the player state or the request as a 32-bit integer, the song URI as is.
+struct record_file_header
+{
+    char     magic[RECORD_MAGIC_SIZE];
+    uint32_t version;
+} __attribute__((packed));
+
+struct record_header
+{
+    uint64_t timestamp;
+    uint8_t  type;
+    uint16_t length;
+} __attribute__((packed));
+
+
+enum mpd_fnscroller_result record_open(const char *path);
+void record_close(void);
+void record_write(enum record_type type, const void *payload,
+                  uint16_t length);
+void record_uint32_write(enum record_type type, uint32_t value);
+
+
+#endif /* RECORD_H */
@@ -0,0 +1,368 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "refresh.h"
+
+
+
+
+extern bool debug;
+extern char *bar_pidfile_path;
+
+
+static void *refresh_thread(void *arg);
+static void refresh_signal_send(struct mpd_fnscroller_refresh *refresh);
+static void refresh_pids_load(struct mpd_fnscroller_refresh *refresh);
+static unsigned int refresh_pidfile_read(pid_t *pids);
+static pid_t refresh_bar_pid_find(void);
+
+
+void refresh_init(struct mpd_fnscroller_refresh *refresh)
+{
+    pthread_condattr_t condattr;
+
+    memset(refresh, 0, sizeof(*refresh));
+    pthread_mutex_init(&refresh->lock, NULL);
+// Deadlines are in CLOCK_MONOTONIC like all the others
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&refresh->cond, &condattr);
+    pthread_condattr_destroy(&condattr);
+
+    return;
+};
+
+enum mpd_fnscroller_result
+refresh_start(struct mpd_fnscroller_refresh *refresh)
+{
+    if (refresh->signal == 0)
+    {
+        return RESULT_SUCCESS;
+    }
+    if (SIGRTMIN + refresh->signal > SIGRTMAX)
+    {
+        ERR_("Refresh signal is out of range: %d", refresh->signal)
+        return RESULT_ERROR;
+    }
+
+    if (thread_create(&refresh->thread_id, refresh_thread, refresh))
+    {
+        ERR_("Could not start refresh thread")
+        return RESULT_ERROR;
+    }
+    refresh->started = true;
+
+    return RESULT_SUCCESS;
+};
+
+void refresh_stop(struct mpd_fnscroller_refresh *refresh)
+{
+    if (!refresh->started)
+    {
+        return;
+    }
+    pthread_cancel(refresh->thread_id);
+    refresh->started = false;
+
+    return;
+};
+
+// Frame has been changed by a player event
+void refresh_notify(struct mpd_fnscroller_refresh *refresh)
+{
+    if (refresh->signal == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&refresh->lock);
+    refresh->changed = true;
+    pthread_cond_signal(&refresh->cond);
+    pthread_mutex_unlock(&refresh->lock);
+
+    return;
+};
+
+// Frame keeps changing on its own: the title is scrolled or the progress is
+// shown while playing
+void refresh_ticking_set(struct mpd_fnscroller_refresh *refresh,
+                         bool ticking)
+{
+    if ((refresh->signal == 0) || (refresh->ticking == ticking))
+    {
+        return;
+    }
+    pthread_mutex_lock(&refresh->lock);
+    if ((ticking) && (!refresh->ticking))
+    {
+        refresh->tick_time = monotonic_time_get() + REFRESH_INTERVAL_MS;
+    }
+    refresh->ticking = ticking;
+    pthread_cond_signal(&refresh->cond);
+    pthread_mutex_unlock(&refresh->lock);
+
+    return;
+};
+
+// Client run by i3blocks leaves the PID of the bar in the runtime directory
+// for the server. Nothing is written when it is there already.
+void refresh_bar_register(void)
+{
+    pid_t        pids[REFRESH_PIDS_MAX];
+    pid_t        bar_pid = 0;
+    unsigned int count = 0;
+    unsigned int i = 0;
+    char         path[PATH_STRING_SIZE];
+    FILE         *file = NULL;
+
+    if (getenv("BLOCK_NAME") == NULL)
+    {
+        return;
+    }
+    bar_pid = refresh_bar_pid_find();
+    if (bar_pid == -1)
+    {
+        return;
+    }
+
+    count = refresh_pidfile_read(pids);
+    for (i = 0; i < count; ++i)
+    {
+        if (pids[i] == bar_pid)
+        {
+            return;
+        }
+    }
+
+// Bars gone are dropped, the file is replaced as a whole
+    snprintf(path, PATH_STRING_SIZE, "%s.%d", bar_pidfile_path, getpid());
+    file = fopen(path, "w");
+    if (file == NULL)
+    {
+        ERR_("Could not create %s", path)
+        return;
+    }
+    fprintf(file, "%d\n", bar_pid);
+    for (i = 0; i < count && i < REFRESH_PIDS_MAX - 1; ++i)
+    {
+        if (kill(pids[i], 0) == 0)
+        {
+            fprintf(file, "%d\n", pids[i]);
+        }
+    }
+    if ((fclose(file) != 0) || (rename(path, bar_pidfile_path) == -1))
+    {
+        ERR_("Could not write %s", bar_pidfile_path)
+        unlink(path);
+    }
+
+    return;
+};
+
+
+static void *refresh_thread(void *arg)
+{
+    struct mpd_fnscroller_refresh *refresh = arg;
+    struct timespec               deadline;
+    unsigned long long            now = 0;
+    bool                          send = false;
+
+    pthread_mutex_lock(&refresh->lock);
+    while (true)
+    {
+        if ((!refresh->changed) && (!refresh->ticking))
+        {
+            pthread_cond_wait(&refresh->cond, &refresh->lock);
+        }
+        else if (!refresh->changed)
+        {
+            deadline.tv_sec = refresh->tick_time / 1000;
+            deadline.tv_nsec = (refresh->tick_time % 1000) * 1000000;
+            pthread_cond_timedwait(&refresh->cond, &refresh->lock, &deadline);
+        }
+
+        now = monotonic_time_get();
+        send = (refresh->changed) ||
+               ((refresh->ticking) && (now >= refresh->tick_time));
+        if (send)
+        {
+            refresh->changed = false;
+            refresh->tick_time = now + REFRESH_INTERVAL_MS;
+            pthread_mutex_unlock(&refresh->lock);
+            refresh_signal_send(refresh);
+            pthread_mutex_lock(&refresh->lock);
+        }
+    }
+
+    return NULL;
+};
+
+static void refresh_signal_send(struct mpd_fnscroller_refresh *refresh)
+{
+    unsigned int i = 0;
+
+    TRACE_()
+
+    if (refresh->pid)
+    {
+        if (kill(refresh->pid, SIGRTMIN + refresh->signal) == -1)
+        {
+            DEBUG_("Could not signal %d: %s", refresh->pid, strerror(errno))
+        }
+        return;
+    }
+
+    refresh_pids_load(refresh);
+    for (i = 0; i < refresh->pids_count; ++i)
+    {
+        if (kill(refresh->pids[i], SIGRTMIN + refresh->signal) == -1)
+        {
+            DEBUG_("Could not signal %d: %s", refresh->pids[i],
+                   strerror(errno))
+        }
+    }
+
+    return;
+};
+
+// File is only read again when it has been replaced
+static void refresh_pids_load(struct mpd_fnscroller_refresh *refresh)
+{
+    struct stat stat_buffer;
+
+    if (stat(bar_pidfile_path, &stat_buffer) == -1)
+    {
+        refresh->pids_count = 0;
+        return;
+    }
+    if ((stat_buffer.st_mtim.tv_sec == refresh->pidfile_mtime.tv_sec) &&
+        (stat_buffer.st_mtim.tv_nsec == refresh->pidfile_mtime.tv_nsec))
+    {
+        return;
+    }
+    refresh->pidfile_mtime = stat_buffer.st_mtim;
+    refresh->pids_count = refresh_pidfile_read(refresh->pids);
+    DEBUG_("Bars to refresh: %u", refresh->pids_count)
+
+    return;
+};
+
+static unsigned int refresh_pidfile_read(pid_t *pids)
+{
+    char         buffer[REFRESH_PIDS_MAX * PID_STRING_SIZE];
+    char         *c = buffer;
+    char         *end = NULL;
+    unsigned int count = 0;
+    ssize_t      bytes_read = 0;
+    int          fd = open(bar_pidfile_path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+    {
+        return 0;
+    }
+    bytes_read = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (bytes_read <= 0)
+    {
+        return 0;
+    }
+    buffer[bytes_read] = '\0';
+
+    while (count < REFRESH_PIDS_MAX)
+    {
+        pids[count] = strtol(c, &end, DEC);
+        if ((end == c) || (pids[count] <= 0))
+        {
+            break;
+        }
+        ++count;
+        c = end;
+    }
+
+    return count;
+};
+
+// Block command may be run through a shell or two: the bar is looked for
+// up the process tree
+static pid_t refresh_bar_pid_find(void)
+{
+    char         path[PATH_STRING_SIZE];
+    char         stat_string[REFRESH_STAT_SIZE];
+    char         *comm_end = NULL;
+    pid_t        pid = getppid();
+    unsigned int depth = 0;
+    ssize_t      bytes_read = 0;
+    int          fd = 0;
+
+    for (depth = 0; (depth < REFRESH_ANCESTORS_MAX) && (pid > 1); ++depth)
+    {
+        snprintf(path, PATH_STRING_SIZE, "/proc/%d/stat", pid);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return -1;
+        }
+        bytes_read = read(fd, stat_string, REFRESH_STAT_SIZE - 1);
+        close(fd);
+        if (bytes_read <= 0)
+        {
+            return -1;
+        }
+        stat_string[bytes_read] = '\0';
+
+// "pid (comm) state ppid ...", comm may have spaces and parentheses itself
+        comm_end = strrchr(stat_string, ')');
+        if ((comm_end == NULL) || (strchr(stat_string, '(') == NULL))
+        {
+            return -1;
+        }
+        *comm_end = '\0';
+        if (strcmp(strchr(stat_string, '(') + 1, REFRESH_BAR_NAME) == 0)
+        {
+            return pid;
+        }
+        if (sscanf(comm_end + 2, "%*c %d", &pid) != 1)
+        {
+            return -1;
+        }
+    }
+
+    return -1;
+};
@@ -0,0 +1,80 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef REFRESH_H
+#define REFRESH_H
+
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mpd-fnscroller.h"
+#include "libmpdfnscroller.h"
+
+
+
+
+#define REFRESH_INTERVAL_MS   MPDFNSCROLLER_STEP_MS
+#define REFRESH_PIDS_MAX      8
+#define REFRESH_ANCESTORS_MAX 8
+#define REFRESH_BAR_NAME      "i3blocks"
+#define REFRESH_STAT_SIZE     512
+
+
+// i3blocks is signalled to run the block when its frame changes: right away
+// on the player events and on every step while the frame keeps moving. The
+// block does not need to be polled on an interval then.
+struct mpd_fnscroller_refresh
+{
+    int                signal;
+    pid_t              pid;
+
+    pid_t              pids[REFRESH_PIDS_MAX];
+    unsigned int       pids_count;
+    struct timespec    pidfile_mtime;
+
+    bool               changed;
+    bool               ticking;
+    unsigned long long tick_time;
+    pthread_t          thread_id;
+    bool               started;
+    pthread_mutex_t    lock;
+    pthread_cond_t     cond;
+};
+
+
+void refresh_init(struct mpd_fnscroller_refresh *refresh);
+enum mpd_fnscroller_result
+refresh_start(struct mpd_fnscroller_refresh *refresh);
+void refresh_stop(struct mpd_fnscroller_refresh *refresh);
+void refresh_notify(struct mpd_fnscroller_refresh *refresh);
+void refresh_ticking_set(struct mpd_fnscroller_refresh *refresh,
+                         bool ticking);
+void refresh_bar_register(void);
+
+
+#endif /* REFRESH_H */
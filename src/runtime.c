@@ -23,9 +23,14 @@
  */
 
 
+#define _GNU_SOURCE
+
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <pwd.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
@@ -33,6 +38,7 @@
 #include <errno.h>
 #include <syslog.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "mpd-fnscroller.h"
 #include "runtime.h"
@@ -40,16 +46,21 @@
 
 
 
-static char runtime_dir_path[PATH_STRING_SIZE] = "";
+static char *runtime_dir_path = NULL;
 
 extern bool debug;
-extern char pidfile_path[];
-extern char sockfile_path[];
+extern char *pidfile_path;
+extern char *sockfile_path;
+extern char *handoverfile_path;
+extern char *snapshotfile_path;
+extern char *bar_pidfile_path;
 
 
 static enum mpd_fnscroller_result get_runtime_dir(void);
-static enum mpd_fnscroller_result get_pidfile_path(void);
-static enum mpd_fnscroller_result get_sockfile_path(void);
+static enum mpd_fnscroller_result runtime_path_get(char **path,
+                                                   const char *name,
+                                                   size_t size_max);
+static enum mpd_fnscroller_result server_pid_socket_get(pid_t *pid);
 
 
 enum mpd_fnscroller_result runtime_paths_init(void)
@@ -60,7 +71,121 @@ enum mpd_fnscroller_result runtime_paths_init(void)
         return RESULT_ERROR;
     }
 
-    return get_pidfile_path() | get_sockfile_path();
+    return runtime_path_get(&pidfile_path, PIDFILE_NAME, PATH_STRING_SIZE) &
+           runtime_path_get(&sockfile_path, SOCKFILE_NAME,
+                            SUN_PATH_STRING_SIZE) &
+           runtime_path_get(&handoverfile_path, HANDOVERFILE_NAME,
+                            SUN_PATH_STRING_SIZE) &
+           runtime_path_get(&snapshotfile_path, SNAPSHOTFILE_NAME,
+                            PATH_STRING_SIZE) &
+           runtime_path_get(&bar_pidfile_path, BAR_PIDFILE_NAME,
+                            PATH_STRING_SIZE);
+};
+
+enum mpd_fnscroller_result server_pid_get(pid_t *pid)
+{
+    int     pidfile_fd = 0;
+    ssize_t bytes_read = 0;
+    char    *invalid_numchar = NULL;
+    char    pid_str[PID_STRING_SIZE];
+
+    memset(pid_str, '\0', PID_STRING_SIZE);
+
+    pidfile_fd = open(pidfile_path, O_RDONLY);
+    if ((pidfile_fd == -1) && (errno == ENOENT))
+    {
+        return server_pid_socket_get(pid);
+    }
+    if (pidfile_fd == -1)
+    {
+        ERR_("Could not open pidfile: %s", pidfile_path)
+        return RESULT_ERROR;
+    }
+    bytes_read = read(pidfile_fd, pid_str, PID_STRING_SIZE - 1);
+    close(pidfile_fd);
+    if (bytes_read <= 0)
+    {
+        ERR_("Could not read server PID")
+        return RESULT_ERROR;
+    }
+    *pid = strtol(pid_str, &invalid_numchar, DEC);
+    if (*invalid_numchar)
+    {
+        ERR_("Invalid pidfile data")
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Milliseconds of CLOCK_MONOTONIC: deadlines and intervals are measured in it
+unsigned long long monotonic_time_get(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+};
+
+// Milliseconds since the epoch, for the times kept across restarts
+unsigned long long wall_time_get(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+};
+
+// Server changes its working directory when it is daemonized: the paths given
+// on the command line are made absolute beforehand. Result is malloc'ed.
+char *absolute_path_get(const char *path)
+{
+    char cwd[PATH_STRING_SIZE];
+    char *absolute_path = NULL;
+
+    if (path[0] == '/')
+    {
+        return strdup(path);
+    }
+
+    if (getcwd(cwd, PATH_STRING_SIZE) == NULL)
+    {
+        return NULL;
+    }
+    absolute_path = malloc(strlen(cwd) + strlen(path) + 2);
+    if (absolute_path)
+    {
+        sprintf(absolute_path, "%s/%s", cwd, path);
+    }
+
+    return absolute_path;
+};
+
+// pthread_create() with the stack size of the build, returns its result
+int thread_create(pthread_t *thread_id, void *(*routine)(void *), void *arg)
+{
+#ifdef MPD_FNSCROLLER_FOOTPRINT
+    pthread_attr_t attr;
+    int            result = 0;
+
+    result = pthread_attr_init(&attr);
+    if (result)
+    {
+        return result;
+    }
+    result = pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    if (!result)
+    {
+        result = pthread_create(thread_id, &attr, routine, arg);
+    }
+    pthread_attr_destroy(&attr);
+
+    return result;
+#else
+    return pthread_create(thread_id, NULL, routine, arg);
+#endif /* MPD_FNSCROLLER_FOOTPRINT */
 };
 
 
@@ -68,35 +193,34 @@ static enum mpd_fnscroller_result get_runtime_dir(void)
 {
     struct stat   stat_buffer;
     struct passwd *passwd_buffer;
-    char          *xdg_runtime_dir = NULL;
-    char          *username;
+    const char    *format = NULL;
+    const char    *name = NULL;
+    int           size = 0;
 
-    if (strlen(runtime_dir_path))
+    if (runtime_dir_path)
     {
         return RESULT_SUCCESS;
     }
 
-    xdg_runtime_dir = getenv("XDG_RUNTIME_DIR");
-    memset(runtime_dir_path, '\0', PATH_STRING_SIZE);
-
-    if (xdg_runtime_dir)
+    name = getenv("XDG_RUNTIME_DIR");
+    if (name)
     {
-        if (strlen(xdg_runtime_dir) > PATH_STRING_SIZE - (strlen(PROGNAME) +
-                                      strlen(SOCKFILE_NAME) + 2))
-        {
-            ERR_("runtime directory path is too long")
-            return RESULT_ERROR;
-        }
-        snprintf(runtime_dir_path, PATH_STRING_SIZE, "%s/" PROGNAME,
-                 xdg_runtime_dir);
+        format = "%s/" PROGNAME;
     }
     else
     {
         passwd_buffer = getpwuid(getuid());
-        username = passwd_buffer ? passwd_buffer->pw_name : "unknown";
-        snprintf(runtime_dir_path, PATH_STRING_SIZE,
-                 TMP_DIR_PATH "/" TMP_RUNTIME_DIR_PREFIX "%s", username);
+        name = passwd_buffer ? passwd_buffer->pw_name : "unknown";
+        format = TMP_DIR_PATH "/" TMP_RUNTIME_DIR_PREFIX "%s";
+    }
+    size = snprintf(NULL, 0, format, name) + 1;
+    runtime_dir_path = malloc(size);
+    if (runtime_dir_path == NULL)
+    {
+        ERR_("Could not allocate runtime directory path")
+        return RESULT_ERROR;
     }
+    snprintf(runtime_dir_path, size, format, name);
     if (mkdir(runtime_dir_path, 0750) == -1)
     {
         if (errno == EEXIST)
@@ -118,26 +242,61 @@ static enum mpd_fnscroller_result get_runtime_dir(void)
     return RESULT_SUCCESS;
 };
 
-static enum mpd_fnscroller_result get_pidfile_path(void)
+// Paths of the runtime files are allocated to their length, the ones bound
+// to a socket have to fit into sun_path
+static enum mpd_fnscroller_result runtime_path_get(char **path,
+                                                   const char *name,
+                                                   size_t size_max)
 {
-    if (snprintf(pidfile_path, PATH_STRING_SIZE, "%s/" PIDFILE_NAME,
-             runtime_dir_path) < 0)
+    size_t size = strlen(runtime_dir_path) + strlen(name) + 2;
+
+    if (size > size_max)
+    {
+        ERR_("Path of %s in %s is too long", name, runtime_dir_path)
+        return RESULT_ERROR;
+    }
+    *path = malloc(size);
+    if (*path == NULL)
     {
-        ERR_("Could not fill pidfile_path buffer")
+        ERR_("Could not allocate %s path", name)
         return RESULT_ERROR;
     }
+    snprintf(*path, size, "%s/%s", runtime_dir_path, name);
 
     return RESULT_SUCCESS;
 };
 
-static enum mpd_fnscroller_result get_sockfile_path(void)
+// Server run in the foreground ("-n") writes no pidfile. Its listening socket
+// tells its pid instead: the credentials of a listener are those of the
+// process which called listen() last, which the server taking it over does.
+static enum mpd_fnscroller_result server_pid_socket_get(pid_t *pid)
 {
-    if (snprintf(sockfile_path, PATH_STRING_SIZE, "%s/" SOCKFILE_NAME,
-             runtime_dir_path) < 0)
+    struct sockaddr_un server_sockaddr;
+    struct ucred       credentials;
+    socklen_t          length = sizeof(credentials);
+    int                sock = 0;
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        ERR_("Could not create socket")
+        return RESULT_ERROR;
+    }
+    memset(&server_sockaddr, 0, sizeof(server_sockaddr));
+    server_sockaddr.sun_family = AF_UNIX;
+    strncpy(server_sockaddr.sun_path, sockfile_path,
+            sizeof(server_sockaddr.sun_path) - 1);
+    if ((connect(sock, (struct sockaddr *)&server_sockaddr,
+                 sizeof(server_sockaddr)) == -1) ||
+        (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &credentials,
+                    &length) == -1))
     {
-        ERR_("Could not fill sockfile_path buffer")
+        ERR_("Could not find the server by its pidfile or socket")
+        close(sock);
         return RESULT_ERROR;
     }
+    close(sock);
+    *pid = credentials.pid;
 
     return RESULT_SUCCESS;
 };
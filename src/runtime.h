@@ -27,6 +27,9 @@
 #define RUNTIME_H
 
 
+#include <sys/types.h>
+#include <pthread.h>
+
 #include "mpd-fnscroller.h"
 
 
@@ -36,9 +39,28 @@
 #define TMP_RUNTIME_DIR_PREFIX PROGNAME "_"
 #define PIDFILE_NAME           PROGNAME ".pid"
 #define SOCKFILE_NAME          PROGNAME ".sock"
+#define HANDOVERFILE_NAME      PROGNAME ".handover"
+#define SNAPSHOTFILE_NAME      PROGNAME ".snapshot"
+#define BAR_PIDFILE_NAME       "i3blocks.pid"
+// System daemon serving every user (-U)
+#define SYSTEM_RUNTIME_DIR_PATH "/run/" PROGNAME
+#define SYSTEM_SOCKFILE_PATH    SYSTEM_RUNTIME_DIR_PATH "/" SOCKFILE_NAME
+
+#define PID_STRING_SIZE 8
+
+// Threads of the server run shallow loops, the footprint build gives them a
+// small stack instead of the default one (8 MiB of address space as a rule)
+#ifdef MPD_FNSCROLLER_FOOTPRINT
+#define THREAD_STACK_SIZE (128 * 1024)
+#endif /* MPD_FNSCROLLER_FOOTPRINT */
 
 
 enum mpd_fnscroller_result runtime_paths_init(void);
+enum mpd_fnscroller_result server_pid_get(pid_t *pid);
+unsigned long long monotonic_time_get(void);
+unsigned long long wall_time_get(void);
+char *absolute_path_get(const char *path);
+int thread_create(pthread_t *thread_id, void *(*routine)(void *), void *arg);
 
 
 #endif /* RUNTIME_H */
@@ -0,0 +1,307 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <time.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "scrobble.h"
+
+
+
+
+extern bool debug;
+
+static const enum mpd_tag_type scrobble_mpd_tags[SCROBBLE_TAG_COUNT] =
+{
+    MPD_TAG_ARTIST, MPD_TAG_ALBUM, MPD_TAG_TITLE, MPD_TAG_TRACK,
+    MPD_TAG_MUSICBRAINZ_TRACKID
+};
+
+
+static enum mpd_fnscroller_result scrobble_recover(int fd);
+static void scrobble_play_start(struct scrobble_play *play,
+                                const struct source_song *song,
+                                unsigned int duration_ms);
+static void scrobble_play_finish(struct mpd_fnscroller_scrobble *scrobble);
+static void scrobble_sync(struct mpd_fnscroller_scrobble *scrobble);
+static void scrobble_tag_copy(char *tag, const char *value);
+
+
+enum mpd_fnscroller_result
+scrobble_open(struct mpd_fnscroller_scrobble *scrobble, const char *path)
+{
+    char header[sizeof(SCROBBLE_LOG_HEADER) + 32];
+    int  length = 0;
+
+    memset(scrobble, 0, sizeof(*scrobble));
+
+    scrobble->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (scrobble->fd == -1)
+    {
+        ERR_("Could not open scrobbler log %s", path)
+        return RESULT_ERROR;
+    }
+    if (!scrobble_recover(scrobble->fd))
+    {
+        ERR_("Could not recover scrobbler log %s", path)
+        close(scrobble->fd);
+        scrobble->fd = -1;
+        return RESULT_ERROR;
+    }
+
+    if (lseek(scrobble->fd, 0, SEEK_END) == 0)
+    {
+        length = snprintf(header, sizeof(header), SCROBBLE_LOG_HEADER
+                          "%d.%d.%d\n", MPD_FNSCROLLER_VERSION_MAJOR,
+                          MPD_FNSCROLLER_VERSION_MINOR,
+                          MPD_FNSCROLLER_VERSION_PATCH);
+        if ((write(scrobble->fd, header, length) != length) ||
+            (fsync(scrobble->fd) == -1))
+        {
+            ERR_("Could not write scrobbler log header")
+            close(scrobble->fd);
+            scrobble->fd = -1;
+            return RESULT_ERROR;
+        }
+    }
+    scrobble->synced_time = monotonic_time_get();
+
+    return RESULT_SUCCESS;
+};
+
+void scrobble_close(struct mpd_fnscroller_scrobble *scrobble)
+{
+    if (scrobble->fd == -1)
+    {
+        return;
+    }
+
+// Song played at shutdown is scrobbled when it has been played long enough
+    scrobble_player_update(scrobble, false, NULL, 0);
+    scrobble_sync(scrobble);
+    close(scrobble->fd);
+    scrobble->fd = -1;
+
+    return;
+};
+
+// Called on every status taken from the source: the time played is accounted
+// between the statuses, the play is finished when the song is changed
+void scrobble_player_update(struct mpd_fnscroller_scrobble *scrobble,
+                            bool playing, const struct source_song *song,
+                            unsigned int duration_ms)
+{
+    struct scrobble_play *play = &scrobble->play;
+    unsigned long long   now = 0;
+
+    if (scrobble->fd == -1)
+    {
+        return;
+    }
+
+    now = monotonic_time_get();
+    if ((play->active) && (play->playing))
+    {
+        play->played_ms += now - play->updated;
+    }
+    if ((play->active) &&
+        ((song == NULL) || (song->id != play->song_id) ||
+         (strcmp(song->uri, play->uri))))
+    {
+        scrobble_play_finish(scrobble);
+    }
+    if ((song) && (!play->active))
+    {
+        scrobble_play_start(play, song, duration_ms);
+    }
+    play->playing = playing;
+    play->updated = now;
+
+    if ((scrobble->unsynced) &&
+        (now - scrobble->synced_time >= SCROBBLE_SYNC_INTERVAL_MS))
+    {
+        scrobble_sync(scrobble);
+    }
+
+    return;
+};
+
+
+// Line cut short by a crash is dropped: the log is kept to whole entries
+static enum mpd_fnscroller_result scrobble_recover(int fd)
+{
+    char  buffer[BUFSIZ];
+    off_t size = lseek(fd, 0, SEEK_END);
+    off_t offset = size;
+    off_t chunk = 0;
+
+    while (offset > 0)
+    {
+        chunk = (offset > BUFSIZ) ? BUFSIZ : offset;
+        if (pread(fd, buffer, chunk, offset - chunk) != chunk)
+        {
+            return RESULT_ERROR;
+        }
+        while ((chunk > 0) && (buffer[chunk - 1] != '\n'))
+        {
+            --chunk;
+            --offset;
+        }
+        if (chunk > 0)
+        {
+            break;
+        }
+    }
+
+    if (offset != size)
+    {
+        syslog(LOG_WARNING, "Dropping %lld bytes of incomplete scrobble",
+               (long long)(size - offset));
+        if ((ftruncate(fd, offset) == -1) || (fsync(fd) == -1))
+        {
+            return RESULT_ERROR;
+        }
+    }
+
+    return RESULT_SUCCESS;
+};
+
+static void scrobble_play_start(struct scrobble_play *play,
+                                const struct source_song *song,
+                                unsigned int duration_ms)
+{
+    unsigned int i = 0;
+
+    snprintf(play->uri, PATH_STRING_SIZE, "%s", song->uri);
+    play->song_id = song->id;
+    for (i = 0; i < SCROBBLE_TAG_COUNT; ++i)
+    {
+        scrobble_tag_copy(play->tags[i],
+                          source_song_tag_get(song, scrobble_mpd_tags[i]));
+    }
+// "3/12" is the third track of twelve
+    play->tags[SCROBBLE_TAG_TRACK][strspn(play->tags[SCROBBLE_TAG_TRACK],
+                                          "0123456789")] = '\0';
+    play->duration_ms = duration_ms;
+    play->started = time(NULL);
+    play->played_ms = 0;
+    play->active = true;
+
+    return;
+};
+
+// Play counts when the song is longer than 30 seconds and has been played
+// for half of its duration or for 4 minutes, whichever comes first
+static void scrobble_play_finish(struct mpd_fnscroller_scrobble *scrobble)
+{
+    struct scrobble_play *play = &scrobble->play;
+    unsigned long long   played_min_ms = play->duration_ms / 2;
+    char                 line[SCROBBLE_LINE_SIZE];
+    int                  length = 0;
+
+    play->active = false;
+
+    if (played_min_ms > SCROBBLE_PLAYED_MAX_MS)
+    {
+        played_min_ms = SCROBBLE_PLAYED_MAX_MS;
+    }
+    if ((play->duration_ms < SCROBBLE_DURATION_MIN_MS) ||
+        (play->played_ms < played_min_ms) ||
+        (play->tags[SCROBBLE_TAG_ARTIST][0] == '\0') ||
+        (play->tags[SCROBBLE_TAG_TITLE][0] == '\0'))
+    {
+        return;
+    }
+
+    length = snprintf(line, SCROBBLE_LINE_SIZE, "%s\t%s\t%s\t%s\t%u\tL\t%lld\t"
+                      "%s\n", play->tags[SCROBBLE_TAG_ARTIST],
+                      play->tags[SCROBBLE_TAG_ALBUM],
+                      play->tags[SCROBBLE_TAG_TITLE],
+                      play->tags[SCROBBLE_TAG_TRACK],
+                      play->duration_ms / 1000, (long long)play->started,
+                      play->tags[SCROBBLE_TAG_MBID]);
+    if ((length <= 0) || (length >= SCROBBLE_LINE_SIZE))
+    {
+        return;
+    }
+
+// Whole entry in a single write: a crash never leaves half of it behind
+// other than at the end, where it is dropped on the next start
+    if (write(scrobble->fd, line, length) != length)
+    {
+        ERR_("Could not write scrobble")
+        return;
+    }
+    DEBUG_("Scrobbled %s - %s", play->tags[SCROBBLE_TAG_ARTIST],
+           play->tags[SCROBBLE_TAG_TITLE])
+
+    if (++scrobble->unsynced >= SCROBBLE_SYNC_ENTRIES)
+    {
+        scrobble_sync(scrobble);
+    }
+
+    return;
+};
+
+// Group commit: one fsync makes a batch of entries durable
+static void scrobble_sync(struct mpd_fnscroller_scrobble *scrobble)
+{
+    if ((scrobble->unsynced) && (fdatasync(scrobble->fd) == -1))
+    {
+        ERR_("Could not sync scrobbler log")
+    }
+    scrobble->unsynced = 0;
+    scrobble->synced_time = monotonic_time_get();
+
+    return;
+};
+
+// Tabs and line breaks would break the log format
+static void scrobble_tag_copy(char *tag, const char *value)
+{
+    char *c = NULL;
+
+    snprintf(tag, SCROBBLE_TAG_SIZE, "%s", value ? value : "");
+    for (c = tag; *c; ++c)
+    {
+        if ((*c == '\t') || (*c == '\n') || (*c == '\r'))
+        {
+            *c = ' ';
+        }
+    }
+
+    return;
+};
@@ -0,0 +1,96 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef SCROBBLE_H
+#define SCROBBLE_H
+
+
+#include <stdbool.h>
+#include <time.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "source.h"
+
+
+
+
+#define SCROBBLE_LOG_HEADER       "#AUDIOSCROBBLER/1.1\n#TZ/UTC\n#CLIENT/" \
+                                  PROGNAME " "
+#define SCROBBLE_TAG_SIZE         256
+#define SCROBBLE_LINE_SIZE        (6 * SCROBBLE_TAG_SIZE)
+#define SCROBBLE_DURATION_MIN_MS  (30 * 1000)
+#define SCROBBLE_PLAYED_MAX_MS    (4 * 60 * 1000)
+#define SCROBBLE_SYNC_ENTRIES     8
+#define SCROBBLE_SYNC_INTERVAL_MS (10 * 60 * 1000)
+
+
+enum scrobble_tag
+{
+    SCROBBLE_TAG_ARTIST = 0,
+    SCROBBLE_TAG_ALBUM,
+    SCROBBLE_TAG_TITLE,
+    SCROBBLE_TAG_TRACK,
+    SCROBBLE_TAG_MBID,
+    SCROBBLE_TAG_COUNT
+};
+
+// Song which is being played now with the time it has actually been played:
+// the pauses do not count
+struct scrobble_play
+{
+    bool               active;
+    bool               playing;
+    char               uri[PATH_STRING_SIZE];
+    unsigned int       song_id;
+    char               tags[SCROBBLE_TAG_COUNT][SCROBBLE_TAG_SIZE];
+    unsigned int       duration_ms;
+    time_t             started;
+    unsigned long long played_ms;
+    unsigned long long updated;
+};
+
+// Offline scrobble queue in the .scrobbler.log format of the portable
+// players. Entries are written one by one, fsync is done for a group of
+// them.
+struct mpd_fnscroller_scrobble
+{
+    int                  fd;
+    unsigned int         unsynced;
+    unsigned long long   synced_time;
+
+    struct scrobble_play play;
+};
+
+
+enum mpd_fnscroller_result
+scrobble_open(struct mpd_fnscroller_scrobble *scrobble, const char *path);
+void scrobble_close(struct mpd_fnscroller_scrobble *scrobble);
+void scrobble_player_update(struct mpd_fnscroller_scrobble *scrobble,
+                            bool playing, const struct source_song *song,
+                            unsigned int duration_ms);
+
+
+#endif /* SCROBBLE_H */
@@ -0,0 +1,208 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <wchar.h>
+
+#include "mpd-fnscroller.h"
+#include "libmpdfnscroller.h"
+#include "json.h"
+#include "scroll.h"
+
+
+
+
+extern bool debug;
+
+
+static unsigned int scroll_position_next(struct mpd_fnscroller_scroll *scroll,
+                                         unsigned int width);
+
+
+void scroll_init(struct mpd_fnscroller_scroll *scroll)
+{
+    mpdfnscroller_init(&scroll->scroller, 0);
+    json_title_set(&scroll->json, &scroll->scroller);
+    scroll_rewind(scroll);
+
+    return;
+};
+
+// Spec is a comma separated list like "bounce,dwell=2,accel=3", the
+// delimiter goes last as it takes the rest of the spec: "delimiter= ~ "
+enum mpd_fnscroller_result
+scroll_options_parse(struct mpdfnscroller_options *options, char *spec)
+{
+    char *option = spec;
+    char *next = NULL;
+    char *invalid_numchar = NULL;
+
+    memset(options, 0, sizeof(*options));
+    options->mode = MPDFNSCROLLER_MODE_WRAP;
+
+    while ((option) && (*option != '\0'))
+    {
+        invalid_numchar = NULL;
+        if (strncmp(option, SCROLL_OPTARG_DELIMITER,
+                    strlen(SCROLL_OPTARG_DELIMITER)) == 0)
+        {
+            options->delimiter = option + strlen(SCROLL_OPTARG_DELIMITER);
+            break;
+        }
+
+        next = strchr(option, ',');
+        if (next)
+        {
+            *next++ = '\0';
+        }
+
+        if (strcmp(option, SCROLL_OPTARG_WRAP) == 0)
+        {
+            options->mode = MPDFNSCROLLER_MODE_WRAP;
+        }
+        else if (strcmp(option, SCROLL_OPTARG_BOUNCE) == 0)
+        {
+            options->mode = MPDFNSCROLLER_MODE_BOUNCE;
+        }
+        else if (strncmp(option, SCROLL_OPTARG_DWELL,
+                         strlen(SCROLL_OPTARG_DWELL)) == 0)
+        {
+            options->dwell = strtoul(option + strlen(SCROLL_OPTARG_DWELL),
+                                     &invalid_numchar, 10);
+        }
+        else if (strncmp(option, SCROLL_OPTARG_ACCELERATION,
+                         strlen(SCROLL_OPTARG_ACCELERATION)) == 0)
+        {
+            options->acceleration = strtoul(option +
+                                            strlen(SCROLL_OPTARG_ACCELERATION),
+                                            &invalid_numchar, 10);
+        }
+        else
+        {
+            ERR_("Unknown scrolling option: %s", option)
+            return RESULT_ERROR;
+        }
+        if ((invalid_numchar) && (*invalid_numchar != '\0'))
+        {
+            ERR_("Invalid scrolling option value: %s", option)
+            return RESULT_ERROR;
+        }
+        option = next;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Schedule is compiled again with the next frame
+enum mpd_fnscroller_result
+scroll_options_set(struct mpd_fnscroller_scroll *scroll,
+                   const struct mpdfnscroller_options *options)
+{
+    if (mpdfnscroller_options_set(&scroll->scroller, options) == -1)
+    {
+        ERR_("Scrolling options are out of range: dwell is up to %d, "
+             "acceleration is up to %d, delimiter is up to %d characters",
+             MPDFNSCROLLER_DWELL_MAX, MPDFNSCROLLER_ACCELERATION_MAX,
+             MPDFNSCROLLER_DELIMITER_SIZE - 1)
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Replaces the string to be scrolled and restarts the scrolling
+enum mpd_fnscroller_result
+scroll_string_set(struct mpd_fnscroller_scroll *scroll, const char *string)
+{
+    scroll_rewind(scroll);
+
+    if (mpdfnscroller_title_set(&scroll->scroller, string, 0) == -1)
+    {
+        ERR_("Invalid string to scroll or longer than %d characters: %s",
+             MPDFNSCROLLER_TITLE_SIZE - 1, string)
+        json_title_set(&scroll->json, &scroll->scroller);
+        return RESULT_ERROR;
+    }
+    json_title_set(&scroll->json, &scroll->scroller);
+    DEBUG_("string: %s; length: %u", string, scroll->scroller.length)
+
+    return RESULT_SUCCESS;
+};
+
+void scroll_rewind(struct mpd_fnscroller_scroll *scroll)
+{
+    scroll->position = 0;
+
+    return;
+};
+
+void scroll_frame_get(struct mpd_fnscroller_scroll *scroll,
+                      wchar_t *filename_part_buf, unsigned int wcbufsize)
+{
+    unsigned int width = wcbufsize - 1;
+
+    TRACE_()
+
+    memset(filename_part_buf, '\0', sizeof(wchar_t) * wcbufsize);
+    mpdfnscroller_frame_at(&scroll->scroller, width,
+                           scroll_position_next(scroll, width),
+                           filename_part_buf);
+
+    return;
+};
+
+// Same frame as scroll_frame_get() sliced out of the escaped title
+size_t scroll_json_frame_get(struct mpd_fnscroller_scroll *scroll,
+                             unsigned int wcbufsize, const char *progress,
+                             const char *color, char *buf, size_t size)
+{
+    unsigned int width = wcbufsize - 1;
+    unsigned int offset = 0;
+
+    TRACE_()
+
+    offset = mpdfnscroller_offset_at(&scroll->scroller, width,
+                                     scroll_position_next(scroll, width));
+
+    return json_frame_render(&scroll->json, &scroll->scroller, offset, width,
+                             progress, color, buf, size);
+};
+
+
+// Position is kept within the period: it is handed over as it is
+static unsigned int scroll_position_next(struct mpd_fnscroller_scroll *scroll,
+                                         unsigned int width)
+{
+    unsigned int position = scroll->position;
+
+    scroll->position = (position + 1) %
+                       mpdfnscroller_period_get(&scroll->scroller, width);
+    TRACEPOINT_("position: %lld; width: %lld", position, width)
+
+    return position;
+};
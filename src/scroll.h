@@ -0,0 +1,74 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef SCROLL_H
+#define SCROLL_H
+
+
+#include <wchar.h>
+
+#include "mpd-fnscroller.h"
+#include "libmpdfnscroller.h"
+#include "json.h"
+
+
+
+
+#define SCROLL_OPTARG_WRAP         "wrap"
+#define SCROLL_OPTARG_BOUNCE       "bounce"
+#define SCROLL_OPTARG_DWELL        "dwell="
+#define SCROLL_OPTARG_ACCELERATION "accel="
+#define SCROLL_OPTARG_DELIMITER    "delimiter="
+
+
+// Scrolling state of a single string: the frames are produced one after
+// another, every call advances the state by one character. Frames themselves
+// come from libmpdfnscroller, the server only keeps the position and the
+// escaped title for the JSON frames.
+struct mpd_fnscroller_scroll
+{
+    struct mpdfnscroller       scroller;
+    volatile unsigned int      position;
+    struct mpd_fnscroller_json json;
+};
+
+
+void scroll_init(struct mpd_fnscroller_scroll *scroll);
+enum mpd_fnscroller_result
+scroll_options_parse(struct mpdfnscroller_options *options, char *spec);
+enum mpd_fnscroller_result
+scroll_options_set(struct mpd_fnscroller_scroll *scroll,
+                   const struct mpdfnscroller_options *options);
+enum mpd_fnscroller_result
+scroll_string_set(struct mpd_fnscroller_scroll *scroll, const char *string);
+void scroll_rewind(struct mpd_fnscroller_scroll *scroll);
+void scroll_frame_get(struct mpd_fnscroller_scroll *scroll,
+                      wchar_t *filename_part_buf, unsigned int wcbufsize);
+size_t scroll_json_frame_get(struct mpd_fnscroller_scroll *scroll,
+                             unsigned int wcbufsize, const char *progress,
+                             const char *color, char *buf, size_t size);
+
+
+#endif /* SCROLL_H */
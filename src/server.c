@@ -27,20 +27,29 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/eventfd.h>
 #include <signal.h>
 #include <stdbool.h>
-#include <libgen.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <syslog.h>
 #include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
 #include <pthread.h>
 #include <wchar.h>
 #include <mpd/client.h>
 
 #include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "handover.h"
+#include "connection.h"
+#include "record.h"
+#include "utf8.h"
 #include "server.h"
 
 
@@ -48,31 +57,95 @@
 
 extern bool daemonize_service;
 extern bool debug;
-extern char pidfile_path[];
-extern char sockfile_path[];
+extern char *pidfile_path;
+extern char *sockfile_path;
+extern char *snapshotfile_path;
 
 volatile static struct mpd_fnscroller_server *mpd_fnscroller_server = NULL;
-volatile static unsigned int                 filename_part_buf_offset = 0;
+volatile static unsigned int                 client_wcbufsize = 0;
+volatile static unsigned int                 up_next_wcbufsize = 0;
+volatile static enum mpd_fnscroller_progress client_progress = PROGRESS_NONE;
 volatile static enum server_status           status = STATUS_COUNT;
-static pthread_mutex_t                       lock;
+volatile static sig_atomic_t                 shutdown_requested = 0;
+volatile static sig_atomic_t                 handover_requested = 0;
+static pthread_mutex_t                       lock =
+                                             PTHREAD_MUTEX_INITIALIZER;
+static struct connection_pool                connection_pool;
 
 
 static void server_shutdown_handler(int sig);
+static void server_handover_handler(int sig);
+static void server_signal_wakeup(void);
+static void server_handover(struct mpd_fnscroller_server *server);
 
-static void daemonize(int *pidfile_fd);
+static void daemonize(struct mpd_fnscroller_server *server);
+static enum mpd_fnscroller_result
+server_handover_take(struct mpd_fnscroller_server *server);
+static void server_snapshot_get(struct mpd_fnscroller_server *server,
+                                struct mpd_fnscroller_snapshot *snapshot);
+static void server_snapshot_set(struct mpd_fnscroller_server *server,
+                                const struct mpd_fnscroller_snapshot *snapshot);
+static void server_snapshot_restore(struct mpd_fnscroller_server *server);
+static void server_snapshot_save(struct mpd_fnscroller_server *server);
 static enum mpd_fnscroller_result
 serve_thread_start(struct mpd_fnscroller_server *server);
+static void serve_thread_stop(struct mpd_fnscroller_server *server);
 static void *client_serve(void *arg);
 static enum mpd_fnscroller_result
-filename_part_send(struct mpd_fnscroller_server *server, int sock,
-                   unsigned int bufsize);
+client_connections_serve(struct mpd_fnscroller_server *server,
+                         struct connection_pool *pool);
 static enum mpd_fnscroller_result
-mpd_event_handler_loop(struct mpd_fnscroller_server *server);
+client_request_handle(struct mpd_fnscroller_server *server,
+                      struct connection_pool *pool,
+                      struct mpd_fnscroller_connection *connection);
 static enum mpd_fnscroller_result
-mpd_fn_string_get(struct mpd_fnscroller_server *server,
-                  struct mpd_connection *connection);
-
+frame_request_handle(struct mpd_fnscroller_server *server,
+                     struct mpd_fnscroller_connection *connection,
+                     enum mpd_fnscroller_request request,
+                     unsigned int frame_arg);
+static enum mpd_fnscroller_result
+trace_dump_request_handle(struct mpd_fnscroller_connection *connection);
+static enum mpd_fnscroller_result
+history_request_handle(struct mpd_fnscroller_server *server,
+                       struct mpd_fnscroller_connection *connection,
+                       enum mpd_fnscroller_request request,
+                       unsigned int count);
+static enum mpd_fnscroller_result
+wait_request_handle(struct mpd_fnscroller_server *server,
+                    struct connection_pool *pool,
+                    struct mpd_fnscroller_connection *connection,
+                    unsigned int version);
+static void wait_requests_release(struct mpd_fnscroller_server *server,
+                                  struct connection_pool *pool);
+static size_t wait_response_render(struct mpd_fnscroller_server *server,
+                                   char *output, size_t size);
+static enum mpd_fnscroller_result
+json_frame_request_handle(struct mpd_fnscroller_server *server,
+                          struct mpd_fnscroller_connection *connection,
+                          struct mpd_fnscroller_scroll *scroll,
+                          unsigned int wcbufsize,
+                          enum mpd_fnscroller_progress progress);
+static void filename_part_get(struct mpd_fnscroller_server *server,
+                              struct mpd_fnscroller_scroll *scroll,
+                              wchar_t *filename_part_buf,
+                              unsigned int wcbufsize,
+                              enum mpd_fnscroller_progress progress);
+static enum mpd_fnscroller_result
+source_event_handler_loop(struct mpd_fnscroller_server *server);
+static enum mpd_fnscroller_result
+source_commands_run(struct mpd_fnscroller_server *server);
+static void server_signals_handle(struct mpd_fnscroller_server *server);
+static enum mpd_fnscroller_result
+source_player_update(struct mpd_fnscroller_server *server,
+                     struct source_song *song);
+static enum mpd_fnscroller_result
+up_next_update(struct mpd_fnscroller_server *server,
+               const struct source_status *source_status, bool *published);
+static void server_publish(struct mpd_fnscroller_server *server);
+static void refresh_ticking_update(struct mpd_fnscroller_server *server);
+static void pidfile_release(void);
 static void server_cleanup(void);
+static void server_flush(void);
 
 
 enum mpd_fnscroller_result server_init(struct mpd_fnscroller_server *server)
@@ -80,99 +153,136 @@ enum mpd_fnscroller_result server_init(struct mpd_fnscroller_server *server)
     mpd_fnscroller_server = server;
 
     status = STATUS_INITIALIZING;
-    server->mpd_timeout = MPD_DEFAULT_TIMEOUT;
-    if (!mpd_server_defaults_get(server->mpd_host, &server->mpd_port))
+    if (!source_init(&server->source))
     {
         ERR_("Unable to get default mpd server hostname and port")
         return RESULT_ERROR;
     }
 
     server->current_string_size = 0;
+    server->mpd_state = MPD_STATE_UNKNOWN;
 
-    filename_part_buf_offset = 0;
+    client_wcbufsize = 0;
+    up_next_wcbufsize = 0;
+    client_progress = PROGRESS_NONE;
 
     memset(server->fn_string, '\0', FILENAME_STRING_SIZE);
-    memset(server->fn_wcstring, '\0', sizeof(wchar_t) *
-           FILENAME_WCHAR_STRING_SIZE);
-
+    if (!format_compile(&server->format, FORMAT_DEFAULT_STRING))
+    {
+        ERR_("Unable to compile default format")
+        return RESULT_ERROR;
+    }
+    cleanup_init(&server->cleanup);
+    scroll_init(&server->scroll);
+    playtime_set(&server->playtime, false, 0, 0, 0);
+
+    server->up_next = false;
+    queue_init(&server->queue);
+    memset(server->up_next_string, '\0', FILENAME_STRING_SIZE);
+    scroll_init(&server->up_next_scroll);
+
+    tenants_init(&server->tenants);
+
+    server->handover = false;
+    server->record_path = NULL;
+    server->history_path = NULL;
+    memset(&server->history, 0, sizeof(server->history));
+    server->scrobble_path = NULL;
+    memset(&server->scrobble, 0, sizeof(server->scrobble));
+    server->scrobble.fd = -1;
+    hook_init(&server->hook);
+    refresh_init(&server->refresh);
+    mpris_init(&server->mpris);
+    watchdog_init(&server->watchdog);
+// Version seen from a previous instance is not mistaken for the current one
+    server->version = (monotonic_time_get() & REQUEST_ARG_MASK) | 1;
+    server->wait_fd = -1;
+    server->command_fd = -1;
     server->pidfile_fd = 0;
 
-    server->sock_listener = 0;
+    server->serve_thread_started = false;
+    server->sock_listener = -1;
 
     signal(SIGUSR1, server_shutdown_handler);
+    signal(SIGUSR2, server_handover_handler);
 
     return RESULT_SUCCESS;
 };
 
-enum mpd_fnscroller_result mpd_server_defaults_get(char *host,
-                                                   unsigned int *port)
+// Shutdown is made by the event handler loop as well, which leaves through
+// the same path as on any other stop: the snapshot is saved there
+static void server_shutdown_handler(int sig)
 {
-    char *mpd_env_variable_host = getenv(MPD_ENV_VARIABLE_HOST);
-    char *mpd_env_variable_port = getenv(MPD_ENV_VARIABLE_PORT);
-    char *invalid_numchar = NULL;
+    shutdown_requested = 1;
+    server_signal_wakeup();
 
-    memset(host, '\0', HOSTNAME_STRING_SIZE);
-    if (mpd_env_variable_host)
-    {
-        if (strlen(mpd_env_variable_host) > HOSTNAME_STRING_SIZE - 1)
-        {
-            ERR_(MPD_ENV_VARIABLE_HOST " variable value too is long")
-            return RESULT_ERROR;
-        }
-        else
-        {
-            strncpy(host, mpd_env_variable_host, HOSTNAME_STRING_SIZE - 1);
-        }
-    }
-    else
-    {
-        strncpy(host, MPD_DEFAULT_HOST, HOSTNAME_STRING_SIZE - 1);
-    }
+    return;
+};
 
-    if (mpd_env_variable_port)
-    {
-        *port = strtol(mpd_env_variable_port, &invalid_numchar, DEC);
-        if (*invalid_numchar)
-        {
-            ERR_("Invalid " MPD_ENV_VARIABLE_PORT "variable value")
-            return RESULT_ERROR;
-        }
-    }
-    else
+// Another instance asks for the listening socket and the current state. Only
+// the request is noted here, the event handler loop makes the handover.
+static void server_handover_handler(int sig)
+{
+    handover_requested = 1;
+    server_signal_wakeup();
+
+    return;
+};
+
+// Command descriptor of the event handler loop is an eventfd, which is safe
+// to be written to from a signal handler
+static void server_signal_wakeup(void)
+{
+    int      saved_errno = errno;
+    uint64_t wakeup = 1;
+
+    if ((mpd_fnscroller_server->command_fd != -1) &&
+        (write(mpd_fnscroller_server->command_fd, &wakeup,
+               sizeof(wakeup)) == -1))
     {
-        *port = MPD_DEFAULT_PORT;
+// Loop already woken up has the counter full, nothing is lost
     }
+    errno = saved_errno;
 
-    return RESULT_SUCCESS;
+    return;
 };
 
-static void server_shutdown_handler(int sig)
+// The pidfile is released before anything is sent, so that the new instance
+// may create its own one as soon as it has got the socket
+static void server_handover(struct mpd_fnscroller_server *server)
 {
+    struct mpd_fnscroller_snapshot snapshot;
+    int                            sock_handover = 0;
+
     TRACE_()
-    DEBUG_("SIGNAL: %d; current server status: %d", sig, status)
+    DEBUG_("Handover requested; current server status: %d", status)
 
-    if (sig == SIGUSR1)
+    sock_handover = handover_connect();
+    if (sock_handover == -1)
     {
-        pthread_mutex_lock(&lock);
-        status = STATUS_SHUTDOWN;
-        pthread_mutex_unlock(&lock);
-
-        server_cleanup();
-        exit(EXIT_SUCCESS);
+        ERR_("Handover request ignored")
+        return;
     }
-    else
-    {
-        ERR_("Unhandled signal %d", sig)
 
-        pthread_mutex_lock(&lock);
-        status = STATUS_SHUTDOWN;
-        pthread_mutex_unlock(&lock);
+    pthread_mutex_lock(&lock);
+    status = STATUS_SHUTDOWN;
+    server_snapshot_get(server, &snapshot);
+    pthread_mutex_unlock(&lock);
 
+    serve_thread_stop(server);
+    pidfile_release();
+
+    if (!handover_send(sock_handover, &snapshot, server->sock_listener))
+    {
+        ERR_("Handover failed")
         server_cleanup();
         exit(EXIT_FAILURE);
     }
 
-    return;
+// Socket belongs to the new instance now: only the rest is cleaned up
+    syslog(LOG_WARNING, "Server is handed over");
+    server_flush();
+    exit(EXIT_SUCCESS);
 };
 
 
@@ -182,13 +292,77 @@ enum mpd_fnscroller_result server_run(struct mpd_fnscroller_server *server)
 
     TRACE_()
 
+// System daemon runs in the foreground with an event loop of its own
+    if (server->tenants.template)
+    {
+        return tenants_run(&server->tenants, &server->format,
+                           &server->cleanup, &server->scroll);
+    }
+
     syslog(LOG_INFO, PROGNAME " server is started");
 
+    if ((server->up_next) && (!source_queue_supported(&server->source)))
+    {
+        ERR_("The %s source has no queue for -N", server->source.ops->name)
+        return RESULT_ERROR;
+    }
+
     status = STATUS_OK;
     if (daemonize_service)
     {
-        daemonize(&server->pidfile_fd);
+        daemonize(server);
+    }
+    else
+    {
+        if (server->handover && !server_handover_take(server))
+        {
+            ERR_("Could not take over the running server instance")
+            return RESULT_ERROR;
+        }
+    }
+    if (!server->handover)
+    {
+        server_snapshot_restore(server);
+    }
+
+    if ((server->record_path) && (!record_open(server->record_path)))
+    {
+        server_cleanup();
+        return RESULT_ERROR;
+    }
+    if ((server->history_path) &&
+        (!history_open(&server->history, server->history_path)))
+    {
+        server_cleanup();
+        return RESULT_ERROR;
+    }
+    if ((server->scrobble_path) &&
+        (!scrobble_open(&server->scrobble, server->scrobble_path)))
+    {
+        server_cleanup();
+        return RESULT_ERROR;
+    }
+    if (!hook_start(&server->hook))
+    {
+        server_cleanup();
+        return RESULT_ERROR;
+    }
+    server->wait_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->wait_fd == -1)
+    {
+        ERR_("Could not create wait_fd")
+        server_cleanup();
+        return RESULT_ERROR;
+    }
+// Event handler loop is woken up by the MPRIS commands and the watchdog pings
+    server->command_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->command_fd == -1)
+    {
+        ERR_("Could not create command_fd")
+        server_cleanup();
+        return RESULT_ERROR;
     }
+    server->mpris.command_fd = server->command_fd;
 
     if (!serve_thread_start(server))
     {
@@ -197,18 +371,40 @@ enum mpd_fnscroller_result server_run(struct mpd_fnscroller_server *server)
         server_cleanup();
         return RESULT_ERROR;
     }
+    if (!refresh_start(&server->refresh))
+    {
+        server_cleanup();
+        return RESULT_ERROR;
+    }
+    if (!mpris_start(&server->mpris))
+    {
+        server_cleanup();
+        return RESULT_ERROR;
+    }
+    if (!watchdog_start(&server->watchdog, server->command_fd))
+    {
+        server_cleanup();
+        return RESULT_ERROR;
+    }
 
-    result = mpd_event_handler_loop(server);
+    result = source_event_handler_loop(server);
 
     DEBUG_("Server status: %d; event handler loop retval: %d", status,
            result)
+// Scroll position is saved as of the shutdown
+    if ((status == STATUS_SHUTDOWN) &&
+        (server->mpd_state != MPD_STATE_UNKNOWN))
+    {
+        server_snapshot_save(server);
+    }
     server_cleanup();
     return result;
 };
 
 
-static void daemonize(int *pidfd)
+static void daemonize(struct mpd_fnscroller_server *server)
 {
+    int         *pidfd = &server->pidfile_fd;
     struct stat stat_buffer;
     char        pid_str[PID_STRING_SIZE];
     int         fd = 0;
@@ -266,6 +462,13 @@ static void daemonize(int *pidfd)
     stdout = fopen("/dev/null", "w+");
     stderr = fopen("/dev/null", "w+");
 
+    if (server->handover && !server_handover_take(server))
+    {
+        ERR_("Could not take over the running server instance")
+        closelog();
+        exit(EXIT_FAILURE);
+    }
+
     if (stat(pidfile_path, &stat_buffer) == 0)
     {
         ERR_("pidfile %s already exists", pidfile_path)
@@ -295,90 +498,169 @@ static void daemonize(int *pidfd)
 };
 
 static enum mpd_fnscroller_result
-serve_thread_start(struct mpd_fnscroller_server *server)
+server_handover_take(struct mpd_fnscroller_server *server)
 {
+    struct mpd_fnscroller_snapshot snapshot;
+
     TRACE_()
 
-    if (pthread_create(&server->serve_thread_id, NULL, client_serve,
-                       server))
+    if (!handover_receive(&snapshot, &server->sock_listener))
     {
-        ERR_("Issue creating server thread")
         return RESULT_ERROR;
     }
-    if (pthread_detach(server->serve_thread_id))
+// Listening again makes the credentials of the socket ours, for finding the
+// server with no pidfile
+    if (listen(server->sock_listener, CONNECTION_BACKLOG) == -1)
     {
-        ERR_("Issue detaching server thread")
-        pthread_cancel(server->serve_thread_id);
-        return RESULT_ERROR;
+        ERR_("Issue listening on the socket taken over")
     }
+    server_snapshot_set(server, &snapshot);
 
-    if (pthread_mutex_init(&lock, NULL) != 0)
-    {
-        ERR_("Issue initializing mutex")
-        pthread_cancel(server->serve_thread_id);
-        return RESULT_ERROR;
-    }
+    syslog(LOG_INFO, "Took over the running server instance");
 
     return RESULT_SUCCESS;
 };
 
-static void *client_serve(void *arg)
+// Both are called with the lock held or before the serve thread is started
+static void server_snapshot_get(struct mpd_fnscroller_server *server,
+                                struct mpd_fnscroller_snapshot *snapshot)
 {
-    struct mpd_fnscroller_server *server = arg;
-    struct sockaddr_un           server_sockaddr;
-    struct sockaddr_un           connected_client;
-    int                          sock_connection = 0;
-    socklen_t                    socklen;
-    unsigned int                 client_msg;
-    char                         client_wcbufsize = 0;
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->layout_version = SNAPSHOT_LAYOUT_VERSION;
 
-    TRACE_()
+    memcpy(snapshot->fn_string, server->fn_string, FILENAME_STRING_SIZE);
+    snapshot->fn_wcstring_offset = server->scroll.position;
+// Position alone is enough now, the field is kept for the older instances
+    snapshot->filename_part_buf_offset = 0;
+    snapshot->client_wcbufsize = client_wcbufsize;
+    snapshot->mpd_state = server->mpd_state;
 
-    unlink(sockfile_path);
-    server->sock_listener = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (server->sock_listener == -1)
+    return;
+};
+
+static void server_snapshot_set(struct mpd_fnscroller_server *server,
+                                const struct mpd_fnscroller_snapshot *snapshot)
+{
+    memcpy(server->fn_string, snapshot->fn_string, FILENAME_STRING_SIZE);
+    if (!scroll_string_set(&server->scroll, server->fn_string))
     {
-        ERR_("Issue creating server side socket")
+        ERR_("Could not convert fn_string from the snapshot")
+    }
+    server->scroll.position = snapshot->fn_wcstring_offset;
+    client_wcbufsize = snapshot->client_wcbufsize;
+    server->mpd_state = snapshot->mpd_state;
 
-        pthread_mutex_lock(&lock);
-        status = STATUS_SERVE_THREAD_ISSUE;
-        pthread_mutex_unlock(&lock);
+    return;
+};
 
-        pthread_exit(NULL);
+// Instance started anew serves the last frame of the previous one before the
+// player has answered, the first status taken reconciles it
+static void server_snapshot_restore(struct mpd_fnscroller_server *server)
+{
+    struct snapshot_file file;
+    unsigned long long   now = wall_time_get();
+    unsigned int         elapsed_ms = 0;
+
+    if (!snapshot_file_load(snapshotfile_path, &file))
+    {
+        return;
     }
 
-    server_sockaddr.sun_family = AF_UNIX;
-    strncpy(server_sockaddr.sun_path, sockfile_path, SUN_PATH_STRING_SIZE);
-    if (bind(server->sock_listener, (struct sockaddr *)&server_sockaddr,
-             sizeof(server_sockaddr)) < 0)
+    server_snapshot_set(server, &file.snapshot);
+    elapsed_ms = file.elapsed_ms;
+    if ((server->mpd_state == MPD_STATE_PLAY) && (now > file.saved_time))
+    {
+        elapsed_ms += now - file.saved_time;
+    }
+    playtime_set(&server->playtime, server->mpd_state == MPD_STATE_PLAY,
+                 elapsed_ms, file.duration_ms, monotonic_time_get());
+// Ticker left by an instance run with -N is not shown by one without it
+    if (server->up_next)
+    {
+        memcpy(server->up_next_string, file.up_next_string,
+               FILENAME_STRING_SIZE);
+    }
+    else
+    {
+        memset(server->up_next_string, '\0', FILENAME_STRING_SIZE);
+    }
+    if (!scroll_string_set(&server->up_next_scroll, server->up_next_string))
     {
-        ERR_("Issue binding server side socket")
+        ERR_("Could not convert up_next_string from the snapshot")
+    }
+    DEBUG_("Warm start from %s: %s", snapshotfile_path, server->fn_string)
 
-        pthread_mutex_lock(&lock);
-        status = STATUS_SERVE_THREAD_ISSUE;
-        pthread_mutex_unlock(&lock);
+    return;
+};
 
-        pthread_exit(NULL);
+// Called out of the lock on the changes published; the file is small and
+// written on song and state changes only
+static void server_snapshot_save(struct mpd_fnscroller_server *server)
+{
+    struct snapshot_file file;
+
+    memset(&file, 0, sizeof(file));
+    pthread_mutex_lock(&lock);
+    server_snapshot_get(server, &file.snapshot);
+    memcpy(file.up_next_string, server->up_next_string,
+           FILENAME_STRING_SIZE);
+    file.elapsed_ms = playtime_elapsed_get(&server->playtime,
+                                           monotonic_time_get());
+    file.duration_ms = server->playtime.duration_ms;
+    pthread_mutex_unlock(&lock);
+    file.saved_time = wall_time_get();
+
+    snapshot_file_save(snapshotfile_path, &file);
+
+    return;
+};
+
+static enum mpd_fnscroller_result
+serve_thread_start(struct mpd_fnscroller_server *server)
+{
+    TRACE_()
+
+    if (thread_create(&server->serve_thread_id, client_serve, server))
+    {
+        ERR_("Issue creating server thread")
+        return RESULT_ERROR;
     }
+    server->serve_thread_started = true;
 
-    while(status == STATUS_OK)
+    return RESULT_SUCCESS;
+};
+
+// Cleanup may come before the thread was ever started, or after the handover
+// has stopped it already
+static void serve_thread_stop(struct mpd_fnscroller_server *server)
+{
+    if (!server->serve_thread_started)
     {
-        if (listen(server->sock_listener, 1))
-        {
-            ERR_("Issue listening sock_listener")
+        return;
+    }
+    pthread_cancel(server->serve_thread_id);
+    pthread_join(server->serve_thread_id, NULL);
+    server->serve_thread_started = false;
 
-            pthread_mutex_lock(&lock);
-            status = STATUS_SERVE_THREAD_ISSUE;
-            pthread_mutex_unlock(&lock);
+    return;
+};
 
-            pthread_exit(NULL);
-        }
-        sock_connection = accept(server->sock_listener,
-                                 (struct sockaddr *)&connected_client,
-                                 &socklen);
-        if (sock_connection == -1)
+static void *client_serve(void *arg)
+{
+    struct mpd_fnscroller_server *server = arg;
+    struct sockaddr_un           server_sockaddr;
+    enum mpd_fnscroller_result   result = RESULT_SUCCESS;
+
+    TRACE_()
+
+// Listening socket could have been taken over from another instance
+    if (server->sock_listener == -1)
+    {
+        unlink(sockfile_path);
+        server->sock_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server->sock_listener == -1)
         {
-            ERR_("Issue accepting incoming connection")
+            ERR_("Issue creating server side socket")
 
             pthread_mutex_lock(&lock);
             status = STATUS_SERVE_THREAD_ISSUE;
@@ -387,304 +669,828 @@ static void *client_serve(void *arg)
             pthread_exit(NULL);
         }
 
-        if (recv(sock_connection, &client_msg, sizeof(unsigned int),
-                 0) > sizeof(unsigned int))
+        server_sockaddr.sun_family = AF_UNIX;
+        strncpy(server_sockaddr.sun_path, sockfile_path,
+                SUN_PATH_STRING_SIZE);
+        if (bind(server->sock_listener, (struct sockaddr *)&server_sockaddr,
+                 sizeof(server_sockaddr)) < 0)
         {
-            ERR_("Issue recieving client message")
+            ERR_("Issue binding server side socket")
 
             pthread_mutex_lock(&lock);
             status = STATUS_SERVE_THREAD_ISSUE;
             pthread_mutex_unlock(&lock);
 
-            close(sock_connection);
             pthread_exit(NULL);
         }
-        if (client_msg != client_wcbufsize)
-        {
-            client_wcbufsize = client_msg;
+    }
 
-            pthread_mutex_lock(&lock);
-            server->fn_wcstring_offset = 0;
-            filename_part_buf_offset = 0;
-            pthread_mutex_unlock(&lock);
-        }
+    if ((fcntl(server->sock_listener, F_SETFL,
+               fcntl(server->sock_listener, F_GETFL) | O_NONBLOCK) == -1) ||
+        (listen(server->sock_listener, CONNECTION_BACKLOG) == -1))
+    {
+        ERR_("Issue listening sock_listener")
 
-        if (!filename_part_send(server, sock_connection, client_wcbufsize))
-        {
-            ERR_("Issue sending current filename string part")
+        pthread_mutex_lock(&lock);
+        status = STATUS_SERVE_THREAD_ISSUE;
+        pthread_mutex_unlock(&lock);
 
-            pthread_mutex_lock(&lock);
-            status = STATUS_SERVE_THREAD_ISSUE;
-            pthread_mutex_unlock(&lock);
+        pthread_exit(NULL);
+    }
 
-            close(sock_connection);
-            pthread_exit(NULL);
-        }
-        close(sock_connection);
+    connection_pool_init(&connection_pool);
+    while ((status == STATUS_OK) && (result == RESULT_SUCCESS))
+    {
+        result = client_connections_serve(server, &connection_pool);
+    }
+    connection_pool_close(&connection_pool);
+
+    if (result != RESULT_SUCCESS)
+    {
+        pthread_mutex_lock(&lock);
+        status = STATUS_SERVE_THREAD_ISSUE;
+        pthread_mutex_unlock(&lock);
     }
 
     pthread_exit(NULL);
 };
 
+// One iteration of the serve loop. Any issue with a single connection costs
+// only that connection; the listening socket failure is the only fatal one.
 static enum mpd_fnscroller_result
-filename_part_send(struct mpd_fnscroller_server *server, int sock,
-                   unsigned int wcbufsize)
+client_connections_serve(struct mpd_fnscroller_server *server,
+                         struct connection_pool *pool)
 {
-    wchar_t filename_part_buf[FILENAME_WCHAR_STRING_SIZE];
-    wchar_t wc_delimeter[DELIMETER_STR_SIZE];
-    ssize_t bytes_sent;
+    struct mpd_fnscroller_connection *connection;
+    enum connection_io_result        io_result;
+    unsigned int                     i = 0;
+    short                            revents = 0;
 
-    TRACE_()
+    if (connection_pool_poll(pool, server->sock_listener,
+                             server->wait_fd) == -1)
+    {
+        if (errno == EINTR)
+        {
+            return RESULT_SUCCESS;
+        }
 
-    mbstowcs(wc_delimeter, DELIMETER_DEFAULT_STRING, DELIMETER_STR_SIZE);
-    memset(filename_part_buf, '\0', sizeof(wchar_t) *
-           FILENAME_WCHAR_STRING_SIZE);
+        ERR_("Issue polling connections")
+        return RESULT_ERROR;
+    }
 
-    pthread_mutex_lock(&lock);
-// Song filename is less than buffer to send
-    if (wcslen(server->fn_wcstring) < wcbufsize)
+    if (pool->pollfds[0].revents & (POLLERR | POLLNVAL))
     {
-        TRACE_()
-
-        wcsncpy(filename_part_buf, server->fn_wcstring, wcbufsize - 1);
+        ERR_("Issue with sock_listener")
+        return RESULT_ERROR;
     }
-    else
+    if ((pool->pollfds[0].revents & POLLIN) &&
+        (!connection_accept(pool, server->sock_listener)))
     {
-// Sending everything before delimeter
-        if (server->fn_wcstring_offset <=
-            wcslen(server->fn_wcstring) - (wcbufsize - 1))
-        {
-            TRACE_()
-
-            wcsncpy(filename_part_buf,
-                    server->fn_wcstring + server->fn_wcstring_offset,
-                    wcbufsize - 1);
+        return RESULT_ERROR;
+    }
+    wait_requests_release(server, pool);
 
-            ++server->fn_wcstring_offset;
-            DEBUG_("filename_part_buf: %ls; fn_wcstring_offset: %d",
-                    filename_part_buf, server->fn_wcstring_offset)
+    for (i = 0; i < CONNECTION_SLOTS; ++i)
+    {
+        connection = &pool->connections[i];
+        revents = pool->pollfds[i + 1].revents;
+        if ((connection->state == CONNECTION_FREE) || (!revents))
+        {
+            continue;
         }
-// Sending [filename ending] [delimeter] [filename beginning]
-        else
+        if (revents & (POLLERR | POLLNVAL))
         {
-            if (wcslen(server->fn_wcstring + server->fn_wcstring_offset))
+            connection_close(pool, connection);
+            continue;
+        }
+
+        if (connection->state == CONNECTION_READING)
+        {
+            io_result = connection_read(connection);
+            if (io_result == CONNECTION_IO_PENDING)
             {
-                TRACE_()
-
-                wcsncpy(filename_part_buf,
-                        server->fn_wcstring + server->fn_wcstring_offset,
-                        wcbufsize - 1);
-                wcsncat(filename_part_buf, wc_delimeter,
-                        (wcbufsize - 1) - wcslen(filename_part_buf));
-                if (server->fn_wcstring_offset - wcslen(wc_delimeter) >
-                    wcslen(wc_delimeter))
-                {
-                    wcsncat(filename_part_buf, server->fn_wcstring,
-                            (wcbufsize - 1) - wcslen(filename_part_buf));
-                }
+                continue;
             }
-// Sending [delimeter] [filename beginning]
-            else
+            if ((io_result == CONNECTION_IO_ERROR) ||
+                (!client_request_handle(server, pool, connection)))
             {
-                TRACE_()
-
-                wcsncpy(filename_part_buf,
-                        wc_delimeter + filename_part_buf_offset + 1 -
-                        (wcbufsize - 1), wcbufsize - 1);
-                wcsncat(filename_part_buf, server->fn_wcstring,
-                        (wcbufsize - 1) - wcslen(filename_part_buf));
+                TRACEPOINT_("Dropping connection %lld: bad request",
+                            connection->sock, 0)
+                connection_close(pool, connection);
+                continue;
             }
-
-            ++filename_part_buf_offset;
-            ++server->fn_wcstring_offset;
-            if (filename_part_buf_offset >=
-                (wcbufsize - 1) + wcslen(wc_delimeter))
+// Parked waiter has left its slot
+            if (connection->state == CONNECTION_FREE)
             {
-                TRACE_()
-
-                filename_part_buf_offset = 0;
-                server->fn_wcstring_offset = 0;
+                continue;
             }
         }
-    }
-    pthread_mutex_unlock(&lock);
 
-    DEBUG_("filename_part_buf: %ls; wcbufsize: %d; fn_wcstring_offset: %d; filename_part_buf_offset: %d",
-           filename_part_buf, wcbufsize, server->fn_wcstring_offset,
-           filename_part_buf_offset)
-    bytes_sent = send(sock, filename_part_buf, wcbufsize * sizeof(wchar_t), 0);
-    if (bytes_sent == -1)
-    {
-        ERR_("Could not send entire filename; bytes_sent: %ld", bytes_sent)
-        return RESULT_ERROR;
+        io_result = connection_write(connection);
+        if (io_result != CONNECTION_IO_PENDING)
+        {
+            connection_close(pool, connection);
+        }
     }
 
+    connection_pool_expire(pool);
+
     return RESULT_SUCCESS;
 };
 
 static enum mpd_fnscroller_result
-mpd_event_handler_loop(struct mpd_fnscroller_server *server)
+client_request_handle(struct mpd_fnscroller_server *server,
+                      struct connection_pool *pool,
+                      struct mpd_fnscroller_connection *connection)
 {
-    struct  mpd_connection *mpd_connection;
-    ssize_t req_wcstring_size;
+    enum mpd_fnscroller_result result = RESULT_ERROR;
+    unsigned int               client_msg = 0;
 
-    TRACE_()
+    memcpy(&client_msg, connection->request, sizeof(unsigned int));
+    record_uint32_write(RECORD_REQUEST, client_msg);
+    TRACEPOINT_("request type: %lld; arg: %lld", REQUEST_TYPE(client_msg),
+                REQUEST_ARG(client_msg))
 
-    mpd_connection = mpd_connection_new(server->mpd_host, server->mpd_port,
-                                        server->mpd_timeout * 1000);
-    if (mpd_connection_get_error(mpd_connection) != MPD_ERROR_SUCCESS)
+    switch (REQUEST_TYPE(client_msg))
     {
-        ERR_("Could not establish connection with mpd")
+        case REQUEST_FRAME:
 
-        pthread_mutex_lock(&lock);
-        status = STATUS_MPD_EVENT_HANDLER_ISSUE;
+        case REQUEST_UP_NEXT:
+            result = frame_request_handle(server, connection,
+                                          REQUEST_TYPE(client_msg),
+                                          REQUEST_ARG(client_msg));
+            break;
+
+        case REQUEST_TRACE_DUMP:
+            result = trace_dump_request_handle(connection);
+            break;
+
+        case REQUEST_HISTORY_LAST:
+
+        case REQUEST_HISTORY_TOP:
+            result = history_request_handle(server, connection,
+                                            REQUEST_TYPE(client_msg),
+                                            REQUEST_ARG(client_msg));
+            break;
+
+        case REQUEST_WAIT:
+            result = wait_request_handle(server, pool, connection,
+                                         REQUEST_ARG(client_msg));
+            break;
+
+        default:
+            ERR_("Invalid client message: %u", client_msg)
+            break;
+    }
+    if (!result)
+    {
+        return RESULT_ERROR;
+    }
+    if (connection->state == CONNECTION_FREE)
+    {
+        return RESULT_SUCCESS;
+    }
+
+    connection->output_offset = 0;
+    connection->state = CONNECTION_WRITING;
+    connection->deadline = monotonic_time_get() + CONNECTION_TIMEOUT_MS;
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result
+frame_request_handle(struct mpd_fnscroller_server *server,
+                     struct mpd_fnscroller_connection *connection,
+                     enum mpd_fnscroller_request request,
+                     unsigned int frame_arg)
+{
+    wchar_t                      *filename_part_buf = NULL;
+    unsigned int                 wcbufsize = REQUEST_FRAME_WIDTH(frame_arg);
+    enum mpd_fnscroller_progress progress = REQUEST_FRAME_PROGRESS(frame_arg);
+    struct mpd_fnscroller_scroll *scroll = &server->scroll;
+    volatile unsigned int        *scroll_wcbufsize = &client_wcbufsize;
+
+    if ((!wcbufsize) || (wcbufsize > FILENAME_WCHAR_STRING_SIZE))
+    {
+        ERR_("Invalid frame width: %u", wcbufsize)
+        return RESULT_ERROR;
+    }
+    if (progress >= PROGRESS_COUNT)
+    {
+        ERR_("Invalid frame progress: %u", progress)
+        return RESULT_ERROR;
+    }
+
+// "Up next" ticker scrolls on its own, with no progress of the current song
+    if (request == REQUEST_UP_NEXT)
+    {
+        scroll = &server->up_next_scroll;
+        scroll_wcbufsize = &up_next_wcbufsize;
+        progress = PROGRESS_NONE;
+    }
+
+    if (wcbufsize != *scroll_wcbufsize)
+    {
+        pthread_mutex_lock(&lock);
+        *scroll_wcbufsize = wcbufsize;
+        scroll_rewind(scroll);
+        refresh_ticking_update(server);
         pthread_mutex_unlock(&lock);
+    }
+    if ((request != REQUEST_UP_NEXT) && (progress != client_progress))
+    {
+        pthread_mutex_lock(&lock);
+        client_progress = progress;
+        refresh_ticking_update(server);
+        pthread_mutex_unlock(&lock);
+    }
 
-        mpd_connection_free(mpd_connection);
+    if (frame_arg & REQUEST_FRAME_JSON)
+    {
+        return json_frame_request_handle(server, connection, scroll,
+                                         wcbufsize, progress);
+    }
+
+// Frame is rendered right into the output buffer of the connection, which
+// has room for the widest one with the progress
+    filename_part_buf = (wchar_t *)connection->output_buffer;
+    filename_part_get(server, scroll, filename_part_buf, wcbufsize, progress);
+
+// Plain frames keep their fixed size for the older clients
+    if (progress != PROGRESS_NONE)
+    {
+        wcbufsize = wcslen(filename_part_buf) + 1;
+    }
+    connection->output = connection->output_buffer;
+    connection->output_length = wcbufsize * sizeof(wchar_t);
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result
+trace_dump_request_handle(struct mpd_fnscroller_connection *connection)
+{
+    char *output = NULL;
+
+    output = connection_output_reserve(connection, TRACE_DUMP_SIZE_MAX);
+    if (output == NULL)
+    {
+        return RESULT_ERROR;
+    }
+    connection->output_length = trace_dump(output, TRACE_DUMP_SIZE_MAX);
+
+    return RESULT_SUCCESS;
+};
+
+// Answered right from the mapped history file
+static enum mpd_fnscroller_result
+history_request_handle(struct mpd_fnscroller_server *server,
+                       struct mpd_fnscroller_connection *connection,
+                       enum mpd_fnscroller_request request,
+                       unsigned int count)
+{
+    char *output = NULL;
+
+    if ((!count) || (count > HISTORY_QUERY_MAX))
+    {
+        ERR_("Invalid history query size: %u", count)
         return RESULT_ERROR;
     }
 
-    if (!mpd_fn_string_get(server, mpd_connection))
+    output = connection_output_reserve(connection,
+                                       count * HISTORY_LINE_SIZE + 1);
+    if (output == NULL)
     {
-        ERR_("Could not get fn_string for the first time")
+        return RESULT_ERROR;
+    }
+    if (request == REQUEST_HISTORY_LAST)
+    {
+        connection->output_length = history_last_get(&server->history, count,
+                                                     output,
+                                                     count * HISTORY_LINE_SIZE
+                                                     + 1);
+    }
+    else
+    {
+        connection->output_length = history_top_get(&server->history, count,
+                                                    output,
+                                                    count * HISTORY_LINE_SIZE +
+                                                    1);
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Waiter already behind is answered at once, the others are parked until the
+// next publish or their deadline. With no room left to park it the waiter is
+// answered busy, which the client reports as a failure.
+static enum mpd_fnscroller_result
+wait_request_handle(struct mpd_fnscroller_server *server,
+                    struct connection_pool *pool,
+                    struct mpd_fnscroller_connection *connection,
+                    unsigned int version)
+{
+    char   *output = connection->output_buffer;
+    size_t length = 0;
+
+    connection->output = output;
+    if (version != server->version)
+    {
+        length = wait_response_render(server, output, CONNECTION_OUTPUT_SIZE);
+        connection->output_length = length;
+        return RESULT_SUCCESS;
+    }
+    if (connection_park(pool, connection, version,
+                        monotonic_time_get() + REQUEST_WAIT_TIMEOUT_MS))
+    {
+        return RESULT_SUCCESS;
+    }
+
+    memcpy(output, REQUEST_WAIT_BUSY, sizeof(REQUEST_WAIT_BUSY) - 1);
+    connection->output_length = sizeof(REQUEST_WAIT_BUSY) - 1;
+
+    return RESULT_SUCCESS;
+};
+
+// All the waiters are released together with the same response: one wakeup
+// and one rendering per publish whatever their number is
+static void wait_requests_release(struct mpd_fnscroller_server *server,
+                                  struct connection_pool *pool)
+{
+    struct mpd_fnscroller_waiter *waiter;
+    unsigned long long           now = monotonic_time_get();
+    unsigned int                 i = 0;
+    uint64_t                     wakeups = 0;
+    char                         output[CONNECTION_OUTPUT_SIZE];
+    size_t                       output_length = 0;
+
+    if ((pool->pollfds[CONNECTION_POLLFD_WAKEUP].revents & POLLIN) &&
+        (read(server->wait_fd, &wakeups, sizeof(wakeups)) == -1))
+    {
+        TRACEPOINT_("Could not read wait_fd: %lld", errno, 0)
+    }
+
+    for (i = 0; (i < CONNECTION_WAITERS_MAX) && (pool->waiting); ++i)
+    {
+        waiter = &pool->waiters[i];
+        if (waiter->sock == -1)
+        {
+            continue;
+        }
+        if (pool->pollfds[CONNECTION_POLLFD_WAITERS + i].revents)
+        {
+            connection_waiter_release(pool, waiter, NULL, 0);
+            continue;
+        }
+        if ((waiter->version == server->version) && (waiter->deadline > now))
+        {
+            continue;
+        }
+
+        TRACEPOINT_("Releasing waiter %lld; version: %lld", waiter->sock,
+                    server->version)
+        if (!output_length)
+        {
+            output_length = wait_response_render(server, output,
+                                                 sizeof(output));
+        }
+        connection_waiter_release(pool, waiter, output, output_length);
+    }
+
+    return;
+};
+
+// "<version> <state>\n<title>\n": the version is passed with the next wait
+static size_t wait_response_render(struct mpd_fnscroller_server *server,
+                                   char *output, size_t size)
+{
+    const char *state_name = "stop";
+    int        length = 0;
+
+    pthread_mutex_lock(&lock);
+    if (server->mpd_state == MPD_STATE_PLAY)
+    {
+        state_name = "play";
+    }
+    else if (server->mpd_state == MPD_STATE_PAUSE)
+    {
+        state_name = "pause";
+    }
+    length = snprintf(output, size, "%u %s\n%s\n", server->version,
+                      state_name, server->fn_string);
+    pthread_mutex_unlock(&lock);
+
+    return (length < (int)size) ? length : size - 1;
+};
+
+// Frame sliced out of the title escaped on song change, the state picks the
+// color
+static enum mpd_fnscroller_result
+json_frame_request_handle(struct mpd_fnscroller_server *server,
+                          struct mpd_fnscroller_connection *connection,
+                          struct mpd_fnscroller_scroll *scroll,
+                          unsigned int wcbufsize,
+                          enum mpd_fnscroller_progress progress)
+{
+    wchar_t            progress_wcstring[PROGRESS_STRING_SIZE];
+    char               progress_string[PROGRESS_STRING_SIZE * MB_LEN_MAX];
+    const char         *color = NULL;
+    char               *output = NULL;
+    unsigned long long now = monotonic_time_get();
+
+    output = connection_output_reserve(connection, JSON_OUTPUT_SIZE);
+    if (output == NULL)
+    {
+        return RESULT_ERROR;
+    }
+    progress_wcstring[0] = L'\0';
+    progress_string[0] = '\0';
+
+    pthread_mutex_lock(&lock);
+    if (server->mpd_state == MPD_STATE_STOP)
+    {
+        color = JSON_COLOR_STOP;
+    }
+    else
+    {
+        if (server->mpd_state == MPD_STATE_PAUSE)
+        {
+            color = JSON_COLOR_PAUSE;
+        }
+        if (progress != PROGRESS_NONE)
+        {
+            progress_render(&server->playtime, progress, now,
+                            progress_wcstring, PROGRESS_STRING_SIZE);
+            mpdfnscroller_utf8_encode(progress_wcstring, PROGRESS_STRING_SIZE,
+                                      progress_string,
+                                      sizeof(progress_string));
+        }
+    }
+    connection->output_length = scroll_json_frame_get(scroll, wcbufsize,
+                                                      progress_string, color,
+                                                      output,
+                                                      JSON_OUTPUT_SIZE);
+    pthread_mutex_unlock(&lock);
+
+    return RESULT_SUCCESS;
+};
+
+static void filename_part_get(struct mpd_fnscroller_server *server,
+                              struct mpd_fnscroller_scroll *scroll,
+                              wchar_t *filename_part_buf,
+                              unsigned int wcbufsize,
+                              enum mpd_fnscroller_progress progress)
+{
+    unsigned long long now = 0;
+    size_t             length = 0;
+
+    TRACE_()
+
+    if (progress != PROGRESS_NONE)
+    {
+        now = monotonic_time_get();
+    }
+
+    pthread_mutex_lock(&lock);
+    scroll_frame_get(scroll, filename_part_buf, wcbufsize);
+// Nothing to show next to "STOP"
+    if ((progress != PROGRESS_NONE) && (server->mpd_state != MPD_STATE_STOP))
+    {
+        length = wcslen(filename_part_buf);
+        progress_render(&server->playtime, progress, now,
+                        filename_part_buf + length, PROGRESS_STRING_SIZE);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return;
+};
+
 
+static enum mpd_fnscroller_result
+source_event_handler_loop(struct mpd_fnscroller_server *server)
+{
+    struct mpd_fnscroller_source *source = &server->source;
+    struct source_song           song;
+    enum mpd_idle                idle;
+    enum mpd_idle                idle_mask = MPD_IDLE_PLAYER;
+    bool                         commands = false;
+
+    TRACE_()
+
+    if (!source_open(source))
+    {
         pthread_mutex_lock(&lock);
         status = STATUS_MPD_EVENT_HANDLER_ISSUE;
         pthread_mutex_unlock(&lock);
 
-        mpd_connection_free(mpd_connection);
         return RESULT_ERROR;
     }
 
-    req_wcstring_size = mbstowcs(NULL, server->fn_string, 0) + 1;
-    if (req_wcstring_size > FILENAME_WCHAR_STRING_SIZE)
+    if (!source_player_update(server, &song))
     {
-        ERR_("req_wcstring_size: %ld; FILENAME_WCHAR_STRING_SIZE: %d",
-             req_wcstring_size, FILENAME_WCHAR_STRING_SIZE)
-        mpd_connection_free(mpd_connection);
+        ERR_("Could not get fn_string for the first time")
+
+        pthread_mutex_lock(&lock);
+        status = STATUS_MPD_EVENT_HANDLER_ISSUE;
+        pthread_mutex_unlock(&lock);
+
+        source_close(source);
         return RESULT_ERROR;
     }
 
-    mbstowcs(server->fn_wcstring, server->fn_string,
-             FILENAME_WCHAR_STRING_SIZE);
-    DEBUG_("fn_string: %s; fn_wcstring: %ls", server->fn_string,
-           server->fn_wcstring)
+// Queue changes only matter to the mirror of the "up next" ticker
+    if (server->up_next)
+    {
+        idle_mask |= MPD_IDLE_QUEUE;
+    }
+// So do the volume and the playback options to the MPRIS bridge
+    if (server->mpris.enabled)
+    {
+        idle_mask |= MPD_IDLE_MIXER | MPD_IDLE_OPTIONS;
+    }
 
     DEBUG_("Entering event handler loop")
-    while(status == STATUS_OK && mpd_run_idle_mask(mpd_connection,
-                                                   MPD_IDLE_PLAYER))
+    server_signals_handle(server);
+    while ((status == STATUS_OK) &&
+           (source_wait(source, idle_mask, server->command_fd, &idle,
+                        &commands)))
     {
-        if (!mpd_fn_string_get(server, mpd_connection))
+// Commands are run with the source out of its wait, their effect is
+// reported by the next one
+        if ((commands) && (!source_commands_run(server)))
+        {
+            break;
+        }
+        if (!idle)
+        {
+            continue;
+        }
+        record_uint32_write(RECORD_IDLE, idle);
+        if (!source_player_update(server, &song))
         {
             pthread_mutex_lock(&lock);
             status = STATUS_MPD_EVENT_HANDLER_ISSUE;
             pthread_mutex_unlock(&lock);
-
-            mpd_connection_free(mpd_connection);
-        }
-
-        req_wcstring_size = mbstowcs(NULL, server->fn_string, 0) + 1;
-        if (req_wcstring_size > FILENAME_WCHAR_STRING_SIZE)
-        {
-            ERR_("req_wcstring_size: %ld; FILENAME_WCHAR_STRING_SIZE: %d",
-                 req_wcstring_size, FILENAME_WCHAR_STRING_SIZE)
-            mpd_connection_free(mpd_connection);
-            return RESULT_ERROR;
         }
-
-        mbstowcs(server->fn_wcstring, server->fn_string,
-                 FILENAME_WCHAR_STRING_SIZE);
-        DEBUG_("fn_string: %s; fn_wcstring: %ls", server->fn_string, server->fn_wcstring)
     }
 
+    source_close(source);
     if (status == STATUS_SHUTDOWN)
     {
         TRACE_()
         syslog(LOG_WARNING, "Server shutdown");
-        mpd_connection_free(mpd_connection);
         return RESULT_SUCCESS;
     }
     else
     {
         ERR_("Server status is not ok")
-        mpd_connection_free(mpd_connection);
         return RESULT_ERROR;
     }
 };
 
+// MPRIS commands, the watchdog ping and the signals share the descriptor: it
+// is drained once and whatever is queued is run
 static enum mpd_fnscroller_result
-mpd_fn_string_get(struct mpd_fnscroller_server *server,
-                  struct mpd_connection *connection)
+source_commands_run(struct mpd_fnscroller_server *server)
 {
-    struct mpd_song *mpd_song;
-    enum mpd_state  mpd_state;
-    const char      *mpd_song_uri;
+    uint64_t wakeups = 0;
 
-    pthread_mutex_lock(&lock);
-    memset(server->fn_string, '\0', FILENAME_STRING_SIZE);
-    memset(server->fn_wcstring, '\0',
-           sizeof(wchar_t) * FILENAME_WCHAR_STRING_SIZE);
-    pthread_mutex_unlock(&lock);
+    if (read(server->command_fd, &wakeups, sizeof(wakeups)) == -1)
+    {
+        TRACEPOINT_("Could not read command_fd: %lld", errno, 0)
+    }
+    server_signals_handle(server);
 
-    TRACE_()
+    if ((server->mpris.enabled) &&
+        (!mpris_commands_run(&server->mpris, &server->source)))
+    {
+        return RESULT_ERROR;
+    }
+    if (watchdog_ping_pending(&server->watchdog))
+    {
+        if (!source_ping(&server->source))
+        {
+            return RESULT_ERROR;
+        }
+        watchdog_pong(&server->watchdog);
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Signals noted by the handlers are acted upon here, out of the signal context
+static void server_signals_handle(struct mpd_fnscroller_server *server)
+{
+    if (handover_requested)
+    {
+        handover_requested = 0;
+        server_handover(server);
+    }
+    if (shutdown_requested)
+    {
+        TRACE_()
+        pthread_mutex_lock(&lock);
+        status = STATUS_SHUTDOWN;
+        pthread_mutex_unlock(&lock);
+    }
+
+    return;
+};
+
+// Song is large: the buffer is the caller's and is reused on every event
+static enum mpd_fnscroller_result
+source_player_update(struct mpd_fnscroller_server *server,
+                     struct source_song *song)
+{
+    struct source_status source_status;
+    enum mpd_state       mpd_state;
+    unsigned long long   status_time = 0;
+    bool                 published = false;
+    char                 fn_string[FILENAME_STRING_SIZE];
+
+    memset(fn_string, '\0', FILENAME_STRING_SIZE);
 
-    mpd_command_list_begin(connection, true);
-    mpd_send_status(connection);
-    mpd_send_current_song(connection);
-    mpd_command_list_end(connection);
+    TRACE_()
 
-    mpd_state = mpd_status_get_state(mpd_recv_status(connection));
+    if (!source_status_get(&server->source, &source_status, song))
+    {
+        ERR_("Could not receive the player status")
+        return RESULT_ERROR;
+    }
+    status_time = monotonic_time_get();
+    mpd_state = source_status.state;
+// Playback position is only taken on player events and interpolated locally
+// in between: showing it costs no extra round trips to the player
+    record_uint32_write(RECORD_STATUS, mpd_state);
     DEBUG_("mpd_state: %d", mpd_state)
     switch(mpd_state)
     {
         case MPD_STATE_PAUSE:
 
         case MPD_STATE_PLAY:
-            mpd_response_next(connection);
-            mpd_song = mpd_recv_song(connection);
-            mpd_song_uri = mpd_song_get_uri(mpd_song);
+            record_write(RECORD_SONG, song->uri, strlen(song->uri));
+            format_render(&server->format, song, fn_string,
+                          FILENAME_STRING_SIZE);
+            cleanup_apply(&server->cleanup, fn_string, FILENAME_STRING_SIZE);
+            history_player_update(&server->history,
+                                  mpd_state == MPD_STATE_PLAY, song->uri,
+                                  song->id, source_status.duration_ms,
+                                  fn_string);
+            scrobble_player_update(&server->scrobble,
+                                   mpd_state == MPD_STATE_PLAY, song,
+                                   source_status.duration_ms);
+            hook_player_update(&server->hook, mpd_state, song,
+                               source_status.duration_ms);
+            mpris_player_update(&server->mpris, &source_status, song,
+                                fn_string, status_time);
+
+            break;
 
-            pthread_mutex_lock(&lock);
-            snprintf(server->fn_string, FILENAME_STRING_SIZE, "%s",
-                     basename((char *)mpd_song_uri));
-            pthread_mutex_unlock(&lock);
+        case MPD_STATE_STOP:
+            snprintf(fn_string, FILENAME_STRING_SIZE, "STOP");
+            history_player_update(&server->history, false, NULL, 0, 0, NULL);
+            scrobble_player_update(&server->scrobble, false, NULL, 0);
+            hook_player_update(&server->hook, mpd_state, NULL, 0);
+            mpris_player_update(&server->mpris, &source_status, NULL,
+                                fn_string, status_time);
 
-            mpd_song_free(mpd_song);
-            mpd_response_finish(connection);
+            break;
 
-            pthread_mutex_lock(&lock);
-            server->fn_wcstring_offset = 0;
-            filename_part_buf_offset = 0;
+        default:
+            ERR_("MPD_STATE_UNKNOWN")
+            return RESULT_ERROR;
+    }
+
+// Scrolling is only restarted when the title is actually changed: the state
+// taken over from another instance survives the first query this way
+    pthread_mutex_lock(&lock);
+    if (server->mpd_state != mpd_state)
+    {
+        published = true;
+    }
+    server->mpd_state = mpd_state;
+    playtime_set(&server->playtime, mpd_state == MPD_STATE_PLAY,
+                 source_status.elapsed_ms, source_status.duration_ms,
+                 status_time);
+    if (strcmp(server->fn_string, fn_string))
+    {
+        memcpy(server->fn_string, fn_string, FILENAME_STRING_SIZE);
+        if (!scroll_string_set(&server->scroll, server->fn_string))
+        {
             pthread_mutex_unlock(&lock);
+            return RESULT_ERROR;
+        }
+        published = true;
+    }
+    if (published)
+    {
+        server_publish(server);
+    }
+    refresh_ticking_update(server);
+    pthread_mutex_unlock(&lock);
 
-            return RESULT_SUCCESS;
+    if ((server->up_next) &&
+        (!up_next_update(server, &source_status, &published)))
+    {
+        return RESULT_ERROR;
+    }
+    if (published)
+    {
+        server_snapshot_save(server);
+    }
 
-        case MPD_STATE_STOP:
-            mpd_response_next(connection);
-            mpd_response_finish(connection);
+    return RESULT_SUCCESS;
+};
 
-            pthread_mutex_lock(&lock);
-            server->fn_wcstring_offset = 0;
-            filename_part_buf_offset = 0;
-            snprintf(server->fn_string, FILENAME_STRING_SIZE, "STOP");
-            pthread_mutex_unlock(&lock);
+// Same status serves both the player and the queue events: the queue mirror
+// is only touched when the queue version has moved
+static enum mpd_fnscroller_result
+up_next_update(struct mpd_fnscroller_server *server,
+               const struct source_status *source_status, bool *published)
+{
+    char up_next_string[FILENAME_STRING_SIZE];
 
-            return RESULT_SUCCESS;
+    TRACE_()
 
-        default:
-            ERR_("MPD_STATE_UNKNOWN")
+    if (!queue_update(&server->queue, &server->source, &server->format,
+                      &server->cleanup, source_status->queue_version,
+                      source_status->queue_length))
+    {
+        return RESULT_ERROR;
+    }
+    queue_up_next_get(&server->queue, source_status->song_pos,
+                      up_next_string, FILENAME_STRING_SIZE);
+
+    pthread_mutex_lock(&lock);
+    if (strcmp(server->up_next_string, up_next_string))
+    {
+        memcpy(server->up_next_string, up_next_string, FILENAME_STRING_SIZE);
+        if (!scroll_string_set(&server->up_next_scroll,
+                               server->up_next_string))
+        {
+            pthread_mutex_unlock(&lock);
             return RESULT_ERROR;
+        }
+        server_publish(server);
+        refresh_ticking_update(server);
+        *published = true;
     }
+    pthread_mutex_unlock(&lock);
+
+    return RESULT_SUCCESS;
 };
 
 
-static void server_cleanup(void)
+// Called with the lock held on every change the clients could see: the
+// waiters are woken up in the serve thread and the bar is signalled
+static void server_publish(struct mpd_fnscroller_server *server)
 {
-    TRACE_()
+    uint64_t wakeup = 1;
 
-    pthread_mutex_destroy(&lock);
-    pthread_cancel(mpd_fnscroller_server->serve_thread_id);
+    server->version = (server->version + 1) & REQUEST_ARG_MASK;
+    if (!server->version)
+    {
+        server->version = 1;
+    }
+    if (write(server->wait_fd, &wakeup, sizeof(wakeup)) == -1)
+    {
+        TRACEPOINT_("Could not write wait_fd: %lld", errno, 0)
+    }
+    refresh_notify(&server->refresh);
+
+    return;
+};
+
+// Called with the lock held: the bar keeps being signalled on every step
+// while some of the registered frames move on their own
+static void refresh_ticking_update(struct mpd_fnscroller_server *server)
+{
+    bool ticking = false;
 
+    if ((client_wcbufsize) &&
+        (mpdfnscroller_period_get(&server->scroll.scroller,
+                                  client_wcbufsize - 1) > 1))
+    {
+        ticking = true;
+    }
+    if ((up_next_wcbufsize) &&
+        (mpdfnscroller_period_get(&server->up_next_scroll.scroller,
+                                  up_next_wcbufsize - 1) > 1))
+    {
+        ticking = true;
+    }
+    if ((client_progress != PROGRESS_NONE) &&
+        (server->mpd_state == MPD_STATE_PLAY))
+    {
+        ticking = true;
+    }
+    refresh_ticking_set(&server->refresh, ticking);
+
+    return;
+};
+
+static void pidfile_release(void)
+{
     if (daemonize_service)
     {
         lockf(mpd_fnscroller_server->pidfile_fd, F_ULOCK, 0);
@@ -692,8 +1498,51 @@ static void server_cleanup(void)
         unlink(pidfile_path);
     }
 
+    return;
+};
+
+static void server_cleanup(void)
+{
+    TRACE_()
+
+    serve_thread_stop((struct mpd_fnscroller_server *)mpd_fnscroller_server);
+
+    pidfile_release();
+
     close(mpd_fnscroller_server->sock_listener);
     unlink(sockfile_path);
+    server_flush();
+
+    return;
+};
+
+// Everything but the socket and the pidfile: the pending records, history and
+// scrobbles are written out, the helper threads and processes are stopped
+static void server_flush(void)
+{
+    if (mpd_fnscroller_server->wait_fd != -1)
+    {
+        close(mpd_fnscroller_server->wait_fd);
+    }
+    watchdog_stop((struct mpd_fnscroller_watchdog *)
+                  &mpd_fnscroller_server->watchdog);
+    if (mpd_fnscroller_server->command_fd != -1)
+    {
+        close(mpd_fnscroller_server->command_fd);
+    }
+
+    record_close();
+    history_close((struct mpd_fnscroller_history *)
+                  &mpd_fnscroller_server->history);
+    queue_free((struct mpd_fnscroller_queue *)&mpd_fnscroller_server->queue);
+    scrobble_close((struct mpd_fnscroller_scrobble *)
+                   &mpd_fnscroller_server->scrobble);
+    hook_stop((struct mpd_fnscroller_hook *)&mpd_fnscroller_server->hook);
+    refresh_stop((struct mpd_fnscroller_refresh *)
+                 &mpd_fnscroller_server->refresh);
+    mpris_stop((struct mpd_fnscroller_mpris *)&mpd_fnscroller_server->mpris);
+    cleanup_free((struct mpd_fnscroller_cleanup *)
+                 &mpd_fnscroller_server->cleanup);
 
     return;
 };
@@ -28,23 +28,28 @@
 
 
 #include <pthread.h>
+#include <stdbool.h>
 #include <mpd/client.h>
 
 #include "mpd-fnscroller.h"
+#include "snapshot.h"
+#include "scroll.h"
+#include "progress.h"
+#include "format.h"
+#include "cleanup.h"
+#include "queue.h"
+#include "history.h"
+#include "scrobble.h"
+#include "hook.h"
+#include "refresh.h"
+#include "mpris.h"
+#include "source.h"
+#include "tenant.h"
+#include "watchdog.h"
 
 
 
 
-#define MPD_DEFAULT_HOST    "localhost"
-#define MPD_DEFAULT_PORT    6600
-#define MPD_DEFAULT_TIMEOUT 30
-
-#define DELIMETER_DEFAULT_STRING " | "
-#define DELIMETER_STR_SIZE       4
-
-#define PID_STRING_SIZE 6
-
-
 enum server_status
 {
     STATUS_OK,
@@ -57,25 +62,44 @@ enum server_status
 
 struct mpd_fnscroller_server
 {
-    char                  mpd_host[HOSTNAME_STRING_SIZE];
-    unsigned int          mpd_port;
-    unsigned int          mpd_timeout;
-
-    volatile unsigned int current_string_size;
-    char                  fn_string[FILENAME_STRING_SIZE];
-    wchar_t               fn_wcstring[FILENAME_WCHAR_STRING_SIZE];
-    volatile unsigned int fn_wcstring_offset;
-
-    int                   pidfile_fd;
-
-    pthread_t             serve_thread_id;
-    int                   sock_listener;
+    struct mpd_fnscroller_source   source;
+
+    volatile unsigned int          current_string_size;
+    char                           fn_string[FILENAME_STRING_SIZE];
+    struct mpd_fnscroller_format   format;
+    struct mpd_fnscroller_cleanup  cleanup;
+    struct mpd_fnscroller_scroll   scroll;
+    enum mpd_state                 mpd_state;
+    struct mpd_fnscroller_playtime playtime;
+
+    bool                           up_next;
+    struct mpd_fnscroller_queue    queue;
+    char                           up_next_string[FILENAME_STRING_SIZE];
+    struct mpd_fnscroller_scroll   up_next_scroll;
+
+    bool                           handover;
+    char                           *record_path;
+    char                           *history_path;
+    struct mpd_fnscroller_history  history;
+    char                           *scrobble_path;
+    struct mpd_fnscroller_scrobble scrobble;
+    struct mpd_fnscroller_hook     hook;
+    struct mpd_fnscroller_refresh  refresh;
+    struct mpd_fnscroller_mpris    mpris;
+    struct mpd_fnscroller_tenants  tenants;
+    struct mpd_fnscroller_watchdog watchdog;
+    volatile unsigned int          version;
+    int                            wait_fd;
+    int                            command_fd;
+    int                            pidfile_fd;
+
+    pthread_t                      serve_thread_id;
+    bool                           serve_thread_started;
+    int                            sock_listener;
 };
 
 
 enum mpd_fnscroller_result server_init(struct mpd_fnscroller_server *server);
-enum mpd_fnscroller_result mpd_server_defaults_get(char *host,
-                                                   unsigned int *port);
 
 enum mpd_fnscroller_result server_run(struct mpd_fnscroller_server *server);
 
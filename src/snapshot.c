@@ -0,0 +1,118 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+#include "mpd-fnscroller.h"
+#include "snapshot.h"
+
+
+
+
+extern bool debug;
+
+
+// File of another layout is ignored rather than converted: the next player
+// event brings everything in it anyway
+enum mpd_fnscroller_result snapshot_file_load(const char *path,
+                                              struct snapshot_file *file)
+{
+    const struct snapshot_file *mapped = MAP_FAILED;
+    struct stat                file_stat;
+    int                        fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+    {
+        DEBUG_("No snapshot file %s", path)
+        return RESULT_ERROR;
+    }
+    if ((fstat(fd, &file_stat) == 0) &&
+        (file_stat.st_size == sizeof(*file)))
+    {
+        mapped = mmap(NULL, sizeof(*file), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        ERR_("Snapshot file %s is not compatible", path)
+        return RESULT_ERROR;
+    }
+    if ((mapped->magic != SNAPSHOT_FILE_MAGIC) ||
+        (mapped->version != SNAPSHOT_FILE_VERSION) ||
+        (mapped->size != sizeof(*file)) ||
+        (mapped->snapshot.layout_version != SNAPSHOT_LAYOUT_VERSION))
+    {
+        ERR_("Snapshot file %s is not compatible", path)
+        munmap((void *)mapped, sizeof(*file));
+        return RESULT_ERROR;
+    }
+
+    memcpy(file, mapped, sizeof(*file));
+    munmap((void *)mapped, sizeof(*file));
+    file->snapshot.fn_string[FILENAME_STRING_SIZE - 1] = '\0';
+    file->up_next_string[FILENAME_STRING_SIZE - 1] = '\0';
+
+    return RESULT_SUCCESS;
+};
+
+// Written aside and renamed over the previous one, so that a crash never
+// leaves a torn snapshot behind
+enum mpd_fnscroller_result snapshot_file_save(const char *path,
+                                              struct snapshot_file *file)
+{
+    char    tmp_path[PATH_STRING_SIZE + 8];
+    int     fd = -1;
+    ssize_t bytes_written = 0;
+
+    file->magic = SNAPSHOT_FILE_MAGIC;
+    file->version = SNAPSHOT_FILE_VERSION;
+    file->size = sizeof(*file);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd == -1)
+    {
+        ERR_("Could not create %s", tmp_path)
+        return RESULT_ERROR;
+    }
+    bytes_written = write(fd, file, sizeof(*file));
+    close(fd);
+    if ((bytes_written != sizeof(*file)) || (rename(tmp_path, path) == -1))
+    {
+        ERR_("Could not write snapshot file %s", path)
+        unlink(tmp_path);
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
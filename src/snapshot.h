@@ -0,0 +1,77 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+
+#include "mpd-fnscroller.h"
+
+
+
+
+#define SNAPSHOT_LAYOUT_VERSION 1
+#define SNAPSHOT_FILE_MAGIC     0x6d66736e
+#define SNAPSHOT_FILE_VERSION   1
+
+
+// Everything a server instance needs to continue serving exactly where another
+// one has stopped. Plain data only: it is passed between processes as is.
+struct mpd_fnscroller_snapshot
+{
+    unsigned int layout_version;
+
+    char         fn_string[FILENAME_STRING_SIZE];
+    unsigned int fn_wcstring_offset;
+    unsigned int filename_part_buf_offset;
+    unsigned int client_wcbufsize;
+
+    unsigned int mpd_state;
+};
+
+// Last snapshot kept in the runtime directory, for a restarted instance to
+// serve a frame before the player answers. The playback position is taken
+// with the wall clock, as the monotonic one is not kept across boots.
+struct snapshot_file
+{
+    unsigned int                   magic;
+    unsigned int                   version;
+    unsigned int                   size;
+
+    struct mpd_fnscroller_snapshot snapshot;
+    char                           up_next_string[FILENAME_STRING_SIZE];
+    unsigned int                   elapsed_ms;
+    unsigned int                   duration_ms;
+    unsigned long long             saved_time;
+};
+
+
+enum mpd_fnscroller_result snapshot_file_load(const char *path,
+                                              struct snapshot_file *file);
+enum mpd_fnscroller_result snapshot_file_save(const char *path,
+                                              struct snapshot_file *file);
+
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,344 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "source.h"
+
+
+
+
+extern bool debug;
+
+
+static enum mpd_fnscroller_result
+source_mpd_address_parse(struct mpd_fnscroller_source *source,
+                         const char *address);
+
+
+enum mpd_fnscroller_result source_init(struct mpd_fnscroller_source *source)
+{
+    memset(source, 0, sizeof(*source));
+    source->ops = &source_mpd_ops;
+    source->timeout = MPD_DEFAULT_TIMEOUT;
+    source->fd = -1;
+    source->watch_fd = -1;
+
+    return source_mpd_defaults_get(source->host, &source->port);
+};
+
+// "mpris:<player>" and "file:<path>" pick the other backends, anything else
+// is the MPD server
+enum mpd_fnscroller_result
+source_address_parse(struct mpd_fnscroller_source *source,
+                     const char *address)
+{
+    const char *path = NULL;
+
+    if (strncmp(address, SOURCE_PREFIX_MPRIS,
+                strlen(SOURCE_PREFIX_MPRIS)) == 0)
+    {
+        path = address + strlen(SOURCE_PREFIX_MPRIS);
+        source->ops = &source_mpris_ops;
+    }
+    else if (strncmp(address, SOURCE_PREFIX_FILE,
+                     strlen(SOURCE_PREFIX_FILE)) == 0)
+    {
+        path = address + strlen(SOURCE_PREFIX_FILE);
+        source->ops = &source_file_ops;
+    }
+    else
+    {
+        source->ops = &source_mpd_ops;
+        return source_mpd_address_parse(source, address);
+    }
+
+    if ((path[0] == '\0') || (strlen(path) > PATH_STRING_SIZE - 1))
+    {
+        ERR_("Invalid %s source: %s", source->ops->name, address)
+        return RESULT_ERROR;
+    }
+    free(source->path);
+// Server changes its working directory when it is daemonized
+    source->path = (source->ops == &source_file_ops) ?
+                   absolute_path_get(path) : strdup(path);
+    if ((source->path == NULL) ||
+        (strlen(source->path) > PATH_STRING_SIZE - 1))
+    {
+        ERR_("Invalid %s source: %s", source->ops->name, address)
+        free(source->path);
+        source->path = NULL;
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+enum mpd_fnscroller_result source_mpd_defaults_get(char *host,
+                                                   unsigned int *port)
+{
+    char *mpd_env_variable_host = getenv(MPD_ENV_VARIABLE_HOST);
+    char *mpd_env_variable_port = getenv(MPD_ENV_VARIABLE_PORT);
+    char *invalid_numchar = NULL;
+
+    memset(host, '\0', HOSTNAME_STRING_SIZE);
+    if (mpd_env_variable_host)
+    {
+        if (strlen(mpd_env_variable_host) > HOSTNAME_STRING_SIZE - 1)
+        {
+            ERR_(MPD_ENV_VARIABLE_HOST " variable value too is long")
+            return RESULT_ERROR;
+        }
+        else
+        {
+            strncpy(host, mpd_env_variable_host, HOSTNAME_STRING_SIZE - 1);
+        }
+    }
+    else
+    {
+        strncpy(host, MPD_DEFAULT_HOST, HOSTNAME_STRING_SIZE - 1);
+    }
+
+    if (mpd_env_variable_port)
+    {
+        *port = strtol(mpd_env_variable_port, &invalid_numchar, DEC);
+        if (*invalid_numchar)
+        {
+            ERR_("Invalid " MPD_ENV_VARIABLE_PORT "variable value")
+            return RESULT_ERROR;
+        }
+    }
+    else
+    {
+        *port = MPD_DEFAULT_PORT;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+enum mpd_fnscroller_result source_open(struct mpd_fnscroller_source *source)
+{
+    DEBUG_("Opening %s source", source->ops->name)
+
+    return source->ops->open(source);
+};
+
+void source_close(struct mpd_fnscroller_source *source)
+{
+    source->ops->close(source);
+
+    return;
+};
+
+// Blocks until the player has some of the events of idle_mask, or the
+// commands are queued on command_fd (-1 for none). Both could be reported.
+enum mpd_fnscroller_result source_wait(struct mpd_fnscroller_source *source,
+                                       enum mpd_idle idle_mask,
+                                       int command_fd, enum mpd_idle *idle,
+                                       bool *commands)
+{
+    *idle = 0;
+    *commands = false;
+
+    return source->ops->wait(source, idle_mask, command_fd, idle, commands);
+};
+
+// Song is only filled in while playing or paused
+enum mpd_fnscroller_result
+source_status_get(struct mpd_fnscroller_source *source,
+                  struct source_status *status, struct source_song *song)
+{
+    memset(status, 0, sizeof(*status));
+    status->volume = -1;
+    status->song_pos = -1;
+    song->uri[0] = '\0';
+    song->id = 0;
+    song->pos = 0;
+    song->duration_ms = 0;
+    memset(song->tags, 0, sizeof(song->tags));
+
+    return source->ops->status_get(source, status, song);
+};
+
+// Failed or unsupported command only costs itself
+enum mpd_fnscroller_result
+source_command_run(struct mpd_fnscroller_source *source,
+                   enum source_command command, long long arg,
+                   unsigned int song_id)
+{
+    if (source->ops->command_run == NULL)
+    {
+        ERR_("Player commands are not supported by the %s source",
+             source->ops->name)
+        return RESULT_SUCCESS;
+    }
+
+    return source->ops->command_run(source, command, arg, song_id);
+};
+
+bool source_queue_supported(const struct mpd_fnscroller_source *source)
+{
+    return source->ops->queue_begin != NULL;
+};
+
+// Songs of the queue changed since the version are listed between begin and
+// end
+enum mpd_fnscroller_result
+source_queue_begin(struct mpd_fnscroller_source *source,
+                   unsigned int version)
+{
+    return source->ops->queue_begin(source, version);
+};
+
+bool source_queue_song_next(struct mpd_fnscroller_source *source,
+                            struct source_song *song)
+{
+    song->uri[0] = '\0';
+    memset(song->tags, 0, sizeof(song->tags));
+
+    return source->ops->queue_song_next(source, song);
+};
+
+enum mpd_fnscroller_result
+source_queue_end(struct mpd_fnscroller_source *source)
+{
+    return source->ops->queue_end(source);
+};
+
+// Player which has no way to be pinged answers by its events alone
+enum mpd_fnscroller_result source_ping(struct mpd_fnscroller_source *source)
+{
+    if (source->ops->ping == NULL)
+    {
+        return RESULT_SUCCESS;
+    }
+
+    return source->ops->ping(source);
+};
+
+// NULL for a missing tag, like libmpdclient does
+const char *source_song_tag_get(const struct source_song *song,
+                                enum mpd_tag_type tag)
+{
+    if ((tag < 0) || (tag >= MPD_TAG_COUNT) || (song->tags[tag][0] == '\0'))
+    {
+        return NULL;
+    }
+
+    return song->tags[tag];
+};
+
+void source_song_tag_set(struct source_song *song, enum mpd_tag_type tag,
+                         const char *value)
+{
+    if ((tag < 0) || (tag >= MPD_TAG_COUNT))
+    {
+        return;
+    }
+    snprintf(song->tags[tag], SOURCE_TAG_SIZE, "%s", value ? value : "");
+
+    return;
+};
+
+// Sources with no song ids of their own derive them from the track key: the
+// history, the scrobbles and the hooks tell the songs apart by the id
+unsigned int source_song_id_get(const char *key)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *key; ++key)
+    {
+        hash = (hash ^ (unsigned char)*key) * 16777619u;
+    }
+
+    return hash ? hash : 1;
+};
+
+
+static enum mpd_fnscroller_result
+source_mpd_address_parse(struct mpd_fnscroller_source *source,
+                         const char *address)
+{
+    const char   *colon = strchr(address, ':');
+    unsigned int colon_pos = 0;
+    char         *invalid_numchar = NULL;
+
+    memset(source->host, '\0', HOSTNAME_STRING_SIZE);
+    if (colon)
+    {
+        colon_pos = colon - address;
+        if ((colon_pos < HOSTNAME_STRING_SIZE - 2) && (colon_pos > 0))
+        {
+            strncpy(source->host, address, colon_pos);
+        }
+        else
+        {
+            ERR_("Wrong <host>:<port> argument")
+            return RESULT_ERROR;
+        }
+        source->port = strtol(colon + 1, &invalid_numchar, DEC);
+        if ((*invalid_numchar) || (!strlen(colon + 1)))
+        {
+            ERR_("Invalid port")
+            return RESULT_ERROR;
+        }
+    }
+// Local socket of MPD is given by its path
+    else if (address[0] == '/')
+    {
+        if (strlen(address) > HOSTNAME_STRING_SIZE - 1)
+        {
+            ERR_("MPD socket path is too long")
+            return RESULT_ERROR;
+        }
+        strncpy(source->host, address, HOSTNAME_STRING_SIZE - 1);
+        source->port = 0;
+    }
+    else
+    {
+        if (strcmp(address, MPD_FNSCROLLER_DEFAULT_OPTARG) == 0)
+        {
+            if (!source_mpd_defaults_get(source->host, &source->port))
+            {
+                ERR_("Unable to get default mpd host and port")
+                return RESULT_ERROR;
+            }
+        }
+        else
+        {
+            ERR_("Invalid -s optarg")
+            return RESULT_ERROR;
+        }
+    }
+
+    return RESULT_SUCCESS;
+};
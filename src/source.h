@@ -0,0 +1,204 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+
+
+
+
+#define MPD_DEFAULT_HOST    "localhost"
+#define MPD_DEFAULT_PORT    6600
+#define MPD_DEFAULT_TIMEOUT 30
+
+#define SOURCE_PREFIX_MPRIS      "mpris:"
+#define SOURCE_PREFIX_FILE       "file:"
+#define SOURCE_MPRIS_NAME_PREFIX "org.mpris.MediaPlayer2."
+#define SOURCE_TAG_SIZE          256
+#define SOURCE_TRACK_SIZE        256
+#define SOURCE_RECORD_SIZE       4096
+
+
+// Commands of the player taken by the MPRIS bridge
+enum source_command
+{
+    SOURCE_COMMAND_PLAY = 0,
+    SOURCE_COMMAND_PAUSE,
+    SOURCE_COMMAND_PLAY_PAUSE,
+    SOURCE_COMMAND_STOP,
+    SOURCE_COMMAND_NEXT,
+    SOURCE_COMMAND_PREVIOUS,
+    SOURCE_COMMAND_SEEK,
+    SOURCE_COMMAND_POSITION_SET,
+    SOURCE_COMMAND_VOLUME_SET,
+    SOURCE_COMMAND_SHUFFLE_SET,
+    SOURCE_COMMAND_LOOP_SET,
+    SOURCE_COMMAND_COUNT
+};
+
+enum source_loop
+{
+    SOURCE_LOOP_NONE = 0,
+    SOURCE_LOOP_TRACK,
+    SOURCE_LOOP_PLAYLIST,
+    SOURCE_LOOP_COUNT
+};
+
+// Player state taken on an event. MPD states, tags and idle events are the
+// vocabulary of every source: the rest of the server and the workload
+// records stay the same whatever the player is.
+struct source_status
+{
+    enum mpd_state state;
+    unsigned int   elapsed_ms;
+    unsigned int   duration_ms;
+    int            volume;
+    bool           repeat;
+    bool           random;
+    bool           single;
+    int            song_pos;
+    unsigned int   queue_version;
+    unsigned int   queue_length;
+};
+
+// Missing tags are empty strings
+struct source_song
+{
+    char         uri[PATH_STRING_SIZE];
+    unsigned int id;
+    unsigned int pos;
+    unsigned int duration_ms;
+    char         tags[MPD_TAG_COUNT][SOURCE_TAG_SIZE];
+};
+
+struct mpd_fnscroller_source;
+
+// Backend of the player. The event handler loop opens it, waits for its
+// events and takes the status on each of them; the queue is only mirrored
+// from the backends which have one.
+struct source_ops
+{
+    const char                 *name;
+    enum mpd_fnscroller_result (*open)(struct mpd_fnscroller_source *source);
+    void                       (*close)(struct mpd_fnscroller_source *source);
+    enum mpd_fnscroller_result (*wait)(struct mpd_fnscroller_source *source,
+                                       enum mpd_idle idle_mask,
+                                       int command_fd, enum mpd_idle *idle,
+                                       bool *commands);
+    enum mpd_fnscroller_result (*status_get)(struct mpd_fnscroller_source
+                                             *source,
+                                             struct source_status *status,
+                                             struct source_song *song);
+    enum mpd_fnscroller_result (*command_run)(struct mpd_fnscroller_source
+                                              *source,
+                                              enum source_command command,
+                                              long long arg,
+                                              unsigned int song_id);
+    enum mpd_fnscroller_result (*queue_begin)(struct mpd_fnscroller_source
+                                              *source,
+                                              unsigned int version);
+    bool                       (*queue_song_next)(struct
+                                                  mpd_fnscroller_source
+                                                  *source,
+                                                  struct source_song *song);
+    enum mpd_fnscroller_result (*queue_end)(struct mpd_fnscroller_source
+                                            *source);
+    enum mpd_fnscroller_result (*ping)(struct mpd_fnscroller_source *source);
+};
+
+// Record buffer and the song of the file backend are allocated on its open
+struct mpd_fnscroller_source
+{
+    const struct source_ops *ops;
+
+    char                    host[HOSTNAME_STRING_SIZE];
+    unsigned int            port;
+    unsigned int            timeout;
+    char                    *path;
+
+    struct mpd_connection   *connection;
+
+    void                    *bus;
+    char                    track[SOURCE_TRACK_SIZE];
+
+    int                     fd;
+    int                     watch_fd;
+    bool                    fifo;
+    char                    *record;
+    size_t                  record_length;
+    unsigned long long      record_time;
+    struct source_status    status;
+    struct source_song      *song;
+};
+
+
+extern const struct source_ops source_mpd_ops;
+extern const struct source_ops source_mpris_ops;
+extern const struct source_ops source_file_ops;
+
+
+enum mpd_fnscroller_result source_init(struct mpd_fnscroller_source *source);
+enum mpd_fnscroller_result
+source_address_parse(struct mpd_fnscroller_source *source,
+                     const char *address);
+enum mpd_fnscroller_result source_mpd_defaults_get(char *host,
+                                                   unsigned int *port);
+enum mpd_fnscroller_result source_open(struct mpd_fnscroller_source *source);
+void source_close(struct mpd_fnscroller_source *source);
+enum mpd_fnscroller_result source_wait(struct mpd_fnscroller_source *source,
+                                       enum mpd_idle idle_mask,
+                                       int command_fd, enum mpd_idle *idle,
+                                       bool *commands);
+enum mpd_fnscroller_result
+source_status_get(struct mpd_fnscroller_source *source,
+                  struct source_status *status, struct source_song *song);
+enum mpd_fnscroller_result
+source_command_run(struct mpd_fnscroller_source *source,
+                   enum source_command command, long long arg,
+                   unsigned int song_id);
+bool source_queue_supported(const struct mpd_fnscroller_source *source);
+enum mpd_fnscroller_result
+source_queue_begin(struct mpd_fnscroller_source *source,
+                   unsigned int version);
+bool source_queue_song_next(struct mpd_fnscroller_source *source,
+                            struct source_song *song);
+enum mpd_fnscroller_result
+source_queue_end(struct mpd_fnscroller_source *source);
+enum mpd_fnscroller_result source_ping(struct mpd_fnscroller_source *source);
+const char *source_song_tag_get(const struct source_song *song,
+                                enum mpd_tag_type tag);
+void source_song_tag_set(struct source_song *song, enum mpd_tag_type tag,
+                         const char *value);
+unsigned int source_song_id_get(const char *key);
+
+
+#endif /* SOURCE_H */
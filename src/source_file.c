@@ -0,0 +1,473 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "source.h"
+
+
+
+
+extern bool debug;
+
+
+static enum mpd_fnscroller_result
+source_file_open(struct mpd_fnscroller_source *source);
+static void source_file_close(struct mpd_fnscroller_source *source);
+static enum mpd_fnscroller_result
+source_file_wait(struct mpd_fnscroller_source *source, enum mpd_idle idle_mask,
+                 int command_fd, enum mpd_idle *idle, bool *commands);
+static enum mpd_fnscroller_result
+source_file_status_get(struct mpd_fnscroller_source *source,
+                       struct source_status *status, struct source_song *song);
+static enum mpd_fnscroller_result
+source_file_fifo_open(struct mpd_fnscroller_source *source);
+static enum mpd_fnscroller_result
+source_file_fifo_read(struct mpd_fnscroller_source *source, bool *updated);
+static enum mpd_fnscroller_result
+source_file_watch_read(struct mpd_fnscroller_source *source, bool *updated);
+static void source_file_read(struct mpd_fnscroller_source *source);
+static void source_file_record_parse(struct mpd_fnscroller_source *source,
+                                     char *record);
+static bool source_file_field_parse(struct mpd_fnscroller_source *source,
+                                    char *line);
+
+
+// Player only tells what it plays, it takes no commands and has no queue
+const struct source_ops source_file_ops =
+{
+    .name = "file",
+    .open = source_file_open,
+    .close = source_file_close,
+    .wait = source_file_wait,
+    .status_get = source_file_status_get
+};
+
+
+// FIFO is read record by record as it is written to. Regular file is read
+// whole on open and every time it is written or replaced: its directory is
+// watched, so that the file could be replaced with rename.
+static enum mpd_fnscroller_result
+source_file_open(struct mpd_fnscroller_source *source)
+{
+    struct stat path_stat;
+    char        directory[PATH_STRING_SIZE];
+
+    source->record = malloc(SOURCE_RECORD_SIZE);
+    source->song = malloc(sizeof(*source->song));
+    if ((source->record == NULL) || (source->song == NULL))
+    {
+        ERR_("Could not allocate file source buffers")
+        source_file_close(source);
+        return RESULT_ERROR;
+    }
+
+    if ((stat(source->path, &path_stat) == 0) && (S_ISFIFO(path_stat.st_mode)))
+    {
+        source->fifo = true;
+        source->record_length = 0;
+        source->record[0] = '\0';
+        source_file_record_parse(source, source->record);
+        if (!source_file_fifo_open(source))
+        {
+            source_file_close(source);
+            return RESULT_ERROR;
+        }
+        return RESULT_SUCCESS;
+    }
+
+    source->fifo = false;
+    source->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (source->watch_fd == -1)
+    {
+        ERR_("Could not create inotify instance")
+        source_file_close(source);
+        return RESULT_ERROR;
+    }
+    snprintf(directory, PATH_STRING_SIZE, "%s", source->path);
+    if (inotify_add_watch(source->watch_fd, dirname(directory),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                          IN_DELETE) == -1)
+    {
+        ERR_("Could not watch the directory of %s", source->path)
+        source_file_close(source);
+        return RESULT_ERROR;
+    }
+    source_file_read(source);
+
+    return RESULT_SUCCESS;
+};
+
+static void source_file_close(struct mpd_fnscroller_source *source)
+{
+    if (source->fd != -1)
+    {
+        close(source->fd);
+        source->fd = -1;
+    }
+    if (source->watch_fd != -1)
+    {
+        close(source->watch_fd);
+        source->watch_fd = -1;
+    }
+    free(source->record);
+    source->record = NULL;
+    free(source->song);
+    source->song = NULL;
+
+    return;
+};
+
+// Every record read is a player event, whatever is changed in it
+static enum mpd_fnscroller_result
+source_file_wait(struct mpd_fnscroller_source *source, enum mpd_idle idle_mask,
+                 int command_fd, enum mpd_idle *idle, bool *commands)
+{
+    struct pollfd pollfds[2];
+    bool          updated = false;
+
+    pollfds[0].fd = source->fifo ? source->fd : source->watch_fd;
+    pollfds[0].events = POLLIN;
+    pollfds[1].fd = command_fd;
+    pollfds[1].events = POLLIN;
+    while ((!updated) && (!*commands))
+    {
+        pollfds[0].revents = 0;
+        pollfds[1].revents = 0;
+        if (poll(pollfds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ERR_("Issue polling the %s source", source->path)
+            return RESULT_ERROR;
+        }
+
+        *commands = pollfds[1].revents & POLLIN;
+        if (!(pollfds[0].revents & (POLLIN | POLLHUP)))
+        {
+            continue;
+        }
+        if ((source->fifo) && (!source_file_fifo_read(source, &updated)))
+        {
+            return RESULT_ERROR;
+        }
+        if ((!source->fifo) && (!source_file_watch_read(source, &updated)))
+        {
+            return RESULT_ERROR;
+        }
+        pollfds[0].fd = source->fifo ? source->fd : source->watch_fd;
+    }
+    if (updated)
+    {
+        *idle = MPD_IDLE_PLAYER & idle_mask;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Position written with the record moves on while playing
+static enum mpd_fnscroller_result
+source_file_status_get(struct mpd_fnscroller_source *source,
+                       struct source_status *status, struct source_song *song)
+{
+    *status = source->status;
+    if ((status->state == MPD_STATE_PLAY) || (status->state == MPD_STATE_PAUSE))
+    {
+        *song = *source->song;
+    }
+    if (status->state == MPD_STATE_PLAY)
+    {
+        status->elapsed_ms += monotonic_time_get() - source->record_time;
+        if ((status->duration_ms) &&
+            (status->elapsed_ms > status->duration_ms))
+        {
+            status->elapsed_ms = status->duration_ms;
+        }
+    }
+
+    return RESULT_SUCCESS;
+};
+
+
+// Opened non-blocking not to wait for a writer; a reader opened anew is not
+// woken up by the writer which has already gone
+static enum mpd_fnscroller_result
+source_file_fifo_open(struct mpd_fnscroller_source *source)
+{
+    if (source->fd != -1)
+    {
+        close(source->fd);
+    }
+    source->fd = open(source->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (source->fd == -1)
+    {
+        ERR_("Could not open %s", source->path)
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Record ends with an empty line or when the writer closes the FIFO, the last
+// of the records read at once wins
+static enum mpd_fnscroller_result
+source_file_fifo_read(struct mpd_fnscroller_source *source, bool *updated)
+{
+    char    *record = source->record;
+    char    *end = NULL;
+    ssize_t length = 0;
+
+    length = read(source->fd, record + source->record_length,
+                  SOURCE_RECORD_SIZE - 1 - source->record_length);
+    if (length == -1)
+    {
+        if ((errno == EAGAIN) || (errno == EINTR))
+        {
+            return RESULT_SUCCESS;
+        }
+        ERR_("Could not read %s", source->path)
+        return RESULT_ERROR;
+    }
+    source->record_length += length;
+    record[source->record_length] = '\0';
+
+    while ((end = strstr(record, "\n\n")) != NULL)
+    {
+        *end = '\0';
+        source_file_record_parse(source, record);
+        *updated = true;
+        source->record_length -= end + 2 - record;
+        memmove(record, end + 2, source->record_length + 1);
+    }
+// Writer is gone, or the record does not fit and is cut
+    if ((length == 0) || (source->record_length == SOURCE_RECORD_SIZE - 1))
+    {
+        if (source->record_length)
+        {
+            source_file_record_parse(source, record);
+            *updated = true;
+            source->record_length = 0;
+        }
+        if (length == 0)
+        {
+            return source_file_fifo_open(source);
+        }
+    }
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result
+source_file_watch_read(struct mpd_fnscroller_source *source, bool *updated)
+{
+    char                       buf[4096] __attribute__((aligned(8)));
+    const struct inotify_event *event = NULL;
+    const char                 *name = strrchr(source->path, '/') + 1;
+    ssize_t                    length = 0;
+    ssize_t                    offset = 0;
+
+    length = read(source->watch_fd, buf, sizeof(buf));
+    if (length == -1)
+    {
+        if ((errno == EAGAIN) || (errno == EINTR))
+        {
+            return RESULT_SUCCESS;
+        }
+        ERR_("Could not read the inotify events")
+        return RESULT_ERROR;
+    }
+
+    for (offset = 0; offset < length;
+         offset += sizeof(struct inotify_event) + event->len)
+    {
+        event = (const struct inotify_event *)(buf + offset);
+        if ((event->len) && (strcmp(event->name, name) == 0))
+        {
+            *updated = true;
+        }
+    }
+    if (*updated)
+    {
+        source_file_read(source);
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Missing file stops the player
+static void source_file_read(struct mpd_fnscroller_source *source)
+{
+    int     fd = open(source->path, O_RDONLY | O_CLOEXEC);
+    ssize_t length = 0;
+
+    source->record_length = 0;
+    if (fd != -1)
+    {
+        while ((source->record_length < SOURCE_RECORD_SIZE - 1) &&
+               ((length = read(fd, source->record + source->record_length,
+                               SOURCE_RECORD_SIZE - 1 -
+                               source->record_length)) > 0))
+        {
+            source->record_length += length;
+        }
+        close(fd);
+    }
+    source->record[source->record_length] = '\0';
+    source_file_record_parse(source, source->record);
+    source->record_length = 0;
+
+    return;
+};
+
+// "key=value" lines, the keys are "state", "file", "elapsed" and "duration"
+// (in seconds) and the MPD tag names; any other line is the title. Record
+// with a title is playing unless told otherwise, an empty one is stopped.
+static void source_file_record_parse(struct mpd_fnscroller_source *source,
+                                     char *record)
+{
+    struct source_status *status = &source->status;
+    struct source_song   *song = source->song;
+    char                 *line = NULL;
+    char                 *save = NULL;
+    bool                 state_set = false;
+    char                 key[PATH_STRING_SIZE];
+
+    memset(status, 0, sizeof(*status));
+    status->state = MPD_STATE_STOP;
+    status->volume = -1;
+    status->song_pos = -1;
+    memset(song, 0, sizeof(*song));
+    source->record_time = monotonic_time_get();
+
+    for (line = strtok_r(record, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save))
+    {
+        if (strncmp(line, "state=", strlen("state=")) == 0)
+        {
+            state_set = true;
+            if (strcmp(line + strlen("state="), "play") == 0)
+            {
+                status->state = MPD_STATE_PLAY;
+            }
+            else if (strcmp(line + strlen("state="), "pause") == 0)
+            {
+                status->state = MPD_STATE_PAUSE;
+            }
+        }
+        else if (!source_file_field_parse(source, line))
+        {
+            source_song_tag_set(song, MPD_TAG_TITLE, line);
+        }
+    }
+
+    if ((!state_set) && ((song->uri[0]) || (song->tags[MPD_TAG_TITLE][0])))
+    {
+        status->state = MPD_STATE_PLAY;
+    }
+    status->duration_ms = song->duration_ms;
+// Songs are known by their file, or by the title when there is none
+    if (song->uri[0])
+    {
+        song->id = source_song_id_get(song->uri);
+    }
+    else
+    {
+        snprintf(key, PATH_STRING_SIZE, "%s\n%s", song->tags[MPD_TAG_ARTIST],
+                 song->tags[MPD_TAG_TITLE]);
+        song->id = source_song_id_get(key);
+        snprintf(song->uri, PATH_STRING_SIZE, "%s", song->tags[MPD_TAG_TITLE]);
+    }
+    DEBUG_("File source record: state %d; %s", status->state, song->uri)
+
+    return;
+};
+
+static bool source_file_field_parse(struct mpd_fnscroller_source *source,
+                                    char *line)
+{
+    char              *value = strchr(line, '=');
+    char              *invalid_numchar = NULL;
+    enum mpd_tag_type tag = MPD_TAG_UNKNOWN;
+    double            seconds = 0;
+
+    if (value == NULL)
+    {
+        return false;
+    }
+
+    *value = '\0';
+    ++value;
+    if (strcmp(line, "file") == 0)
+    {
+        snprintf(source->song->uri, PATH_STRING_SIZE, "%s", value);
+        return true;
+    }
+    if ((strcmp(line, "elapsed") == 0) || (strcmp(line, "duration") == 0))
+    {
+        seconds = strtod(value, &invalid_numchar);
+        if ((!*invalid_numchar) && (seconds >= 0) && (seconds < 1e6))
+        {
+            if (line[0] == 'e')
+            {
+                source->status.elapsed_ms = seconds * 1000;
+            }
+            else
+            {
+                source->song->duration_ms = seconds * 1000;
+            }
+            return true;
+        }
+    }
+    else
+    {
+        tag = mpd_tag_name_iparse(line);
+        if (tag != MPD_TAG_UNKNOWN)
+        {
+            source_song_tag_set(source->song, tag, value);
+            return true;
+        }
+    }
+
+// Not a field: the title has an equals sign in it
+    *(value - 1) = '=';
+    return false;
+};
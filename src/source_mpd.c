@@ -0,0 +1,352 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "source.h"
+
+
+
+
+extern bool debug;
+
+
+static enum mpd_fnscroller_result
+source_mpd_open(struct mpd_fnscroller_source *source);
+static void source_mpd_close(struct mpd_fnscroller_source *source);
+static enum mpd_fnscroller_result
+source_mpd_wait(struct mpd_fnscroller_source *source, enum mpd_idle idle_mask,
+                int command_fd, enum mpd_idle *idle, bool *commands);
+static enum mpd_fnscroller_result
+source_mpd_status_get(struct mpd_fnscroller_source *source,
+                      struct source_status *status, struct source_song *song);
+static enum mpd_fnscroller_result
+source_mpd_command_run(struct mpd_fnscroller_source *source,
+                       enum source_command command, long long arg,
+                       unsigned int song_id);
+static enum mpd_fnscroller_result
+source_mpd_queue_begin(struct mpd_fnscroller_source *source,
+                       unsigned int version);
+static bool source_mpd_queue_song_next(struct mpd_fnscroller_source *source,
+                                       struct source_song *song);
+static enum mpd_fnscroller_result
+source_mpd_queue_end(struct mpd_fnscroller_source *source);
+static enum mpd_fnscroller_result
+source_mpd_ping(struct mpd_fnscroller_source *source);
+static void source_mpd_song_fill(struct source_song *song,
+                                 const struct mpd_song *mpd_song);
+
+
+const struct source_ops source_mpd_ops =
+{
+    .name = "mpd",
+    .open = source_mpd_open,
+    .close = source_mpd_close,
+    .wait = source_mpd_wait,
+    .status_get = source_mpd_status_get,
+    .command_run = source_mpd_command_run,
+    .queue_begin = source_mpd_queue_begin,
+    .queue_song_next = source_mpd_queue_song_next,
+    .queue_end = source_mpd_queue_end,
+    .ping = source_mpd_ping
+};
+
+
+static enum mpd_fnscroller_result
+source_mpd_open(struct mpd_fnscroller_source *source)
+{
+    source->connection = mpd_connection_new(source->host, source->port,
+                                            source->timeout * 1000);
+    if (mpd_connection_get_error(source->connection) != MPD_ERROR_SUCCESS)
+    {
+        ERR_("Could not establish connection with mpd")
+        mpd_connection_free(source->connection);
+        source->connection = NULL;
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+static void source_mpd_close(struct mpd_fnscroller_source *source)
+{
+    if (source->connection != NULL)
+    {
+        mpd_connection_free(source->connection);
+        source->connection = NULL;
+    }
+
+    return;
+};
+
+// Idle is left early when the commands are queued: they are run on the same
+// connection, their events are reported by the next idle
+static enum mpd_fnscroller_result
+source_mpd_wait(struct mpd_fnscroller_source *source, enum mpd_idle idle_mask,
+                int command_fd, enum mpd_idle *idle, bool *commands)
+{
+    struct mpd_connection *connection = source->connection;
+    struct pollfd         pollfds[2];
+
+    if (!mpd_send_idle_mask(connection, idle_mask))
+    {
+        ERR_("Could not enter idle: %s",
+             mpd_connection_get_error_message(connection))
+        return RESULT_ERROR;
+    }
+
+    pollfds[0].fd = mpd_connection_get_fd(connection);
+    pollfds[0].events = POLLIN;
+    pollfds[1].fd = command_fd;
+    pollfds[1].events = POLLIN;
+    pollfds[1].revents = 0;
+    while (poll(pollfds, 2, -1) == -1)
+    {
+        if (errno != EINTR)
+        {
+            ERR_("Issue polling the MPD connection")
+            return RESULT_ERROR;
+        }
+    }
+
+    *commands = pollfds[1].revents & POLLIN;
+    if ((*commands) && (!mpd_send_noidle(connection)))
+    {
+        ERR_("Could not leave idle: %s",
+             mpd_connection_get_error_message(connection))
+        return RESULT_ERROR;
+    }
+    *idle = mpd_recv_idle(connection, true);
+    if ((!*idle) &&
+        (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS))
+    {
+        ERR_("Issue waiting for MPD events: %s",
+             mpd_connection_get_error_message(connection))
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Status and the current song are taken with a single round trip
+static enum mpd_fnscroller_result
+source_mpd_status_get(struct mpd_fnscroller_source *source,
+                      struct source_status *status, struct source_song *song)
+{
+    struct mpd_connection *connection = source->connection;
+    struct mpd_status     *mpd_status;
+    struct mpd_song       *mpd_song;
+
+    mpd_command_list_begin(connection, true);
+    mpd_send_status(connection);
+    mpd_send_current_song(connection);
+    mpd_command_list_end(connection);
+
+    mpd_status = mpd_recv_status(connection);
+    if (mpd_status == NULL)
+    {
+        ERR_("Could not receive mpd status")
+        return RESULT_ERROR;
+    }
+    status->state = mpd_status_get_state(mpd_status);
+    status->elapsed_ms = mpd_status_get_elapsed_ms(mpd_status);
+    status->duration_ms = mpd_status_get_total_time(mpd_status) * 1000;
+    status->volume = mpd_status_get_volume(mpd_status);
+    status->repeat = mpd_status_get_repeat(mpd_status);
+    status->random = mpd_status_get_random(mpd_status);
+    status->single = mpd_status_get_single(mpd_status);
+    status->song_pos = mpd_status_get_song_pos(mpd_status);
+    status->queue_version = mpd_status_get_queue_version(mpd_status);
+    status->queue_length = mpd_status_get_queue_length(mpd_status);
+    mpd_status_free(mpd_status);
+
+    mpd_response_next(connection);
+    if ((status->state == MPD_STATE_PLAY) ||
+        (status->state == MPD_STATE_PAUSE))
+    {
+        mpd_song = mpd_recv_song(connection);
+        if (mpd_song == NULL)
+        {
+            ERR_("Could not receive the current song")
+            return RESULT_ERROR;
+        }
+        source_mpd_song_fill(song, mpd_song);
+        mpd_song_free(mpd_song);
+    }
+    mpd_response_finish(connection);
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result
+source_mpd_command_run(struct mpd_fnscroller_source *source,
+                       enum source_command command, long long arg,
+                       unsigned int song_id)
+{
+    struct mpd_connection *connection = source->connection;
+    bool                  result = true;
+
+    switch (command)
+    {
+        case SOURCE_COMMAND_PLAY:
+            result = mpd_run_play(connection);
+            break;
+
+        case SOURCE_COMMAND_PAUSE:
+            result = mpd_run_pause(connection, true);
+            break;
+
+        case SOURCE_COMMAND_PLAY_PAUSE:
+            result = mpd_run_toggle_pause(connection);
+            break;
+
+        case SOURCE_COMMAND_STOP:
+            result = mpd_run_stop(connection);
+            break;
+
+        case SOURCE_COMMAND_NEXT:
+            result = mpd_run_next(connection);
+            break;
+
+        case SOURCE_COMMAND_PREVIOUS:
+            result = mpd_run_previous(connection);
+            break;
+
+        case SOURCE_COMMAND_SEEK:
+            result = mpd_run_seek_current(connection, arg / 1000.0f, true);
+            break;
+
+        case SOURCE_COMMAND_POSITION_SET:
+            result = mpd_run_seek_id_float(connection, song_id, arg / 1000.0f);
+            break;
+
+        case SOURCE_COMMAND_VOLUME_SET:
+            result = mpd_run_set_volume(connection, arg);
+            break;
+
+        case SOURCE_COMMAND_SHUFFLE_SET:
+            result = mpd_run_random(connection, arg);
+            break;
+
+        case SOURCE_COMMAND_LOOP_SET:
+            result = mpd_run_repeat(connection, arg != SOURCE_LOOP_NONE) &&
+                     mpd_run_single(connection, arg == SOURCE_LOOP_TRACK);
+            break;
+
+        default:
+            ERR_("Invalid player command: %d", command)
+            break;
+    }
+    if (!result)
+    {
+        ERR_("Player command %d failed: %s", command,
+             mpd_connection_get_error_message(connection))
+        if (!mpd_connection_clear_error(connection))
+        {
+            return RESULT_ERROR;
+        }
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// "plchanges" returns the songs at the positions changed since the version
+static enum mpd_fnscroller_result
+source_mpd_queue_begin(struct mpd_fnscroller_source *source,
+                       unsigned int version)
+{
+    if (!mpd_send_queue_changes_meta(source->connection, version))
+    {
+        ERR_("Could not request queue changes")
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+static bool source_mpd_queue_song_next(struct mpd_fnscroller_source *source,
+                                       struct source_song *song)
+{
+    struct mpd_song *mpd_song = mpd_recv_song(source->connection);
+
+    if (mpd_song == NULL)
+    {
+        return false;
+    }
+    source_mpd_song_fill(song, mpd_song);
+    mpd_song_free(mpd_song);
+
+    return true;
+};
+
+static enum mpd_fnscroller_result
+source_mpd_queue_end(struct mpd_fnscroller_source *source)
+{
+    if (!mpd_response_finish(source->connection))
+    {
+        ERR_("Could not receive queue changes")
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Run with the connection out of its idle, between two waits
+static enum mpd_fnscroller_result
+source_mpd_ping(struct mpd_fnscroller_source *source)
+{
+    if (!mpd_run_ping(source->connection))
+    {
+        ERR_("MPD did not answer the ping: %s",
+             mpd_connection_get_error_message(source->connection))
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+static void source_mpd_song_fill(struct source_song *song,
+                                 const struct mpd_song *mpd_song)
+{
+    int tag = 0;
+
+    snprintf(song->uri, PATH_STRING_SIZE, "%s", mpd_song_get_uri(mpd_song));
+    song->id = mpd_song_get_id(mpd_song);
+    song->pos = mpd_song_get_pos(mpd_song);
+    song->duration_ms = mpd_song_get_duration_ms(mpd_song);
+    for (tag = 0; tag < MPD_TAG_COUNT; ++tag)
+    {
+        source_song_tag_set(song, tag, mpd_song_get_tag(mpd_song, tag, 0));
+    }
+
+    return;
+};
@@ -0,0 +1,665 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <mpd/client.h>
+#ifdef MPD_FNSCROLLER_MPRIS
+#include <dbus/dbus.h>
+#endif /* MPD_FNSCROLLER_MPRIS */
+
+#include "mpd-fnscroller.h"
+#include "mpris.h"
+#include "source.h"
+
+
+
+
+#define SOURCE_MPRIS_NAME_SIZE (sizeof(SOURCE_MPRIS_NAME_PREFIX) + \
+                                PATH_STRING_SIZE)
+
+
+extern bool debug;
+
+
+static enum mpd_fnscroller_result
+source_mpris_open(struct mpd_fnscroller_source *source);
+#ifdef MPD_FNSCROLLER_MPRIS
+static void source_mpris_close(struct mpd_fnscroller_source *source);
+static enum mpd_fnscroller_result
+source_mpris_wait(struct mpd_fnscroller_source *source,
+                  enum mpd_idle idle_mask, int command_fd,
+                  enum mpd_idle *idle, bool *commands);
+static enum mpd_fnscroller_result
+source_mpris_status_get(struct mpd_fnscroller_source *source,
+                        struct source_status *status,
+                        struct source_song *song);
+static enum mpd_fnscroller_result
+source_mpris_command_run(struct mpd_fnscroller_source *source,
+                         enum source_command command, long long arg,
+                         unsigned int song_id);
+static void source_mpris_name_get(const struct mpd_fnscroller_source *source,
+                                  char *name);
+static void source_mpris_property_parse(struct mpd_fnscroller_source *source,
+                                        const char *name,
+                                        DBusMessageIter *value,
+                                        struct source_status *status,
+                                        struct source_song *song);
+static void source_mpris_metadata_parse(struct mpd_fnscroller_source *source,
+                                        DBusMessageIter *metadata,
+                                        struct source_song *song);
+static const char *source_mpris_string_get(DBusMessageIter *value);
+static bool source_mpris_basic_get(DBusMessageIter *value, int type,
+                                   void *basic);
+
+
+static const char *source_mpris_methods[] =
+{
+    [SOURCE_COMMAND_PLAY] = "Play",
+    [SOURCE_COMMAND_PAUSE] = "Pause",
+    [SOURCE_COMMAND_PLAY_PAUSE] = "PlayPause",
+    [SOURCE_COMMAND_STOP] = "Stop",
+    [SOURCE_COMMAND_NEXT] = "Next",
+    [SOURCE_COMMAND_PREVIOUS] = "Previous"
+};
+
+static const char *source_mpris_loop_names[SOURCE_LOOP_COUNT] =
+{
+    "None", "Track", "Playlist"
+};
+
+
+// Any player on the session bus: it is followed with its signals and asked
+// for its properties on each of them
+const struct source_ops source_mpris_ops =
+{
+    .name = "mpris",
+    .open = source_mpris_open,
+    .close = source_mpris_close,
+    .wait = source_mpris_wait,
+    .status_get = source_mpris_status_get,
+    .command_run = source_mpris_command_run
+};
+#else
+const struct source_ops source_mpris_ops =
+{
+    .name = "mpris",
+    .open = source_mpris_open
+};
+#endif /* MPD_FNSCROLLER_MPRIS */
+
+
+// Player is not required to be running: it is stopped until its name is
+// taken on the bus
+static enum mpd_fnscroller_result
+source_mpris_open(struct mpd_fnscroller_source *source)
+{
+#ifdef MPD_FNSCROLLER_MPRIS
+    DBusConnection *bus = NULL;
+    DBusError      error;
+    char           name[SOURCE_MPRIS_NAME_SIZE];
+    char           rule[SOURCE_MPRIS_NAME_SIZE + 256];
+
+    source_mpris_name_get(source, name);
+    if (!dbus_validate_bus_name(name, NULL))
+    {
+        ERR_("Invalid MPRIS player name: %s", name)
+        return RESULT_ERROR;
+    }
+
+    dbus_error_init(&error);
+    bus = dbus_bus_get_private(DBUS_BUS_SESSION, &error);
+    if (bus == NULL)
+    {
+        ERR_("Could not connect to the session bus: %s", error.message)
+        dbus_error_free(&error);
+        return RESULT_ERROR;
+    }
+    dbus_connection_set_exit_on_disconnect(bus, FALSE);
+
+    snprintf(rule, sizeof(rule),
+             "type='signal',sender='%s',path='" MPRIS_OBJECT_PATH "',"
+             "interface='" DBUS_INTERFACE_PROPERTIES "',"
+             "member='PropertiesChanged',arg0='" MPRIS_INTERFACE_PLAYER "'",
+             name);
+    dbus_bus_add_match(bus, rule, &error);
+    if (!dbus_error_is_set(&error))
+    {
+        snprintf(rule, sizeof(rule),
+                 "type='signal',sender='%s',path='" MPRIS_OBJECT_PATH "',"
+                 "interface='" MPRIS_INTERFACE_PLAYER "',member='Seeked'",
+                 name);
+        dbus_bus_add_match(bus, rule, &error);
+    }
+    if (!dbus_error_is_set(&error))
+    {
+        snprintf(rule, sizeof(rule),
+                 "type='signal',sender='" DBUS_SERVICE_DBUS "',"
+                 "interface='" DBUS_INTERFACE_DBUS "',"
+                 "member='NameOwnerChanged',arg0='%s'", name);
+        dbus_bus_add_match(bus, rule, &error);
+    }
+    if (dbus_error_is_set(&error))
+    {
+        ERR_("Could not follow %s: %s", name, error.message)
+        dbus_error_free(&error);
+        dbus_connection_close(bus);
+        dbus_connection_unref(bus);
+        return RESULT_ERROR;
+    }
+    source->bus = bus;
+
+    return RESULT_SUCCESS;
+#else
+    ERR_("MPRIS source needs " PROGNAME " built with MPRIS=1")
+    return RESULT_ERROR;
+#endif /* MPD_FNSCROLLER_MPRIS */
+};
+
+
+#ifdef MPD_FNSCROLLER_MPRIS
+static void source_mpris_close(struct mpd_fnscroller_source *source)
+{
+    if (source->bus != NULL)
+    {
+        dbus_connection_close(source->bus);
+        dbus_connection_unref(source->bus);
+        source->bus = NULL;
+    }
+
+    return;
+};
+
+// Signals are only taken as the events: whatever they carry, the properties
+// are fetched whole by the status, as MPD status is
+static enum mpd_fnscroller_result
+source_mpris_wait(struct mpd_fnscroller_source *source,
+                  enum mpd_idle idle_mask, int command_fd,
+                  enum mpd_idle *idle, bool *commands)
+{
+    DBusConnection *bus = source->bus;
+    DBusMessage    *message = NULL;
+    struct pollfd  pollfds[2];
+    int            bus_fd = -1;
+
+    if (!dbus_connection_get_unix_fd(bus, &bus_fd))
+    {
+        ERR_("Could not get the session bus descriptor")
+        return RESULT_ERROR;
+    }
+    pollfds[0].fd = bus_fd;
+    pollfds[0].events = POLLIN;
+    pollfds[1].fd = command_fd;
+    pollfds[1].events = POLLIN;
+
+    for (;;)
+    {
+        while ((message = dbus_connection_pop_message(bus)) != NULL)
+        {
+            if (dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_SIGNAL)
+            {
+                *idle = MPD_IDLE_PLAYER & idle_mask;
+            }
+            dbus_message_unref(message);
+        }
+        if ((*idle) || (*commands))
+        {
+            return RESULT_SUCCESS;
+        }
+
+        pollfds[0].revents = 0;
+        pollfds[1].revents = 0;
+        if (poll(pollfds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ERR_("Issue polling the session bus")
+            return RESULT_ERROR;
+        }
+        *commands = pollfds[1].revents & POLLIN;
+        if ((pollfds[0].revents) &&
+            ((!dbus_connection_read_write(bus, 0)) ||
+             (!dbus_connection_get_is_connected(bus))))
+        {
+            ERR_("Session bus connection is lost")
+            return RESULT_ERROR;
+        }
+    }
+};
+
+// Player which is gone or does not answer is stopped
+static enum mpd_fnscroller_result
+source_mpris_status_get(struct mpd_fnscroller_source *source,
+                        struct source_status *status,
+                        struct source_song *song)
+{
+    DBusMessage     *message = NULL;
+    DBusMessage     *reply = NULL;
+    DBusMessageIter iter;
+    DBusMessageIter properties;
+    DBusMessageIter entry;
+    DBusMessageIter value;
+    DBusError       error;
+    const char      *interface = MPRIS_INTERFACE_PLAYER;
+    const char      *name = NULL;
+    char            bus_name[SOURCE_MPRIS_NAME_SIZE];
+
+    status->state = MPD_STATE_STOP;
+    source->track[0] = '\0';
+
+    source_mpris_name_get(source, bus_name);
+    message = dbus_message_new_method_call(bus_name, MPRIS_OBJECT_PATH,
+                                           DBUS_INTERFACE_PROPERTIES,
+                                           "GetAll");
+    if ((message == NULL) ||
+        (!dbus_message_append_args(message, DBUS_TYPE_STRING, &interface,
+                                   DBUS_TYPE_INVALID)))
+    {
+        ERR_("Could not create the MPRIS properties request")
+        return RESULT_ERROR;
+    }
+    dbus_error_init(&error);
+    reply = dbus_connection_send_with_reply_and_block(source->bus, message,
+                                                      source->timeout * 1000,
+                                                      &error);
+    dbus_message_unref(message);
+    if (reply == NULL)
+    {
+        DEBUG_("No properties from %s: %s", bus_name, error.message)
+        dbus_error_free(&error);
+        return RESULT_SUCCESS;
+    }
+
+    if ((!dbus_message_iter_init(reply, &iter)) ||
+        (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY))
+    {
+        ERR_("Invalid MPRIS properties from %s", bus_name)
+        dbus_message_unref(reply);
+        return RESULT_SUCCESS;
+    }
+    dbus_message_iter_recurse(&iter, &properties);
+    while (dbus_message_iter_get_arg_type(&properties) ==
+           DBUS_TYPE_DICT_ENTRY)
+    {
+        dbus_message_iter_recurse(&properties, &entry);
+        if (source_mpris_basic_get(&entry, DBUS_TYPE_STRING, &name) &&
+            (dbus_message_iter_next(&entry)) &&
+            (dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_VARIANT))
+        {
+            dbus_message_iter_recurse(&entry, &value);
+            source_mpris_property_parse(source, name, &value, status, song);
+        }
+        dbus_message_iter_next(&properties);
+    }
+    dbus_message_unref(reply);
+
+    if (status->state == MPD_STATE_STOP)
+    {
+        return RESULT_SUCCESS;
+    }
+// Songs are known by their track ids, the URL or the title stand in for
+// the file
+    status->duration_ms = song->duration_ms;
+    if (song->uri[0] == '\0')
+    {
+        snprintf(song->uri, PATH_STRING_SIZE, "%s",
+                 song->tags[MPD_TAG_TITLE]);
+    }
+    song->id = source_song_id_get(source->track[0] ? source->track :
+                                                     song->uri);
+
+    return RESULT_SUCCESS;
+};
+
+// Commands are sent with no reply awaited: the player tells their effect
+// with its signals
+static enum mpd_fnscroller_result
+source_mpris_command_run(struct mpd_fnscroller_source *source,
+                         enum source_command command, long long arg,
+                         unsigned int song_id)
+{
+    DBusMessage     *message = NULL;
+    DBusMessageIter iter;
+    DBusMessageIter variant;
+    const char      *interface = MPRIS_INTERFACE_PLAYER;
+    const char      *property = NULL;
+    const char      *track = source->track;
+    const char      *loop = NULL;
+    char            name[SOURCE_MPRIS_NAME_SIZE];
+    dbus_int64_t    offset = arg * 1000;
+    double          volume = arg / 100.0;
+    dbus_bool_t     flag = arg ? TRUE : FALSE;
+    bool            result = false;
+
+    source_mpris_name_get(source, name);
+    if (command <= SOURCE_COMMAND_PREVIOUS)
+    {
+        message = dbus_message_new_method_call(name, MPRIS_OBJECT_PATH,
+                                               MPRIS_INTERFACE_PLAYER,
+                                               source_mpris_methods[command]);
+        result = (message != NULL);
+    }
+    else if (command == SOURCE_COMMAND_SEEK)
+    {
+        message = dbus_message_new_method_call(name, MPRIS_OBJECT_PATH,
+                                               MPRIS_INTERFACE_PLAYER, "Seek");
+        result = (message != NULL) &&
+                 dbus_message_append_args(message, DBUS_TYPE_INT64, &offset,
+                                          DBUS_TYPE_INVALID);
+    }
+    else if (command == SOURCE_COMMAND_POSITION_SET)
+    {
+        if ((track[0] == '\0') ||
+            (!dbus_validate_path(track, NULL)) ||
+            (source_song_id_get(track) != song_id))
+        {
+            ERR_("No track of %s to set the position in", name)
+            return RESULT_SUCCESS;
+        }
+        message = dbus_message_new_method_call(name, MPRIS_OBJECT_PATH,
+                                               MPRIS_INTERFACE_PLAYER,
+                                               "SetPosition");
+        result = (message != NULL) &&
+                 dbus_message_append_args(message, DBUS_TYPE_OBJECT_PATH,
+                                          &track, DBUS_TYPE_INT64, &offset,
+                                          DBUS_TYPE_INVALID);
+    }
+    else if (command < SOURCE_COMMAND_COUNT)
+    {
+        message = dbus_message_new_method_call(name, MPRIS_OBJECT_PATH,
+                                               DBUS_INTERFACE_PROPERTIES,
+                                               "Set");
+        result = (message != NULL);
+    }
+    if ((result) && (command > SOURCE_COMMAND_POSITION_SET))
+    {
+        dbus_message_iter_init_append(message, &iter);
+        if (command == SOURCE_COMMAND_VOLUME_SET)
+        {
+            property = "Volume";
+            result = dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING,
+                                                    &interface) &&
+                     dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING,
+                                                    &property) &&
+                     dbus_message_iter_open_container(&iter,
+                                                      DBUS_TYPE_VARIANT, "d",
+                                                      &variant) &&
+                     dbus_message_iter_append_basic(&variant,
+                                                    DBUS_TYPE_DOUBLE,
+                                                    &volume);
+        }
+        else if (command == SOURCE_COMMAND_SHUFFLE_SET)
+        {
+            property = "Shuffle";
+            result = dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING,
+                                                    &interface) &&
+                     dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING,
+                                                    &property) &&
+                     dbus_message_iter_open_container(&iter,
+                                                      DBUS_TYPE_VARIANT, "b",
+                                                      &variant) &&
+                     dbus_message_iter_append_basic(&variant,
+                                                    DBUS_TYPE_BOOLEAN,
+                                                    &flag);
+        }
+        else
+        {
+            property = "LoopStatus";
+            loop = source_mpris_loop_names[(arg >= 0) &&
+                                           (arg < SOURCE_LOOP_COUNT) ?
+                                           arg : SOURCE_LOOP_NONE];
+            result = dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING,
+                                                    &interface) &&
+                     dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING,
+                                                    &property) &&
+                     dbus_message_iter_open_container(&iter,
+                                                      DBUS_TYPE_VARIANT, "s",
+                                                      &variant) &&
+                     dbus_message_iter_append_basic(&variant,
+                                                    DBUS_TYPE_STRING, &loop);
+        }
+        result = result && dbus_message_iter_close_container(&iter, &variant);
+    }
+
+    if (!result)
+    {
+        ERR_("Could not create the player command %d for %s", command, name)
+        if (message != NULL)
+        {
+            dbus_message_unref(message);
+        }
+        return RESULT_SUCCESS;
+    }
+    dbus_message_set_no_reply(message, TRUE);
+    result = dbus_connection_send(source->bus, message, NULL);
+    dbus_message_unref(message);
+    if (!result)
+    {
+        ERR_("Could not send the player command %d to %s", command, name)
+        return RESULT_ERROR;
+    }
+    dbus_connection_flush(source->bus);
+
+    return RESULT_SUCCESS;
+};
+
+static void source_mpris_name_get(const struct mpd_fnscroller_source *source,
+                                  char *name)
+{
+    snprintf(name, SOURCE_MPRIS_NAME_SIZE, SOURCE_MPRIS_NAME_PREFIX "%s",
+             source->path);
+
+    return;
+};
+
+// Properties of the wrong type are skipped, as the players send what they
+// like at times
+static void source_mpris_property_parse(struct mpd_fnscroller_source *source,
+                                        const char *name,
+                                        DBusMessageIter *value,
+                                        struct source_status *status,
+                                        struct source_song *song)
+{
+    const char   *string = NULL;
+    dbus_int64_t position = 0;
+    double       volume = 0;
+    dbus_bool_t  flag = FALSE;
+
+    if (strcmp(name, "PlaybackStatus") == 0)
+    {
+        string = source_mpris_string_get(value);
+        if (string == NULL)
+        {
+            return;
+        }
+        if (strcmp(string, "Playing") == 0)
+        {
+            status->state = MPD_STATE_PLAY;
+        }
+        else if (strcmp(string, "Paused") == 0)
+        {
+            status->state = MPD_STATE_PAUSE;
+        }
+    }
+    else if (strcmp(name, "Metadata") == 0)
+    {
+        source_mpris_metadata_parse(source, value, song);
+    }
+    else if ((strcmp(name, "Position") == 0) &&
+             (source_mpris_basic_get(value, DBUS_TYPE_INT64, &position)) &&
+             (position > 0))
+    {
+        status->elapsed_ms = position / 1000;
+    }
+    else if ((strcmp(name, "Volume") == 0) &&
+             (source_mpris_basic_get(value, DBUS_TYPE_DOUBLE, &volume)))
+    {
+        status->volume = (volume > 0) ? volume * 100 + 0.5 : 0;
+    }
+    else if ((strcmp(name, "Shuffle") == 0) &&
+             (source_mpris_basic_get(value, DBUS_TYPE_BOOLEAN, &flag)))
+    {
+        status->random = flag;
+    }
+// Loop of a single track is repeat in single mode, as MPD has it
+    else if (strcmp(name, "LoopStatus") == 0)
+    {
+        string = source_mpris_string_get(value);
+        if (string == NULL)
+        {
+            return;
+        }
+        status->repeat = (strcmp(string, "None") != 0);
+        status->single = (strcmp(string, "Track") == 0);
+    }
+
+    return;
+};
+
+static void source_mpris_metadata_parse(struct mpd_fnscroller_source *source,
+                                        DBusMessageIter *metadata,
+                                        struct source_song *song)
+{
+    static const struct
+    {
+        const char        *key;
+        enum mpd_tag_type tag;
+    } tags[] =
+    {
+        { "xesam:title", MPD_TAG_TITLE },
+        { "xesam:artist", MPD_TAG_ARTIST },
+        { "xesam:album", MPD_TAG_ALBUM },
+        { "xesam:albumArtist", MPD_TAG_ALBUM_ARTIST },
+        { "xesam:genre", MPD_TAG_GENRE },
+        { "xesam:composer", MPD_TAG_COMPOSER }
+    };
+    DBusMessageIter dict;
+    DBusMessageIter entry;
+    DBusMessageIter value;
+    const char      *key = NULL;
+    const char      *string = NULL;
+    dbus_int64_t    length = 0;
+    dbus_int32_t    number = 0;
+    unsigned int    i = 0;
+    char            track[16];
+
+    if (dbus_message_iter_get_arg_type(metadata) != DBUS_TYPE_ARRAY)
+    {
+        return;
+    }
+    dbus_message_iter_recurse(metadata, &dict);
+    while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY)
+    {
+        dbus_message_iter_recurse(&dict, &entry);
+        dbus_message_iter_next(&dict);
+        if ((!source_mpris_basic_get(&entry, DBUS_TYPE_STRING, &key)) ||
+            (!dbus_message_iter_next(&entry)) ||
+            (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_VARIANT))
+        {
+            continue;
+        }
+        dbus_message_iter_recurse(&entry, &value);
+
+        for (i = 0; i < sizeof(tags) / sizeof(tags[0]); ++i)
+        {
+            if (strcmp(key, tags[i].key) == 0)
+            {
+                source_song_tag_set(song, tags[i].tag,
+                                    source_mpris_string_get(&value));
+                break;
+            }
+        }
+        if (i < sizeof(tags) / sizeof(tags[0]))
+        {
+            continue;
+        }
+
+        if ((strcmp(key, "mpris:trackid") == 0) &&
+            ((string = source_mpris_string_get(&value)) != NULL))
+        {
+            snprintf(source->track, SOURCE_TRACK_SIZE, "%s", string);
+        }
+        else if ((strcmp(key, "xesam:url") == 0) &&
+                 ((string = source_mpris_string_get(&value)) != NULL))
+        {
+            snprintf(song->uri, PATH_STRING_SIZE, "%s", string);
+        }
+        else if ((strcmp(key, "mpris:length") == 0) &&
+                 (source_mpris_basic_get(&value, DBUS_TYPE_INT64, &length)) &&
+                 (length > 0))
+        {
+            song->duration_ms = length / 1000;
+        }
+        else if ((strcmp(key, "xesam:trackNumber") == 0) &&
+                 (source_mpris_basic_get(&value, DBUS_TYPE_INT32, &number)))
+        {
+            snprintf(track, sizeof(track), "%d", number);
+            source_song_tag_set(song, MPD_TAG_TRACK, track);
+        }
+    }
+
+    return;
+};
+
+// String, object path or the first of a list of strings
+static const char *source_mpris_string_get(DBusMessageIter *value)
+{
+    DBusMessageIter strings;
+    const char      *string = NULL;
+
+    if (dbus_message_iter_get_arg_type(value) == DBUS_TYPE_ARRAY)
+    {
+        dbus_message_iter_recurse(value, &strings);
+        value = &strings;
+    }
+    if ((dbus_message_iter_get_arg_type(value) != DBUS_TYPE_STRING) &&
+        (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_OBJECT_PATH))
+    {
+        return NULL;
+    }
+    dbus_message_iter_get_basic(value, &string);
+
+    return string;
+};
+
+static bool source_mpris_basic_get(DBusMessageIter *value, int type,
+                                   void *basic)
+{
+    if (dbus_message_iter_get_arg_type(value) != type)
+    {
+        return false;
+    }
+    dbus_message_iter_get_basic(value, basic);
+
+    return true;
+};
+#endif /* MPD_FNSCROLLER_MPRIS */
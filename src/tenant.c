@@ -0,0 +1,1137 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/fsuid.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <limits.h>
+#include <errno.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <poll.h>
+#include <pwd.h>
+#include <wchar.h>
+#include <pthread.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "connection.h"
+#include "json.h"
+#include "utf8.h"
+#include "tenant.h"
+
+
+
+
+extern bool debug;
+
+static struct mpd_fnscroller_tenants *mpd_fnscroller_tenants;
+static struct connection_pool        tenant_connection_pool;
+volatile static sig_atomic_t         tenants_shutdown_requested;
+
+
+static void tenants_shutdown_handler(int sig);
+static void tenants_cleanup(struct mpd_fnscroller_tenants *tenants);
+static enum mpd_fnscroller_result
+tenants_listener_open(struct mpd_fnscroller_tenants *tenants);
+static enum mpd_fnscroller_result
+tenants_workers_start(struct mpd_fnscroller_tenants *tenants);
+static void tenants_workers_stop(struct mpd_fnscroller_tenants *tenants);
+static enum mpd_fnscroller_result
+tenants_serve(struct mpd_fnscroller_tenants *tenants,
+              struct connection_pool *pool);
+static void tenants_events_handle(struct mpd_fnscroller_tenants *tenants);
+static void tenants_jobs_done_handle(struct mpd_fnscroller_tenants *tenants);
+static enum mpd_fnscroller_result
+tenant_request_handle(struct mpd_fnscroller_tenants *tenants,
+                      struct mpd_fnscroller_connection *connection);
+static struct mpd_fnscroller_tenant *
+tenant_get(struct mpd_fnscroller_tenants *tenants, uid_t uid, gid_t gid,
+           unsigned long long now);
+static void tenant_free(struct mpd_fnscroller_tenants *tenants,
+                        unsigned int index);
+static void tenant_destroy(struct mpd_fnscroller_tenants *tenants,
+                           struct mpd_fnscroller_tenant *tenant);
+static enum mpd_fnscroller_result
+tenant_address_get(const char *template, uid_t uid, char *buf, size_t size);
+static void tenant_job_queue(struct mpd_fnscroller_tenants *tenants,
+                             struct mpd_fnscroller_tenant *tenant);
+static void tenant_job_done(struct mpd_fnscroller_tenants *tenants,
+                            struct mpd_fnscroller_tenant *tenant);
+static void *tenant_worker(void *arg);
+static enum mpd_fnscroller_result
+tenant_connect(struct mpd_fnscroller_tenants *tenants,
+               struct mpd_fnscroller_tenant *tenant,
+               struct source_song *song);
+static enum mpd_fnscroller_result
+tenant_event_handle(struct mpd_fnscroller_tenants *tenants,
+                    struct mpd_fnscroller_tenant *tenant,
+                    struct source_song *song);
+static void tenant_disconnect(struct mpd_fnscroller_tenants *tenants,
+                              struct mpd_fnscroller_tenant *tenant);
+static enum mpd_fnscroller_result
+tenant_peer_check(struct mpd_fnscroller_tenant *tenant);
+static enum mpd_fnscroller_result
+tenant_player_update(struct mpd_fnscroller_tenants *tenants,
+                     struct mpd_fnscroller_tenant *tenant,
+                     struct source_song *song);
+static void tenant_string_set(struct mpd_fnscroller_tenant *tenant);
+static struct tenant_width *
+tenant_width_get(struct mpd_fnscroller_tenant *tenant, unsigned int wcbufsize,
+                 unsigned long long now);
+static enum mpd_fnscroller_result
+tenant_frame_handle(struct mpd_fnscroller_tenant *tenant,
+                    struct mpd_fnscroller_connection *connection,
+                    unsigned int frame_arg, unsigned long long now);
+static enum mpd_fnscroller_result
+tenant_json_frame_handle(struct mpd_fnscroller_tenant *tenant,
+                         struct mpd_fnscroller_connection *connection,
+                         unsigned int wcbufsize,
+                         enum mpd_fnscroller_progress progress);
+
+
+void tenants_init(struct mpd_fnscroller_tenants *tenants)
+{
+    memset(tenants, 0, sizeof(*tenants));
+    tenants->epoll_fd = -1;
+    tenants->wakeup_fd = -1;
+    tenants->sock_listener = -1;
+    tenants->jobs_tail = &tenants->jobs;
+
+    return;
+};
+
+// "%u" is the user ID, "%n" the user name and "%%" the percent sign. Only
+// MPD is followed: the other sources are bound to the session of the user.
+enum mpd_fnscroller_result
+tenants_template_set(struct mpd_fnscroller_tenants *tenants,
+                     const char *template)
+{
+    char address[TENANT_ADDRESS_SIZE];
+
+    if (strcmp(template, MPD_FNSCROLLER_DEFAULT_OPTARG) == 0)
+    {
+        template = TENANT_TEMPLATE_DEFAULT;
+    }
+    if ((strncmp(template, SOURCE_PREFIX_MPRIS,
+                 strlen(SOURCE_PREFIX_MPRIS)) == 0) ||
+        (strncmp(template, SOURCE_PREFIX_FILE,
+                 strlen(SOURCE_PREFIX_FILE)) == 0) ||
+        (!tenant_address_get(template, getuid(), address,
+                             TENANT_ADDRESS_SIZE)))
+    {
+        ERR_("Invalid MPD address template: %s", template)
+        return RESULT_ERROR;
+    }
+
+    free(tenants->template);
+    tenants->template = strdup(template);
+    if (tenants->template == NULL)
+    {
+        ERR_("Could not allocate MPD address template")
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+enum mpd_fnscroller_result
+tenants_run(struct mpd_fnscroller_tenants *tenants,
+            const struct mpd_fnscroller_format *format,
+            const struct mpd_fnscroller_cleanup *cleanup,
+            const struct mpd_fnscroller_scroll *scroll)
+{
+    enum mpd_fnscroller_result result = RESULT_SUCCESS;
+    struct epoll_event         event;
+
+    TRACE_()
+
+    syslog(LOG_INFO, PROGNAME " system daemon is started");
+
+    mpd_fnscroller_tenants = tenants;
+    tenants->format = format;
+    tenants->cleanup = cleanup;
+    tenants->scroll = scroll;
+
+    tenants->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    tenants->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((tenants->epoll_fd == -1) || (tenants->wakeup_fd == -1))
+    {
+        ERR_("Could not create epoll instance")
+        tenants_cleanup(tenants);
+        return RESULT_ERROR;
+    }
+// Wakeup descriptor is told apart from the tenants by the missing pointer
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if ((epoll_ctl(tenants->epoll_fd, EPOLL_CTL_ADD, tenants->wakeup_fd,
+                   &event) == -1) ||
+        (!tenants_listener_open(tenants)) ||
+        (!tenants_workers_start(tenants)))
+    {
+        tenants_cleanup(tenants);
+        return RESULT_ERROR;
+    }
+    signal(SIGUSR1, tenants_shutdown_handler);
+    signal(SIGTERM, tenants_shutdown_handler);
+
+    connection_pool_init(&tenant_connection_pool);
+    tenant_connection_pool.uid_connections_max = TENANT_CONNECTIONS_MAX;
+    while ((result == RESULT_SUCCESS) && (!tenants_shutdown_requested))
+    {
+        result = tenants_serve(tenants, &tenant_connection_pool);
+    }
+    connection_pool_close(&tenant_connection_pool);
+
+    tenants_cleanup(tenants);
+    return result;
+};
+
+
+// Only flags the shutdown: the loop cleans up once it is woken up
+static void tenants_shutdown_handler(int sig)
+{
+    int      saved_errno = errno;
+    uint64_t wakeup = 1;
+
+    (void)sig;
+    tenants_shutdown_requested = 1;
+    if (write(mpd_fnscroller_tenants->wakeup_fd, &wakeup,
+              sizeof(wakeup)) == -1)
+    {
+// Loop already woken up has the counter full, nothing is lost
+    }
+    errno = saved_errno;
+
+    return;
+};
+
+// Workers are joined first: no tenant is freed while a worker is inside one
+// of its MPD calls
+static void tenants_cleanup(struct mpd_fnscroller_tenants *tenants)
+{
+    unsigned int i = 0;
+
+    tenants_workers_stop(tenants);
+    tenants_jobs_done_handle(tenants);
+    for (i = 0; i < TENANTS_MAX; ++i)
+    {
+        if (tenants->tenants[i])
+        {
+            tenant_free(tenants, i);
+        }
+    }
+    if (tenants->sock_listener != -1)
+    {
+        close(tenants->sock_listener);
+        tenants->sock_listener = -1;
+        unlink(SYSTEM_SOCKFILE_PATH);
+    }
+    if (tenants->wakeup_fd != -1)
+    {
+        close(tenants->wakeup_fd);
+        tenants->wakeup_fd = -1;
+    }
+    if (tenants->epoll_fd != -1)
+    {
+        close(tenants->epoll_fd);
+        tenants->epoll_fd = -1;
+    }
+
+    return;
+};
+
+static enum mpd_fnscroller_result
+tenants_listener_open(struct mpd_fnscroller_tenants *tenants)
+{
+    struct sockaddr_un address;
+
+    if ((mkdir(SYSTEM_RUNTIME_DIR_PATH, 0755) == -1) && (errno != EEXIST))
+    {
+        ERR_("Could not create %s", SYSTEM_RUNTIME_DIR_PATH)
+        return RESULT_ERROR;
+    }
+
+    unlink(SYSTEM_SOCKFILE_PATH);
+    tenants->sock_listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                                    SOCK_CLOEXEC, 0);
+    if (tenants->sock_listener == -1)
+    {
+        ERR_("Issue creating server side socket")
+        return RESULT_ERROR;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, SYSTEM_SOCKFILE_PATH,
+            sizeof(address.sun_path) - 1);
+// Anyone may connect: who is served is told by the credentials of the peer
+    if ((bind(tenants->sock_listener, (struct sockaddr *)&address,
+              sizeof(address)) == -1) ||
+        (chmod(SYSTEM_SOCKFILE_PATH, 0666) == -1) ||
+        (listen(tenants->sock_listener, CONNECTION_BACKLOG) == -1))
+    {
+        ERR_("Issue listening on %s", SYSTEM_SOCKFILE_PATH)
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result
+tenants_workers_start(struct mpd_fnscroller_tenants *tenants)
+{
+    pthread_mutex_init(&tenants->jobs_lock, NULL);
+    pthread_cond_init(&tenants->jobs_cond, NULL);
+    for (tenants->workers_count = 0; tenants->workers_count < TENANT_WORKERS;
+         ++tenants->workers_count)
+    {
+        if (thread_create(&tenants->workers[tenants->workers_count],
+                          tenant_worker, tenants))
+        {
+            ERR_("Could not start the MPD workers")
+            return RESULT_ERROR;
+        }
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Job a worker is on is finished first, within TENANT_MPD_TIMEOUT; the jobs
+// still queued are handed back to the loop undone
+static void tenants_workers_stop(struct mpd_fnscroller_tenants *tenants)
+{
+    struct mpd_fnscroller_tenant *tenant;
+    unsigned int                 i = 0;
+
+    if (!tenants->workers_count)
+    {
+        return;
+    }
+    pthread_mutex_lock(&tenants->jobs_lock);
+    tenants->stopping = true;
+    pthread_cond_broadcast(&tenants->jobs_cond);
+    pthread_mutex_unlock(&tenants->jobs_lock);
+    for (i = 0; i < tenants->workers_count; ++i)
+    {
+        pthread_join(tenants->workers[i], NULL);
+    }
+    tenants->workers_count = 0;
+
+    while (tenants->jobs)
+    {
+        tenant = tenants->jobs;
+        tenants->jobs = tenant->next;
+        tenant->job_result = false;
+        tenant->next = tenants->done;
+        tenants->done = tenant;
+    }
+    tenants->jobs_tail = &tenants->jobs;
+    pthread_mutex_destroy(&tenants->jobs_lock);
+    pthread_cond_destroy(&tenants->jobs_cond);
+
+    return;
+};
+
+// One iteration of the loop: the MPD connections of all the tenants and the
+// wakeup descriptor are behind the epoll descriptor taking the wakeup slot of
+// the pool
+static enum mpd_fnscroller_result
+tenants_serve(struct mpd_fnscroller_tenants *tenants,
+              struct connection_pool *pool)
+{
+    struct mpd_fnscroller_connection *connection;
+    enum connection_io_result        io_result;
+    unsigned int                     i = 0;
+    short                            revents = 0;
+
+    if (connection_pool_poll(pool, tenants->sock_listener,
+                             tenants->epoll_fd) == -1)
+    {
+        if (errno == EINTR)
+        {
+            return RESULT_SUCCESS;
+        }
+
+        ERR_("Issue polling connections")
+        return RESULT_ERROR;
+    }
+
+    if (pool->pollfds[0].revents & (POLLERR | POLLNVAL))
+    {
+        ERR_("Issue with sock_listener")
+        return RESULT_ERROR;
+    }
+    if ((pool->pollfds[0].revents & POLLIN) &&
+        (!connection_accept(pool, tenants->sock_listener)))
+    {
+        return RESULT_ERROR;
+    }
+    if (pool->pollfds[CONNECTION_POLLFD_WAKEUP].revents & POLLIN)
+    {
+        tenants_events_handle(tenants);
+    }
+
+    for (i = 0; i < CONNECTION_SLOTS; ++i)
+    {
+        connection = &pool->connections[i];
+        revents = pool->pollfds[i + 1].revents;
+        if ((connection->state == CONNECTION_FREE) || (!revents))
+        {
+            continue;
+        }
+        if (revents & (POLLERR | POLLNVAL))
+        {
+            connection_close(pool, connection);
+            continue;
+        }
+
+        if (connection->state == CONNECTION_READING)
+        {
+            io_result = connection_read(connection);
+            if (io_result == CONNECTION_IO_PENDING)
+            {
+                continue;
+            }
+            if ((io_result == CONNECTION_IO_ERROR) ||
+                (!tenant_request_handle(tenants, connection)))
+            {
+                TRACEPOINT_("Dropping connection %lld: bad request",
+                            connection->sock, 0)
+                connection_close(pool, connection);
+                continue;
+            }
+        }
+
+        io_result = connection_write(connection);
+        if (io_result != CONNECTION_IO_PENDING)
+        {
+            connection_close(pool, connection);
+        }
+    }
+
+    connection_pool_expire(pool);
+
+    return RESULT_SUCCESS;
+};
+
+// Tenants whose MPD has something to tell are handed over to the workers,
+// the tenants the workers are done with are taken back
+static void tenants_events_handle(struct mpd_fnscroller_tenants *tenants)
+{
+    struct epoll_event           events[TENANT_EVENTS_MAX];
+    struct mpd_fnscroller_tenant *tenant;
+    uint64_t                     wakeup = 0;
+    int                          count = 0;
+    int                          i = 0;
+
+    count = epoll_wait(tenants->epoll_fd, events, TENANT_EVENTS_MAX, 0);
+    for (i = 0; i < count; ++i)
+    {
+        tenant = events[i].data.ptr;
+        if (tenant == NULL)
+        {
+            if ((read(tenants->wakeup_fd, &wakeup, sizeof(wakeup)) == -1) &&
+                (errno != EAGAIN))
+            {
+                ERR_("Issue reading wakeup_fd")
+            }
+            tenants_jobs_done_handle(tenants);
+            continue;
+        }
+        TRACEPOINT_("MPD event of uid %lld", tenant->uid, 0)
+        tenant_job_queue(tenants, tenant);
+    }
+
+    return;
+};
+
+// MPD connection is watched again once its job is done: it is registered
+// with EPOLLONESHOT, so that no event comes while a worker is reading it
+static void tenants_jobs_done_handle(struct mpd_fnscroller_tenants *tenants)
+{
+    struct mpd_fnscroller_tenant *tenant;
+    struct mpd_fnscroller_tenant *done;
+    struct epoll_event           event;
+    int                          op = EPOLL_CTL_MOD;
+
+    if (tenants->workers_count)
+    {
+        pthread_mutex_lock(&tenants->jobs_lock);
+    }
+    done = tenants->done;
+    tenants->done = NULL;
+    if (tenants->workers_count)
+    {
+        pthread_mutex_unlock(&tenants->jobs_lock);
+    }
+
+    while (done)
+    {
+        tenant = done;
+        done = tenant->next;
+        tenant->next = NULL;
+        tenant->busy = false;
+        if (tenant->dropped)
+        {
+            tenant_destroy(tenants, tenant);
+            continue;
+        }
+        if (!tenant->job_result)
+        {
+            if (tenant->connected)
+            {
+                syslog(LOG_WARNING, "Lost the MPD connection of uid %u",
+                       tenant->uid);
+                tenant_disconnect(tenants, tenant);
+            }
+            tenant->retry_time = monotonic_time_get() + TENANT_RETRY_MS;
+            continue;
+        }
+
+        op = tenant->connected ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = tenant;
+        if (epoll_ctl(tenants->epoll_fd, op,
+                      mpd_connection_get_fd(tenant->source.connection),
+                      &event) == -1)
+        {
+            ERR_("Could not follow the MPD of uid %u", tenant->uid)
+            tenant_disconnect(tenants, tenant);
+            tenant->retry_time = monotonic_time_get() + TENANT_RETRY_MS;
+            continue;
+        }
+        if (!tenant->connected)
+        {
+            DEBUG_("Following the MPD of uid %u", tenant->uid)
+        }
+        tenant->connected = true;
+    }
+
+    return;
+};
+
+// Only the frames are served: history, queue and waiters belong to the
+// servers of the users
+static enum mpd_fnscroller_result
+tenant_request_handle(struct mpd_fnscroller_tenants *tenants,
+                      struct mpd_fnscroller_connection *connection)
+{
+    struct mpd_fnscroller_tenant *tenant;
+    unsigned long long           now = monotonic_time_get();
+    unsigned int                 client_msg = 0;
+
+    memcpy(&client_msg, connection->request, sizeof(unsigned int));
+    TRACEPOINT_("request type: %lld; arg: %lld", REQUEST_TYPE(client_msg),
+                REQUEST_ARG(client_msg))
+
+    if (REQUEST_TYPE(client_msg) != REQUEST_FRAME)
+    {
+        ERR_("Request %u is not served by the system daemon",
+             REQUEST_TYPE(client_msg))
+        return RESULT_ERROR;
+    }
+    tenant = tenant_get(tenants, connection->uid, connection->gid, now);
+    if (tenant == NULL)
+    {
+        return RESULT_ERROR;
+    }
+
+// Requests beyond the rate of the tenant are dropped: no user takes the loop
+// over from the others
+    if (now - tenant->window_start >= 1000)
+    {
+        tenant->window_start = now;
+        tenant->window_requests = 0;
+    }
+    if (++tenant->window_requests > TENANT_REQUESTS_PER_SECOND)
+    {
+        TRACEPOINT_("uid %lld is over its request rate", tenant->uid, 0)
+        return RESULT_ERROR;
+    }
+    tenant->last_request = now;
+
+    if ((!tenant->connected) && (!tenant->busy) && (now >= tenant->retry_time))
+    {
+        tenant_job_queue(tenants, tenant);
+    }
+
+    pthread_mutex_lock(&tenant->lock);
+    if (!tenant_frame_handle(tenant, connection, REQUEST_ARG(client_msg),
+                             now))
+    {
+        pthread_mutex_unlock(&tenant->lock);
+        return RESULT_ERROR;
+    }
+    pthread_mutex_unlock(&tenant->lock);
+
+    connection->output_offset = 0;
+    connection->state = CONNECTION_WRITING;
+    connection->deadline = now + CONNECTION_TIMEOUT_MS;
+
+    return RESULT_SUCCESS;
+};
+
+// Tenants not heard from for TENANT_IDLE_TIMEOUT_MS are dropped on the way,
+// with their MPD connections
+static struct mpd_fnscroller_tenant *
+tenant_get(struct mpd_fnscroller_tenants *tenants, uid_t uid, gid_t gid,
+           unsigned long long now)
+{
+    struct mpd_fnscroller_tenant *tenant = NULL;
+    char                         address[TENANT_ADDRESS_SIZE];
+    unsigned int                 slot = TENANTS_MAX;
+    unsigned int                 i = 0;
+
+    for (i = 0; i < TENANTS_MAX; ++i)
+    {
+        tenant = tenants->tenants[i];
+        if ((tenant) && (tenant->uid == uid))
+        {
+            return tenant;
+        }
+        if ((tenant) && (now - tenant->last_request >= TENANT_IDLE_TIMEOUT_MS))
+        {
+            DEBUG_("Dropping idle tenant uid %u", tenant->uid)
+            tenant_free(tenants, i);
+        }
+        if ((tenants->tenants[i] == NULL) && (slot == TENANTS_MAX))
+        {
+            slot = i;
+        }
+    }
+    if (slot == TENANTS_MAX)
+    {
+        syslog(LOG_WARNING, "Too many tenants; uid %u is not served", uid);
+        return NULL;
+    }
+
+    tenant = calloc(1, sizeof(*tenant));
+    if (tenant == NULL)
+    {
+        ERR_("Could not allocate tenant")
+        return NULL;
+    }
+    tenant->uid = uid;
+    tenant->gid = gid;
+    if ((!source_init(&tenant->source)) ||
+        (!tenant_address_get(tenants->template, uid, address,
+                             TENANT_ADDRESS_SIZE)) ||
+        (!source_address_parse(&tenant->source, address)))
+    {
+        ERR_("Could not set the MPD address of uid %u", uid)
+        free(tenant->source.path);
+        free(tenant);
+        return NULL;
+    }
+    tenant->source.timeout = TENANT_MPD_TIMEOUT;
+// Scrolling options are the ones set with -m, the title is empty so far
+    pthread_mutex_init(&tenant->lock, NULL);
+    tenant->scroll = *tenants->scroll;
+    tenant->mpd_state = MPD_STATE_UNKNOWN;
+    playtime_set(&tenant->playtime, false, 0, 0, 0);
+
+    tenants->tenants[slot] = tenant;
+    ++tenants->count;
+    syslog(LOG_INFO, "Serving uid %u (%u tenants)", uid, tenants->count);
+
+    return tenant;
+};
+
+// Tenant a worker is busy with is freed once the job is done
+static void tenant_free(struct mpd_fnscroller_tenants *tenants,
+                        unsigned int index)
+{
+    struct mpd_fnscroller_tenant *tenant = tenants->tenants[index];
+
+    tenants->tenants[index] = NULL;
+    --tenants->count;
+    if (tenant->busy)
+    {
+        tenant->dropped = true;
+        return;
+    }
+    tenant_destroy(tenants, tenant);
+
+    return;
+};
+
+static void tenant_destroy(struct mpd_fnscroller_tenants *tenants,
+                           struct mpd_fnscroller_tenant *tenant)
+{
+    if (tenant->connected)
+    {
+        tenant_disconnect(tenants, tenant);
+    }
+    pthread_mutex_destroy(&tenant->lock);
+    free(tenant->source.path);
+    free(tenant);
+
+    return;
+};
+
+static enum mpd_fnscroller_result
+tenant_address_get(const char *template, uid_t uid, char *buf, size_t size)
+{
+    struct passwd *passwd_buffer = NULL;
+    size_t        length = 0;
+    int           written = 0;
+
+    for (; *template != '\0'; ++template)
+    {
+        if (*template != '%')
+        {
+            written = snprintf(buf + length, size - length, "%c", *template);
+        }
+        else if (*++template == 'u')
+        {
+            written = snprintf(buf + length, size - length, "%u", uid);
+        }
+        else if (*template == 'n')
+        {
+            passwd_buffer = getpwuid(uid);
+            if (passwd_buffer == NULL)
+            {
+                ERR_("No user name for uid %u", uid)
+                return RESULT_ERROR;
+            }
+            written = snprintf(buf + length, size - length, "%s",
+                               passwd_buffer->pw_name);
+        }
+        else if (*template == '%')
+        {
+            written = snprintf(buf + length, size - length, "%%");
+        }
+        else
+        {
+            ERR_("Unknown template conversion: %%%c", *template)
+            return RESULT_ERROR;
+        }
+
+        length += written;
+        if (length >= size)
+        {
+            ERR_("MPD address of uid %u is too long", uid)
+            return RESULT_ERROR;
+        }
+    }
+    buf[length] = '\0';
+
+    return RESULT_SUCCESS;
+};
+
+// Tenant belongs to the worker from the time it is queued until it is handed
+// back: the loop does not touch its MPD connection in between
+static void tenant_job_queue(struct mpd_fnscroller_tenants *tenants,
+                             struct mpd_fnscroller_tenant *tenant)
+{
+    tenant->busy = true;
+    tenant->next = NULL;
+
+    pthread_mutex_lock(&tenants->jobs_lock);
+    *tenants->jobs_tail = tenant;
+    tenants->jobs_tail = &tenant->next;
+    pthread_cond_signal(&tenants->jobs_cond);
+    pthread_mutex_unlock(&tenants->jobs_lock);
+
+    return;
+};
+
+static void tenant_job_done(struct mpd_fnscroller_tenants *tenants,
+                            struct mpd_fnscroller_tenant *tenant)
+{
+    uint64_t wakeup = 1;
+
+    pthread_mutex_lock(&tenants->jobs_lock);
+    tenant->next = tenants->done;
+    tenants->done = tenant;
+    pthread_mutex_unlock(&tenants->jobs_lock);
+    if (write(tenants->wakeup_fd, &wakeup, sizeof(wakeup)) == -1)
+    {
+// Loop already woken up has the counter full, nothing is lost
+    }
+
+    return;
+};
+
+// Worker makes the MPD calls which may block: a tenant without a connection
+// is connected, a tenant with one has an event to be read
+static void *tenant_worker(void *arg)
+{
+    struct mpd_fnscroller_tenants *tenants = arg;
+    struct mpd_fnscroller_tenant  *tenant;
+// Song is large: a single buffer serves all the jobs of the worker
+    struct source_song            *song = malloc(sizeof(*song));
+
+    if (song == NULL)
+    {
+        ERR_("Could not allocate the song of an MPD worker")
+        return NULL;
+    }
+
+    pthread_mutex_lock(&tenants->jobs_lock);
+    while (!tenants->stopping)
+    {
+        tenant = tenants->jobs;
+        if (tenant == NULL)
+        {
+            pthread_cond_wait(&tenants->jobs_cond, &tenants->jobs_lock);
+            continue;
+        }
+        tenants->jobs = tenant->next;
+        if (tenants->jobs == NULL)
+        {
+            tenants->jobs_tail = &tenants->jobs;
+        }
+        pthread_mutex_unlock(&tenants->jobs_lock);
+
+        tenant->job_result = tenant->connected ?
+                             tenant_event_handle(tenants, tenant, song) :
+                             tenant_connect(tenants, tenant, song);
+        tenant_job_done(tenants, tenant);
+
+        pthread_mutex_lock(&tenants->jobs_lock);
+    }
+    pthread_mutex_unlock(&tenants->jobs_lock);
+
+    free(song);
+    return NULL;
+};
+
+// Socket of the MPD is reached with the file permissions of the user
+// (privileged daemon only): no one gets to the player of someone else through
+// the daemon. They are set for the calling thread only.
+static enum mpd_fnscroller_result
+tenant_connect(struct mpd_fnscroller_tenants *tenants,
+               struct mpd_fnscroller_tenant *tenant,
+               struct source_song *song)
+{
+    enum mpd_fnscroller_result result = RESULT_ERROR;
+    bool                       privileged = (geteuid() == 0);
+    gid_t                      gid = getegid();
+
+    if (privileged)
+    {
+        setfsgid(tenant->gid);
+        setfsuid(tenant->uid);
+    }
+    result = source_open(&tenant->source);
+    if (privileged)
+    {
+        setfsuid(0);
+        setfsgid(gid);
+    }
+    if (!result)
+    {
+        return RESULT_ERROR;
+    }
+
+    if ((!tenant_peer_check(tenant)) ||
+        (!tenant_player_update(tenants, tenant, song)) ||
+        (!mpd_send_idle_mask(tenant->source.connection, MPD_IDLE_PLAYER)))
+    {
+        ERR_("Could not follow the MPD of uid %u", tenant->uid)
+        source_close(&tenant->source);
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result
+tenant_event_handle(struct mpd_fnscroller_tenants *tenants,
+                    struct mpd_fnscroller_tenant *tenant,
+                    struct source_song *song)
+{
+    struct mpd_connection *connection = tenant->source.connection;
+
+    if (((!mpd_recv_idle(connection, true)) &&
+         (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS)) ||
+        (!tenant_player_update(tenants, tenant, song)) ||
+        (!mpd_send_idle_mask(connection, MPD_IDLE_PLAYER)))
+    {
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Title of a player which is gone is not shown any more
+static void tenant_disconnect(struct mpd_fnscroller_tenants *tenants,
+                              struct mpd_fnscroller_tenant *tenant)
+{
+    epoll_ctl(tenants->epoll_fd, EPOLL_CTL_DEL,
+              mpd_connection_get_fd(tenant->source.connection), NULL);
+    source_close(&tenant->source);
+    tenant->connected = false;
+
+    pthread_mutex_lock(&tenant->lock);
+    tenant->mpd_state = MPD_STATE_UNKNOWN;
+    tenant->title[0] = '\0';
+    tenant_string_set(tenant);
+    pthread_mutex_unlock(&tenant->lock);
+
+    return;
+};
+
+// MPD listening on a local socket has to run as the tenant: a socket path
+// leading elsewhere (a symbolic link, say) is not followed
+static enum mpd_fnscroller_result
+tenant_peer_check(struct mpd_fnscroller_tenant *tenant)
+{
+    struct ucred credentials;
+    socklen_t    length = sizeof(credentials);
+
+    if (tenant->source.host[0] != '/')
+    {
+        return RESULT_SUCCESS;
+    }
+    if (getsockopt(mpd_connection_get_fd(tenant->source.connection),
+                   SOL_SOCKET, SO_PEERCRED, &credentials, &length) == -1)
+    {
+        ERR_("Could not get the credentials of the MPD of uid %u",
+             tenant->uid)
+        return RESULT_ERROR;
+    }
+    if (credentials.uid != tenant->uid)
+    {
+        syslog(LOG_WARNING, "MPD at %s runs as uid %u, not as uid %u",
+               tenant->source.host, credentials.uid, tenant->uid);
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Title is rendered before the lock is taken: the loop only waits for the
+// copy
+static enum mpd_fnscroller_result
+tenant_player_update(struct mpd_fnscroller_tenants *tenants,
+                     struct mpd_fnscroller_tenant *tenant,
+                     struct source_song *song)
+{
+    struct source_status source_status;
+    unsigned long long   status_time = 0;
+    char                 title[FILENAME_STRING_SIZE];
+
+    memset(title, '\0', FILENAME_STRING_SIZE);
+
+    if (!source_status_get(&tenant->source, &source_status, song))
+    {
+        ERR_("Could not receive the player status of uid %u", tenant->uid)
+        return RESULT_ERROR;
+    }
+    status_time = monotonic_time_get();
+
+    switch (source_status.state)
+    {
+        case MPD_STATE_PAUSE:
+
+        case MPD_STATE_PLAY:
+            format_render(tenants->format, song, title,
+                          FILENAME_STRING_SIZE);
+            cleanup_apply(tenants->cleanup, title, FILENAME_STRING_SIZE);
+            break;
+
+        case MPD_STATE_STOP:
+            snprintf(title, FILENAME_STRING_SIZE, "STOP");
+            break;
+
+        default:
+            ERR_("MPD_STATE_UNKNOWN")
+            return RESULT_ERROR;
+    }
+
+    pthread_mutex_lock(&tenant->lock);
+    tenant->mpd_state = source_status.state;
+    playtime_set(&tenant->playtime, source_status.state == MPD_STATE_PLAY,
+                 source_status.elapsed_ms, source_status.duration_ms,
+                 status_time);
+// Title which could not be scrolled is left empty, the player is followed on
+    if (strcmp(tenant->title, title))
+    {
+        memcpy(tenant->title, title, FILENAME_STRING_SIZE);
+        tenant_string_set(tenant);
+    }
+    pthread_mutex_unlock(&tenant->lock);
+
+    return RESULT_SUCCESS;
+};
+
+// Every width starts over with the new title
+static void tenant_string_set(struct mpd_fnscroller_tenant *tenant)
+{
+    unsigned int i = 0;
+
+    scroll_string_set(&tenant->scroll, tenant->title);
+    for (i = 0; i < TENANT_WIDTHS; ++i)
+    {
+        tenant->widths[i].position = 0;
+    }
+
+    return;
+};
+
+// Width not asked for yet takes the place of the one asked for least recently
+static struct tenant_width *
+tenant_width_get(struct mpd_fnscroller_tenant *tenant, unsigned int wcbufsize,
+                 unsigned long long now)
+{
+    struct tenant_width *width = &tenant->widths[0];
+    unsigned int        i = 0;
+
+    for (i = 0; i < TENANT_WIDTHS; ++i)
+    {
+        if (tenant->widths[i].wcbufsize == wcbufsize)
+        {
+            width = &tenant->widths[i];
+            break;
+        }
+        if (tenant->widths[i].last_request < width->last_request)
+        {
+            width = &tenant->widths[i];
+        }
+    }
+    if (width->wcbufsize != wcbufsize)
+    {
+        width->wcbufsize = wcbufsize;
+        width->position = 0;
+    }
+    width->last_request = now;
+
+    return width;
+};
+
+// Scroller is shared by all the widths, only the position is kept per width
+static enum mpd_fnscroller_result
+tenant_frame_handle(struct mpd_fnscroller_tenant *tenant,
+                    struct mpd_fnscroller_connection *connection,
+                    unsigned int frame_arg, unsigned long long now)
+{
+    wchar_t                      *frame = NULL;
+    struct tenant_width          *width = NULL;
+    unsigned int                 wcbufsize = REQUEST_FRAME_WIDTH(frame_arg);
+    enum mpd_fnscroller_progress progress = REQUEST_FRAME_PROGRESS(frame_arg);
+    enum mpd_fnscroller_result   result = RESULT_SUCCESS;
+
+    if ((!wcbufsize) || (wcbufsize > FILENAME_WCHAR_STRING_SIZE))
+    {
+        ERR_("Invalid frame width: %u", wcbufsize)
+        return RESULT_ERROR;
+    }
+    if (progress >= PROGRESS_COUNT)
+    {
+        ERR_("Invalid frame progress: %u", progress)
+        return RESULT_ERROR;
+    }
+
+    width = tenant_width_get(tenant, wcbufsize, now);
+    tenant->scroll.position = width->position;
+    if (frame_arg & REQUEST_FRAME_JSON)
+    {
+        result = tenant_json_frame_handle(tenant, connection, wcbufsize,
+                                          progress);
+        width->position = tenant->scroll.position;
+        return result;
+    }
+
+    frame = (wchar_t *)connection->output_buffer;
+    scroll_frame_get(&tenant->scroll, frame, wcbufsize);
+    width->position = tenant->scroll.position;
+// Plain frames keep their fixed size for the older clients
+    if (progress != PROGRESS_NONE)
+    {
+        if (tenant->mpd_state != MPD_STATE_STOP)
+        {
+            progress_render(&tenant->playtime, progress, monotonic_time_get(),
+                            frame + wcslen(frame), PROGRESS_STRING_SIZE);
+        }
+        wcbufsize = wcslen(frame) + 1;
+    }
+    connection->output = connection->output_buffer;
+    connection->output_length = wcbufsize * sizeof(wchar_t);
+
+    return RESULT_SUCCESS;
+};
+
+static enum mpd_fnscroller_result
+tenant_json_frame_handle(struct mpd_fnscroller_tenant *tenant,
+                         struct mpd_fnscroller_connection *connection,
+                         unsigned int wcbufsize,
+                         enum mpd_fnscroller_progress progress)
+{
+    wchar_t    progress_wcstring[PROGRESS_STRING_SIZE];
+    char       progress_string[PROGRESS_STRING_SIZE * MB_LEN_MAX];
+    const char *color = NULL;
+    char       *output = NULL;
+
+    output = connection_output_reserve(connection, JSON_OUTPUT_SIZE);
+    if (output == NULL)
+    {
+        return RESULT_ERROR;
+    }
+    progress_wcstring[0] = L'\0';
+    progress_string[0] = '\0';
+
+    if (tenant->mpd_state == MPD_STATE_STOP)
+    {
+        color = JSON_COLOR_STOP;
+    }
+    else
+    {
+        if (tenant->mpd_state == MPD_STATE_PAUSE)
+        {
+            color = JSON_COLOR_PAUSE;
+        }
+        if (progress != PROGRESS_NONE)
+        {
+            progress_render(&tenant->playtime, progress, monotonic_time_get(),
+                            progress_wcstring, PROGRESS_STRING_SIZE);
+            mpdfnscroller_utf8_encode(progress_wcstring, PROGRESS_STRING_SIZE,
+                                      progress_string,
+                                      sizeof(progress_string));
+        }
+    }
+    connection->output_length = scroll_json_frame_get(&tenant->scroll,
+                                                      wcbufsize,
+                                                      progress_string, color,
+                                                      output,
+                                                      JSON_OUTPUT_SIZE);
+
+    return RESULT_SUCCESS;
+};
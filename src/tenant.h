@@ -0,0 +1,137 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TENANT_H
+#define TENANT_H
+
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <mpd/client.h>
+
+#include "mpd-fnscroller.h"
+#include "format.h"
+#include "cleanup.h"
+#include "scroll.h"
+#include "progress.h"
+#include "source.h"
+
+
+
+
+#define TENANT_TEMPLATE_DEFAULT    "/run/user/%u/mpd/socket"
+#define TENANT_ADDRESS_SIZE        (PATH_STRING_SIZE + 8)
+#define TENANTS_MAX                256
+#define TENANT_MPD_TIMEOUT         2
+#define TENANT_RETRY_MS            5000
+#define TENANT_IDLE_TIMEOUT_MS     (10 * 60 * 1000)
+#define TENANT_REQUESTS_PER_SECOND 32
+#define TENANT_CONNECTIONS_MAX     4
+#define TENANT_EVENTS_MAX          16
+#define TENANT_WORKERS             4
+#define TENANT_WIDTHS              4
+
+
+// Scrolling position of the frames of a single width: the bars of a user may
+// ask for several at a time
+struct tenant_width
+{
+    unsigned int       wcbufsize;
+    unsigned int       position;
+    unsigned long long last_request;
+};
+
+// Player and scrolling state of a single user of the system daemon. It is
+// all there is per user: a tenant costs its MPD connection and this
+// structure, not a process or a thread of its own. The MPD calls of the
+// tenant are made by a worker while the tenant is busy; the title is shared
+// with the event loop under the lock.
+struct mpd_fnscroller_tenant
+{
+    uid_t                          uid;
+    gid_t                          gid;
+
+    struct mpd_fnscroller_source   source;
+    bool                           connected;
+    bool                           busy;
+    bool                           dropped;
+    bool                           job_result;
+    struct mpd_fnscroller_tenant   *next;
+    unsigned long long             retry_time;
+
+    pthread_mutex_t                lock;
+    char                           title[FILENAME_STRING_SIZE];
+    struct mpd_fnscroller_scroll   scroll;
+    struct tenant_width            widths[TENANT_WIDTHS];
+    enum mpd_state                 mpd_state;
+    struct mpd_fnscroller_playtime playtime;
+
+    unsigned long long             last_request;
+    unsigned long long             window_start;
+    unsigned int                   window_requests;
+};
+
+// System daemon: a single event loop serves the requests of every user, told
+// apart by the credentials of the peer, and follows the MPD of each of them
+// through epoll. The calls to an MPD which may block (connecting, taking the
+// status) are handed over to TENANT_WORKERS threads: an MPD slow to answer
+// holds up a worker for TENANT_MPD_TIMEOUT at most, never the frames of the
+// others. Format, cleanup rules and scrolling options are shared by all the
+// tenants.
+struct mpd_fnscroller_tenants
+{
+    char                                *template;
+    const struct mpd_fnscroller_format  *format;
+    const struct mpd_fnscroller_cleanup *cleanup;
+    const struct mpd_fnscroller_scroll  *scroll;
+
+    struct mpd_fnscroller_tenant        *tenants[TENANTS_MAX];
+    unsigned int                        count;
+    int                                 epoll_fd;
+    int                                 wakeup_fd;
+    int                                 sock_listener;
+
+    pthread_t                           workers[TENANT_WORKERS];
+    unsigned int                        workers_count;
+    pthread_mutex_t                     jobs_lock;
+    pthread_cond_t                      jobs_cond;
+    struct mpd_fnscroller_tenant        *jobs;
+    struct mpd_fnscroller_tenant        **jobs_tail;
+    struct mpd_fnscroller_tenant        *done;
+    bool                                stopping;
+};
+
+void tenants_init(struct mpd_fnscroller_tenants *tenants);
+enum mpd_fnscroller_result
+tenants_template_set(struct mpd_fnscroller_tenants *tenants,
+                     const char *template);
+enum mpd_fnscroller_result
+tenants_run(struct mpd_fnscroller_tenants *tenants,
+            const struct mpd_fnscroller_format *format,
+            const struct mpd_fnscroller_cleanup *cleanup,
+            const struct mpd_fnscroller_scroll *scroll);
+
+
+#endif /* TENANT_H */
@@ -0,0 +1,217 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "mpd-fnscroller.h"
+#include "trace.h"
+
+
+
+
+// Every thread writes into a ring of its own, so recording takes neither locks
+// nor system calls. Formatting is postponed until the ring is dumped: only the
+// static format string and two integer arguments are stored.
+struct trace_entry
+{
+    atomic_ulong       sequence;
+    unsigned long long timestamp;
+    const char         *function;
+    unsigned int       line;
+    const char         *format;
+    long long          args[2];
+};
+
+struct trace_ring
+{
+    pid_t              tid;
+    atomic_ulong       head;
+    struct trace_entry entries[TRACE_RING_SIZE];
+};
+
+
+static struct trace_ring         trace_rings[TRACE_THREADS_MAX];
+static atomic_uint               trace_rings_count = 0;
+static __thread struct trace_ring *trace_ring = NULL;
+static __thread bool             trace_ring_unavailable = false;
+
+
+static struct trace_ring *trace_ring_get(void);
+static size_t trace_ring_dump(struct trace_ring *ring, char *buffer,
+                              size_t size);
+
+
+void trace_record(const char *function, unsigned int line, const char *format,
+                  long long arg0, long long arg1)
+{
+    struct trace_ring  *ring = trace_ring_get();
+    struct trace_entry *entry;
+    struct timespec    now;
+    unsigned long      head = 0;
+
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    entry = &ring->entries[head % TRACE_RING_SIZE];
+
+// Odd sequence marks the entry which is being written at the moment
+    atomic_store_explicit(&entry->sequence, 2 * head + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    entry->timestamp = (unsigned long long)now.tv_sec * 1000000000 +
+                       now.tv_nsec;
+    entry->function = function;
+    entry->line = line;
+    entry->format = format;
+    entry->args[0] = arg0;
+    entry->args[1] = arg1;
+    atomic_store_explicit(&entry->sequence, 2 * head + 2,
+                          memory_order_release);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return;
+};
+
+// Renders the rings of all the threads into the buffer. It is safe to do
+// while they are still being written: overwritten entries are skipped.
+size_t trace_dump(char *buffer, size_t size)
+{
+    unsigned int rings_count = 0;
+    unsigned int i = 0;
+    size_t       length = 0;
+
+    rings_count = atomic_load_explicit(&trace_rings_count,
+                                       memory_order_acquire);
+    if (rings_count > TRACE_THREADS_MAX)
+    {
+        rings_count = TRACE_THREADS_MAX;
+    }
+
+    for (i = 0; i < rings_count; ++i)
+    {
+        length += trace_ring_dump(&trace_rings[i], buffer + length,
+                                  size - length);
+    }
+
+    return length;
+};
+
+
+static struct trace_ring *trace_ring_get(void)
+{
+    unsigned int index = 0;
+
+    if ((trace_ring) || (trace_ring_unavailable))
+    {
+        return trace_ring;
+    }
+
+    index = atomic_fetch_add_explicit(&trace_rings_count, 1,
+                                      memory_order_acq_rel);
+    if (index >= TRACE_THREADS_MAX)
+    {
+        trace_ring_unavailable = true;
+        return NULL;
+    }
+
+    trace_ring = &trace_rings[index];
+    trace_ring->tid = syscall(SYS_gettid);
+
+    return trace_ring;
+};
+
+static size_t trace_ring_dump(struct trace_ring *ring, char *buffer,
+                              size_t size)
+{
+    struct trace_entry entry;
+    char               line[TRACE_LINE_SIZE];
+    unsigned long      head = 0;
+    unsigned long      position = 0;
+    unsigned long      sequence = 0;
+    size_t             length = 0;
+    int                written = 0;
+
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    position = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+
+    for (; (position < head) && (size - length > TRACE_LINE_SIZE); ++position)
+    {
+        struct trace_entry *source = &ring->entries[position %
+                                                    TRACE_RING_SIZE];
+
+        sequence = atomic_load_explicit(&source->sequence,
+                                        memory_order_acquire);
+        entry.timestamp = source->timestamp;
+        entry.function = source->function;
+        entry.line = source->line;
+        entry.format = source->format;
+        entry.args[0] = source->args[0];
+        entry.args[1] = source->args[1];
+        atomic_thread_fence(memory_order_acquire);
+        if ((sequence != 2 * position + 2) ||
+            (atomic_load_explicit(&source->sequence, memory_order_relaxed) !=
+             sequence))
+        {
+            continue;
+        }
+
+        written = snprintf(line, TRACE_LINE_SIZE, "%llu.%09llu [%d] %s():%u",
+                           entry.timestamp / 1000000000,
+                           entry.timestamp % 1000000000, ring->tid,
+                           entry.function, entry.line);
+        if ((entry.format) && (written > 0) && (written < TRACE_LINE_SIZE - 2))
+        {
+            line[written++] = ' ';
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+            snprintf(line + written, TRACE_LINE_SIZE - written, entry.format,
+                     entry.args[0], entry.args[1]);
+#pragma GCC diagnostic pop
+        }
+        line[TRACE_LINE_SIZE - 2] = '\0';
+
+        written = strlen(line);
+        memcpy(buffer + length, line, written);
+        length += written;
+        buffer[length++] = '\n';
+    }
+
+    return length;
+};
@@ -0,0 +1,620 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) &&         \
+    (__SIZEOF_WCHAR_T__ == 4)
+#define MPDFNSCROLLER_UTF8_X86
+#include <immintrin.h>
+#endif /* __SSE2__ */
+
+#include "utf8.h"
+
+
+
+
+#define MPDFNSCROLLER_UTF8_ZWJ              0x200d
+#define MPDFNSCROLLER_UTF8_REGIONAL_FIRST   0x1f1e6
+#define MPDFNSCROLLER_UTF8_REGIONAL_LAST    0x1f1ff
+#define MPDFNSCROLLER_UTF8_CODEPOINT_MAX    0x10ffff
+#define MPDFNSCROLLER_UTF8_SURROGATE_FIRST  0xd800
+#define MPDFNSCROLLER_UTF8_SURROGATE_LAST   0xdfff
+
+
+enum mpdfnscroller_utf8_class
+{
+    MPDFNSCROLLER_UTF8_NARROW = 0,
+    MPDFNSCROLLER_UTF8_WIDE,
+    MPDFNSCROLLER_UTF8_EXTEND,
+    MPDFNSCROLLER_UTF8_CLASS_COUNT
+};
+
+struct mpdfnscroller_utf8_range
+{
+    uint32_t                      first;
+    uint32_t                      last;
+    enum mpdfnscroller_utf8_class class;
+};
+
+// Code points other than one column wide starting a grapheme cluster of
+// their own. Extending ones are the combining marks and the others attached
+// to the preceding code point: no column, never a cluster start. Wide ones
+// are East Asian wide and fullwidth characters and the emoji shown as such.
+// Main scripts only, the rest is shown one column wide.
+static const struct mpdfnscroller_utf8_range mpdfnscroller_utf8_ranges[] =
+{
+    {0x0300, 0x036f, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0483, 0x0489, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0591, 0x05bd, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x05bf, 0x05bf, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x05c1, 0x05c2, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x05c4, 0x05c5, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x05c7, 0x05c7, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0610, 0x061a, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x064b, 0x065f, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0670, 0x0670, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x06d6, 0x06dc, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x06df, 0x06e4, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x06e7, 0x06e8, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x06ea, 0x06ed, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0711, 0x0711, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0730, 0x074a, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x07a6, 0x07b0, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0900, 0x0902, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x093a, 0x093a, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x093c, 0x093c, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0941, 0x0948, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x094d, 0x094d, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0951, 0x0957, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0962, 0x0963, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0981, 0x0981, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x09bc, 0x09bc, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x09c1, 0x09c4, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x09cd, 0x09cd, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0a01, 0x0a02, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0a3c, 0x0a3c, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0a41, 0x0a51, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0a70, 0x0a71, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0e31, 0x0e31, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0e34, 0x0e3a, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0e47, 0x0e4e, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0eb1, 0x0eb1, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0eb4, 0x0ebc, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0ec8, 0x0ecd, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0f18, 0x0f19, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0f35, 0x0f35, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0f37, 0x0f37, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0f39, 0x0f39, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0f71, 0x0f7e, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x0f80, 0x0f84, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x1100, 0x115f, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1160, 0x11ff, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x135d, 0x135f, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x1ab0, 0x1aff, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x1dc0, 0x1dff, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x200b, 0x200f, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x202a, 0x202e, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x2060, 0x2064, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x20d0, 0x20ff, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x231a, 0x231b, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2329, 0x232a, MPDFNSCROLLER_UTF8_WIDE},
+    {0x23e9, 0x23ec, MPDFNSCROLLER_UTF8_WIDE},
+    {0x23f0, 0x23f0, MPDFNSCROLLER_UTF8_WIDE},
+    {0x23f3, 0x23f3, MPDFNSCROLLER_UTF8_WIDE},
+    {0x25fd, 0x25fe, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2614, 0x2615, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2648, 0x2653, MPDFNSCROLLER_UTF8_WIDE},
+    {0x267f, 0x267f, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2693, 0x2693, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26a1, 0x26a1, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26aa, 0x26ab, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26bd, 0x26be, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26c4, 0x26c5, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26ce, 0x26ce, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26d4, 0x26d4, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26ea, 0x26ea, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26f2, 0x26f3, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26f5, 0x26f5, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26fa, 0x26fa, MPDFNSCROLLER_UTF8_WIDE},
+    {0x26fd, 0x26fd, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2705, 0x2705, MPDFNSCROLLER_UTF8_WIDE},
+    {0x270a, 0x270b, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2728, 0x2728, MPDFNSCROLLER_UTF8_WIDE},
+    {0x274c, 0x274c, MPDFNSCROLLER_UTF8_WIDE},
+    {0x274e, 0x274e, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2753, 0x2755, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2757, 0x2757, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2795, 0x2797, MPDFNSCROLLER_UTF8_WIDE},
+    {0x27b0, 0x27b0, MPDFNSCROLLER_UTF8_WIDE},
+    {0x27bf, 0x27bf, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2b1b, 0x2b1c, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2b50, 0x2b50, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2b55, 0x2b55, MPDFNSCROLLER_UTF8_WIDE},
+    {0x2e80, 0x3029, MPDFNSCROLLER_UTF8_WIDE},
+    {0x302a, 0x302d, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x302e, 0x303e, MPDFNSCROLLER_UTF8_WIDE},
+    {0x3041, 0x3098, MPDFNSCROLLER_UTF8_WIDE},
+    {0x3099, 0x309a, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x309b, 0x33ff, MPDFNSCROLLER_UTF8_WIDE},
+    {0x3400, 0x4dbf, MPDFNSCROLLER_UTF8_WIDE},
+    {0x4e00, 0x9fff, MPDFNSCROLLER_UTF8_WIDE},
+    {0xa000, 0xa4cf, MPDFNSCROLLER_UTF8_WIDE},
+    {0xa960, 0xa97f, MPDFNSCROLLER_UTF8_WIDE},
+    {0xac00, 0xd7a3, MPDFNSCROLLER_UTF8_WIDE},
+    {0xf900, 0xfaff, MPDFNSCROLLER_UTF8_WIDE},
+    {0xfe00, 0xfe0f, MPDFNSCROLLER_UTF8_EXTEND},
+    {0xfe10, 0xfe19, MPDFNSCROLLER_UTF8_WIDE},
+    {0xfe20, 0xfe2f, MPDFNSCROLLER_UTF8_EXTEND},
+    {0xfe30, 0xfe6f, MPDFNSCROLLER_UTF8_WIDE},
+    {0xfeff, 0xfeff, MPDFNSCROLLER_UTF8_EXTEND},
+    {0xff00, 0xff60, MPDFNSCROLLER_UTF8_WIDE},
+    {0xffe0, 0xffe6, MPDFNSCROLLER_UTF8_WIDE},
+    {0x16fe0, 0x16fe4, MPDFNSCROLLER_UTF8_WIDE},
+    {0x17000, 0x18aff, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1b000, 0x1b2ff, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f004, 0x1f004, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f0cf, 0x1f0cf, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f18e, 0x1f18e, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f191, 0x1f19a, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f200, 0x1f251, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f300, 0x1f3fa, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f3fb, 0x1f3ff, MPDFNSCROLLER_UTF8_EXTEND},
+    {0x1f400, 0x1f64f, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f680, 0x1f6ff, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f7e0, 0x1f7eb, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1f90c, 0x1f9ff, MPDFNSCROLLER_UTF8_WIDE},
+    {0x1fa70, 0x1faff, MPDFNSCROLLER_UTF8_WIDE},
+    {0x20000, 0x2fffd, MPDFNSCROLLER_UTF8_WIDE},
+    {0x30000, 0x3fffd, MPDFNSCROLLER_UTF8_WIDE},
+    {0xe0001, 0xe0001, MPDFNSCROLLER_UTF8_EXTEND},
+    {0xe0020, 0xe007f, MPDFNSCROLLER_UTF8_EXTEND},
+    {0xe0100, 0xe01ef, MPDFNSCROLLER_UTF8_EXTEND}
+};
+
+
+static size_t mpdfnscroller_utf8_ascii_decode(const unsigned char *string,
+                                              size_t size,
+                                              wchar_t *codepoints,
+                                              unsigned short *columns,
+                                              unsigned char *boundaries,
+                                              unsigned int column);
+#ifdef MPDFNSCROLLER_UTF8_X86
+static size_t mpdfnscroller_utf8_ascii_decode_sse2(const unsigned char *string,
+                                                   size_t size,
+                                                   wchar_t *codepoints,
+                                                   unsigned short *columns,
+                                                   unsigned char *boundaries,
+                                                   unsigned int column);
+static size_t mpdfnscroller_utf8_ascii_decode_avx2(const unsigned char *string,
+                                                   size_t size,
+                                                   wchar_t *codepoints,
+                                                   unsigned short *columns,
+                                                   unsigned char *boundaries,
+                                                   unsigned int column);
+#endif /* MPDFNSCROLLER_UTF8_X86 */
+static size_t mpdfnscroller_utf8_sequence_decode(const unsigned char *string,
+                                                 size_t size,
+                                                 uint32_t *codepoint);
+static enum mpdfnscroller_utf8_class
+mpdfnscroller_utf8_class_get(uint32_t codepoint, size_t *hint);
+
+
+// ASCII runs are widened a vector at a time, the rest is decoded and
+// validated sequence by sequence: the shortest form only, no surrogates,
+// nothing past U+10FFFF
+int mpdfnscroller_utf8_decode(const char *string, wchar_t *codepoints,
+                              unsigned short *columns,
+                              unsigned char *boundaries, size_t size)
+{
+    const unsigned char           *bytes = (const unsigned char *)string;
+    enum mpdfnscroller_utf8_class class = MPDFNSCROLLER_UTF8_NARROW;
+    size_t                        bytes_length = strlen(string);
+    size_t                        offset = 0;
+    size_t                        sequence_length = 0;
+    size_t                        count = 0;
+    size_t                        run = 0;
+    size_t                        hint = 0;
+    unsigned int                  column = 0;
+    unsigned int                  width = 0;
+    uint32_t                      codepoint = 0;
+    uint32_t                      previous = 0;
+    bool                          boundary = false;
+    bool                          regional_open = false;
+
+    if (size == 0)
+    {
+        return -1;
+    }
+
+    while (offset < bytes_length)
+    {
+        if (count == size - 1)
+        {
+            return -1;
+        }
+
+        if (bytes[offset] < 0x80)
+        {
+            run = mpdfnscroller_utf8_ascii_decode(bytes + offset,
+                                                  (bytes_length - offset <
+                                                   size - 1 - count) ?
+                                                  bytes_length - offset :
+                                                  size - 1 - count,
+                                                  codepoints + count,
+                                                  columns + count,
+                                                  boundaries + count, column);
+            offset += run;
+            count += run;
+            column += run;
+            previous = bytes[offset - 1];
+            regional_open = false;
+            continue;
+        }
+
+        sequence_length = mpdfnscroller_utf8_sequence_decode(bytes + offset,
+                                                             bytes_length -
+                                                             offset,
+                                                             &codepoint);
+        if (sequence_length == 0)
+        {
+            return -1;
+        }
+        offset += sequence_length;
+
+        class = mpdfnscroller_utf8_class_get(codepoint, &hint);
+        width = (class == MPDFNSCROLLER_UTF8_WIDE) ? 2 : 1;
+        boundary = true;
+        if ((class == MPDFNSCROLLER_UTF8_EXTEND) ||
+            (previous == MPDFNSCROLLER_UTF8_ZWJ))
+        {
+            width = 0;
+            boundary = false;
+        }
+// Regional indicators make up a flag in pairs
+        if ((codepoint >= MPDFNSCROLLER_UTF8_REGIONAL_FIRST) &&
+            (codepoint <= MPDFNSCROLLER_UTF8_REGIONAL_LAST))
+        {
+            width = regional_open ? 0 : 2;
+            boundary = !regional_open;
+            regional_open = !regional_open;
+        }
+        else
+        {
+            regional_open = false;
+        }
+
+        codepoints[count] = codepoint;
+        columns[count] = column;
+        boundaries[count] = boundary || (count == 0);
+        column += width;
+        previous = codepoint;
+        ++count;
+    }
+
+    codepoints[count] = L'\0';
+    columns[count] = column;
+
+    return count;
+};
+
+size_t mpdfnscroller_utf8_encode(const wchar_t *codepoints, size_t length,
+                                 char *buf, size_t size)
+{
+    unsigned char character[MPDFNSCROLLER_UTF8_CHARACTER_MAX];
+    uint32_t      codepoint = 0;
+    size_t        character_length = 0;
+    size_t        bytes_length = 0;
+    size_t        i = 0;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; (i < length) && (codepoints[i] != L'\0'); ++i)
+    {
+        codepoint = codepoints[i];
+        if ((codepoint > MPDFNSCROLLER_UTF8_CODEPOINT_MAX) ||
+            ((codepoint >= MPDFNSCROLLER_UTF8_SURROGATE_FIRST) &&
+             (codepoint <= MPDFNSCROLLER_UTF8_SURROGATE_LAST)))
+        {
+            codepoint = MPDFNSCROLLER_UTF8_REPLACEMENT;
+        }
+
+        if (codepoint < 0x80)
+        {
+            character[0] = codepoint;
+            character_length = 1;
+        }
+        else if (codepoint < 0x800)
+        {
+            character[0] = 0xc0 | (codepoint >> 6);
+            character[1] = 0x80 | (codepoint & 0x3f);
+            character_length = 2;
+        }
+        else if (codepoint < 0x10000)
+        {
+            character[0] = 0xe0 | (codepoint >> 12);
+            character[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+            character[2] = 0x80 | (codepoint & 0x3f);
+            character_length = 3;
+        }
+        else
+        {
+            character[0] = 0xf0 | (codepoint >> 18);
+            character[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+            character[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+            character[3] = 0x80 | (codepoint & 0x3f);
+            character_length = 4;
+        }
+
+        if (bytes_length + character_length >= size)
+        {
+            break;
+        }
+        memcpy(buf + bytes_length, character, character_length);
+        bytes_length += character_length;
+    }
+    buf[bytes_length] = '\0';
+
+    return bytes_length;
+};
+
+
+// Leading run of ASCII characters, at most size of them: each one is a code
+// point, a column and a grapheme cluster of its own
+static size_t mpdfnscroller_utf8_ascii_decode(const unsigned char *string,
+                                              size_t size,
+                                              wchar_t *codepoints,
+                                              unsigned short *columns,
+                                              unsigned char *boundaries,
+                                              unsigned int column)
+{
+    size_t i = 0;
+
+// Words between non-ASCII letters are short, only hand long runs to SIMD
+    for (; (i < size) && (i < 16) && (string[i] < 0x80); ++i)
+    {
+        codepoints[i] = string[i];
+        columns[i] = column + i;
+        boundaries[i] = true;
+    }
+#ifdef MPDFNSCROLLER_UTF8_X86
+    if ((i == 16) && (size - i >= 32) && (__builtin_cpu_supports("avx2")))
+    {
+        i += mpdfnscroller_utf8_ascii_decode_avx2(string + i, size - i,
+                                                  codepoints + i, columns + i,
+                                                  boundaries + i, column + i);
+    }
+    if ((i >= 16) && (size - i >= 16))
+    {
+        i += mpdfnscroller_utf8_ascii_decode_sse2(string + i, size - i,
+                                                  codepoints + i, columns + i,
+                                                  boundaries + i, column + i);
+    }
+#endif /* MPDFNSCROLLER_UTF8_X86 */
+
+    for (; (i < size) && (string[i] < 0x80); ++i)
+    {
+        codepoints[i] = string[i];
+        columns[i] = column + i;
+        boundaries[i] = true;
+    }
+
+    return i;
+};
+
+#ifdef MPDFNSCROLLER_UTF8_X86
+// 16 characters at a time, until the first block with a non-ASCII byte
+static size_t mpdfnscroller_utf8_ascii_decode_sse2(const unsigned char *string,
+                                                   size_t size,
+                                                   wchar_t *codepoints,
+                                                   unsigned short *columns,
+                                                   unsigned char *boundaries,
+                                                   unsigned int column)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i ramp = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    __m128i       bytes;
+    __m128i       low;
+    __m128i       high;
+    __m128i       base;
+    size_t        i = 0;
+
+    for (i = 0; i + 16 <= size; i += 16)
+    {
+        bytes = _mm_loadu_si128((const __m128i *)(string + i));
+        if (_mm_movemask_epi8(bytes))
+        {
+            break;
+        }
+
+        low = _mm_unpacklo_epi8(bytes, zero);
+        high = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_si128((__m128i *)(codepoints + i),
+                         _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128((__m128i *)(codepoints + i + 4),
+                         _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128((__m128i *)(codepoints + i + 8),
+                         _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128((__m128i *)(codepoints + i + 12),
+                         _mm_unpackhi_epi16(high, zero));
+
+        base = _mm_add_epi16(_mm_set1_epi16(column + i), ramp);
+        _mm_storeu_si128((__m128i *)(columns + i), base);
+        _mm_storeu_si128((__m128i *)(columns + i + 8),
+                         _mm_add_epi16(base, _mm_set1_epi16(8)));
+        _mm_storeu_si128((__m128i *)(boundaries + i), ones);
+    }
+
+    return i;
+};
+
+// 32 characters at a time, the tail is left for SSE2
+__attribute__((target("avx2")))
+static size_t mpdfnscroller_utf8_ascii_decode_avx2(const unsigned char *string,
+                                                   size_t size,
+                                                   wchar_t *codepoints,
+                                                   unsigned short *columns,
+                                                   unsigned char *boundaries,
+                                                   unsigned int column)
+{
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i ramp = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                           11, 12, 13, 14, 15);
+    __m256i       bytes;
+    __m256i       base;
+    size_t        i = 0;
+    size_t        j = 0;
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+        bytes = _mm256_loadu_si256((const __m256i *)(string + i));
+        if (_mm256_movemask_epi8(bytes))
+        {
+            break;
+        }
+
+        for (j = 0; j < 32; j += 8)
+        {
+            _mm256_storeu_si256((__m256i *)(codepoints + i + j),
+                                _mm256_cvtepu8_epi32(
+                                    _mm_loadl_epi64((const __m128i *)
+                                                    (string + i + j))));
+        }
+
+        base = _mm256_add_epi16(_mm256_set1_epi16(column + i), ramp);
+        _mm256_storeu_si256((__m256i *)(columns + i), base);
+        _mm256_storeu_si256((__m256i *)(columns + i + 16),
+                            _mm256_add_epi16(base, _mm256_set1_epi16(16)));
+        _mm256_storeu_si256((__m256i *)(boundaries + i), ones);
+    }
+
+    return i;
+};
+#endif /* MPDFNSCROLLER_UTF8_X86 */
+
+// Returns the length of the sequence, 0 when it is not valid
+static size_t mpdfnscroller_utf8_sequence_decode(const unsigned char *string,
+                                                 size_t size,
+                                                 uint32_t *codepoint)
+{
+    unsigned char lead = string[0];
+    unsigned char second_min = 0x80;
+    unsigned char second_max = 0xbf;
+    size_t        length = 0;
+    size_t        i = 0;
+
+    if ((lead >= 0xc2) && (lead <= 0xdf))
+    {
+        length = 2;
+        *codepoint = lead & 0x1f;
+    }
+    else if ((lead >= 0xe0) && (lead <= 0xef))
+    {
+        length = 3;
+        *codepoint = lead & 0x0f;
+        second_min = (lead == 0xe0) ? 0xa0 : 0x80;
+        second_max = (lead == 0xed) ? 0x9f : 0xbf;
+    }
+    else if ((lead >= 0xf0) && (lead <= 0xf4))
+    {
+        length = 4;
+        *codepoint = lead & 0x07;
+        second_min = (lead == 0xf0) ? 0x90 : 0x80;
+        second_max = (lead == 0xf4) ? 0x8f : 0xbf;
+    }
+    else
+    {
+        return 0;
+    }
+    if ((length > size) || (string[1] < second_min) ||
+        (string[1] > second_max))
+    {
+        return 0;
+    }
+
+    for (i = 1; i < length; ++i)
+    {
+        if ((string[i] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+        *codepoint = (*codepoint << 6) | (string[i] & 0x3f);
+    }
+
+    return length;
+};
+
+// Everything below the combining diacritical marks is narrow, and letters of
+// one script mostly fall in or just before the range found for the previous
+// one, which hint keeps between calls
+static enum mpdfnscroller_utf8_class
+mpdfnscroller_utf8_class_get(uint32_t codepoint, size_t *hint)
+{
+    size_t low = 0;
+    size_t high = sizeof(mpdfnscroller_utf8_ranges) /
+                  sizeof(mpdfnscroller_utf8_ranges[0]);
+    size_t middle = 0;
+
+    if (codepoint < mpdfnscroller_utf8_ranges[0].first)
+    {
+        return MPDFNSCROLLER_UTF8_NARROW;
+    }
+    if ((*hint > 0) && (*hint < high) &&
+        (codepoint <= mpdfnscroller_utf8_ranges[*hint].last) &&
+        (codepoint > mpdfnscroller_utf8_ranges[*hint - 1].last))
+    {
+        return (codepoint >= mpdfnscroller_utf8_ranges[*hint].first) ?
+               mpdfnscroller_utf8_ranges[*hint].class :
+               MPDFNSCROLLER_UTF8_NARROW;
+    }
+
+    while (low < high)
+    {
+        middle = (low + high) / 2;
+        if (codepoint < mpdfnscroller_utf8_ranges[middle].first)
+        {
+            high = middle;
+        }
+        else if (codepoint > mpdfnscroller_utf8_ranges[middle].last)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            *hint = middle;
+            return mpdfnscroller_utf8_ranges[middle].class;
+        }
+    }
+    *hint = low;
+
+    return MPDFNSCROLLER_UTF8_NARROW;
+};
@@ -0,0 +1,58 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef UTF8_H
+#define UTF8_H
+
+
+#include <stddef.h>
+#include <wchar.h>
+
+
+
+
+#define MPDFNSCROLLER_UTF8_CHARACTER_MAX 4
+#define MPDFNSCROLLER_UTF8_REPLACEMENT   0xfffd
+
+
+// Decodes the UTF-8 string into at most size - 1 code points whatever the
+// locale is, and indexes them in the same pass: columns gets the column each
+// code point starts at (columns[length] is the width of the whole string),
+// boundaries whether it starts a grapheme cluster. Both hold size entries.
+// Returns the number of code points, or -1 when the string is not valid
+// UTF-8 or does not fit.
+int mpdfnscroller_utf8_decode(const char *string, wchar_t *codepoints,
+                              unsigned short *columns,
+                              unsigned char *boundaries, size_t size);
+
+// Encodes up to length code points, less at a NUL, into buf of size bytes.
+// The string is cut at a character boundary when buf is too small and is
+// always terminated; code points out of Unicode become U+FFFD. Returns the
+// length of the string in bytes.
+size_t mpdfnscroller_utf8_encode(const wchar_t *codepoints, size_t length,
+                                 char *buf, size_t size);
+
+
+#endif /* UTF8_H */
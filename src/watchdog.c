@@ -0,0 +1,419 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "mpd-fnscroller.h"
+#include "runtime.h"
+#include "watchdog.h"
+
+
+
+
+extern bool debug;
+extern char *sockfile_path;
+
+
+static void *watchdog_thread(void *arg);
+static enum mpd_fnscroller_result
+watchdog_source_check(struct mpd_fnscroller_watchdog *watchdog,
+                      unsigned long long now, char *status);
+static enum mpd_fnscroller_result
+watchdog_probe(struct mpd_fnscroller_watchdog *watchdog, char *status);
+static void watchdog_ping(struct mpd_fnscroller_watchdog *watchdog,
+                          unsigned long long now);
+static void watchdog_notify(struct mpd_fnscroller_watchdog *watchdog,
+                            const char *message);
+
+
+// Service manager passes the watchdog in the environment (sd_watchdog_enabled
+// and sd_notify protocol), which is not left for the processes spawned later
+void watchdog_init(struct mpd_fnscroller_watchdog *watchdog)
+{
+    const char *usec = getenv("WATCHDOG_USEC");
+    const char *pid = getenv("WATCHDOG_PID");
+    const char *socket_path = getenv("NOTIFY_SOCKET");
+
+    memset(watchdog, 0, sizeof(*watchdog));
+    watchdog->probe_ms = WATCHDOG_PROBE_MS_DEFAULT;
+    watchdog->source_ms = WATCHDOG_SOURCE_MS_DEFAULT;
+    watchdog->notify_sock = -1;
+    watchdog->stop_fd = -1;
+    watchdog->command_fd = -1;
+    pthread_mutex_init(&watchdog->lock, NULL);
+
+    if ((usec) && (socket_path) &&
+        (strlen(socket_path) < sizeof(watchdog->notify_address.sun_path)))
+    {
+        watchdog->interval_ms = strtoull(usec, NULL, DEC) / 1000 / 2;
+        watchdog->pid = (pid) ? strtol(pid, NULL, DEC) : 0;
+        watchdog->notify_address.sun_family = AF_UNIX;
+        strcpy(watchdog->notify_address.sun_path, socket_path);
+// Socket in the abstract namespace is given with a leading "@"
+        if (socket_path[0] == '@')
+        {
+            watchdog->notify_address.sun_path[0] = '\0';
+        }
+        watchdog->notify_address_length = offsetof(struct sockaddr_un,
+                                                   sun_path) +
+                                          strlen(socket_path);
+    }
+    unsetenv("WATCHDOG_USEC");
+    unsetenv("WATCHDOG_PID");
+    unsetenv("NOTIFY_SOCKET");
+
+    return;
+};
+
+// "probe=<ms>" is the longest the socket may take to answer, "source=<ms>"
+// the player
+enum mpd_fnscroller_result
+watchdog_thresholds_parse(struct mpd_fnscroller_watchdog *watchdog,
+                          char *spec)
+{
+    char         *option = spec;
+    char         *next = NULL;
+    char         *invalid_numchar = NULL;
+    unsigned int *threshold = NULL;
+
+    while ((option) && (*option != '\0'))
+    {
+        next = strchr(option, ',');
+        if (next)
+        {
+            *next++ = '\0';
+        }
+
+        if (strncmp(option, WATCHDOG_OPTARG_PROBE,
+                    strlen(WATCHDOG_OPTARG_PROBE)) == 0)
+        {
+            threshold = &watchdog->probe_ms;
+            option += strlen(WATCHDOG_OPTARG_PROBE);
+        }
+        else if (strncmp(option, WATCHDOG_OPTARG_SOURCE,
+                         strlen(WATCHDOG_OPTARG_SOURCE)) == 0)
+        {
+            threshold = &watchdog->source_ms;
+            option += strlen(WATCHDOG_OPTARG_SOURCE);
+        }
+        else
+        {
+            ERR_("Unknown watchdog threshold: %s", option)
+            return RESULT_ERROR;
+        }
+        *threshold = strtoul(option, &invalid_numchar, DEC);
+        if ((*invalid_numchar != '\0') || (*threshold == 0))
+        {
+            ERR_("Invalid watchdog threshold value: %s", option)
+            return RESULT_ERROR;
+        }
+        option = next;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Watchdog is off unless the service manager has asked for it, for this very
+// process
+enum mpd_fnscroller_result
+watchdog_start(struct mpd_fnscroller_watchdog *watchdog, int command_fd)
+{
+    if (watchdog->interval_ms == 0)
+    {
+        return RESULT_SUCCESS;
+    }
+    if ((watchdog->pid) && (watchdog->pid != getpid()))
+    {
+        DEBUG_("Watchdog is meant for pid %d", watchdog->pid)
+        watchdog->interval_ms = 0;
+        return RESULT_SUCCESS;
+    }
+
+    watchdog->command_fd = command_fd;
+    watchdog->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (watchdog->stop_fd == -1)
+    {
+        ERR_("Could not create the watchdog stop descriptor")
+        return RESULT_ERROR;
+    }
+    watchdog->notify_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (watchdog->notify_sock == -1)
+    {
+        ERR_("Could not create the notification socket")
+        close(watchdog->stop_fd);
+        watchdog->stop_fd = -1;
+        return RESULT_ERROR;
+    }
+    if (thread_create(&watchdog->thread_id, watchdog_thread, watchdog))
+    {
+        ERR_("Could not start watchdog thread")
+        close(watchdog->notify_sock);
+        close(watchdog->stop_fd);
+        watchdog->notify_sock = -1;
+        watchdog->stop_fd = -1;
+        return RESULT_ERROR;
+    }
+    syslog(LOG_INFO, "Watchdog keepalive every %llu ms",
+           watchdog->interval_ms);
+
+    return RESULT_SUCCESS;
+};
+
+// Thread is woken up and joined: once stopped, it no longer uses the command
+// descriptor, which the caller closes next
+void watchdog_stop(struct mpd_fnscroller_watchdog *watchdog)
+{
+    uint64_t stop = 1;
+
+    if (watchdog->stop_fd == -1)
+    {
+        return;
+    }
+    if (write(watchdog->stop_fd, &stop, sizeof(stop)) == -1)
+    {
+        ERR_("Could not stop the watchdog thread")
+    }
+    pthread_join(watchdog->thread_id, NULL);
+    close(watchdog->notify_sock);
+    close(watchdog->stop_fd);
+    watchdog->notify_sock = -1;
+    watchdog->stop_fd = -1;
+
+    return;
+};
+
+// Event handler loop woken up by the command descriptor answers the ping with
+// the player
+bool watchdog_ping_pending(struct mpd_fnscroller_watchdog *watchdog)
+{
+    bool pending = false;
+
+    pthread_mutex_lock(&watchdog->lock);
+    pending = watchdog->ping_pending;
+    pthread_mutex_unlock(&watchdog->lock);
+
+    return pending;
+};
+
+void watchdog_pong(struct mpd_fnscroller_watchdog *watchdog)
+{
+    pthread_mutex_lock(&watchdog->lock);
+    watchdog->ping_pending = false;
+    watchdog->pong_time = monotonic_time_get();
+    pthread_mutex_unlock(&watchdog->lock);
+
+    return;
+};
+
+
+static void *watchdog_thread(void *arg)
+{
+    struct mpd_fnscroller_watchdog *watchdog = arg;
+    struct pollfd                  stop_pollfd;
+    unsigned long long             now = 0;
+    char                           status[WATCHDOG_STATUS_SIZE];
+    char                           message[WATCHDOG_STATUS_SIZE +
+                                           sizeof("STATUS=")];
+
+    stop_pollfd.fd = watchdog->stop_fd;
+    stop_pollfd.events = POLLIN;
+
+// Interval is waited for on the stop descriptor
+    while (poll(&stop_pollfd, 1, (int)watchdog->interval_ms) != 1)
+    {
+        now = monotonic_time_get();
+
+        if ((watchdog_source_check(watchdog, now, status)) &&
+            (watchdog_probe(watchdog, status)))
+        {
+            if (watchdog->degraded)
+            {
+                syslog(LOG_NOTICE, "Server is healthy again");
+                watchdog_notify(watchdog, "STATUS=Healthy");
+                watchdog->degraded = false;
+            }
+            watchdog_notify(watchdog, "WATCHDOG=1");
+        }
+// Keepalive is held back: the service manager restarts the server once the
+// watchdog period is over
+        else
+        {
+            syslog(LOG_WARNING, "Server is degraded: %s", status);
+            snprintf(message, sizeof(message), "STATUS=%s", status);
+            watchdog_notify(watchdog, message);
+            watchdog->degraded = true;
+        }
+
+        watchdog_ping(watchdog, now);
+    }
+
+    return NULL;
+};
+
+// Ping still pending past the threshold is a stuck player or event handler
+// loop as well as a late answer
+static enum mpd_fnscroller_result
+watchdog_source_check(struct mpd_fnscroller_watchdog *watchdog,
+                      unsigned long long now, char *status)
+{
+    unsigned long long ping_time = 0;
+    unsigned long long pong_time = 0;
+    bool               pending = false;
+
+    pthread_mutex_lock(&watchdog->lock);
+    pending = watchdog->ping_pending;
+    ping_time = watchdog->ping_time;
+    pong_time = watchdog->pong_time;
+    pthread_mutex_unlock(&watchdog->lock);
+
+    if (ping_time == 0)
+    {
+        return RESULT_SUCCESS;
+    }
+    if ((pending) && (now - ping_time > watchdog->source_ms))
+    {
+        snprintf(status, WATCHDOG_STATUS_SIZE,
+                 "player has not answered for %llu ms", now - ping_time);
+        return RESULT_ERROR;
+    }
+    if ((!pending) && (pong_time - ping_time > watchdog->source_ms))
+    {
+        snprintf(status, WATCHDOG_STATUS_SIZE, "player answered in %llu ms",
+                 pong_time - ping_time);
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Request waiting for version 0 is answered at once, with no effect on the
+// scrolling of the clients
+static enum mpd_fnscroller_result
+watchdog_probe(struct mpd_fnscroller_watchdog *watchdog, char *status)
+{
+    struct sockaddr_un address;
+    struct timeval     timeout = {watchdog->probe_ms / 1000,
+                                  (watchdog->probe_ms % 1000) * 1000};
+    unsigned long long start = monotonic_time_get();
+    unsigned long long latency = 0;
+    unsigned int       request = REQUEST_MAKE(REQUEST_WAIT, 0);
+    char               buffer[WATCHDOG_STATUS_SIZE];
+    ssize_t            bytes_received = 0;
+    size_t             total = 0;
+    int                sock = 0;
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        snprintf(status, WATCHDOG_STATUS_SIZE, "could not create the probe");
+        return RESULT_ERROR;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, sockfile_path, sizeof(address.sun_path) - 1);
+
+    if ((connect(sock, (struct sockaddr *)&address, sizeof(address)) == -1) ||
+        (send(sock, &request, sizeof(request), MSG_NOSIGNAL) !=
+         sizeof(request)))
+    {
+        close(sock);
+        snprintf(status, WATCHDOG_STATUS_SIZE, "socket refused the probe");
+        return RESULT_ERROR;
+    }
+    while ((bytes_received = recv(sock, buffer, sizeof(buffer), 0)) > 0)
+    {
+        total += bytes_received;
+    }
+    close(sock);
+
+    latency = monotonic_time_get() - start;
+    if ((bytes_received == -1) || (total == 0))
+    {
+        snprintf(status, WATCHDOG_STATUS_SIZE,
+                 "socket has not answered the probe in %llu ms", latency);
+        return RESULT_ERROR;
+    }
+    if (latency > watchdog->probe_ms)
+    {
+        snprintf(status, WATCHDOG_STATUS_SIZE,
+                 "socket answered the probe in %llu ms", latency);
+        return RESULT_ERROR;
+    }
+
+    return RESULT_SUCCESS;
+};
+
+// Ping is only sent again once the previous one is answered
+static void watchdog_ping(struct mpd_fnscroller_watchdog *watchdog,
+                          unsigned long long now)
+{
+    uint64_t wakeup = 1;
+
+    pthread_mutex_lock(&watchdog->lock);
+    if (watchdog->ping_pending)
+    {
+        pthread_mutex_unlock(&watchdog->lock);
+        return;
+    }
+    watchdog->ping_pending = true;
+    watchdog->ping_time = now;
+    pthread_mutex_unlock(&watchdog->lock);
+
+    if (write(watchdog->command_fd, &wakeup, sizeof(wakeup)) == -1)
+    {
+        TRACEPOINT_("Could not write command_fd: %lld", errno, 0)
+    }
+
+    return;
+};
+
+static void watchdog_notify(struct mpd_fnscroller_watchdog *watchdog,
+                            const char *message)
+{
+    if (sendto(watchdog->notify_sock, message, strlen(message), MSG_NOSIGNAL,
+               (struct sockaddr *)&watchdog->notify_address,
+               watchdog->notify_address_length) == -1)
+    {
+        DEBUG_("Could not notify the service manager: %s", message)
+    }
+
+    return;
+};
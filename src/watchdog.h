@@ -0,0 +1,87 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2021 Bogdan Migunov bogdanmigunov@yandex.ru
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "mpd-fnscroller.h"
+
+
+
+
+#define WATCHDOG_PROBE_MS_DEFAULT  500
+#define WATCHDOG_SOURCE_MS_DEFAULT 2000
+#define WATCHDOG_OPTARG_PROBE      "probe="
+#define WATCHDOG_OPTARG_SOURCE     "source="
+#define WATCHDOG_STATUS_SIZE       128
+
+
+// Health of the server is told to systemd (WatchdogSec=): every half of the
+// watchdog period the socket is probed with a request going the way of the
+// clients, and the event handler loop is pinged through its command
+// descriptor to have the player answer. The keepalive is only sent when both
+// have answered within their thresholds, so a server with a dead serve
+// thread or a stuck player is restarted.
+struct mpd_fnscroller_watchdog
+{
+    unsigned int       probe_ms;
+    unsigned int       source_ms;
+
+    unsigned long long interval_ms;
+    pid_t              pid;
+    struct sockaddr_un notify_address;
+    socklen_t          notify_address_length;
+    int                notify_sock;
+    bool               degraded;
+
+    int                stop_fd;
+    int                command_fd;
+    bool               ping_pending;
+    unsigned long long ping_time;
+    unsigned long long pong_time;
+    pthread_t          thread_id;
+    pthread_mutex_t    lock;
+};
+
+
+void watchdog_init(struct mpd_fnscroller_watchdog *watchdog);
+enum mpd_fnscroller_result
+watchdog_thresholds_parse(struct mpd_fnscroller_watchdog *watchdog,
+                          char *spec);
+enum mpd_fnscroller_result
+watchdog_start(struct mpd_fnscroller_watchdog *watchdog, int command_fd);
+void watchdog_stop(struct mpd_fnscroller_watchdog *watchdog);
+bool watchdog_ping_pending(struct mpd_fnscroller_watchdog *watchdog);
+void watchdog_pong(struct mpd_fnscroller_watchdog *watchdog);
+
+
+#endif /* WATCHDOG_H */